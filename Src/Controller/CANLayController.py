@@ -25,8 +25,10 @@ from rich.table import Table
 from rich import print as rp
 from rich.rule import Rule
 from SensorNode import COMMBlock, SensorNode, WCOMMFrame, WSenseBlock
+from SessionBlocks import (IsoTpPdus, Nack, ParityHeader, TraceBlock,
+                           health_digest, name_table, payload, signal_values)
 from Environment import CANLayLogger
-from CANNode import CAN_message_t
+from CANNode import CAN_message_t, MAX_DATAGRAM
 from Recorder import Recorder
 from Recorder import RecordType as RT
 import re
@@ -336,16 +338,24 @@ class Controller(SensorNode, HTTPClient):
             if ip:
                 self._output.put((TO.NOTIFY, "Session established."))
                 logging.debug(request_data)
+                if "ImpairmentGroups" in request_data:
+                    sssfs, controller = request_data["ImpairmentGroups"]
+                    self._output.put((TO.NOTIFY, (
+                        f"Start the impairment proxy with -a {sssfs}:{port} "
+                        f"-b {controller}:{port}.")))
                 self.start_session(ip, port, request_data)
                 self.network_stats = NetworkStats(
                     len(self.members), self.time_client)
                 self.health_report = HealthReport(self.members)
+                self._iso_tp = IsoTpPdus()
                 self.health_report.start_display(
                     self._stop_mp, self._output, self._log_queue, self._log_level)
                 self.max_report_size = (ct.sizeof(COMMBlock) - ct.sizeof(WCOMMFrame)) + \
                     (ct.sizeof(NodeReport) * len(self.members))
-                if self.max_report_size < ct.sizeof(COMMBlock):
-                    self.max_report_size = ct.sizeof(COMMBlock)
+                # Room for the largest datagram read() takes, NAME tables and
+                # ISO-TP fragments are bigger than a COMMBlock
+                if self.max_report_size < MAX_DATAGRAM:
+                    self.max_report_size = MAX_DATAGRAM
                 self._comm_buffer = (ct.c_byte * self.max_report_size)(0)
                 if len(self._record_filename) > 0:
                     recorder = Recorder(self._record_filename)
@@ -419,6 +429,46 @@ class Controller(SensorNode, HTTPClient):
             #         f"goodput: {m.goodput.mean}")
             self.health_report.update(
                 msg.index, self._comm_buffer, self.members[msg.index].last_seq_num)
+        elif msg and msg.type == 5:
+            trace = payload(TraceBlock, self._comm_buffer, self.header_size, msg_len)
+            if trace:
+                logging.info(trace)
+        elif msg and msg.type == 6:
+            for entry in name_table(self._comm_buffer, self.header_size, msg_len):
+                logging.info(f"Node {msg.index}: {entry}")
+        elif msg and msg.type == 7:
+            # Only SSSFs retransmit, the controller sends nothing reliably
+            nack = payload(Nack, self._comm_buffer, self.header_size, msg_len)
+            if nack:
+                logging.debug(f"From node {msg.index}: {nack}")
+        elif msg and msg.type == 8:
+            # The controller doesn't repair lost datagrams from parity
+            parity = payload(ParityHeader, self._comm_buffer, self.header_size, msg_len)
+            if parity:
+                logging.debug(
+                    f"Parity from node {msg.index} over {parity.count} datagrams "
+                    f"from {parity.first_sequence}.")
+        elif msg and msg.type == 9:
+            pdu = self._iso_tp.add(msg.index, self._comm_buffer, self.header_size, msg_len)
+            if pdu:
+                header, data = pdu
+                logging.info(
+                    f"ISO-TP from node {msg.index}, ECU {header.ecu:X} to tester "
+                    f"{header.tester:X} on can{header.channel}: {data.hex().upper()}")
+        elif msg and msg.type == 10:
+            # Meant for the aggregating node, only its summary matters here
+            logging.debug(f"Health digest from node {msg.index}.")
+        elif msg and msg.type == 11:
+            summary = health_digest(self._comm_buffer, self.header_size, msg_len)
+            if summary:
+                digest, outliers = summary
+                logging.info(f"Session health from node {msg.index}: {digest}")
+                for outlier in outliers:
+                    logging.info(f"\tOutlier {outlier}")
+        elif msg and msg.type == 12:
+            values = signal_values(self._comm_buffer, self.header_size, msg_len)
+            if values is not None:
+                logging.info(f"Signals from node {msg.index}: {values}")
 
     def stop(self, notify_server=True):
         self.do_DELETE()
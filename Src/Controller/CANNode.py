@@ -15,9 +15,14 @@ from typing import List, Tuple, Type
 
 from getmac import get_mac_address as gma
 
+from SessionAuth import SessionAuth
 from Time_Client import Time_Client
 from multiprocessing import Lock
 
+# Largest datagram an SSSF sends, an Ethernet payload; ISO-TP pieces and NAME
+# tables don't fit the 1024 bytes of a COMMBlock buffer
+MAX_DATAGRAM = 1500
+
 
 class FLAGS_FD(Structure):
     _pack_ = 4
@@ -143,6 +148,7 @@ class CANNode(object):
 
         self.mac = gma()
         self._sequence_number = 1
+        self.auth = SessionAuth()
         self.session_status = self.SessionStatus.Inactive
 
         self.mac = "00:0C:29:DE:AD:BE"  # For testing purposes
@@ -219,8 +225,9 @@ class CANNode(object):
         return iface, mreq
             
 
-    def start_session(self, _ip: IPv4Address, _port: int) -> None:
+    def start_session(self, _ip: IPv4Address, _port: int, auth_key: str | None = None, members: int = 0) -> None:
         self.time_client.setup()
+        self.auth.start(auth_key, members)
         self.__can_ip = _ip
         self.__can_port = _port
         self.__iface, self.__mreq = self.__create_group_info(self.__can_ip)
@@ -233,7 +240,11 @@ class CANNode(object):
 
     def read(self) -> bytes:
         try:
-            return self.__can_sock.recv(1024)
+            datagram = self.auth.check(self.__can_sock.recv(MAX_DATAGRAM))
+            if datagram is None:
+                logging.debug("Dropped a datagram that failed authentication.")
+                return b''
+            return datagram
         except OSError as oe:
             logging.debug("Occured in read")
             logging.error(oe)
@@ -262,7 +273,7 @@ class CANNode(object):
     def write(self, message: bytes) -> int:
         try:
             return self.__can_sock.sendto(
-                message,
+                self.auth.sign(message),
                 (str(self.__can_ip), self.__can_port)
             )
         except OSError as oe:
@@ -272,6 +283,7 @@ class CANNode(object):
     def stop_session(self) -> None:
         self.__can_ip = IPv4Address
         self.__can_port = 0
+        self.auth.stop()
         if self.session_status == self.SessionStatus.Active:
             logging.info("Shutting down CAN socket.")
             self.sel.unregister(self.__can_sock)
@@ -5,6 +5,7 @@ from __future__ import annotations
 import threading as th
 import asyncio
 import ipaddress
+import json
 import logging
 import multiprocessing as mp
 import os
@@ -117,6 +118,21 @@ def check_server(host: str):
     return host
 
 
+def load_node_options(path: str) -> dict:
+    """Reads the JSON object of session settings for the SSSFs in path and
+    throws typer.BadParameter if it can't be read or isn't an object."""
+    if not path:
+        return {}
+    try:
+        with open(path) as options_file:
+            options = json.load(options_file)
+    except (OSError, ValueError) as error:
+        raise typer.BadParameter(f"Can't read {path}: {error}")
+    if not isinstance(options, dict):
+        raise typer.BadParameter(f"{path} must hold a JSON object.")
+    return options
+
+
 class DisplayMode(str, Enum):
     INDIVIDUAL = "individual"
     VERTICAL = "vertical"
@@ -171,6 +187,41 @@ def main(
     filename: str = typer.Option(
         "", "--filename", "-f",
         help="The name of the file to save the can and simulator logs to."),
+    authenticate: bool = typer.Option(
+        False, "--authenticate",
+        help=(
+            'Authenticate every datagram of the session with a key the broker '
+            'hands out, so nothing else on the network can put frames on the '
+            'buses. Costs some CPU on every device. (Default: OFF)'),
+        show_default=True),
+    health_aggregation: bool = typer.Option(
+        False, "--health-aggregation",
+        help=(
+            'Have the SSSFs merge their health reports into one session '
+            'summary instead of each sending a report on every other node. '
+            'Cuts the health traffic of large sessions. (Default: OFF)'),
+        show_default=True),
+    impairment_proxy: bool = typer.Option(
+        False, "--impairment-proxy",
+        help=(
+            'Put the controller on a multicast group of its own, for the '
+            'impairment proxy to relay between it and the SSSFs. The groups '
+            'to give the proxy are shown once the session starts. '
+            '(Default: OFF)'),
+        show_default=True),
+    capture: str = typer.Option(
+        "", "--capture",
+        help=(
+            'Have every SSSF record its buses to this file on its SD card, '
+            'appending to it if it is there. Read it back with '
+            'Src/Tools/CaptureTool.')),
+    node_options: str = typer.Option(
+        "", "--node-options",
+        help=(
+            'A JSON file of settings and rule sections every SSSF is started '
+            'with, e.g. {"TraceRate": 1000, "Filters": [...]}. See '
+            'Src/Schemas/NodeOptions.json for the keys.'),
+        callback=load_node_options),
     verbose: int = typer.Option(
         0, "--verbose", "-v",
         help="Enable verbose output. More v's increases verbosity.",
@@ -261,9 +312,17 @@ def main(
     sim_sock, sim_port = open_listening_conn()
 
     # Setup Controller
+    session_options = {
+        "Authenticate": authenticate, "HealthAggregation": health_aggregation,
+        "ImpairmentProxy": impairment_proxy}
+    if capture:
+        session_options["Capture"] = capture
+    if node_options:
+        session_options["Node"] = node_options
     ctrl = Controller(
         _retrans=retransmissions, _frame_rate=60, _server_ip=broker,
-        ntp_servers=ntp_servers, _display_mode=display_mode,
+        ntp_servers=ntp_servers, _session_options=session_options,
+        _display_mode=display_mode,
         _display_totals=display_totals)
     ctrl_thread = mp.Process(
         target=ctrl.start,
@@ -17,8 +17,10 @@ from Environment import Schema
 
 
 class HTTPClient(CANNode, BaseHTTPRequestHandler):
-    def __init__(self, *args, _server_ip=soc.gethostname(), **kwargs) -> None:
+    def __init__(self, *args, _server_ip=soc.gethostname(), _session_options=None, **kwargs) -> None:
         super().__init__(*args, **kwargs)
+        # Asked of the broker with the devices, see Schemas/SessionOptions.json
+        self.session_options = _session_options or {}
         if _server_ip != "127.0.0.1":
             self.__server_ip = _server_ip
         else:
@@ -156,7 +158,10 @@ class HTTPClient(CANNode, BaseHTTPRequestHandler):
         msg = "request desired devices from the server"
         logging.info(f"Requesting {msg[7:]}")
         req = [i for i in _devices if i["ID"] in _req]
-        requestJSON = json.dumps({"MAC": self.mac, "Devices": req})
+        request = {"MAC": self.mac, "Devices": req}
+        if self.session_options:
+            request["Options"] = self.session_options
+        requestJSON = json.dumps(request)
         try:
             uri = "/controller/session"
             headers = {"Content-Type": "application/json"}
@@ -82,11 +82,13 @@ class SensorNode(CANNode):
         logging.debug(f"Timeout additive: {self.timeout_additive}")
 
         self.frame_number = 0
-        self._signal_offset = (sizeof(COMMBlock) - sizeof(WCOMMFrame)) + 4
+        self.header_size = sizeof(COMMBlock) - sizeof(WCOMMFrame)
+        self._signal_offset = self.header_size + 4
         self.times_retrans = 0
 
     def start_session(self, ip: IPv4Address, port: int, request_data: dict) -> None:
-        super().start_session(ip, port)
+        super().start_session(ip, port, request_data.get("AuthKey"),
+                              len(request_data["Devices"]))
         self._id = request_data["ID"]
         self.members = [Member_Node] * len(request_data["Devices"]) # type: ignore
         for member in request_data["Devices"]:
@@ -123,8 +125,9 @@ class SensorNode(CANNode):
     def read(self, buffer: Array[c_byte]) -> tuple[COMMBlock | None, int]:
         try:
             buf = super().read()
-            if buf and len(buf) >= sizeof(COMMBlock):
-                memmove(buffer, buf, len(buf))
+            # Only the header is always there, the rest depends on the type
+            if buf and len(buf) >= self.header_size:
+                memmove(buffer, buf, min(len(buf), sizeof(buffer)))
                 msg = COMMBlock.from_buffer(buffer)
                 self.members[msg.index].last_received_frame = msg.frame_number
                 if msg.type == 1:
@@ -0,0 +1,134 @@
+from __future__ import annotations
+import hmac
+import struct
+
+# Datagram authentication as the SSSFs do it, Src/SSSF/src/Auth. With an
+# "AuthKey" in the session information every datagram ends with a trailer: a
+# counter the sender increments for each datagram and the low AUTH_TAG_SIZE
+# bytes of a SipHash-2-4 over the datagram and the counter. Receivers drop
+# datagrams whose tag is wrong and counters they have already seen from that
+# member.
+
+AUTH_KEY_SIZE = 16
+AUTH_TAG_SIZE = 4
+AUTH_WINDOW = 64  # Counters remembered per member
+TRAILER = struct.Struct(f"<I{AUTH_TAG_SIZE}s")
+
+_MASK = (1 << 64) - 1
+
+# SipHash-2-4 of 00 01 .. (n - 1) under the key 00 01 .. 0f, as in SipHash.cpp
+_VECTORS = (
+    (0, 0x726fdb47dd0e0e31),
+    (1, 0x74f839c593dc67fd),
+    (7, 0xab0200f58b01d137),
+    (8, 0x93f5f5799a932462),
+    (15, 0xa129ca6149be45e5),
+    (16, 0x3f2acc7f57c29bdb),
+    (63, 0x958a324ceb064572)
+)
+
+
+def _rotate(x: int, bits: int) -> int:
+    return ((x << bits) | (x >> (64 - bits))) & _MASK
+
+
+def _round(v0: int, v1: int, v2: int, v3: int) -> tuple[int, int, int, int]:
+    v0 = (v0 + v1) & _MASK
+    v1 = _rotate(v1, 13) ^ v0
+    v0 = _rotate(v0, 32)
+    v2 = (v2 + v3) & _MASK
+    v3 = _rotate(v3, 16) ^ v2
+    v0 = (v0 + v3) & _MASK
+    v3 = _rotate(v3, 21) ^ v0
+    v2 = (v2 + v1) & _MASK
+    v1 = _rotate(v1, 17) ^ v2
+    v2 = _rotate(v2, 32)
+    return v0, v1, v2, v3
+
+
+def siphash(key: bytes, message: bytes) -> int:
+    k0, k1 = struct.unpack("<QQ", key)
+    v0 = k0 ^ 0x736f6d6570736575
+    v1 = k1 ^ 0x646f72616e646f6d
+    v2 = k0 ^ 0x6c7967656e657261
+    v3 = k1 ^ 0x7465646279746573
+    whole = len(message) - len(message) % 8
+    words = list(struct.unpack_from(f"<{whole // 8}Q", message))
+    words.append(int.from_bytes(message[whole:], "little") | ((len(message) & 0xFF) << 56))
+    for m in words:
+        v3 ^= m
+        v0, v1, v2, v3 = _round(v0, v1, v2, v3)
+        v0, v1, v2, v3 = _round(v0, v1, v2, v3)
+        v0 ^= m
+    v2 ^= 0xFF
+    for _ in range(4):
+        v0, v1, v2, v3 = _round(v0, v1, v2, v3)
+    return v0 ^ v1 ^ v2 ^ v3
+
+
+def self_test() -> bool:
+    key = bytes(range(AUTH_KEY_SIZE))
+    return all(siphash(key, bytes(range(n))) == h for n, h in _VECTORS)
+
+
+class SessionAuth:
+    def __init__(self) -> None:
+        self.key: bytes | None = None
+        self.counter = 0  # Of the last datagram sent
+        self.windows: list[tuple[int, int]] = []  # Highest counter and seen bits per member
+
+    @property
+    def enabled(self) -> bool:
+        return self.key is not None
+
+    def start(self, hex_key: str | None, members: int) -> None:
+        # Raises ValueError for a key the SSSFs wouldn't take either
+        self.key = None
+        self.counter = 0
+        self.windows = [(0, 0)] * members
+        if not hex_key:
+            return
+        key = bytes.fromhex(hex_key)
+        if len(key) != AUTH_KEY_SIZE:
+            raise ValueError(f"AuthKey must be {2 * AUTH_KEY_SIZE} hex digits.")
+        if not self_test():
+            raise ValueError("SipHash failed its self test, datagrams can't be authenticated.")
+        self.key = key
+
+    def stop(self) -> None:
+        self.key = None
+        self.windows = []
+
+    def __tag(self, datagram: bytes, counter: int) -> bytes:
+        h = siphash(self.key, datagram + struct.pack("<I", counter))  # type: ignore
+        return h.to_bytes(8, "little")[:AUTH_TAG_SIZE]
+
+    def sign(self, datagram: bytes) -> bytes:
+        # The datagram with its trailer
+        if not self.enabled:
+            return datagram
+        self.counter = (self.counter + 1) & 0xFFFFFFFF
+        return datagram + TRAILER.pack(self.counter, self.__tag(datagram, self.counter))
+
+    def check(self, datagram: bytes) -> bytes | None:
+        # The datagram without its trailer, None if it has to be dropped
+        if not self.enabled:
+            return datagram
+        if len(datagram) < 4 + TRAILER.size:
+            return None
+        body = datagram[:-TRAILER.size]
+        counter, tag = TRAILER.unpack_from(datagram, len(body))
+        index = struct.unpack_from("<I", body)[0]
+        if not hmac.compare_digest(self.__tag(body, counter), tag) or (index >= len(self.windows)) or (counter == 0):
+            return None
+        highest, seen = self.windows[index]
+        if counter > highest:
+            shift = counter - highest
+            seen = ((seen << shift) | 1) & ((1 << AUTH_WINDOW) - 1) if shift < AUTH_WINDOW else 1
+            self.windows[index] = (counter, seen)
+            return body
+        age = highest - counter
+        if (age >= AUTH_WINDOW) or (seen & (1 << age)):
+            return None
+        self.windows[index] = (highest, seen | (1 << age))
+        return body
@@ -0,0 +1,214 @@
+from __future__ import annotations
+import struct
+from ctypes import (Structure, c_bool, c_float, c_int32, c_uint8, c_uint16,
+                    c_uint32, c_uint64, sizeof)
+
+from HealthReport import HealthCore, NodeReport
+
+# Layouts of what the SSSFs send after the COMMBlock header for the datagram
+# types other than CAN (1), sensor (2) and health (3, 4). They mirror the
+# firmware's structs in Src/SSSF/src, which are little endian and 4 byte
+# aligned like these, apart from 64 bit fields the Teensy aligns to 8.
+
+TRACE_STAGES = ("CANReceive", "LoopPickup", "UDPSend",
+                "NetworkReceive", "CANQueued", "CANTransmitted")
+
+
+class TraceBlock(Structure):
+    # Type 5, FrameTrace::TraceBlock in Trace/FrameTrace.h
+    _pack_ = 4
+    _fields_ = [
+        ("origin", c_uint32),
+        ("reporter", c_uint32),
+        ("sequence_number", c_uint32),
+        ("can_id", c_uint32),
+        ("epoch", c_uint64),
+        ("stages", c_int32 * len(TRACE_STAGES))
+    ]
+
+    def hops(self) -> list[tuple[str, int]]:
+        # Time spent reaching each stage from the one before, in us. Stages
+        # that were never reached are -1 and left out.
+        hops = []
+        previous = 0
+        for name, stage in zip(TRACE_STAGES, self.stages):
+            if stage < 0:
+                continue
+            hops.append((name, stage - previous))
+            previous = stage
+        return hops
+
+    def __repr__(self) -> str:
+        s = (
+            f'Trace of {self.can_id:X} from node {self.origin} to node {self.reporter} '
+            f'(sequence {self.sequence_number}):'
+        )
+        for name, elapsed in self.hops():
+            s += f' {name} +{elapsed}us'
+        return s
+
+
+def payload(block_type: type[Structure], buffer, header_size: int, length: int) -> Structure | None:
+    # The payload of a datagram of length bytes, None if it was cut short
+    if length < header_size + sizeof(block_type):
+        return None
+    return block_type.from_buffer_copy(buffer, header_size)
+
+
+def signal_values(buffer, header_size: int, length: int) -> list[float] | None:
+    # Type 12, the decoded signals of an SSSF's "Signals" section: a count
+    # padded to four bytes then one float per signal, NaN if not seen yet.
+    # Laid out like the type 2 frames the controller sends.
+    if length < header_size + 4:
+        return None
+    count = buffer[header_size] & 0xFF  # The buffer is c_byte
+    if length < header_size + 4 + 4 * count:
+        return None
+    return list(struct.unpack_from(f"<{count}f", buffer, header_size + 4))
+
+
+HEALTH_MAX_OUTLIERS = 8
+
+
+class HealthOutlier(Structure):
+    # HealthAggregator::Outlier in NetworkStats/HealthAggregator.h
+    _pack_ = 4
+    _fields_ = [
+        ("reporter", c_uint16),
+        ("peer", c_uint16),
+        ("score", c_float),
+        ("report", NodeReport)
+    ]
+
+    def __repr__(self) -> str:
+        return (
+            f'{self.peer} as seen by {self.reporter} (score {self.score:.1f}): '
+            f'loss {self.report.packetLoss:.0f} latency {self.report.latency.mean:.0f}us'
+        )
+
+
+class HealthDigest(Structure):
+    # Types 10 (a node's digest) and 11 (the session summary), the head of
+    # HealthAggregator::Digest; numOutliers HealthOutliers follow it.
+    _pack_ = 4
+    _fields_ = [
+        ("reporters", c_uint16),
+        ("pairs", c_uint16),
+        ("numOutliers", c_uint16),
+        ("reserved", c_uint16),
+        ("packetLoss", c_float),
+        ("maxPacketLoss", c_float),
+        ("latency", HealthCore),
+        ("jitter", HealthCore),
+        ("goodput", HealthCore)
+    ]
+
+    def __repr__(self) -> str:
+        return (
+            f'{self.reporters} nodes, {self.pairs} pairs: loss {self.packetLoss:.0f} '
+            f'(worst pair {self.maxPacketLoss:.0f}), latency {self.latency.mean:.0f}us '
+            f'(max {self.latency.max:.0f}us), jitter {self.jitter.mean:.0f}us, '
+            f'{self.numOutliers} outliers'
+        )
+
+
+def health_digest(buffer, header_size: int, length: int) -> tuple[HealthDigest, list[HealthOutlier]] | None:
+    # A digest and its outliers, None if it was cut short
+    digest = payload(HealthDigest, buffer, header_size, length)
+    if digest is None or digest.numOutliers > HEALTH_MAX_OUTLIERS:
+        return None
+    start = header_size + sizeof(HealthDigest)
+    if length < start + digest.numOutliers * sizeof(HealthOutlier):
+        return None
+    outliers = [HealthOutlier.from_buffer_copy(buffer, start + i * sizeof(HealthOutlier))
+                for i in range(digest.numOutliers)]
+    return digest, outliers
+
+
+class NameEntry(Structure):
+    # Type 6 is an array of these, AddressTable::NameEntry in J1939/AddressTable.h
+    _pack_ = 4
+    _fields_ = [
+        ("name", c_uint64),
+        ("handle", c_uint8),
+        ("channel", c_uint8),
+        ("address", c_uint8),
+        ("claimed", c_bool),
+        ("padding", c_uint32)  # The array's stride is 8 byte aligned
+    ]
+
+    def __repr__(self) -> str:
+        where = f'address {self.address:02X}' if self.claimed else 'no address'
+        return f'NAME {self.name:016X} has {where} on can{self.channel}'
+
+
+def name_table(buffer, header_size: int, length: int) -> list[NameEntry]:
+    # Whatever whole entries the datagram holds
+    count = (length - header_size) // sizeof(NameEntry)
+    return [NameEntry.from_buffer_copy(buffer, header_size + i * sizeof(NameEntry))
+            for i in range(max(count, 0))]
+
+
+class Nack(Structure):
+    # Type 7, ReliableLink::Nack in Reliability/ReliableLink.h
+    _pack_ = 4
+    _fields_ = [
+        ("target", c_uint32),
+        ("highest", c_uint32),
+        ("missing", c_uint64)
+    ]
+
+    def __repr__(self) -> str:
+        return f'NACK to node {self.target}: {bin(self.missing).count("1")} missing up to {self.highest}'
+
+
+class ParityHeader(Structure):
+    # Type 8, the head of ParityFEC::Parity in Reliability/ParityFEC.h; the
+    # XOR of the block's datagrams follows it
+    _pack_ = 4
+    _fields_ = [
+        ("first_sequence", c_uint32),
+        ("count", c_uint8),
+        ("reserved", c_uint8 * 3)
+    ]
+
+
+class IsoTpHeader(Structure):
+    # Type 9, IsoTp::PduHeader in IsoTp/IsoTp.h; length bytes of the PDU follow
+    _pack_ = 4
+    _fields_ = [
+        ("tester", c_uint32),
+        ("ecu", c_uint32),
+        ("total", c_uint16),
+        ("offset", c_uint16),
+        ("length", c_uint16),
+        ("channel", c_uint8),
+        ("direction", c_uint8)
+    ]
+
+
+class IsoTpPdus:
+    # Puts the pieces of the PDUs the SSSFs send back together. A PDU starts
+    # again with a piece at offset 0 and one with a piece missing is dropped.
+    def __init__(self) -> None:
+        self.pending: dict[tuple[int, int, int, int], bytearray] = {}
+
+    def add(self, index: int, buffer, header_size: int, length: int) -> tuple[IsoTpHeader, bytes] | None:
+        # The header and whole PDU once its last piece is in, otherwise None
+        header = payload(IsoTpHeader, buffer, header_size, length)
+        start = header_size + sizeof(IsoTpHeader)
+        if header is None or length < start + header.length:
+            return None
+        key = (index, header.tester, header.ecu, header.channel)
+        pdu = self.pending.get(key)
+        if header.offset == 0:
+            pdu = bytearray()
+        if pdu is None or len(pdu) != header.offset:
+            self.pending.pop(key, None)
+            return None
+        pdu += bytes(buffer)[start:start + header.length]  # The buffer is c_byte
+        if len(pdu) < header.total:
+            self.pending[key] = pdu
+            return None
+        self.pending.pop(key, None)
+        return header, bytes(pdu[:header.total])
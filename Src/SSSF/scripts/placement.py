@@ -0,0 +1,63 @@
+# PlatformIO post build script, prints where the forwarding path ended up.
+# Functions marked FASTRUN are copied to RAM at boot and run without going
+# through the flash cache, everything else in .text runs from flash.
+import os
+import re
+
+Import("env")
+
+SECTION = re.compile(r"^\s(\.fastrun\S*)\s*(?:0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+))?$")
+PLACEMENT = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S+)$")
+SYMBOL = re.compile(r"^\s+0x([0-9a-f]+)\s+(\S.*)$")
+OUTPUT = re.compile(r"^(\.text|\.data|\.bss|\.dmabuffers)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)")
+
+
+def parse(path: str):
+    fastrun = []
+    outputs = []
+    with open(path) as file:
+        lines = file.read().splitlines()
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+        output = OUTPUT.match(line)
+        if output is not None:
+            outputs.append((output.group(1), int(output.group(2), 16), int(output.group(3), 16)))
+        section = SECTION.match(line)
+        if section is not None:
+            if section.group(2) is None and (i + 1) < len(lines):
+                # Long names push the address onto the next line
+                i += 1
+                placement = PLACEMENT.match(lines[i])
+                if placement is None:
+                    continue
+                address, size, source = placement.groups()
+            else:
+                address, size, source = section.group(2), section.group(3), section.group(4)
+            symbols = []
+            while (i + 1) < len(lines) and SYMBOL.match(lines[i + 1]) and not PLACEMENT.match(lines[i + 1]):
+                i += 1
+                symbols.append(SYMBOL.match(lines[i]).group(2).strip())
+            fastrun.append((int(address, 16), int(size, 16), os.path.basename(source), symbols))
+        i += 1
+    return fastrun, outputs
+
+
+def report(source, target, env):
+    path = os.path.join(env.subst("$BUILD_DIR"), "firmware.map")
+    if not os.path.exists(path):
+        print("placement: no linker map at %s" % path)
+        return
+    fastrun, outputs = parse(path)
+    print("Memory placement (from %s):" % path)
+    for name, address, size in outputs:
+        print("  %-12s 0x%08x %7d bytes" % (name, address, size))
+    print("FASTRUN functions:")
+    total = 0
+    for address, size, source, symbols in fastrun:
+        total += size
+        print("  0x%08x %6d %s %s" % (address, size, source, ", ".join(symbols)))
+    print("  %d bytes in RAM" % total)
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)
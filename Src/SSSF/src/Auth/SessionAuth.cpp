@@ -0,0 +1,121 @@
+#include <Arduino.h>
+#include <Auth/SessionAuth.h>
+#include <ArduinoLog.h>
+
+SessionAuth::~SessionAuth()
+{
+    delete[] windows;
+}
+
+bool SessionAuth::setKey(const char* hex)
+{
+    keyed = false;
+    if ((hex == nullptr) || (hex[0] == '\0')) return true;
+    uint8_t parsed[AUTH_KEY_SIZE];
+    if (!parseKey(hex, parsed)) return false;
+    return setKey(parsed);
+}
+
+bool SessionAuth::setKey(const uint8_t *newKey)
+{
+    keyed = false;
+    if (newKey == nullptr) return true;
+    if (!SipHash::selfTest())
+    {
+        Log.errorln("SipHash failed its self test, datagrams can't be authenticated.");
+        return false;
+    }
+    memcpy(key, newKey, AUTH_KEY_SIZE);
+    keyed = true;
+    return true;
+}
+
+bool SessionAuth::parseKey(const char* hex, uint8_t *parsed)
+{
+    if ((hex == nullptr) || (strlen(hex) != 2 * AUTH_KEY_SIZE)) return false;
+    for (uint8_t i = 0; i < AUTH_KEY_SIZE; i++)
+    {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+        char *end;
+        parsed[i] = strtoul(byte, &end, 16);
+        if (*end != '\0') return false;
+    }
+    return true;
+}
+
+void SessionAuth::start(size_t members)
+{
+    delete[] windows;
+    numWindows = members;
+    windows = new Window[numWindows];
+    counter = 0;
+}
+
+void SessionAuth::stop()
+{
+    delete[] windows;
+    windows = nullptr;
+    numWindows = 0;
+}
+
+FASTRUN void SessionAuth::beginSend()
+{
+    outbound.begin(key);
+}
+
+FASTRUN void SessionAuth::sent(const uint8_t *data, size_t size)
+{
+    outbound.update(data, size);
+}
+
+FASTRUN void SessionAuth::sign(struct Trailer &trailer)
+{
+    trailer.counter = ++counter;
+    tag(outbound, trailer.counter, trailer.tag);
+}
+
+FASTRUN void SessionAuth::beginReceive()
+{
+    inbound.begin(key);
+}
+
+FASTRUN void SessionAuth::received(const uint8_t *data, size_t size)
+{
+    inbound.update(data, size);
+}
+
+FASTRUN bool SessionAuth::check(uint32_t index, const struct Trailer &trailer)
+{
+    uint8_t expected[AUTH_TAG_SIZE];
+    tag(inbound, trailer.counter, expected);
+    uint8_t difference = 0;
+    for (uint8_t i = 0; i < AUTH_TAG_SIZE; i++)
+    {// Takes as long whichever byte is wrong
+        difference |= expected[i] ^ trailer.tag[i];
+    }
+    if ((difference != 0) || (index >= numWindows) || (trailer.counter == 0)) return false;
+
+    struct Window &window = windows[index];
+    if (trailer.counter > window.highest)
+    {
+        uint32_t shift = trailer.counter - window.highest;
+        window.seen = (shift < AUTH_WINDOW) ? (window.seen << shift) | 1 : 1;
+        window.highest = trailer.counter;
+        return true;
+    }
+    uint32_t age = window.highest - trailer.counter;
+    if ((age >= AUTH_WINDOW) || (window.seen & (1ULL << age))) return false;
+    window.seen |= 1ULL << age;
+    return true;
+}
+
+FASTRUN void SessionAuth::tag(SipHash &hash, uint32_t count, uint8_t out[AUTH_TAG_SIZE])
+{// The counter is hashed after the datagram, the tag is the low bytes of the hash
+    uint8_t bytes[4] = {uint8_t(count), uint8_t(count >> 8), uint8_t(count >> 16), uint8_t(count >> 24)};
+    hash.update(bytes, sizeof(bytes));
+    uint64_t h = hash.end();
+    for (uint8_t i = 0; i < AUTH_TAG_SIZE; i++)
+    {
+        out[i] = h >> (8 * i);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef session_auth_h_
+#define session_auth_h_
+
+#include <Arduino.h>
+#include <Auth/SipHash.h>
+
+#define AUTH_KEY_SIZE 16
+#define AUTH_TAG_SIZE 4  // Bytes of the SipHash kept
+#define AUTH_WINDOW 64  // Counters a receiver tracks per sender
+
+/*
+Optional datagram authentication for a session, so a host on the test
+network can't put frames on a vehicle's bus by sending COMMBlocks to the
+group. It is turned on by an "AuthKey" of 32 hex digits in the session
+request, which the broker generates when the controller asks for an
+authenticated session (Controller/SessionAuth.py does the controller's
+side); a session started over the control socket keeps the key of the last
+HTTP request, and one without a key is unauthenticated as before.
+
+Every datagram (every record, on the raw transport) ends with a Trailer: a
+counter the sender increments for each datagram and a SipHash-2-4 tag over
+the datagram and the counter, truncated to AUTH_TAG_SIZE bytes. A receiver
+drops datagrams whose tag doesn't match, and remembers the last AUTH_WINDOW
+counters of each member so a captured datagram can't be sent again.
+Counters start over with each session, a node that restarts has to be
+started in a new session too.
+
+SipHash runs in software, hashing each piece of a datagram as it is written
+or read. The per frame cycle counts of the benchmark builds include it, so
+its cost shows by running them with and without a key.
+*/
+class SessionAuth
+{
+public:
+    struct Trailer
+    {
+        uint32_t counter;
+        uint8_t tag[AUTH_TAG_SIZE];
+    };
+
+private:
+    struct Window
+    {
+        uint32_t highest = 0;
+        uint64_t seen = 0;  // Bit n set if highest - n has been received
+    };
+
+    bool keyed = false;
+    uint8_t key[AUTH_KEY_SIZE];
+    SipHash outbound;
+    SipHash inbound;
+    uint32_t counter = 0;  // Of the last datagram sent
+    struct Window *windows = nullptr;
+    size_t numWindows = 0;
+
+public:
+    ~SessionAuth();
+
+    /**
+     * @param hex AUTH_KEY_SIZE bytes as hex digits, empty to turn authentication off
+     * @return false if the key isn't valid, leaving authentication off
+     */
+    bool setKey(const char* hex);
+
+    /**
+     * @param newKey AUTH_KEY_SIZE bytes, nullptr to turn authentication off
+     * @return false if SipHash fails its self test, leaving authentication off
+     */
+    bool setKey(const uint8_t *newKey);
+
+    /**
+     * Reads a key without touching the one in use.
+     *
+     * @return false if hex isn't 2 * AUTH_KEY_SIZE hex digits
+     */
+    static bool parseKey(const char* hex, uint8_t *parsed);
+    bool enabled() { return keyed; }
+    void start(size_t members);
+    void stop();
+
+    // Sending side, fed every byte of the datagram
+    void beginSend();
+    void sent(const uint8_t *data, size_t size);
+    void sign(struct Trailer &trailer);
+
+    // Receiving side, fed every byte before the trailer
+    void beginReceive();
+    void received(const uint8_t *data, size_t size);
+
+    /**
+     * @return true if the tag is right and the counter hasn't been seen from this member
+     */
+    bool check(uint32_t index, const struct Trailer &trailer);
+
+private:
+    void tag(SipHash &hash, uint32_t count, uint8_t out[AUTH_TAG_SIZE]);
+};
+
+#endif /* session_auth_h_ */
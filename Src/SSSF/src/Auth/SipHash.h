@@ -0,0 +1,33 @@
+#ifndef sip_hash_h_
+#define sip_hash_h_
+
+#include <Arduino.h>
+#include <stddef.h>
+
+/*
+SipHash-2-4 (Aumasson and Bernstein), a keyed hash short enough to tag every
+datagram in software: two rounds of 64 bit adds, rotates and XORs per eight
+bytes, which the Cortex-M4 does as pairs of 32 bit operations. Input can be
+fed in pieces of any size. selfTest() checks the implementation against the
+reference vectors for the key 00 01 .. 0f and the messages 00 01 .. (n - 1).
+*/
+class SipHash
+{
+private:
+    uint64_t v0, v1, v2, v3;
+    uint64_t pending = 0;  // Bytes of an unfinished word, little endian
+    uint32_t length = 0;
+
+public:
+    void begin(const uint8_t key[16]);
+    void update(const uint8_t *data, size_t size);
+    uint64_t end();
+
+    static bool selfTest();
+
+private:
+    void compress(uint64_t word);
+    void round();
+};
+
+#endif /* sip_hash_h_ */
@@ -0,0 +1,80 @@
+#ifndef cycle_counter_h_
+#define cycle_counter_h_
+
+#include <Arduino.h>
+#include <ArduinoLog.h>
+
+#define CYCLE_REPORT_INTERVAL 10000  // ms
+
+/*
+Counts CPU cycles spent on a piece of the forwarding path with the Cortex-M
+DWT cycle counter. Only built in with -D SSSF_CYCLE_BENCHMARK (the
+*_benchmark environments in platformio.ini), otherwise every call is empty
+and compiles away.
+
+Min and max are kept next to the mean because the point is a stable per frame
+cost: code running from flash is fast while it sits in the flash cache and
+slow after something evicted it, which shows as a max far above the min.
+Code placed with FASTRUN doesn't go through the cache and should stay close.
+*/
+class CycleCounter
+{
+#if defined(SSSF_CYCLE_BENCHMARK)
+private:
+    const char* name;
+    uint32_t started = 0;
+    bool running = false;
+    uint32_t count = 0;
+    uint32_t minimum = UINT32_MAX;
+    uint32_t maximum = 0;
+    uint64_t total = 0;
+
+public:
+    CycleCounter(const char* _name): name(_name) {}
+
+    static void begin()
+    {
+        ARM_DEMCR |= ARM_DEMCR_TRCENA;
+        ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    }
+
+    void start()
+    {
+        started = ARM_DWT_CYCCNT;
+        running = true;
+    }
+
+    void stop()
+    {// Counts the cycles since start, if there was one
+        uint32_t cycles = ARM_DWT_CYCCNT - started;
+        if (!running) return;
+        running = false;
+        count++;
+        minimum = min(minimum, cycles);
+        maximum = max(maximum, cycles);
+        total += cycles;
+    }
+
+    void report()
+    {// Logs and starts over
+        if (count > 0)
+        {
+            Log.noticeln("%s: %d runs, cycles min %d mean %d max %d.", name, count, minimum,
+                uint32_t(total / count), maximum);
+        }
+        count = 0;
+        minimum = UINT32_MAX;
+        maximum = 0;
+        total = 0;
+    }
+#else
+public:
+    CycleCounter(const char*) {}
+    static void begin() {}
+    void start() {}
+    void stop() {}
+    void report() {}
+#endif
+};
+
+#endif /* cycle_counter_h_ */
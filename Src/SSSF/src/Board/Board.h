@@ -0,0 +1,70 @@
+#ifndef board_h_
+#define board_h_
+
+#include <Arduino.h>
+
+/*
+Board support for the Teensy based hardware the SSSF runs on. Each board is a
+trait type with its pin map and the board specific parts of bring up. The
+board is chosen at build time by the PlatformIO environment (see
+platformio.ini), which defines one of the SSSF_BOARD_* flags. To support new
+hardware add a trait type here and an environment that selects it.
+*/
+
+struct SSS3Board
+{
+    static constexpr const char* name() { return "SSS3"; }
+    static constexpr uint8_t statusLED = 2;  // Green
+    static constexpr uint8_t rxCANLED = 5;  // Red
+    static constexpr uint8_t relay = 39;
+    static constexpr uint32_t relayDelay = 3000;  // ms for the ECUs to power up/down
+
+    static void setupPins()
+    {
+        pinMode(statusLED, OUTPUT);
+        digitalWrite(statusLED, LOW);
+        pinMode(rxCANLED, OUTPUT);
+        digitalWrite(rxCANLED, LOW);
+        pinMode(relay, OUTPUT);
+    }
+
+    static void ignition(bool on)
+    {
+        digitalWrite(relay, on ? HIGH : LOW);
+        delay(relayDelay);
+    }
+};
+
+struct CANToEthernetBoard
+{
+    static constexpr const char* name() { return "CAN-to-Ethernet"; }
+    static constexpr uint8_t statusLED = 5;
+    static constexpr uint8_t rxCANLED = 16;
+    static constexpr uint8_t silentPin1 = 14;
+    static constexpr uint8_t silentPin2 = 35;
+
+    static void setupPins()
+    {
+        pinMode(statusLED, OUTPUT);
+        digitalWrite(statusLED, LOW);
+        pinMode(rxCANLED, OUTPUT);
+        digitalWrite(rxCANLED, LOW);
+        // Low takes the transceivers out of silent mode.
+        pinMode(silentPin1, OUTPUT);
+        pinMode(silentPin2, OUTPUT);
+        digitalWrite(silentPin1, LOW);
+        digitalWrite(silentPin2, LOW);
+    }
+
+    static void ignition(bool) {}  // No ignition relay
+};
+
+#if defined(SSSF_BOARD_SSS3)
+typedef SSS3Board Board;
+#elif defined(SSSF_BOARD_CAN_TO_ETHERNET)
+typedef CANToEthernetBoard Board;
+#else
+#error "No SSSF board selected. Build with one of the environments in platformio.ini."
+#endif
+
+#endif /* board_h_ */
@@ -0,0 +1,164 @@
+#include <Arduino.h>
+#include <BusStats/BusStats.h>
+#include <FlexCAN_T4.h>
+
+namespace
+{
+    // Walks the bits of a frame from SOF to the end of the CRC, calculating the
+    // CRC and counting the stuff bits the controller would insert.
+    struct StuffedBits
+    {
+        uint16_t crc = 0;
+        uint16_t bits = 0;
+        uint8_t last = 2;
+        uint8_t run = 0;
+
+        void bit(uint8_t b, bool includeInCRC = true)
+        {
+            if (includeInCRC)
+            {
+                uint8_t crcNext = b ^ ((crc >> 14) & 1);
+                crc = (crc << 1) & 0x7FFF;
+                if (crcNext) crc ^= 0x4599;
+            }
+            bits++;
+            if (b == last)
+            {
+                if (++run == 5)
+                {
+                    bits++;
+                    last = !b;
+                    run = 1;
+                }
+            }
+            else
+            {
+                last = b;
+                run = 1;
+            }
+        }
+
+        void field(uint32_t value, uint8_t count, bool includeInCRC = true)
+        {
+            while (count > 0)
+            {
+                count--;
+                bit((value >> count) & 1, includeInCRC);
+            }
+        }
+    };
+}
+
+BusStats::BusStats()
+{}
+
+void BusStats::start(int32_t can0Bitrate, int32_t can1Bitrate)
+{
+    channels[0].bitrate = (can0Bitrate > 0) ? can0Bitrate : 0;
+    channels[1].bitrate = (can1Bitrate > 0) ? can1Bitrate : 0;
+    for (int c = 0; c < BUS_STATS_CHANNELS; c++)
+    {
+        channels[c].ids = 0;
+    }
+    for (int i = 0; i < ID_INDEX_CAPACITY; i++)
+    {
+        stats[i] = IDStats();
+    }
+    reset();
+}
+
+void BusStats::received(uint8_t channel, int16_t slot, const CAN_message_t &canFrame)
+{
+    uint32_t now = micros();
+    struct Channel &c = channels[channel];
+    c.windowBits += frameBits(canFrame);
+    c.windowFrames++;
+    struct IDStats *s = find(slot);
+    if (s == nullptr)
+    {
+        c.untracked++;
+        return;
+    }
+    if (s->count == 0)
+    {// Slots are per channel, so this is an ID new to the channel
+        c.ids++;
+    }
+    else
+    {// Welford's online algorithm, same as NetworkStats::calculate
+        float period = now - s->lastSeen;
+        float delta = period - s->meanPeriod;
+        s->meanPeriod += delta / s->count;
+        s->sumOfSquaredDifferences += delta * (period - s->meanPeriod);
+    }
+    s->count++;
+    s->lastSeen = now;
+    s->dlc = canFrame.len;
+}
+
+void BusStats::transmitted(uint8_t channel, const CAN_message_t &canFrame)
+{
+    channels[channel].windowBits += frameBits(canFrame);
+}
+
+void BusStats::summarize()
+{
+    float elapsed = (micros() - windowStart) / 1000000.0;
+    for (int i = 0; i < BUS_STATS_CHANNELS; i++)
+    {
+        struct Channel &c = channels[i];
+        Summary[i].load = ((c.bitrate > 0) && (elapsed > 0)) ? (c.windowBits * 100.0) / (c.bitrate * elapsed) : 0.0;
+        Summary[i].frames = c.windowFrames;
+        Summary[i].ids = c.ids;
+        Summary[i].untracked = min(c.untracked, (uint32_t) UINT16_MAX);
+    }
+}
+
+void BusStats::reset()
+{
+    windowStart = micros();
+    for (int c = 0; c < BUS_STATS_CHANNELS; c++)
+    {
+        channels[c].windowBits = 0;
+        channels[c].windowFrames = 0;
+        channels[c].untracked = 0;
+    }
+}
+
+struct BusStats::IDStats* BusStats::find(int16_t slot)
+{
+    return (slot == ID_INDEX_NONE) ? nullptr : &stats[slot];
+}
+
+float BusStats::jitter(const struct IDStats &stats)
+{// count frames make count - 1 periods, the sample variance divides by one less
+    return (stats.count > 2) ? sqrtf(stats.sumOfSquaredDifferences / (stats.count - 2)) : 0.0;
+}
+
+uint16_t BusStats::frameBits(const CAN_message_t &canFrame)
+{
+    StuffedBits s;
+    uint8_t len = canFrame.flags.remote ? 0 : min(canFrame.len, (uint8_t) 8);
+    s.bit(0);  // SOF
+    if (canFrame.flags.extended)
+    {
+        s.field(canFrame.id >> 18, 11);
+        s.bit(1);  // SRR
+        s.bit(1);  // IDE
+        s.field(canFrame.id & 0x3FFFF, 18);
+        s.bit(canFrame.flags.remote);
+        s.field(0, 2);  // r1, r0
+    }
+    else
+    {
+        s.field(canFrame.id & 0x7FF, 11);
+        s.bit(canFrame.flags.remote);
+        s.field(0, 2);  // IDE, r0
+    }
+    s.field(canFrame.len & 0x0F, 4);
+    for (uint8_t i = 0; i < len; i++)
+    {
+        s.field(canFrame.buf[i], 8);
+    }
+    s.field(s.crc, 15, false);
+    return s.bits + CAN_FRAME_TAIL_BITS;
+}
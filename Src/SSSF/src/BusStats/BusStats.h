@@ -0,0 +1,76 @@
+#ifndef bus_stats_h_
+#define bus_stats_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <IdIndex/IdIndex.h>
+
+#define BUS_STATS_CHANNELS 2
+#define CAN_FRAME_TAIL_BITS 13 // CRC delimiter, ACK slot and delimiter, EOF and IFS
+
+/*
+Keeps per channel, per CAN ID counters for the buses the SSSF sits on, one
+IDStats for each slot of the IdIndex so an update never allocates or
+searches. Frames whose ID didn't fit in the index are still counted towards
+the bus load but are tallied as untracked. The per ID table is served on
+/metrics, see MetricsWriter.
+
+Bus load is the number of bits on the wire over a window divided by the
+number of bits the configured bitrate allows in that window. Frame lengths are
+computed exactly, including the stuff bits inserted between SOF and the end of
+the CRC.
+*/
+
+class BusStats
+{
+public:
+    struct IDStats
+    {// One per IdIndex slot, so kept to what /metrics serves
+        uint32_t count = 0;  // Since the session started
+        uint32_t lastSeen = 0;  // micros()
+        float meanPeriod = 0.0;  // us
+        float sumOfSquaredDifferences = 0.0;
+        uint8_t dlc = 0;  // Of the last frame
+    };
+
+    struct BusSummary
+    {
+        float load = 0.0;  // Percent of the bitrate used over the window
+        uint32_t frames = 0;  // Received over the window
+        uint16_t ids = 0;  // Distinct IDs seen since the session started
+        uint16_t untracked = 0;  // Frames over the window whose ID didn't fit
+    };
+
+    struct BusSummary Summary[BUS_STATS_CHANNELS];
+
+private:
+    struct Channel
+    {
+        uint32_t bitrate = 0;
+        uint32_t windowBits = 0;
+        uint32_t windowFrames = 0;
+        uint32_t untracked = 0;
+        uint16_t ids = 0;
+    };
+
+    struct Channel channels[BUS_STATS_CHANNELS];
+    struct IDStats stats[ID_INDEX_CAPACITY];
+    uint32_t windowStart = 0;
+
+public:
+    BusStats();
+
+    void start(int32_t can0Bitrate, int32_t can1Bitrate);
+    // slot is the frame's in the IdIndex
+    void received(uint8_t channel, int16_t slot, const CAN_message_t &canFrame);
+    void transmitted(uint8_t channel, const CAN_message_t &canFrame);
+    void summarize();
+    void reset();
+    struct IDStats* find(int16_t slot);
+    // Standard deviation of the period, us
+    float jitter(const struct IDStats &stats);
+
+    static uint16_t frameBits(const CAN_message_t &canFrame);
+};
+
+#endif /* bus_stats_h_ */
@@ -1,6 +1,8 @@
 #include <Arduino.h>
 #include <Ethernet.h>
 #include <CANNode/CANNode.h>
+#include <Metrics/Metrics.h>
+#include <EthernetStats/EthernetStats.h>
 #include <TeensyID.h>
 #include <ArduinoLog.h>
 #include <FlexCAN_T4.h>
@@ -10,6 +12,8 @@
 
 LogStream ls;
 
+static_assert(NumTrafficClasses == METRICS_TRAFFIC_CLASSES, "Metrics keep latency per traffic class");
+
 CANNode::CANNode():
     mac{0},
     sessionStatus(Inactive)
@@ -18,22 +22,20 @@ CANNode::CANNode():
     teensyMAC(mac);
 }
 
-CANNode::CANNode(uint32_t _can0Baudrate, String _SSSFDevice):
+CANNode::CANNode(uint32_t _can0Baudrate):
     can0BaudRate(_can0Baudrate),
     mac{0},
-    sessionStatus(Inactive),
-    SSSFDevice(_SSSFDevice)
+    sessionStatus(Inactive)
 {
     setupLogging();
     teensyMAC(mac);
 }
 
-CANNode::CANNode(uint32_t _can0Baudrate, uint32_t _can1Baudrate, String _SSSFDevice):
+CANNode::CANNode(uint32_t _can0Baudrate, uint32_t _can1Baudrate):
     can0BaudRate(_can0Baudrate),
     can1BaudRate(_can1Baudrate),
     mac{0},
-    sessionStatus(Inactive),
-    SSSFDevice(_SSSFDevice)
+    sessionStatus(Inactive)
 {
     setupLogging();
     teensyMAC(mac);
@@ -46,37 +48,8 @@ int CANNode::init()
     canSize = sizeof(CAN_message_t);
     canFDSize = sizeof(CANFD_message_t);
     canHeadSize = canBlockSize - canFDSize;
-    if (SSSFDevice.compareTo("SSS3") == 0)
-    {
-        pinMode(SSS3GreenLED, OUTPUT);
-        digitalWrite(SSS3GreenLED, LOW);
-        pinMode(SSS3RedLED, OUTPUT);
-        digitalWrite(SSS3RedLED, LOW);
-        pinMode(SSS3Relay, OUTPUT);
-        statusLED = SSS3GreenLED;
-        rxCANLED = SSS3RedLED;
-        Log.noticeln("SSSF Device: %s", SSSFDevice.c_str());
-    }
-    else if (SSSFDevice.compareTo("CAN-to-Ethernet") == 0)
-    {
-        pinMode(CAN2EthLED1, OUTPUT);
-        digitalWrite(CAN2EthLED1, LOW);
-        pinMode(CAN2EthLED2, OUTPUT);
-        digitalWrite(CAN2EthLED2, LOW);
-        pinMode(CAN2EthSilentPin1, OUTPUT);
-        pinMode(CAN2EthSilentPin2, OUTPUT);
-        digitalWrite(CAN2EthSilentPin1, LOW);
-        digitalWrite(CAN2EthSilentPin2, LOW);
-        statusLED = CAN2EthLED1;
-        rxCANLED = CAN2EthLED2;
-        Log.noticeln("SSSF Device: %s", SSSFDevice.c_str());
-    }
-    else
-    {
-        Log.fatalln("Invalid SSSF Device. Must be either SSS3 or CAN-to-Ethernet.");
-        foreverFlashInError();
-        return 0;
-    }
+    Board::setupPins();
+    Log.noticeln("SSSF Device: %s", Board::name());
     Log.noticeln("Setting up CAN Channel(s).");
     setupCANChannels();
     Log.noticeln("Setting up Ethernet:");
@@ -91,6 +64,11 @@ int CANNode::init()
         Log.noticeln("\tNetmask: %p", Ethernet.subnetMask());
         Log.noticeln("\tGateway IP: %p", Ethernet.gatewayIP());
         Log.noticeln("\tDNS Server IP: %p\n", Ethernet.dnsServerIP());
+        // Before any other socket is opened, the Ethernet library would hand it out.
+        if (rawSock.reserve(mac))
+        {
+            Log.noticeln("\t-> Holding socket %d for raw Ethernet sessions.\n", RAW_SOCKET);
+        }
         return 1;
     }
     else
@@ -102,22 +80,35 @@ int CANNode::init()
     }
 }
 
-bool CANNode::startSession(IPAddress _ip, uint16_t _port)
+bool CANNode::startSession(IPAddress _ip, uint16_t _port, Transport _transport)
 {
     canIP = _ip;
     canPort = _port;
+    transport = _transport;
+    markedTOS = 0xFF;
     sequenceNumber = 1;
+    linkStats = LinkStats();
 
-    if (canSock.beginMulticast(canIP, canPort))
+    bool opened = (transport == RawTransport) ? rawSock.begin(canIP, canPort) : canSock.beginMulticast(canIP, canPort);
+    if (opened)
     {
         sessionStatus = Active;
+        lastReceived = millis();
         Log.noticeln("Starting new session...");
         Log.noticeln("Session Information: ");
         Log.noticeln("\tIP: %p", canIP);
         Log.noticeln("\tPort: %d", canPort);
+        if (transport == RawTransport) Log.noticeln("\tTransport: raw Ethernet");
         ignitionOn();
         return true;
     }
+    else if (transport == RawTransport)
+    {
+        Log.errorln("Failed to start new session.");
+        Log.errorln("The raw Ethernet socket is not available.");
+        rawSock.stop();
+        return false;
+    }
     else
     {
         Log.errorln("Failed to start new session.");
@@ -126,7 +117,7 @@ bool CANNode::startSession(IPAddress _ip, uint16_t _port)
     }
 }
 
-bool CANNode::startSession(String _ip, uint16_t _port)
+bool CANNode::startSession(String _ip, uint16_t _port, Transport _transport)
 {
     DNSClient dns;
     dns.begin(Ethernet.dnsServerIP());
@@ -138,20 +129,44 @@ bool CANNode::startSession(String _ip, uint16_t _port)
         Log.errorln("Failed to parse multicast IP address.");
         return false;
     }
-    return startSession(ipConverted, _port);
+    return startSession(ipConverted, _port, _transport);
 }
 
-int CANNode::parsePacket()
+FASTRUN int CANNode::parsePacket()
 {
-    return canSock.parsePacket();
+    SPITimer timer;
+    int size = (transport == RawTransport) ? rawSock.parsePacket() : canSock.parsePacket();
+    if (size > 0)
+    {
+        lastReceived = millis();
+        Metrics.datagramsRx++;
+        if (auth.enabled())
+        {
+            auth.beginReceive();
+            unread = (size > int(sizeof(SessionAuth::Trailer))) ? size - sizeof(SessionAuth::Trailer) : 0;
+        }
+    }
+    return size;
 }
 
 int CANNode::read(uint8_t *buffer, size_t size)
 {
-    return canSock.read(buffer, size);
+    SPITimer timer;
+    if (auth.enabled())
+    {// Never into the trailer
+        size = min(size, unread);
+        if (size == 0) return 0;
+    }
+    int received = (transport == RawTransport) ? rawSock.read(buffer, size) : canSock.read(buffer, size);
+    if (auth.enabled() && (received > 0))
+    {
+        auth.received(buffer, received);
+        unread -= received;
+    }
+    return received;
 }
 
-int CANNode::read(struct WCANBlock *buffer)
+FASTRUN int CANNode::read(struct WCANBlock *buffer)
 {
     uint8_t *buf = reinterpret_cast<uint8_t*>(buffer);
     int recvdHeaders = read(buf, canHeadSize);
@@ -176,9 +191,20 @@ int CANNode::read(struct WCANBlock *buffer)
     return -1;
 }
 
-int CANNode::beginPacket()
+int CANNode::beginPacket(TrafficClass trafficClass)
 {
-    return canSock.beginPacket(canIP, canPort);
+    SPITimer timer;
+    if (auth.enabled()) auth.beginSend();
+    if (transport == RawTransport) return rawSock.beginPacket();
+    uint8_t tos = dscp[trafficClass] << 2;
+    if (tos != markedTOS)
+    {
+        canSock.setTOS(tos);
+        markedTOS = tos;
+    }
+    int started = canSock.beginPacket(canIP, canPort);
+    if (!started) Metrics.beginPacketFailures++;
+    return started;
 }
 
 int CANNode::beginPacket(struct WCANBlock &canBlock)
@@ -189,6 +215,9 @@ int CANNode::beginPacket(struct WCANBlock &canBlock)
 
 int CANNode::write(const uint8_t *buffer, size_t size)
 {
+    SPITimer timer;
+    if (auth.enabled()) auth.sent(buffer, size);
+    if (transport == RawTransport) return rawSock.write(buffer, size);
     return canSock.write(buffer, size);
 }
 
@@ -199,14 +228,109 @@ int CANNode::write(struct WCANBlock *canFrame)
 
 int CANNode::endPacket(bool incrementSequenceNumber)
 {
+    SPITimer timer;
     if (incrementSequenceNumber) sequenceNumber += 1;
-    return canSock.endPacket();
+    if (auth.enabled())
+    {
+        SessionAuth::Trailer trailer;
+        auth.sign(trailer);
+        uint8_t *bytes = reinterpret_cast<uint8_t*>(&trailer);
+        if (transport == RawTransport) rawSock.write(bytes, sizeof(trailer));
+        else canSock.write(bytes, sizeof(trailer));
+    }
+    // Raw datagrams are only queued here, they are counted when the frame goes out.
+    if (transport == RawTransport) return rawSock.endPacket();
+    int sent = canSock.endPacket();
+    if (sent)
+    {
+        Metrics.datagramsTx++;
+    }
+    else
+    {
+        Metrics.drops[UDPSendFailed]++;
+        Metrics.endPacketFailures++;
+    }
+    return sent;
+}
+
+bool CANNode::authenticate(uint32_t index)
+{// Hashes whatever the reader skipped, then checks the trailer
+    if (!auth.enabled()) return true;
+    uint8_t skipped[32];
+    while (unread > 0)
+    {
+        if (read(skipped, min(unread, sizeof(skipped))) <= 0) return false;
+    }
+    SessionAuth::Trailer trailer;
+    uint8_t *bytes = reinterpret_cast<uint8_t*>(&trailer);
+    SPITimer timer;
+    int received = (transport == RawTransport) ? rawSock.read(bytes, sizeof(trailer)) : canSock.read(bytes, sizeof(trailer));
+    return (received == sizeof(trailer)) && auth.check(index, trailer);
+}
+
+void CANNode::flush()
+{// Sends the datagrams batched in this pass of the loop
+    SPITimer timer;
+    if (transport == RawTransport) rawSock.flush();
+}
+
+bool CANNode::checkSession(uint32_t timeout)
+{
+    // If a switch ages out our group membership or the WIZnet chip resets the
+    // socket we would keep sending but never hear from the session again.
+    if ((sessionStatus != Active) || (timeout == 0) || ((millis() - lastReceived) < timeout))
+    {
+        return true;
+    }
+    lastReceived = millis();  // Give the session another timeout before retrying
+    if (transport == RawTransport)
+    {// No group to re-join, only the socket can be recovered
+        if (rawSock.status() == SnSR::MACRAW) return true;
+        linkStats.socketResets++;
+        Log.warningln("Raw Ethernet socket was closed. Reopening it.");
+        if (rawSock.begin(canIP, canPort)) return true;
+        Log.errorln("Failed to reopen the raw Ethernet socket.");
+        return false;
+    }
+    uint8_t status = canSock.status();
+    if (status == SnSR::UDP)
+    {
+        linkStats.rejoins++;
+        Log.warningln("No session traffic for %d ms. Re-joining %p.", timeout, canIP);
+    }
+    else
+    {
+        linkStats.socketResets++;
+        Log.warningln("Session socket was closed (status 0x%x). Recreating it.", status);
+    }
+    // Re-opening the socket in multicast mode sends a new IGMP join.
+    canSock.stop();
+    markedTOS = 0xFF;  // May not get the same socket back
+    if (canSock.beginMulticast(canIP, canPort))
+    {
+        return true;
+    }
+    Log.errorln("Failed to recreate the session socket.");
+    return false;
 }
 
 void CANNode::stopSession()
 {
     Log.noticeln("Stopping the session...");
-    canSock.stop();
+    if (transport == RawTransport)
+    {// Socket 0 is parked again, still ours for the next raw session
+        rawSock.flush();
+        rawSock.stop();
+    }
+    else
+    {
+        canSock.stop();
+    }
+    transport = UDPTransport;
+    for (uint8_t channel = 0; channel < 2; channel++)
+    {// Downlink frames of the old session aren't sent into the next one
+        txBacklog[channel].count = 0;
+    }
     canIP = IPAddress();
     canPort = 0;
     sequenceNumber = 1;
@@ -215,6 +339,91 @@ void CANNode::stopSession()
     Log.noticeln("Waiting for next session.");
 }
 
+bool CANNode::setDSCP(TrafficClass trafficClass, uint8_t value)
+{
+    if ((trafficClass >= NumTrafficClasses) || (value > DSCP_MAX))
+    {
+        Log.errorln("%d is not a DSCP.", value);
+        return false;
+    }
+    dscp[trafficClass] = value;
+    return true;
+}
+
+uint32_t CANNode::busAge(uint8_t channel, const struct CAN_message_t &canFrame)
+{
+    // The FlexCAN free running timer ticks once per bit time and the frame's
+    // timestamp is the timer value captured when it was received.
+    int32_t baudRate = (channel == 0) ? can0BaudRate : can1BaudRate;
+    if (baudRate <= 0) return 0;
+    uint16_t now = (channel == 0) ? FLEXCANb_TIMER(CAN0) : FLEXCANb_TIMER(CAN1);
+    uint16_t ticks = now - canFrame.timestamp;
+    return (uint64_t(ticks) * 1000000) / baudRate;
+}
+
+void CANNode::onTransmit(_MB_ptr handler)
+{
+    // Has to be registered here since this is where the channels were started.
+    // Only the transmit mailboxes get their interrupt, the receive ones are
+    // left as onReceive() set them.
+    can0.onTransmit(handler);
+    if (can1BaudRate >= 0) can1.onTransmit(handler);
+    for (int mb = CAN_FIRST_TX_MB; mb <= CAN_LAST_TX_MB; mb++)
+    {
+        can0.enableMBInterrupt(FLEXCAN_MAILBOX(mb));
+        if (can1BaudRate >= 0) can1.enableMBInterrupt(FLEXCAN_MAILBOX(mb));
+    }
+}
+
+FASTRUN bool CANNode::send(uint8_t channel, const struct CAN_message_t &canFrame, bool queue)
+{
+    struct TxBacklog &backlog = txBacklog[channel];
+    // Nothing may overtake a backlogged frame
+    if ((backlog.count == 0) && writeMailbox(channel, canFrame)) return true;
+    if (!queue || (backlog.count == CAN_TX_BACKLOG)) return false;
+    backlog.frames[(backlog.head + backlog.count) & (CAN_TX_BACKLOG - 1)] = canFrame;
+    backlog.count++;
+    return true;
+}
+
+void CANNode::pollTransmit()
+{
+    for (uint8_t channel = 0; channel < 2; channel++)
+    {
+        struct TxBacklog &backlog = txBacklog[channel];
+        while ((backlog.count > 0) && writeMailbox(channel, backlog.frames[backlog.head]))
+        {
+            backlog.head = (backlog.head + 1) & (CAN_TX_BACKLOG - 1);
+            backlog.count--;
+        }
+    }
+}
+
+FASTRUN bool CANNode::writeMailbox(uint8_t channel, const struct CAN_message_t &canFrame)
+{// write() with a mailbox fails while that mailbox is still sending
+    for (int mb = CAN_FIRST_TX_MB; mb <= CAN_LAST_QUEUED_TX_MB; mb++)
+    {
+        if ((channel == 0) ? can0.write(FLEXCAN_MAILBOX(mb), canFrame) : can1.write(FLEXCAN_MAILBOX(mb), canFrame))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CANNode::onReceive(uint8_t channel, _MB_ptr handler)
+{
+    // From here on frames arrive through the handler, FlexCAN no longer polls
+    // the mailboxes for read().
+    if (channel == 0) can0.onReceive(handler);
+    else can1.onReceive(handler);
+    for (int mb = MB0; mb < CAN_FIRST_TX_MB; mb++)
+    {
+        if (channel == 0) can0.enableMBInterrupt(FLEXCAN_MAILBOX(mb));
+        else can1.enableMBInterrupt(FLEXCAN_MAILBOX(mb));
+    }
+}
+
 String CANNode::dumpCANBlock(struct WCANBlock &canBlock)
 {
     String msg = "Sequence Number: " + String(canBlock.sequenceNumber);
@@ -271,6 +480,7 @@ void CANNode::setupCANChannels()
     }
     Log.noticeln("Setting up can0 with a bitrate of %d", can0BaudRate);
     can0.setBaudRate(can0BaudRate);
+    can0.setMB(CAN_LAST_TX_MB, TX);  // Already transmitting, but only the fast lane writes it
     if (can1BaudRate >= 0)
     {
         can1.begin();
@@ -283,6 +493,7 @@ void CANNode::setupCANChannels()
         }
         Log.noticeln("Setting up can1 with a bitrate of %d", can1BaudRate);
         can1.setBaudRate(can1BaudRate);
+        can1.setMB(CAN_LAST_TX_MB, TX);
     }
     // while(true) {
     //     CAN_message_t msg;
@@ -297,20 +508,12 @@ void CANNode::setupCANChannels()
 
 void CANNode::ignitionOn()
 {
-    if (SSSFDevice.compareTo("SSS3") == 0)
-    {
-        digitalWrite(SSS3Relay, HIGH);
-        delay(3000);
-    }
+    Board::ignition(true);
 }
 
 void CANNode::ignitionOff()
 {
-    if (SSSFDevice.compareTo("SSS3") == 0)
-    {
-        digitalWrite(SSS3Relay, LOW);
-        delay(3000);
-    }
+    Board::ignition(false);
 }
 
 uint32_t CANNode::getBaudRate(uint8_t channel)
@@ -8,10 +8,20 @@
 #include <FlexCAN_T4.h>
 #include <SPI.h>
 #include <SD.h>
+#include <Board/Board.h>
+#include <CANNode/SessionUDP.h>
+#include <CANNode/RawSocket.h>
+#include <Auth/SessionAuth.h>
 
 #define AUTOBAUD_TIMEOUT_MS 300
 #define NUM_BAUD_RATES 5
 #define BAUD_RATE_LIST {250000, 500000, 125000, 666666, 1000000}
+#define DSCP_DEFAULTS {46, 34, 18, 8}  // EF, AF41, AF21, CS1
+#define DSCP_MAX 63  // Six bits, the top of the TOS byte
+#define CAN_FIRST_TX_MB MB8  // begin() leaves MB0 to MB7 receiving and MB8 to MB15 transmitting
+#define CAN_LAST_TX_MB MB15
+#define CAN_LAST_QUEUED_TX_MB MB14  // send() leaves MB15 to the fast lane, see FastLane.h
+#define CAN_TX_BACKLOG 16  // Frames per channel waiting for a mailbox, a power of two
 
 // Since the tonton FlexCAN library is a template library and we are using the
 // diamond method, this has to be outside of any class.
@@ -24,31 +34,57 @@ enum SessionStatus
     Active
 };
 
+/*
+Session datagrams are marked with a DSCP per class so switches with QoS can
+keep the CAN path ahead of video and bulk logging sharing the network. The
+WIZnet chips set the TOS per socket, so the register is rewritten when a
+datagram of a different class than the last one is sent.
+*/
+enum TrafficClass
+{
+    CANTraffic,  // CAN frames and their NACKs, retransmissions and parity
+    SensorTraffic,
+    HealthTraffic,  // Health reports and session control
+    BulkTraffic,  // Traces, NAME tables and captures
+    NumTrafficClasses
+};
+
+enum Transport
+{
+    UDPTransport,  // Multicast UDP, works across routers
+    RawTransport  // Ethernet frames on one segment, see RawSocket.h
+};
+
 class CANNode
 {
 private:
-    EthernetUDP canSock;
+    SessionUDP canSock;
+    RawSocket rawSock;
     IPAddress canIP;
     uint16_t canPort;
 
     int canBlockSize = 0;
     int canHeadSize = 0;
 
-    const uint8_t SSS3GreenLED = 2;
-    const uint8_t SSS3RedLED = 5;
-    const uint8_t SSS3Relay = 39;
-
-    const uint8_t CAN2EthLED1 = 5;
-    const uint8_t CAN2EthLED2 = 16;
-    const uint8_t CAN2EthSilentPin1 = 14;
-    const uint8_t CAN2EthSilentPin2 = 35;
+    uint8_t dscp[NumTrafficClasses] = DSCP_DEFAULTS;
+    uint8_t markedTOS = 0xFF;  // Last TOS written to the session socket, 0xFF if unknown
+    size_t unread = 0;  // Bytes before the trailer of an authenticated datagram not read yet
 
     uint8_t baudRateIndex = 0;
     uint32_t baudRates[NUM_BAUD_RATES] = BAUD_RATE_LIST;
+
+    // Frames send() couldn't put in a mailbox, only touched by the loop
+    struct TxBacklog
+    {
+        struct CAN_message_t frames[CAN_TX_BACKLOG];
+        uint8_t head = 0;
+        uint8_t count = 0;
+    };
+    struct TxBacklog txBacklog[2];
     
 protected:
-    uint8_t statusLED = 0;
-    uint8_t rxCANLED = 0;
+    static constexpr uint8_t statusLED = Board::statusLED;
+    static constexpr uint8_t rxCANLED = Board::rxCANLED;
     uint8_t rxCANLEDStatus = LOW;
 
     int canSize = 0;
@@ -60,8 +96,9 @@ protected:
     uint8_t mac[6];  // Hostname is "WIZnet" + last three bytes of the MAC.
     uint32_t sequenceNumber = 1;
     volatile boolean sessionStatus;
-
-    String SSSFDevice;
+    uint32_t lastReceived = 0;  // millis() of the last session datagram
+    Transport transport = UDPTransport;
+    SessionAuth auth;
 
 public:
     struct WCANBlock
@@ -75,28 +112,62 @@ public:
             struct CANFD_message_t canFD;
         };
     };
-    
+
+    struct LinkStats
+    {
+        uint32_t rejoins = 0;  // Group re-joined after the session went silent
+        uint32_t socketResets = 0;  // Socket found closed and recreated
+    };
+    struct LinkStats linkStats;
+
     CANNode();
-    CANNode(uint32_t _can0Baudrate, String _SSSFDevice);
-    CANNode(uint32_t _can0Baudrate, uint32_t _can1Baudrate, String _SSSFDevice);
+    CANNode(uint32_t _can0Baudrate);
+    CANNode(uint32_t _can0Baudrate, uint32_t _can1Baudrate);
     virtual int init();
-    virtual bool startSession(IPAddress _ip, uint16_t _port);
-    virtual bool startSession(String _ip, uint16_t _port);
+    virtual bool startSession(IPAddress _ip, uint16_t _port, Transport _transport = UDPTransport);
+    virtual bool startSession(String _ip, uint16_t _port, Transport _transport = UDPTransport);
     virtual int parsePacket();
     virtual int read(uint8_t *buffer, size_t size);
     virtual int read(struct WCANBlock *buffer);
-    virtual int beginPacket();
+    virtual int beginPacket(TrafficClass trafficClass = CANTraffic);
     virtual int beginPacket(struct WCANBlock &canBlock);
     virtual int write(const uint8_t *buffer, size_t size);
     virtual int write(struct WCANBlock *canFrame);
     virtual int endPacket(bool incrementSequenceNumber = true);
+    virtual void flush();
+    // After a datagram has been read, false if it doesn't carry a valid trailer
+    bool authenticate(uint32_t index);
+    virtual bool checkSession(uint32_t timeout);
     virtual void stopSession();
+    // False, leaving the class as it was, for a value that isn't a DSCP
+    bool setDSCP(TrafficClass trafficClass, uint8_t value);
+    uint8_t getDSCP(TrafficClass trafficClass) { return dscp[trafficClass]; }
+    uint8_t sessionSocket() { return (transport == RawTransport) ? RAW_SOCKET : canSock.socket(); }
+    uint32_t busAge(uint8_t channel, const struct CAN_message_t &canFrame);
+    void onTransmit(_MB_ptr handler);
+    void onReceive(uint8_t channel, _MB_ptr handler);
+
+    /**
+     * Writes a frame to the first free mailbox of MB8 to MB14, or backlogs it
+     * behind the frames already waiting. FlexCAN's own write() would take
+     * MB15 as well and its transmit queue refills any mailbox that frees up,
+     * so nothing but the fast lane writes to MB15 as long as every other
+     * frame goes through here.
+     *
+     * @param queue false to give up rather than backlog the frame
+     * @return false if the frame was dropped
+     */
+    bool send(uint8_t channel, const struct CAN_message_t &canFrame, bool queue = true);
+    // Moves backlogged frames into the mailboxes that have freed up, once a pass
+    void pollTransmit();
+    uint8_t transmitBacklog(uint8_t channel) { return txBacklog[channel].count; }
     String dumpCANBlock(struct WCANBlock &canBlock);
     void foreverFlashInError();
 
 private:
     void setupLogging();
     void setupCANChannels();
+    bool writeMailbox(uint8_t channel, const struct CAN_message_t &canFrame);
     void ignitionOn();
     void ignitionOff();
     uint32_t getBaudRate(uint8_t channel);
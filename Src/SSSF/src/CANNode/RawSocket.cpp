@@ -0,0 +1,351 @@
+#include <Arduino.h>
+#include <CANNode/RawSocket.h>
+#include <Metrics/Metrics.h>
+#include <ArduinoLog.h>
+
+#define RAW_FRAMES_PER_POLL 4  // Frames that aren't ours to skip per parsePacket
+
+bool RawSocket::reserve(const uint8_t *_mac)
+{
+    memcpy(mac, _mac, sizeof(mac));
+    if (status() != SnSR::CLOSED)
+    {
+        Log.errorln("WIZnet socket %d is in use, raw Ethernet sessions are not available.", RAW_SOCKET);
+        return false;
+    }
+    reserved = open(SnMR::IPRAW, SnSR::IPRAW);
+    return reserved;
+}
+
+bool RawSocket::begin(IPAddress ip, uint16_t port)
+{
+    if (!reserved || !open(SnMR::MACRAW, SnSR::MACRAW)) return false;
+    group[0] = 0x03;  // Multicast, locally administered
+    group[1] = ip[1];
+    group[2] = ip[2];
+    group[3] = ip[3];
+    group[4] = port >> 8;
+    group[5] = port & 0xFF;
+    clear();
+    discard();
+    return true;
+}
+
+void RawSocket::stop()
+{// Back to parked, so the chip stops queuing every frame on the segment for us
+    clear();
+    if (reserved && (status() != SnSR::IPRAW)) open(SnMR::IPRAW, SnSR::IPRAW);
+}
+
+void RawSocket::clear()
+{
+    outboundUsed = 0;
+    outboundRecords = 0;
+    overflow = false;
+    inboundUsed = 0;
+    nextRecord = 0;
+    remaining = 0;
+}
+
+uint8_t RawSocket::status()
+{
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    uint8_t sr = W5100.readSnSR(RAW_SOCKET);
+    SPI.endTransaction();
+    return sr;
+}
+
+int RawSocket::parsePacket()
+{
+    remaining = 0;  // Like UDP, whatever wasn't read of the last datagram is dropped
+    for (int i = 0; i < RAW_FRAMES_PER_POLL; i++)
+    {
+        if (nextInbound()) return remaining;
+        if (!receiveFrame()) return 0;
+    }
+    return nextInbound() ? remaining : 0;
+}
+
+int RawSocket::read(uint8_t *buffer, size_t size)
+{
+    if (remaining == 0) return -1;
+    uint16_t length = min(size, (size_t) remaining);
+    memcpy(buffer, inbound + position, length);
+    position += length;
+    remaining -= length;
+    return length;
+}
+
+int RawSocket::beginPacket()
+{
+    // Without room for the record header write() can't carry it over, so the batch goes now
+    if ((outboundRecords > 0) && (outboundUsed + RAW_RECORD_HEADER > RAW_MAX_FRAME)) flush();
+    if (outboundUsed == 0) startFrame();
+    recordStart = outboundUsed;
+    outboundUsed += RAW_RECORD_HEADER;
+    overflow = (outboundUsed > RAW_MAX_FRAME);
+    return 1;
+}
+
+size_t RawSocket::write(const uint8_t *buffer, size_t size)
+{
+    if (overflow) return 0;
+    if (outboundUsed + size > RAW_MAX_FRAME)
+    {
+        if (outboundRecords == 0)
+        {// Doesn't fit in a frame on its own
+            overflow = true;
+            return 0;
+        }
+        // Send what was batched before this datagram and carry it over to a new frame.
+        uint16_t partial = outboundUsed - recordStart;
+        uint8_t records = outboundRecords;
+        if (send(recordStart))
+        {
+            Metrics.datagramsTx += records;
+        }
+        else
+        {
+            Metrics.drops[UDPSendFailed] += records;
+            Metrics.endPacketFailures++;
+        }
+        outboundRecords = 0;
+        startFrame();
+        memmove(outbound + RAW_HEADER_SIZE, outbound + recordStart, partial);
+        recordStart = RAW_HEADER_SIZE;
+        outboundUsed = RAW_HEADER_SIZE + partial;
+        if (outboundUsed + size > RAW_MAX_FRAME)
+        {
+            overflow = true;
+            return 0;
+        }
+    }
+    memcpy(outbound + outboundUsed, buffer, size);
+    outboundUsed += size;
+    return size;
+}
+
+int RawSocket::endPacket()
+{
+    if (overflow)
+    {
+        Log.errorln("Datagram is too large for a raw Ethernet frame.");
+        outboundUsed = recordStart;
+        overflow = false;
+        Metrics.drops[UDPSendFailed]++;
+        return 0;
+    }
+    uint16_t length = outboundUsed - recordStart - RAW_RECORD_HEADER;
+    outbound[recordStart] = length & 0xFF;
+    outbound[recordStart + 1] = length >> 8;
+    outboundRecords++;
+    if (outboundRecords == UINT8_MAX) flush();
+    return 1;
+}
+
+int RawSocket::flush()
+{
+    if (outboundRecords == 0) return 0;
+    uint8_t records = outboundRecords;
+    bool sent = send(outboundUsed);
+    outboundUsed = 0;
+    outboundRecords = 0;
+    if (!sent)
+    {
+        Metrics.drops[UDPSendFailed] += records;
+        Metrics.endPacketFailures++;
+        return -1;
+    }
+    Metrics.datagramsTx += records;
+    return records;
+}
+
+bool RawSocket::open(uint8_t mode, uint8_t status)
+{
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    W5100.execCmdSn(RAW_SOCKET, Sock_CLOSE);
+    W5100.writeSnIR(RAW_SOCKET, 0xFF);
+    // Multicast filtering off in MACRAW, the session's frames go to a multicast MAC.
+    W5100.writeSnMR(RAW_SOCKET, mode);
+    W5100.writeSnPROTO(RAW_SOCKET, RAW_PARKED_PROTOCOL);
+    W5100.execCmdSn(RAW_SOCKET, Sock_OPEN);
+    uint8_t sr = W5100.readSnSR(RAW_SOCKET);
+    SPI.endTransaction();
+    if (sr != status)
+    {
+        Log.errorln("Failed to open WIZnet socket %d in %s mode.", RAW_SOCKET, (mode == SnMR::MACRAW) ? "MACRAW" : "IP raw");
+        return false;
+    }
+    return true;
+}
+
+// The chip updates the size registers while they are read, so like socket.cpp
+// these read until two reads agree. Both are called inside a transaction.
+uint16_t RawSocket::received()
+{
+    uint16_t previous;
+    uint16_t available = W5100.readSnRX_RSR(RAW_SOCKET);
+    do
+    {
+        previous = available;
+        available = W5100.readSnRX_RSR(RAW_SOCKET);
+    } while (available != previous);
+    return available;
+}
+
+uint16_t RawSocket::sendSpace()
+{
+    uint16_t previous;
+    uint16_t space = W5100.readSnTX_FSR(RAW_SOCKET);
+    do
+    {
+        previous = space;
+        space = W5100.readSnTX_FSR(RAW_SOCKET);
+    } while (space != previous);
+    return space;
+}
+
+bool RawSocket::receiveFrame()
+{// Reads the next frame off the chip, returns false if there was none
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    uint16_t available = received();
+    if (available == 0)
+    {
+        SPI.endTransaction();
+        return false;
+    }
+    // Each frame is preceded by its length, big endian and counting itself.
+    uint16_t ptr = W5100.readSnRX_RD(RAW_SOCKET);
+    uint8_t info[2];
+    readBuffer(ptr, info, sizeof(info));
+    uint16_t total = (info[0] << 8) | info[1];
+    if ((total < sizeof(info)) || (total > available))
+    {// Lost track of the frames, start again from what arrives next
+        W5100.writeSnRX_RD(RAW_SOCKET, ptr + available);
+        W5100.execCmdSn(RAW_SOCKET, Sock_RECV);
+        SPI.endTransaction();
+        inboundUsed = 0;
+        return true;
+    }
+    uint16_t length = total - sizeof(info);
+    uint16_t copied = min(length, (uint16_t) RAW_MAX_FRAME);
+    readBuffer(ptr + sizeof(info), inbound, copied);
+    W5100.writeSnRX_RD(RAW_SOCKET, ptr + sizeof(info) + length);
+    W5100.execCmdSn(RAW_SOCKET, Sock_RECV);
+    SPI.endTransaction();
+
+    inboundUsed = 0;
+    nextRecord = RAW_HEADER_SIZE;
+    if ((length < RAW_HEADER_SIZE) || (length > RAW_MAX_FRAME)) return true;
+    if (memcmp(inbound, group, sizeof(group)) != 0) return true;
+    if (memcmp(inbound + 6, mac, sizeof(mac)) == 0) return true;  // Our own
+    if ((inbound[12] != (RAW_ETHERTYPE >> 8)) || (inbound[13] != (RAW_ETHERTYPE & 0xFF))) return true;
+    inboundUsed = length;
+    return true;
+}
+
+bool RawSocket::nextInbound()
+{// Moves to the next datagram of the current frame
+    if (nextRecord + RAW_RECORD_HEADER > inboundUsed) return false;
+    uint16_t length = inbound[nextRecord] | (inbound[nextRecord + 1] << 8);
+    if ((length == 0) || (nextRecord + RAW_RECORD_HEADER + length > inboundUsed))
+    {// Padding, or a truncated frame
+        nextRecord = inboundUsed;
+        return false;
+    }
+    position = nextRecord + RAW_RECORD_HEADER;
+    remaining = length;
+    nextRecord = position + length;
+    return true;
+}
+
+void RawSocket::startFrame()
+{
+    memcpy(outbound, group, sizeof(group));
+    memcpy(outbound + 6, mac, sizeof(mac));
+    outbound[12] = RAW_ETHERTYPE >> 8;
+    outbound[13] = RAW_ETHERTYPE & 0xFF;
+    outboundUsed = RAW_HEADER_SIZE;
+}
+
+bool RawSocket::send(uint16_t length)
+{
+    if (length < RAW_MIN_FRAME)
+    {// Zeros read as the end of the datagrams
+        memset(outbound + length, 0, RAW_MIN_FRAME - length);
+        length = RAW_MIN_FRAME;
+    }
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    if (sendSpace() < length)
+    {
+        SPI.endTransaction();
+        return false;
+    }
+    uint16_t ptr = W5100.readSnTX_WR(RAW_SOCKET);
+    writeBuffer(ptr, outbound, length);
+    W5100.writeSnTX_WR(RAW_SOCKET, ptr + length);
+    W5100.execCmdSn(RAW_SOCKET, Sock_SEND);
+    // Same wait as the Ethernet library's UDP send, there is no ARP to time out
+    // but a closed socket never reports SEND_OK either.
+    bool sent = true;
+    while ((W5100.readSnIR(RAW_SOCKET) & SnIR::SEND_OK) != SnIR::SEND_OK)
+    {
+        if ((W5100.readSnIR(RAW_SOCKET) & SnIR::TIMEOUT) || (W5100.readSnSR(RAW_SOCKET) != SnSR::MACRAW))
+        {
+            sent = false;
+            break;
+        }
+        SPI.endTransaction();
+        yield();
+        SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    }
+    W5100.writeSnIR(RAW_SOCKET, SnIR::SEND_OK | SnIR::TIMEOUT);
+    SPI.endTransaction();
+    return sent;
+}
+
+void RawSocket::discard()
+{// Throws away anything received outside of the session
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    uint16_t available = received();
+    if (available > 0)
+    {
+        W5100.writeSnRX_RD(RAW_SOCKET, W5100.readSnRX_RD(RAW_SOCKET) + available);
+        W5100.execCmdSn(RAW_SOCKET, Sock_RECV);
+    }
+    SPI.endTransaction();
+}
+
+// The socket buffers are rings, these follow read_data and write_data in the
+// Ethernet library's socket.cpp which it doesn't export.
+void RawSocket::readBuffer(uint16_t from, uint8_t *buffer, uint16_t length)
+{
+    uint16_t offset = from & W5100.SMASK;
+    uint16_t address = W5100.RBASE(RAW_SOCKET) + offset;
+    if (W5100.hasOffsetAddressMapping() || (offset + length <= W5100.SSIZE))
+    {
+        W5100.read(address, buffer, length);
+    }
+    else
+    {
+        uint16_t size = W5100.SSIZE - offset;
+        W5100.read(address, buffer, size);
+        W5100.read(W5100.RBASE(RAW_SOCKET), buffer + size, length - size);
+    }
+}
+
+void RawSocket::writeBuffer(uint16_t to, const uint8_t *buffer, uint16_t length)
+{
+    uint16_t offset = to & W5100.SMASK;
+    uint16_t address = W5100.SBASE(RAW_SOCKET) + offset;
+    if (W5100.hasOffsetAddressMapping() || (offset + length <= W5100.SSIZE))
+    {
+        W5100.write(address, buffer, length);
+    }
+    else
+    {
+        uint16_t size = W5100.SSIZE - offset;
+        W5100.write(address, buffer, size);
+        W5100.write(W5100.SBASE(RAW_SOCKET), buffer + size, length - size);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef RawSocket_h_
+#define RawSocket_h_
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <SPI.h>
+#include <utility/w5100.h>
+
+#define RAW_ETHERTYPE 0x88B5  // IEEE 802 local experimental EtherType 1
+#define RAW_SOCKET 0  // The WIZnet chips only do MACRAW on socket 0
+#define RAW_HEADER_SIZE 14
+#define RAW_MAX_FRAME 1514
+#define RAW_RECORD_HEADER 2
+#define RAW_MIN_FRAME 60
+#define RAW_PARKED_PROTOCOL 255  // IANA reserved IP protocol, nothing sends it
+
+/*
+Session transport straight on Ethernet frames, using the WIZnet chip's MACRAW
+socket, for sessions that stay on one switched segment. There is no IP or UDP
+header to build and no per datagram socket command, and the datagrams written
+during a pass of the forwarding loop are batched into one frame:
+
+    destination MAC, source MAC, RAW_ETHERTYPE
+    length (uint16_t, little endian), datagram bytes
+    ...
+    length 0 or the end of the frame
+
+Datagrams are the same bytes that would have been sent over UDP. The
+destination is a locally administered multicast MAC made from the session's
+group address and port, so every node of the session sees the frame and
+sessions on the same segment stay apart. Switches flood it like any unknown
+multicast.
+
+Socket 0 is claimed with reserve() before the Ethernet library hands it out
+to the control socket or the HTTP server. Outside of a raw session it is
+parked as an IP raw socket for RAW_PARKED_PROTOCOL, which keeps it out of the
+library's hands without receiving anything. It is only switched to MACRAW,
+where it gets every frame no other socket takes, while a raw session runs.
+*/
+class RawSocket
+{
+private:
+    uint8_t mac[6];
+    uint8_t group[6];
+    bool reserved = false;
+
+    uint8_t outbound[RAW_MAX_FRAME];
+    uint16_t outboundUsed = 0;
+    uint16_t recordStart = 0;  // Offset of the record being written
+    uint8_t outboundRecords = 0;
+    bool overflow = false;
+
+    uint8_t inbound[RAW_MAX_FRAME];
+    uint16_t inboundUsed = 0;
+    uint16_t nextRecord = 0;  // Offset of the record after the current one
+    uint16_t position = 0;  // Read position in the current record
+    uint16_t remaining = 0;  // Unread bytes of the current record
+
+public:
+    bool reserve(const uint8_t *_mac);
+    bool begin(IPAddress ip, uint16_t port);
+    void stop();
+    uint8_t status();
+    int parsePacket();
+    int read(uint8_t *buffer, size_t size);
+    int beginPacket();
+    size_t write(const uint8_t *buffer, size_t size);
+    int endPacket();
+
+    /**
+     * Sends the datagrams batched so far as one frame.
+     *
+     * @return number of datagrams sent, -1 if the frame could not be sent
+     */
+    int flush();
+    uint8_t pending() { return outboundRecords; }
+
+private:
+    bool open(uint8_t mode, uint8_t status);
+    void clear();
+    static uint16_t received();
+    static uint16_t sendSpace();
+    bool receiveFrame();
+    bool nextInbound();
+    void startFrame();
+    bool send(uint16_t length);
+    void discard();
+    void readBuffer(uint16_t from, uint8_t *buffer, uint16_t length);
+    void writeBuffer(uint16_t to, const uint8_t *buffer, uint16_t length);
+};
+
+#endif /* RawSocket_h_ */
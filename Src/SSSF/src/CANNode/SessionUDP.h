@@ -0,0 +1,36 @@
+#ifndef SessionUDP_h_
+#define SessionUDP_h_
+
+#include <Arduino.h>
+#include <EthernetUdp.h>
+#include <SPI.h>
+#include <utility/w5100.h>
+
+/*
+EthernetUDP does not expose which WIZnet socket it is using. The session needs
+it to look at and set the socket's registers directly.
+*/
+class SessionUDP : public EthernetUDP
+{
+public:
+    uint8_t socket() { return sockindex; }
+
+    void setTOS(uint8_t tos)
+    {// Applies to every datagram sent after it
+        if (sockindex >= MAX_SOCK_NUM) return;
+        SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+        W5100.writeSnTOS(sockindex, tos);
+        SPI.endTransaction();
+    }
+
+    uint8_t status()
+    {
+        if (sockindex >= MAX_SOCK_NUM) return SnSR::CLOSED;
+        SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+        uint8_t sr = W5100.readSnSR(sockindex);
+        SPI.endTransaction();
+        return sr;
+    }
+};
+
+#endif /* SessionUDP_h_ */
@@ -0,0 +1,105 @@
+#ifndef capture_format_h_
+#define capture_format_h_
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC 0x50414353  // "SCAP" at the start of every block
+#define CAPTURE_RECORDS_PER_BLOCK 170  // 4080 bytes of records before compression
+#define CAPTURE_COMPRESSED 0x0001  // Block flag, otherwise the payload is stored as it is
+#define CAPTURE_SHUFFLED 0x0002  // Block flag, the records went through captureShuffle
+
+/*
+On card layout of a CAN capture, shared with the host tool in Src/Tools.
+
+A capture file is a run of blocks, each a BlockHeader followed by storedSize
+bytes: CAPTURE_RECORDS_PER_BLOCK or fewer Records, shuffled and then, when
+flagged compressed, as an LZ4 block. Shuffling turns the timestamps into
+deltas and puts byte n of every record together, so the IDs, the deltas and
+each data byte are runs LZ4 can match on rather than being broken up every
+24 bytes by a timestamp. It about doubles what LZ4 gets out of J1939.
+
+Every header says where the next block starts and which time span its block
+covers, so a reader can skip to a time without decompressing what comes
+before, and can find the next magic to carry on past a block a power cut
+left half written. Sessions append to the same file.
+
+Little endian, as both the Teensy and the hosts are.
+*/
+struct CaptureRecord
+{
+    uint64_t timestamp;  // us since the epoch, from the session clock
+    uint32_t id;
+    uint8_t channel;
+    uint8_t length;
+    uint8_t flags;  // CaptureRecordFlags
+    uint8_t reserved;
+    uint8_t data[8];
+};
+
+enum CaptureRecordFlags
+{
+    CaptureExtended = 0x01,
+    CaptureRemote = 0x02,
+    CaptureTransmitted = 0x04  // Written to the bus by the SSSF, otherwise read from it
+};
+
+struct CaptureBlockHeader
+{
+    uint32_t magic;
+    uint32_t sequence;  // Counts blocks from the start of the session
+    uint64_t firstTimestamp;
+    uint64_t lastTimestamp;
+    uint16_t records;
+    uint16_t flags;
+    uint16_t rawSize;  // Bytes of records
+    uint16_t storedSize;  // Bytes following the header
+    uint32_t checksum;  // FNV-1a of the stored bytes
+    uint32_t reserved;
+};
+
+static_assert(sizeof(CaptureRecord) == 24, "Capture records changed size");
+static_assert(sizeof(CaptureBlockHeader) == 40, "Capture block headers changed size");
+
+inline uint32_t captureChecksum(const uint8_t *data, uint32_t size)
+{
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+    return hash;
+}
+
+inline void captureShuffle(struct CaptureRecord *records, int count, uint8_t *out)
+{// Changes records, they're left with their timestamps as deltas
+    for (int i = count - 1; i > 0; i--)
+    {
+        records[i].timestamp -= records[i - 1].timestamp;
+    }
+    const uint8_t *in = reinterpret_cast<const uint8_t*>(records);
+    for (int i = 0; i < count; i++)
+    {
+        for (unsigned b = 0; b < sizeof(CaptureRecord); b++)
+        {
+            out[b * count + i] = in[i * sizeof(CaptureRecord) + b];
+        }
+    }
+}
+
+inline void captureUnshuffle(const uint8_t *in, int count, struct CaptureRecord *records)
+{
+    uint8_t *out = reinterpret_cast<uint8_t*>(records);
+    for (int i = 0; i < count; i++)
+    {
+        for (unsigned b = 0; b < sizeof(CaptureRecord); b++)
+        {
+            out[i * sizeof(CaptureRecord) + b] = in[b * count + i];
+        }
+    }
+    for (int i = 1; i < count; i++)
+    {
+        records[i].timestamp += records[i - 1].timestamp;
+    }
+}
+
+#endif /* capture_format_h_ */
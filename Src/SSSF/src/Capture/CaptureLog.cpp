@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include <ArduinoLog.h>
+#include <Capture/CaptureLog.h>
+#include <Metrics/Metrics.h>
+
+bool CaptureLog::start(const char* filename)
+{
+    if (recording) stop();
+    buffers = new RecordBuffer[2];
+    shuffled = new uint8_t[sizeof(CaptureRecord) * CAPTURE_RECORDS_PER_BLOCK];
+    block = new StoredBlock;
+    codec = new Lz4Block;
+    if ((buffers == nullptr) || (shuffled == nullptr) || (block == nullptr) || (codec == nullptr))
+    {
+        Log.errorln("Not enough memory for the capture.");
+        release();
+        return false;
+    }
+    file = SD.open(filename, FILE_WRITE);
+    if (!file)
+    {
+        Log.errorln("Failed to open %s for the capture.", filename);
+        release();
+        return false;
+    }
+    for (int b = 0; b < 2; b++)
+    {
+        buffers[b].count = 0;
+        buffers[b].sealed = false;
+    }
+    filling = 0;
+    packing = 0;
+    blockSize = 0;
+    blockWritten = 0;
+    sequence = 0;
+    lastFlush = millis();
+    recording = true;
+    return true;
+}
+
+void CaptureLog::stop()
+{// Writes out what has been recorded, blocking until the card has it
+    if (!recording) return;
+    if (buffers[filling].count > 0) seal();
+    while (recording && (buffers[0].sealed || buffers[1].sealed || (blockWritten < blockSize)))
+    {
+        poll();
+    }
+    if (recording) file.close();
+    recording = false;
+    release();
+}
+
+void CaptureLog::release()
+{
+    delete[] buffers;
+    delete[] shuffled;
+    delete block;
+    delete codec;
+    buffers = nullptr;
+    shuffled = nullptr;
+    block = nullptr;
+    codec = nullptr;
+}
+
+FASTRUN void CaptureLog::record(uint8_t channel, const CAN_message_t &canFrame, uint64_t timestamp, bool transmitted)
+{
+    if (!recording) return;
+    struct RecordBuffer &buffer = buffers[filling];
+    if (buffer.sealed)
+    {// Both are waiting on the card
+        Metrics.captureDrops++;
+        return;
+    }
+    if (buffer.count == 0) buffer.opened = millis();
+    struct CaptureRecord &r = buffer.records[buffer.count++];
+    r.timestamp = timestamp;
+    r.id = canFrame.id;
+    r.channel = channel;
+    r.length = canFrame.len;
+    r.flags = (canFrame.flags.extended ? CaptureExtended : 0) | (canFrame.flags.remote ? CaptureRemote : 0) |
+        (transmitted ? CaptureTransmitted : 0);
+    r.reserved = 0;
+    memcpy(r.data, canFrame.buf, sizeof(r.data));
+    Metrics.captureFrames++;
+    if (buffer.count == CAPTURE_RECORDS_PER_BLOCK) seal();
+}
+
+void CaptureLog::poll()
+{// At most one block compressed and one chunk written per call
+    if (!recording) return;
+    struct RecordBuffer &open = buffers[filling];
+    if ((open.count > 0) && !open.sealed && (millis() - open.opened >= CAPTURE_SEAL_INTERVAL)) seal();
+    if ((blockWritten == blockSize) && buffers[packing].sealed)
+    {
+        pack(buffers[packing]);
+        packing ^= 1;
+    }
+    if ((blockWritten < blockSize) && !SD.sdfs.card()->isBusy())
+    {// A busy card would have the write wait in the loop for it
+        if (!writeChunk()) return;
+        if ((blockWritten == blockSize) && (millis() - lastFlush >= CAPTURE_FLUSH_INTERVAL)) flush();
+    }
+}
+
+void CaptureLog::seal()
+{
+    buffers[filling].sealed = true;
+    filling ^= 1;
+}
+
+void CaptureLog::pack(struct RecordBuffer &buffer)
+{// Into the stored block, leaving the buffer free to fill again
+    block->header.firstTimestamp = buffer.records[0].timestamp;
+    block->header.lastTimestamp = buffer.records[buffer.count - 1].timestamp;
+    size_t rawSize = buffer.count * sizeof(CaptureRecord);
+    captureShuffle(buffer.records, buffer.count, shuffled);
+    size_t size = codec->compress(shuffled, rawSize, block->payload, sizeof(block->payload));
+    block->header.flags = CAPTURE_SHUFFLED | CAPTURE_COMPRESSED;
+    if ((size == 0) || (size >= rawSize))
+    {// Stored as is, it's no bigger and is quicker to read
+        memcpy(block->payload, shuffled, rawSize);
+        size = rawSize;
+        block->header.flags = CAPTURE_SHUFFLED;
+    }
+    block->header.magic = CAPTURE_MAGIC;
+    block->header.sequence = sequence++;
+    block->header.records = buffer.count;
+    block->header.rawSize = rawSize;
+    block->header.storedSize = size;
+    block->header.checksum = captureChecksum(block->payload, size);
+    block->header.reserved = 0;
+    blockSize = sizeof(block->header) + size;
+    blockWritten = 0;
+    Metrics.captureRawBytes += rawSize;
+    Metrics.captureStoredBytes += blockSize;
+    buffer.count = 0;
+    buffer.sealed = false;
+}
+
+bool CaptureLog::writeChunk()
+{
+    size_t size = min(blockSize - blockWritten, size_t(CAPTURE_WRITE_CHUNK));
+    const uint8_t *data = reinterpret_cast<const uint8_t*>(block) + blockWritten;
+    uint32_t started = micros();
+    size_t written = file.write(data, size);
+    timed(started);
+    if (written != size)
+    {// Most likely the card is full, nothing after this would be kept either
+        Log.errorln("Capture stopped, writing to the SD card failed.");
+        file.close();
+        recording = false;
+        release();
+        return false;
+    }
+    blockWritten += size;
+    return true;
+}
+
+void CaptureLog::flush()
+{// So a power cut loses seconds of capture, not the file
+    lastFlush = millis();
+    uint32_t started = micros();
+    file.flush();
+    timed(started);
+}
+
+void CaptureLog::timed(uint32_t started)
+{
+    uint32_t elapsed = micros() - started;
+    Metrics.captureWriteUS += elapsed;
+    Metrics.captureWriteLastUS = elapsed;
+    if (elapsed > Metrics.captureWriteMaxUS) Metrics.captureWriteMaxUS = elapsed;
+    if (elapsed > CAPTURE_STALL_US) Metrics.captureStalls++;
+}
@@ -0,0 +1,93 @@
+#ifndef capture_log_h_
+#define capture_log_h_
+
+#include <Arduino.h>
+#include <SD.h>
+#include <FlexCAN_T4.h>
+#include <Capture/CaptureFormat.h>
+#include <Capture/Lz4Block.h>
+
+#define CAPTURE_WRITE_CHUNK 512  // Bytes written to the card per pass of the loop, one sector
+#define CAPTURE_SEAL_INTERVAL 1000  // ms a block is left open on a quiet bus
+#define CAPTURE_FLUSH_INTERVAL 5000  // ms between updates of the file's size on the card
+#define CAPTURE_STALL_US 500  // A card write or flush that holds the loop longer than this is counted as a stall
+
+/*
+Records every CAN frame read from or written to the buses to a file on the
+SD card, in blocks of CAPTURE_RECORDS_PER_BLOCK compressed with LZ4 (see
+CaptureFormat.h for the layout).
+
+Frames go into one of two record buffers while the other waits for the card.
+poll() does the rest a piece at a time from the loop: it shuffles and
+compresses a full buffer into the stored block, which frees that buffer
+straight away, then writes the stored block a sector per pass. A block takes
+a fraction of a millisecond to compress, card writes are what stall. File
+writes are synchronous, so a pass skips writing while the card is still busy
+programming the last sector rather than waiting on it, which leaves one
+sector's transfer, tens of us over SDIO, in the loop. Flushes also rewrite
+the directory entry and are left to every CAPTURE_FLUSH_INTERVAL. Every
+write and flush is timed into the capture metrics, those over
+CAPTURE_STALL_US counted as stalls. Frames are only dropped, and counted,
+while both buffers are full and the card hasn't caught up.
+
+The buffers and the compressor's table, about 24 KB, are only allocated
+between start() and stop(), most sessions never capture.
+
+Two saturated 500 kbit/s buses are about 8000 frames a second, 190 KB/s of
+records. J1939 traffic repeats its IDs and most of its data from one frame
+to the next, so blocks of it compress several-fold (3.7 to 1 for the
+synthetic mix of 20 PGNs in test_lz4_block) and the card both keeps up and
+takes as many times longer to fill.
+*/
+class CaptureLog
+{
+private:
+    struct RecordBuffer
+    {
+        struct CaptureRecord records[CAPTURE_RECORDS_PER_BLOCK];
+        uint16_t count = 0;
+        bool sealed = false;  // Waiting to be compressed
+        uint32_t opened = 0;  // millis() of the first record
+    };
+
+    struct StoredBlock
+    {
+        struct CaptureBlockHeader header;
+        uint8_t payload[Lz4Block::bound(sizeof(CaptureRecord) * CAPTURE_RECORDS_PER_BLOCK)];
+    };
+
+    struct RecordBuffer *buffers = nullptr;  // Two of them
+    uint8_t filling = 0;
+    uint8_t packing = 0;  // Buffers are sealed, and so compressed, in turn
+    uint8_t *shuffled = nullptr;  // sizeof(CaptureRecord) * CAPTURE_RECORDS_PER_BLOCK
+    struct StoredBlock *block = nullptr;
+    size_t blockSize = 0;  // Header and payload
+    size_t blockWritten = 0;
+    Lz4Block *codec = nullptr;
+    File file;
+    bool recording = false;
+    uint32_t sequence = 0;
+    uint32_t lastFlush = 0;
+
+public:
+    /**
+     * Appends to filename, creating it if need be. The SD card must already
+     * be initialized.
+     */
+    bool start(const char* filename);
+    void stop();
+    bool enabled() { return recording; }
+
+    void record(uint8_t channel, const CAN_message_t &canFrame, uint64_t timestamp, bool transmitted);
+    void poll();
+
+private:
+    void seal();
+    void pack(struct RecordBuffer &buffer);
+    bool writeChunk();
+    void flush();
+    void timed(uint32_t started);
+    void release();
+};
+
+#endif /* capture_log_h_ */
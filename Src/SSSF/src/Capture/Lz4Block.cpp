@@ -0,0 +1,133 @@
+#include <Capture/Lz4Block.h>
+#include <string.h>
+
+namespace
+{
+    const size_t minMatch = 4;
+    const size_t lastLiterals = 5;  // The format ends every block with at least this many
+    const size_t matchLimit = 12;  // No match starts closer than this to the end
+    const size_t maxOffset = 65535;
+}
+
+size_t Lz4Block::compress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity)
+{
+    if (size > maxOffset) return 0;
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in;
+    const uint8_t *end = in + size;
+    uint8_t *op = out;
+    uint8_t *outEnd = out + capacity;
+    memset(table, 0, sizeof(table));
+
+    if (size > matchLimit)
+    {
+        const uint8_t *limit = end - matchLimit;
+        ip++;
+        while (ip < limit)
+        {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash(sequence);
+            const uint8_t *ref = in + table[h];
+            table[h] = ip - in;
+            if ((ref >= ip) || (read32(ref) != sequence))
+            {
+                ip++;
+                continue;
+            }
+            size_t matched = minMatch;
+            while ((ip + matched < end - lastLiterals) && (ref[matched] == ip[matched])) matched++;
+
+            size_t literals = ip - anchor;
+            // Token, lengths, literals and the offset
+            if (op + 1 + literals / 255 + 1 + literals + 2 + (matched - minMatch) / 255 + 1 > outEnd) return 0;
+            uint8_t *token = op++;
+            *token = (literals >= 15) ? 0xF0 : (literals << 4);
+            if (literals >= 15) op = length(op, literals - 15);
+            memcpy(op, anchor, literals);
+            op += literals;
+            uint16_t offset = ip - ref;
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+            size_t extra = matched - minMatch;
+            *token |= (extra >= 15) ? 0x0F : extra;
+            if (extra >= 15) op = length(op, extra - 15);
+
+            ip += matched;
+            anchor = ip;
+            if (ip < limit) table[hash(read32(ip - 2))] = ip - 2 - in;
+        }
+    }
+
+    size_t literals = end - anchor;
+    if (op + 1 + literals / 255 + 1 + literals > outEnd) return 0;
+    uint8_t *token = op++;
+    *token = (literals >= 15) ? 0xF0 : (literals << 4);
+    if (literals >= 15) op = length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    return op - out;
+}
+
+int Lz4Block::decompress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity)
+{
+    const uint8_t *ip = in;
+    const uint8_t *end = in + size;
+    uint8_t *op = out;
+    uint8_t *outEnd = out + capacity;
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= end) return -1;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if ((size_t(end - ip) < literals) || (size_t(outEnd - op) < literals)) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end) break;  // The last sequence has no match
+
+        if (end - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > size_t(op - out))) return -1;
+        size_t matched = token & 0x0F;
+        if (matched == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= end) return -1;
+                b = *ip++;
+                matched += b;
+            } while (b == 255);
+        }
+        matched += minMatch;
+        if (size_t(outEnd - op) < matched) return -1;
+        const uint8_t *ref = op - offset;
+        for (size_t i = 0; i < matched; i++)
+        {// Byte by byte, the match can overlap what it writes
+            op[i] = ref[i];
+        }
+        op += matched;
+    }
+    return op - out;
+}
+
+uint8_t* Lz4Block::length(uint8_t *op, size_t extra)
+{// Lengths of 15 and more go on in bytes of 255 and a remainder
+    while (extra >= 255)
+    {
+        *op++ = 255;
+        extra -= 255;
+    }
+    *op++ = extra;
+    return op;
+}
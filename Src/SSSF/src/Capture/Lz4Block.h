@@ -0,0 +1,47 @@
+#ifndef lz4_block_h_
+#define lz4_block_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ4_HASH_BITS 12  // 8 KB of table, enough for blocks of a few KB
+
+/*
+Compressor and decompressor for the LZ4 block format (no frame format, no
+dictionary), so anything else that reads LZ4 blocks can read what it writes.
+The compressor is the plain greedy one: a hash of the next four bytes finds
+the last place they were seen and a match is taken as far as it goes. That
+is a fraction of what a tuned LZ4 gets on text but captures of J1939 traffic
+repeat whole records and compress well with it.
+
+Plain C++ with no Arduino headers, the host capture tool builds it as is.
+*/
+class Lz4Block
+{
+private:
+    uint16_t table[1 << LZ4_HASH_BITS];  // Last position of each hash, blocks are under 64 KB
+
+public:
+    static constexpr size_t bound(size_t size) { return size + size / 255 + 16; }
+
+    /**
+     * @param capacity at least bound(size) for the data to always fit
+     * @return compressed size, 0 if it didn't fit in capacity or size is 64 KB or more
+     */
+    size_t compress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity);
+
+    /**
+     * @return decompressed size, -1 if the data is corrupt or doesn't fit in capacity
+     */
+    static int decompress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity);
+
+private:
+    static uint32_t read32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    }
+    static uint32_t hash(uint32_t sequence) { return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS); }
+    static uint8_t* length(uint8_t *op, size_t extra);
+};
+
+#endif /* lz4_block_h_ */
@@ -0,0 +1,75 @@
+#include <Arduino.h>
+#include <Control/ControlSocket.h>
+#include <ArduinoLog.h>
+#include <EthernetUdp.h>
+
+bool ControlSocket::begin(uint16_t port)
+{
+    listening = udp.begin(port);
+    if (listening)
+    {
+        Log.noticeln("Listening for session control on UDP port %d.", port);
+    }
+    else
+    {
+        Log.errorln("No socket left for session control, only HTTP will work.");
+    }
+    return listening;
+}
+
+bool ControlSocket::poll()
+{
+    if (!listening) return false;
+    int size = udp.parsePacket();
+    if (size <= 0) return false;
+    if ((size < (int) sizeof(ControlHeader)) ||
+        (udp.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header)) ||
+        (header.magic != CONTROL_MAGIC) ||
+        (header.version != CONTROL_VERSION))
+    {
+        udp.flush();
+        return false;
+    }
+    bool repeated = (lastReplyLength > 0) &&
+        (header.sequence == lastSequence) &&
+        (udp.remoteIP() == lastSender) &&
+        (udp.remotePort() == lastSenderPort);
+    if (repeated)
+    {// Our reply was lost, the command has already been carried out
+        if (udp.beginPacket(lastSender, lastSenderPort))
+        {
+            udp.write(lastReply, lastReplyLength);
+            udp.endPacket();
+        }
+        return false;
+    }
+    lastSender = udp.remoteIP();
+    lastSenderPort = udp.remotePort();
+    lastSequence = header.sequence;
+    lastReplyLength = 0;
+    if ((header.length > CONTROL_MAX_PAYLOAD) ||
+        ((header.length > 0) && (udp.read(payload, header.length) != header.length)))
+    {
+        udp.flush();
+        reply(ControlBadRequest);
+        return false;
+    }
+    return true;
+}
+
+void ControlSocket::reply(uint8_t status, const void* data, uint16_t length)
+{
+    length = min(length, (uint16_t) CONTROL_MAX_PAYLOAD);
+    struct ControlHeader response = header;
+    response.command |= CONTROL_ACK;
+    response.length = length;
+    response.status = status;
+    memcpy(lastReply, &response, sizeof(response));
+    if (length > 0) memcpy(lastReply + sizeof(response), data, length);
+    lastReplyLength = sizeof(response) + length;
+    if (udp.beginPacket(lastSender, lastSenderPort))
+    {
+        udp.write(lastReply, lastReplyLength);
+        udp.endPacket();
+    }
+}
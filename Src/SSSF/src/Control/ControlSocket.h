@@ -0,0 +1,123 @@
+#ifndef control_socket_h_
+#define control_socket_h_
+
+#include <Arduino.h>
+#include <EthernetUdp.h>
+#include <CANNode/SessionUDP.h>
+#include <IPAddress.h>
+
+#define CONTROL_PORT 41234
+#define CONTROL_MAGIC 0x5353  // "SS"
+#define CONTROL_VERSION 1
+#define CONTROL_ACK 0x80  // Set in the command of every reply
+#define CONTROL_MAX_PAYLOAD 64
+#define CONTROL_OPTION_J1939_TAGGING 0x01
+#define CONTROL_OPTION_RAW_TRANSPORT 0x02  // Start only, see RawSocket.h
+
+/*
+Binary session control over UDP, for controllers that need to start and stop
+many nodes quickly. Every message is a ControlHeader followed by the payload
+for its command, all little endian and laid out without padding:
+
+    Start        ControlStart        -> ack with no payload
+    Stop         none                -> ack with no payload
+    Reconfigure  ControlOptions      -> ack with no payload
+    Ping         none                -> ack with a ControlStatusReport
+
+The reply carries the sequence number of the command it answers. A controller
+that gets no reply resends the command with the same sequence number; the node
+recognizes the repeat and sends the reply again instead of running the command
+twice. Only the last command from each sender is remembered, so a controller
+must wait for the reply before sending its next command.
+
+Filter and rewrite tables aren't part of the binary protocol, a session
+started this way uses the tables from the last HTTP request.
+*/
+
+enum ControlCommand
+{
+    CommandStart = 1,
+    CommandStop = 2,
+    CommandReconfigure = 3,
+    CommandPing = 4
+};
+
+enum ControlStatus
+{
+    ControlOK = 0,
+    ControlBadRequest = 1,  // Unknown command, short payload or invalid values
+    ControlNotActive = 2,  // The command needs a running session
+    ControlFailed = 3  // The node couldn't carry out the command
+};
+
+struct ControlHeader
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t command;
+    uint32_t sequence;
+    uint16_t length;  // Bytes of payload after the header
+    uint8_t status;  // ControlStatus, replies only
+    uint8_t reserved;
+};
+
+struct ControlOptions
+{
+    uint16_t traceRate;  // 0 disables tracing
+    uint16_t watchdogTimeout;  // ms, 0 disables the session watchdog
+    uint8_t options;  // CONTROL_OPTION_* bits
+    uint8_t fecBlock;  // Datagrams per parity datagram, 0 disables FEC
+    uint16_t slotPeriod;  // us per round of uplink slots, 0 sends whenever
+};
+
+struct ControlStart
+{
+    uint32_t id;
+    uint32_t index;
+    uint8_t ip[4];  // Session multicast group
+    uint16_t port;
+    uint16_t members;  // Devices in the session
+    struct ControlOptions options;
+};
+
+struct ControlStatusReport
+{
+    uint32_t id;
+    uint32_t index;
+    uint64_t epochUS;
+    uint32_t uptimeMS;
+    uint8_t sessionActive;
+    uint8_t reserved[3];
+};
+
+class ControlSocket
+{
+public:
+    struct ControlHeader header;
+    uint8_t payload[CONTROL_MAX_PAYLOAD];
+
+private:
+    SessionUDP udp;
+    bool listening = false;
+
+    IPAddress lastSender;
+    uint16_t lastSenderPort = 0;
+    uint32_t lastSequence = 0;
+    uint8_t lastReply[sizeof(ControlHeader) + CONTROL_MAX_PAYLOAD];
+    size_t lastReplyLength = 0;
+
+public:
+    bool begin(uint16_t port = CONTROL_PORT);
+    void setTOS(uint8_t tos) { udp.setTOS(tos); }
+
+    /**
+     * Reads a waiting command into header and payload. Repeats of the last
+     * command are answered here and never returned.
+     *
+     * @return true if there is a new command to carry out
+     */
+    bool poll();
+    void reply(uint8_t status, const void* data = nullptr, uint16_t length = 0);
+};
+
+#endif /* control_socket_h_ */
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+#include <Decimation/Decimator.h>
+#include <Metrics/Metrics.h>
+#include <ArduinoLog.h>
+#include <FlexCAN_T4.h>
+
+int8_t DecimationTable::find(uint32_t key, uint8_t channel)
+{
+    for (uint8_t i = 0; i < numRules; i++)
+    {
+        if (rules[i].match.matches(key, channel, Uplink)) return i;
+    }
+    return -1;
+}
+
+void DecimationTable::begin()
+{
+    RuleSection::begin();
+    clear();
+}
+
+bool DecimationTable::end()
+{
+    if (!valid) return false;
+    Log.noticeln("\tCompiled %d CAN rate caps.", numRules);
+    return true;
+}
+
+void DecimationTable::field(const char* key, const char* text)
+{
+    if (pendingRule.bits.field(key, text)) return;
+    if (!strcmp(key, "MaxRate"))
+    {
+        double rate = strtod(text, nullptr);
+        pendingRule.intervalMS = (rate > 0) ? uint32_t(1000.0 / rate) : 0;
+    }
+    else if (!strcmp(key, "Aggregate"))
+    {
+        if (!strcmp(text, "Min")) pendingRule.aggregate = AggregateMin;
+        else if (!strcmp(text, "Max")) pendingRule.aggregate = AggregateMax;
+        else if (!strcmp(text, "Mean")) pendingRule.aggregate = AggregateMean;
+        else pendingRule.aggregate = AggregateLatest;
+    }
+}
+
+bool DecimationTable::add()
+{
+    if (numRules >= DECIMATION_MAX_RULES)
+    {
+        Log.errorln("Too many CAN rate caps, the limit is %d.", DECIMATION_MAX_RULES);
+        return false;
+    }
+    if ((pendingRule.intervalMS == 0) || !pendingRule.bits.prepare())
+    {
+        Log.errorln("CAN rate cap %d needs a MaxRate and a field that fits in a frame.", numRules);
+        return false;
+    }
+    pendingRule.match = pending;
+    rules[numRules++] = pendingRule;
+    return true;
+}
+
+void Decimator::begin(StagedTable<DecimationTable>* _table)
+{
+    table = _table;
+    reset();
+}
+
+void Decimator::reset()
+{
+    for (int i = 0; i < ID_INDEX_CAPACITY; i++)
+    {
+        slots[i].rule = DECIMATION_UNSEEN;
+    }
+    numStreams = 0;
+    nextExpired = 0;
+}
+
+FASTRUN bool Decimator::offer(uint8_t channel, int16_t slot, CAN_message_t &canFrame, uint32_t now)
+{
+    if (((*table)->size() == 0) || (slot == ID_INDEX_NONE)) return true;
+    struct Slot &s = slots[slot];
+    if (s.rule == DECIMATION_UNSEEN) classify(s, channel, canFrame);
+    if (s.rule < 0) return true;
+    const struct DecimationTable::Rule &rule = (*table)->rule(s.rule);
+    struct Stream &stream = streams[s.stream];
+
+    double value;
+    if ((rule.aggregate != AggregateLatest) && rule.bits.read(canFrame, value))
+    {
+        bool extreme = (stream.count == 0) ||
+            ((rule.aggregate == AggregateMin) && (value < stream.extreme)) ||
+            ((rule.aggregate == AggregateMax) && (value > stream.extreme));
+        if (extreme)
+        {
+            stream.extreme = value;
+            stream.held = canFrame;
+        }
+        stream.count++;
+        stream.total += value;
+    }
+    if (stream.open && (now - stream.start < rule.intervalMS))
+    {
+        if ((rule.aggregate == AggregateLatest) || (rule.aggregate == AggregateMean)) stream.held = canFrame;
+        stream.waiting = true;
+        Metrics.decimated++;
+        return false;
+    }
+    aggregate(stream, rule, canFrame);
+    restart(stream, now);
+    return true;
+}
+
+bool Decimator::expired(uint8_t &channel, CAN_message_t &canFrame, uint32_t now)
+{
+    if ((*table)->size() == 0) return false;
+    for (uint8_t n = 0; n < numStreams; n++)
+    {
+        uint8_t i = (nextExpired + n) % numStreams;
+        struct Stream &stream = streams[i];
+        if (!stream.waiting) continue;
+        const struct DecimationTable::Rule &rule = (*table)->rule(stream.rule);
+        if (now - stream.start < rule.intervalMS) continue;
+        // The held frame stands in for the one that would have closed the interval
+        canFrame = stream.held;
+        aggregate(stream, rule, canFrame);
+        channel = stream.channel;
+        restart(stream, now);
+        nextExpired = (i + 1) % numStreams;
+        return true;
+    }
+    return false;
+}
+
+void Decimator::aggregate(struct Stream &stream, const struct DecimationTable::Rule &rule, CAN_message_t &canFrame)
+{
+    if (stream.count == 0) return;
+    if ((rule.aggregate == AggregateMin) || (rule.aggregate == AggregateMax)) canFrame = stream.held;
+    else if (rule.aggregate == AggregateMean) rule.bits.write(canFrame, stream.total / stream.count);
+}
+
+void Decimator::restart(struct Stream &stream, uint32_t now)
+{
+    stream.open = true;
+    stream.waiting = false;
+    stream.start = now;
+    stream.count = 0;
+    stream.total = 0;
+}
+
+void Decimator::classify(struct Slot &slot, uint8_t channel, const CAN_message_t &canFrame)
+{// The first frame of an ID since the rules changed
+    slot.rule = (*table)->find(RuleMatch::keyOf(canFrame), channel);
+    if ((slot.rule >= 0) && (numStreams < DECIMATION_MAX_STREAMS))
+    {
+        slot.stream = numStreams++;
+        streams[slot.stream] = Stream();
+        streams[slot.stream].channel = channel;
+        streams[slot.stream].rule = slot.rule;
+    }
+    else
+    {
+        slot.rule = -1;
+    }
+}
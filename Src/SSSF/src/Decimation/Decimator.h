@@ -0,0 +1,140 @@
+#ifndef decimator_h_
+#define decimator_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <Rules/Rules.h>
+#include <Signals/BitField.h>
+#include <IdIndex/IdIndex.h>
+
+#define DECIMATION_MAX_RULES 64
+#define DECIMATION_MAX_STREAMS 128  // IDs that can be decimated at once
+#define DECIMATION_UNSEEN -2  // Rule of a slot not classified since the rules changed
+
+enum Aggregate
+{
+    AggregateLatest,  // The frame that closes the interval
+    AggregateMin,  // The frame with the smallest value of the field in the interval
+    AggregateMax,
+    AggregateMean  // The latest frame with the field set to its mean over the interval
+};
+
+/*
+Output rate caps for the "Decimation" section of the session request, e.g.
+
+    {"ID": "0x0CF00400", "Mask": "0x03FFFF00", "MaxRate": 10,
+     "Aggregate": "Mean", "Start": 24, "Length": 16}
+
+caps engine speed (PGN 61444 from any source) at 10 frames a second, sending
+the mean of the field over each interval. "Aggregate" is "Latest" (the
+default), "Min", "Max" or "Mean"; the field is a BitField, the first byte if
+not given. The first rule that matches a frame applies, a mask with the
+source address bits left out gives a cap per PGN that each source gets in
+full.
+*/
+class DecimationTable: public RuleSection
+{
+public:
+    struct Rule
+    {
+        struct RuleMatch match;
+        uint32_t intervalMS = 0;
+        uint8_t aggregate = AggregateLatest;
+        struct BitField bits;
+    };
+
+private:
+    struct Rule rules[DECIMATION_MAX_RULES];
+    struct Rule pendingRule;
+    uint8_t numRules = 0;
+
+public:
+    void clear() { numRules = 0; }
+    size_t size() { return numRules; }
+    const struct Rule &rule(uint8_t i) { return rules[i]; }
+
+    // Index of the first rule that matches, -1 if none does
+    int8_t find(uint32_t key, uint8_t channel);
+
+    virtual void begin();
+    virtual bool end();
+
+protected:
+    virtual void clearPending() { pendingRule = Rule(); }
+    virtual void field(const char* key, const char* text);
+    virtual bool add();
+};
+
+/*
+Applies the live DecimationTable to the frames read from the buses. The
+first frame of each ID in the IdIndex finds the rule that matches it (or
+that none does) and keeps it under the ID's slot, so deciding on a frame
+takes an array read however many rules there are. IDs with a rule also get
+a stream that collects their current interval.
+
+An interval closes with the first frame that arrives after it ends, that
+frame (or the one the aggregate picks) is forwarded and a new interval
+starts, so IDs slower than their cap are forwarded untouched. Frames held
+back in an interval that has ended are sent by the forwarding loop through
+expired(), so a stream that goes quiet still sends its last interval and
+the aggregate leaves at the cap rather than whenever the next frame comes.
+IDs beyond DECIMATION_MAX_STREAMS, or that don't fit in the index, aren't
+decimated.
+*/
+class Decimator
+{
+private:
+    struct Slot
+    {
+        int8_t rule;  // -1 if no rule applies
+        uint8_t stream;
+    };
+
+    struct Stream
+    {
+        bool open;  // An interval has started
+        bool waiting;  // A frame was held back in the current interval
+        uint8_t channel;
+        int8_t rule;
+        uint32_t start;  // millis() the interval started
+        uint32_t count;  // Values of the field collected
+        double total;
+        double extreme;  // Smallest or largest value so far
+        CAN_message_t held;  // Frame with the extreme value, the latest one for the other aggregates
+    };
+
+    StagedTable<DecimationTable>* table = nullptr;
+    struct Slot slots[ID_INDEX_CAPACITY];
+    struct Stream streams[DECIMATION_MAX_STREAMS];
+    uint8_t numStreams = 0;
+    uint8_t nextExpired = 0;  // Where the expired() scan resumes
+
+public:
+    void begin(StagedTable<DecimationTable>* _table);
+
+    // Forgets every ID, after the rules change or the IdIndex is cleared
+    void reset();
+
+    /**
+     * @param slot of the frame's ID in the IdIndex
+     * @param canFrame replaced by the aggregate when it is forwarded
+     * @return false if the frame is held back
+     */
+    bool offer(uint8_t channel, int16_t slot, CAN_message_t &canFrame, uint32_t now);
+
+    /**
+     * Finds a stream whose interval ended with a frame still held back and
+     * starts its next interval, called from the loop until it returns false.
+     *
+     * @param canFrame set to the aggregate to forward
+     * @return false if no stream is due
+     */
+    bool expired(uint8_t &channel, CAN_message_t &canFrame, uint32_t now);
+
+private:
+    void classify(struct Slot &slot, uint8_t channel, const CAN_message_t &canFrame);
+    void aggregate(struct Stream &stream, const struct DecimationTable::Rule &rule, CAN_message_t &canFrame);
+    static void restart(struct Stream &stream, uint32_t now);
+};
+
+#endif /* decimator_h_ */
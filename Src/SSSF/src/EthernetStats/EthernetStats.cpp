@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include <EthernetStats/EthernetStats.h>
+#include <SPI.h>
+#include <utility/w5100.h>
+
+// The chip updates the size registers while they are read, so like socket.cpp
+// (and RawSocket) this reads until two reads agree. Called inside a transaction.
+static uint16_t settled(uint16_t (*readRegister)(SOCKET), SOCKET s)
+{
+    uint16_t previous;
+    uint16_t value = readRegister(s);
+    do
+    {
+        previous = value;
+        value = readRegister(s);
+    } while (value != previous);
+    return value;
+}
+
+void EthernetStats::begin()
+{// SPITimer counts with the DWT cycle counter
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+}
+
+void EthernetStats::poll(uint8_t sessionSocket)
+{
+    uint32_t now = millis();
+    if (now - secondStarted >= 1000)
+    {
+        Metrics.spiBusyLastSecondUS = (Metrics.spiBusyCycles - secondCycles) / (F_CPU / 1000000);
+        secondCycles = Metrics.spiBusyCycles;
+        secondStarted = now;
+    }
+    if (now - lastSample < ETHERNET_SAMPLE_INTERVAL) return;
+    lastSample = now;
+
+    SPITimer timer;
+    uint16_t size = W5100.SSIZE;
+    Metrics.socketBufferSize = size;
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    for (uint8_t s = 0; (s < MAX_SOCK_NUM) && (s < METRICS_SOCKETS); s++)
+    {
+        if (W5100.readSnSR(s) == SnSR::CLOSED) continue;
+        uint16_t rx = settled(W5100Class::readSnRX_RSR, s);
+        uint16_t tx = size - settled(W5100Class::readSnTX_FSR, s);
+        Metrics.socketsOpen |= 1 << s;
+        Metrics.socketRx[s] = rx;
+        Metrics.socketTx[s] = tx;
+        Metrics.socketRxHighWater[s] = max(Metrics.socketRxHighWater[s], rx);
+        Metrics.socketTxHighWater[s] = max(Metrics.socketTxHighWater[s], tx);
+        if (s == sessionSocket)
+        {
+            summary.rxHighWater = max(summary.rxHighWater, rx);
+            summary.txHighWater = max(summary.txHighWater, tx);
+        }
+    }
+    SPI.endTransaction();
+}
+
+void EthernetStats::summarize()
+{
+    summary.bufferSize = Metrics.socketBufferSize;
+    summary.beginFailures = min(Metrics.beginPacketFailures - windowBeginFailures, (uint32_t) UINT16_MAX);
+    summary.endFailures = min(Metrics.endPacketFailures - windowEndFailures, (uint32_t) UINT16_MAX);
+    uint32_t elapsedUS = (millis() - windowStarted) * 1000;
+    uint64_t busyUS = (Metrics.spiBusyCycles - windowCycles) / (F_CPU / 1000000);
+    summary.spiBusyPerMille = (elapsedUS > 0) ? min(busyUS * 1000 / elapsedUS, (uint64_t) 1000) : 0;
+}
+
+void EthernetStats::reset()
+{// Starts the next health report window
+    summary = Summary();
+    windowStarted = millis();
+    windowCycles = Metrics.spiBusyCycles;
+    windowBeginFailures = Metrics.beginPacketFailures;
+    windowEndFailures = Metrics.endPacketFailures;
+}
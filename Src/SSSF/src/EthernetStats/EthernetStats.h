@@ -0,0 +1,74 @@
+#ifndef ethernet_stats_h_
+#define ethernet_stats_h_
+
+#include <Arduino.h>
+#include <Metrics/Metrics.h>
+
+#define ETHERNET_SAMPLE_INTERVAL 10  // ms between socket buffer samples
+
+/*
+Times a call into the Ethernet library. Nearly all of what EthernetUDP and
+RawSocket do is SPI transfers to the WIZnet chip, so the cycles spent in
+them are counted as SPI time. Put one at the top of a function that talks to
+the chip, never in one that calls another timed function.
+*/
+class SPITimer
+{
+private:
+    uint32_t started;
+
+public:
+    SPITimer(): started(ARM_DWT_CYCCNT) {}
+    ~SPITimer() { Metrics.spiBusyCycles += ARM_DWT_CYCCNT - started; }
+};
+
+/*
+Shows where datagrams are lost between the session and the WIZnet chip. Each
+socket's receive and transmit buffer is sampled (Sn_RX_RSR and Sn_TX_FSR)
+every ETHERNET_SAMPLE_INTERVAL ms, so a receive buffer that fills up means
+the loop is too slow to read the session and one that stays empty while
+datagrams go missing points at the network. Together with the beginPacket
+and endPacket failures and the SPI time, counted where they happen, this
+goes to the metrics endpoint for every socket and, for the session socket
+over the last health report window, into the health report.
+
+Samples are a few register reads per open socket, the buffers can fill and
+drain between two of them so the high water marks are a lower bound.
+*/
+class EthernetStats
+{
+public:
+    struct Summary  // Appended to the health report
+    {
+        uint16_t bufferSize = 0;  // Of every socket's receive and transmit buffer
+        uint16_t rxHighWater = 0;  // Most bytes waiting in the session socket's buffers
+        uint16_t txHighWater = 0;
+        uint16_t beginFailures = 0;
+        uint16_t endFailures = 0;
+        uint16_t spiBusyPerMille = 0;  // Of the report window spent in SPI transfers
+    };
+    struct Summary summary;
+
+private:
+    uint32_t lastSample = 0;
+    uint32_t secondStarted = 0;
+    uint64_t secondCycles = 0;  // Metrics.spiBusyCycles when the second started
+    uint32_t windowStarted = 0;
+    uint64_t windowCycles = 0;
+    uint32_t windowBeginFailures = 0;
+    uint32_t windowEndFailures = 0;
+
+public:
+    static void begin();
+
+    /**
+     * Samples the socket buffers if it is time to.
+     *
+     * @param sessionSocket WIZnet socket of the session, MAX_SOCK_NUM if there is none
+     */
+    void poll(uint8_t sessionSocket);
+    void summarize();
+    void reset();
+};
+
+#endif /* ethernet_stats_h_ */
@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include <FastLane/FastLane.h>
+#include <Metrics/Metrics.h>
+#include <FlexCAN_T4.h>
+
+FastLane* FastLane::active = nullptr;
+
+void FastLane::begin(StagedTable<CriticalTable>* _table, IsoTp* _isoTp)
+{
+    table = _table;
+    isoTp = _isoTp;
+    active = this;
+}
+
+void FastLane::start()
+{// Anything left from before the session is dropped
+    for (uint8_t c = 0; c < RULES_CHANNELS; c++) normal[c].clear();
+    queueing = true;
+}
+
+bool FastLane::read(uint8_t channel, CAN_message_t &canFrame)
+{
+    uint8_t from;
+    return (channel < RULES_CHANNELS) && normal[channel].pop(from, canFrame);
+}
+
+FASTRUN void FastLane::received0(const CAN_message_t &canFrame)
+{// Called by FlexCAN from the receive interrupt
+    if (active != nullptr) active->received(0, canFrame);
+}
+
+FASTRUN void FastLane::received1(const CAN_message_t &canFrame)
+{// Called by FlexCAN from the receive interrupt
+    if (active != nullptr) active->received(1, canFrame);
+}
+
+FASTRUN void FastLane::received(uint8_t channel, const CAN_message_t &canFrame)
+{
+    // A full fast ring means the loop is stuck, the frame still goes the slow way.
+    bool urgent = critical(channel, Uplink, canFrame) || isoTp->terminates(channel, canFrame);
+    if (urgent && fast.push(channel, canFrame)) return;
+    if (!queueing) return;
+    if (!normal[channel].push(channel, canFrame)) Metrics.drops[CANRxFull]++;
+}
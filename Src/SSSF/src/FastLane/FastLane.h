@@ -0,0 +1,106 @@
+#ifndef fast_lane_h_
+#define fast_lane_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <Rules/Rules.h>
+#include <IsoTp/IsoTp.h>
+
+#define FAST_LANE_SIZE 16  // Critical frames waiting, a power of two
+#define FAST_LANE_RX_SIZE 128  // Other frames waiting per channel, a power of two
+#define FAST_LANE_TX_MB MB15  // Downlink critical frames skip the transmit backlog
+
+/*
+Receive path that lets the session's critical CAN IDs (brake or steering
+commands, see CriticalTable) overtake everything else.
+
+FlexCAN calls the onReceive handlers straight from the receive interrupt and
+stops polling mailboxes that have their interrupt enabled, so once the fast
+lane owns the interrupt every frame comes through received(). It checks the
+frame against the live critical table's bitmap and puts it on the fast ring
+if it is critical, on its channel's ring otherwise. Frames from the ECUs
+whose ISO-TP is terminated on the node take the fast ring too, so their
+flow control isn't held back by the uplink slot. The forwarding loop
+drains the fast ring between each of its slow steps (NTP, HTTP, metrics, the
+other channel) and sends every critical frame as its own datagram straight
+away, the rest are read one per pass as before (or all at once when the
+uplink is slotted, see UplinkSchedule.h). The datagram can't be sent
+from the interrupt itself since the loop may be in the middle of an SPI
+transfer to the Ethernet chip.
+
+Downlink critical frames are written to a transmit mailbox of their own,
+which every other frame is kept out of by CANNode::send(), instead of behind
+the frames waiting for the other mailboxes.
+
+The rings have one producer (the interrupt) and one consumer (the loop), so
+they need no locking. Outside a session nothing drains the channel rings,
+so the interrupt leaves them alone until start() empties them, rather than
+filling them with frames that would be stale by the time a session starts.
+*/
+class FastLane
+{
+private:
+    struct Entry
+    {
+        uint8_t channel;
+        CAN_message_t frame;
+    };
+
+    template<uint16_t Size>
+    struct Ring
+    {
+        struct Entry entries[Size];
+        volatile uint16_t head = 0;  // Written by the interrupt
+        volatile uint16_t tail = 0;  // Written by the loop
+
+        bool push(uint8_t channel, const CAN_message_t &canFrame)
+        {
+            uint16_t next = (head + 1) & (Size - 1);
+            if (next == tail) return false;
+            entries[head].channel = channel;
+            entries[head].frame = canFrame;
+            asm volatile("" ::: "memory");  // The entry is complete before it is published
+            head = next;
+            return true;
+        }
+
+        bool pop(uint8_t &channel, CAN_message_t &canFrame)
+        {
+            if (tail == head) return false;
+            channel = entries[tail].channel;
+            canFrame = entries[tail].frame;
+            asm volatile("" ::: "memory");
+            tail = (tail + 1) & (Size - 1);
+            return true;
+        }
+
+        void clear() { tail = head; }  // From the loop only
+    };
+
+    static FastLane* active;
+
+    StagedTable<CriticalTable>* table = nullptr;
+    IsoTp* isoTp = nullptr;
+    Ring<FAST_LANE_SIZE> fast;
+    Ring<FAST_LANE_RX_SIZE> normal[RULES_CHANNELS];
+    volatile bool queueing = false;  // Whether the channel rings take frames
+
+public:
+    void begin(StagedTable<CriticalTable>* _table, IsoTp* _isoTp);
+    void start();
+    void stop() { queueing = false; }
+    bool critical(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame)
+    {
+        return (*table)->critical(channel, direction, canFrame);
+    }
+    bool nextCritical(uint8_t &channel, CAN_message_t &canFrame) { return fast.pop(channel, canFrame); }
+    bool read(uint8_t channel, CAN_message_t &canFrame);
+
+    static void received0(const CAN_message_t &canFrame);
+    static void received1(const CAN_message_t &canFrame);
+
+private:
+    void received(uint8_t channel, const CAN_message_t &canFrame);
+};
+
+#endif /* fast_lane_h_ */
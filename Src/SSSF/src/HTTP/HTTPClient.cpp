@@ -17,7 +17,9 @@ HTTPClient::HTTPClient(DynamicJsonDocument& _attachedDevice, const char* _server
     serverIP(),
     serverPort(_serverPort),
     connectionStatus(Disconnected)
-    {};
+    {
+        bodyStream.addSection("Devices", &deviceCounter);
+    };
 
 HTTPClient::HTTPClient(DynamicJsonDocument& _attachedDevice, String& _serverAddress, uint16_t _serverPort):
     HTTPClient(_attachedDevice, _serverAddress.c_str(), _serverPort)
@@ -31,7 +33,9 @@ HTTPClient::HTTPClient(DynamicJsonDocument& _attachedDevice, IPAddress& _serverI
     serverIP(_serverIP),
     serverPort(_serverPort),
     connectionStatus(Disconnected)
-    {};
+    {
+        bodyStream.addSection("Devices", &deviceCounter);
+    };
 
 bool HTTPClient::connect()
 {
@@ -73,23 +77,37 @@ bool HTTPClient::connect()
 
 bool HTTPClient::read(struct Request *request, bool respondOnError)
 {
+    if (readingBody)
+    {
+        return parseData(request, respondOnError);
+    }
     if (client.available())
     {
-        request->raw = clientSock.readString((size_t) 4096);
-        if (parseRequest(request))
+        while ((clientSock.peek() == '\r') || (clientSock.peek() == '\n'))
+        {// Left over from the end of the last body
+            clientSock.read();
+        }
+        if (!clientSock.available()) return false;
+        request->clear();
+        bodyStream.reset();
+        int32_t contentLength = -1;
+        if (!parseHeaders(contentLength, request))
         {
-            Log.noticeln(
-                "New command from: %p\n%s",
-                clientSock.remoteIP(),
-                request->raw.c_str()
-                );
-            return true;
+            return rejectRequest(respondOnError);
         }
-        else if (respondOnError)
+        bool bodyExpected = (contentLength > 0) ||
+            ((contentLength < 0) &&
+                (clientSock.available() || request->method.equalsIgnoreCase("POST") || request->method.equalsIgnoreCase("PUT")));
+        if (!bodyExpected)
         {
-            struct Response response = {400, "BAD REQUEST"};
-            write(&response);
+            return acceptRequest(request, respondOnError);
         }
+        request->hasBody = true;
+        readingBody = true;
+        bodyRemaining = contentLength;
+        lastBodyByte = millis();
+        bodyStream.begin(&request->json);
+        return parseData(request, respondOnError);
     }
     else if (!client.connected() && (connectionStatus != Unreachable))
     {
@@ -117,6 +135,40 @@ bool HTTPClient::write(struct Response *res)
     return false;
 }
 
+bool HTTPClient::beginResponse(uint16_t code, const char* reason, const char* contentType)
+{// Starts a response whose body is sent with writeChunk
+    if (clientSock.connected())
+    {
+        char headers[160];
+        int length = snprintf(
+            headers,
+            sizeof(headers),
+            "HTTP/1.1 %u %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n",
+            code,
+            reason,
+            contentType
+            );
+        clientSock.write(reinterpret_cast<const uint8_t*>(headers), length);
+        return true;
+    }
+    return false;
+}
+
+bool HTTPClient::writeChunk(const char* data, size_t length)
+{// A chunk with a length of 0 ends the response
+    if (clientSock.connected())
+    {
+        char size[12];
+        int sizeLength = snprintf(size, sizeof(size), "%x\r\n", (unsigned int) length);
+        clientSock.write(reinterpret_cast<const uint8_t*>(size), sizeLength);
+        if (length > 0) clientSock.write(reinterpret_cast<const uint8_t*>(data), length);
+        clientSock.write(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+        if (length == 0) clientSock.flush();
+        return true;
+    }
+    return false;
+}
+
 int HTTPClient::write(struct Request *req, struct Response *res)
 {
     if (client.connected())
@@ -237,30 +289,46 @@ int HTTPClient::connectionFailed(int code, bool retry)
     }
 }
 
-bool HTTPClient::parseRequest(struct Request *req)
-{
-    int endOfHeaders = req->raw.indexOf("\r\n\r\n");
-    if (endOfHeaders == -1 || endOfHeaders == 0)
-    {
-        endOfHeaders = req->raw.indexOf("\n\n");
-        if (endOfHeaders == -1 || endOfHeaders == 0)
-            return false;
-    }
-    if (parseHeaders(endOfHeaders, req) && parseData(endOfHeaders+4, req))
-    {
-        return validateRequestData(req);
-    }
-    else
+bool HTTPClient::parseHeaders(int32_t &contentLength, struct Request *req)
+{// Reads up to the blank line that ends the headers
+    char line[REQUEST_MAX_LINE];
+    size_t length = 0;
+    bool requestLine = true;
+    uint32_t lastByte = millis();
+    while (millis() - lastByte < REQUEST_TIMEOUT)
     {
-        return false;
+        int c = clientSock.read();
+        if (c < 0) continue;
+        lastByte = millis();
+        if (c == '\r') continue;
+        if (c != '\n')
+        {
+            if (length < sizeof(line) - 1) line[length++] = c;
+            continue;
+        }
+        line[length] = '\0';
+        if (length == 0) return !requestLine;
+        req->raw += line;
+        req->raw += "\n";
+        if (requestLine)
+        {
+            if (!parseRequestLine(line, req)) return false;
+            requestLine = false;
+        }
+        else if (!strncasecmp(line, "Content-Length:", 15))
+        {
+            contentLength = atol(line + 15);
+        }
+        length = 0;
     }
+    Log.errorln("Timed out reading the request headers.");
+    return false;
 }
 
-bool HTTPClient::parseHeaders(int endOfHeaders, struct Request *req)
+bool HTTPClient::parseRequestLine(const char* line, struct Request *req)
 {
-    String headers = req->raw.substring(0, endOfHeaders);
     String params[3];
-    if (tokenizeRequestLine(headers, params) && params[2] == "HTTP/1.1")
+    if (tokenizeRequestLine(String(line), params) && params[2] == "HTTP/1.1")
     {
         req->method = params[0];
         req->uri = params[1];
@@ -273,29 +341,70 @@ bool HTTPClient::parseHeaders(int endOfHeaders, struct Request *req)
     }
 }
 
-bool HTTPClient::parseData(int startOfData, struct Request *req)
-{
-    if (startOfData != ((signed) req->raw.length()))
+bool HTTPClient::parseData(struct Request *req, bool respondOnError)
+{// One chunk per call so forwarding carries on while a big body arrives
+    uint8_t chunk[REQUEST_CHUNK_SIZE];
+    size_t wanted = (bodyRemaining > 0) ? min((size_t) bodyRemaining, sizeof(chunk)) : sizeof(chunk);
+    int received = clientSock.read(chunk, wanted);
+    if (received > 0)
     {
-        String data = req->raw.substring(startOfData);
-        DeserializationError error = deserializeJson(req->json, data);
-        if (error)
-        {
-            Log.errorln("Deserializing the request data failed.");
-            Log.errorln("Code: %s", error.c_str());
-            return false;
+        lastBodyByte = millis();
+        if (bodyRemaining > 0) bodyRemaining -= received;
+        bodyStream.feed(chunk, received);
+    }
+    // Without a Content-Length the body ends with the JSON document.
+    if ((bodyStream.getStatus() == JsonStream::Parsing) &&
+        (bodyRemaining != 0) &&
+        (millis() - lastBodyByte < REQUEST_TIMEOUT))
+    {
+        return false;
+    }
+    readingBody = false;
+    if (bodyStream.getStatus() != JsonStream::Done)
+    {
+        Log.errorln("Request data is incomplete or malformed.");
+        while (clientSock.available() > 0)
+        {// Don't mistake the rest of the body for the next request
+            clientSock.read(chunk, sizeof(chunk));
         }
+        return rejectRequest(respondOnError);
+    }
+    req->devices = deviceCounter.count;
+    req->devicesListed = deviceCounter.listed;
+    return acceptRequest(req, respondOnError);
+}
+
+bool HTTPClient::acceptRequest(struct Request *req, bool respondOnError)
+{
+    if (!validateRequestData(req))
+    {
+        return rejectRequest(respondOnError);
     }
+    Log.noticeln(
+        "New command from: %p\n%s",
+        clientSock.remoteIP(),
+        req->raw.c_str()
+        );
     return true;
 }
 
+bool HTTPClient::rejectRequest(bool respondOnError)
+{
+    if (respondOnError)
+    {
+        struct Response response = {400, "BAD REQUEST"};
+        write(&response);
+    }
+    return false;
+}
+
 bool HTTPClient::validateRequestData(struct Request *req)
 {
     bool id = req->json.containsKey("ID");
     bool index = req->json.containsKey("Index");
     bool ip = req->json.containsKey("IP");
     bool port = req->json.containsKey("Port");
-    bool devices = req->json.containsKey("Devices");
+    bool devices = req->devicesListed;
     if (req->method.equalsIgnoreCase("POST"))
     {
         if (!ip || !port || !id || !index || !devices)
@@ -317,7 +426,7 @@ bool HTTPClient::validateRequestData(struct Request *req)
     }
     else if (req->method.equalsIgnoreCase("DELETE"))
     {
-        if (!req->json.isNull())
+        if (req->hasBody)
         {
             Log.errorln("DELETE method cannot contain data.");
             return false;
@@ -329,8 +438,8 @@ bool HTTPClient::validateRequestData(struct Request *req)
 bool HTTPClient::tokenizeRequestLine(String headers, String params[3])
 {
     int count = 0;
-    char headers_c_str[headers.length()];
-    headers.toCharArray(headers_c_str, headers.length());
+    char headers_c_str[headers.length() + 1];
+    headers.toCharArray(headers_c_str, headers.length() + 1);
     char *tokenized = strtok(headers_c_str, " \r\n");
     while ((tokenized != NULL) && (count < 3))
     {
@@ -8,8 +8,13 @@
 #include <IPAddress.h>
 #include <Ethernet.h>
 #include <Configuration/Load.h>
+#include <HTTP/JsonStream.h>
 #include <vector>
 
+#define REQUEST_TIMEOUT 1000  // ms without a byte before a request is abandoned
+#define REQUEST_MAX_LINE 256
+#define REQUEST_CHUNK_SIZE 256
+
 enum ConnectionStatus
 {
     Unreachable,
@@ -17,6 +22,23 @@ enum ConnectionStatus
     Connected
 };
 
+/*
+Counts the members of the session from the "Devices" section of the request,
+they're only needed to size the health tracking. An empty list is still a
+list, listed tells it apart from a request without one.
+*/
+class DeviceCounter: public JsonSection
+{
+public:
+    size_t count = 0;
+    bool listed = false;
+
+    virtual void reset() { count = 0; listed = false; }
+    virtual void begin() { listed = true; }
+    virtual void beginObject(uint8_t depth) { if (depth == 2) count++; }
+    virtual void value(uint8_t depth, const char* key, const char* text, bool isString) { if (depth == 1) count++; }
+};
+
 class HTTPClient: public virtual CANNode
 {
 private:
@@ -32,13 +54,39 @@ private:
 
     String registration;
 
+    JsonStream bodyStream;
+    DeviceCounter deviceCounter;
+    bool readingBody = false;
+    int32_t bodyRemaining = -1;  // Bytes, -1 without a Content-Length
+    uint32_t lastBodyByte = 0;  // millis()
+
 public:
+    /*
+    Only the request line and headers are kept in raw. The body is parsed as
+    it is read: top level scalars land in json and sections registered with
+    addSection are compiled by their handlers. A body is read a chunk per call
+    to read(), so the same Request has to be passed until read() returns true.
+    */
     struct Request
     {
         String method;
         String uri;
-        StaticJsonDocument<1024> json;
+        StaticJsonDocument<512> json;
         String raw;
+        size_t devices = 0;  // Entries in "Devices"
+        bool devicesListed = false;  // "Devices" was there, even if empty
+        bool hasBody = false;
+
+        void clear()
+        {
+            method = "";
+            uri = "";
+            json.clear();
+            raw = "";
+            devices = 0;
+            devicesListed = false;
+            hasBody = false;
+        }
     };
 
     struct Response
@@ -55,8 +103,11 @@ public:
     HTTPClient(DynamicJsonDocument& _attachedDevices, IPAddress& _serverIP, uint16_t _serverPort = 80);
     
     virtual bool connect();
+    void addSection(const char* key, JsonSection* section) { bodyStream.addSection(key, section); }
     virtual bool read(struct Request *request, bool respondOnError = true);
     virtual bool write(struct Response *response);
+    virtual bool beginResponse(uint16_t code, const char* reason, const char* contentType);
+    virtual bool writeChunk(const char* data, size_t length);
     virtual int write(struct Request *request, struct Response *response);
 
 private:
@@ -65,9 +116,11 @@ private:
     int connectionSuccessful(int statusCode, bool retry = true);
     int connectionFailed(int code, bool retry = true);
 
-    bool parseRequest(struct Request *req);
-    bool parseHeaders(int endOfHeaders, struct Request *req);
-    bool parseData(int startOfData, struct Request *req);
+    bool parseHeaders(int32_t &contentLength, struct Request *req);
+    bool parseRequestLine(const char* line, struct Request *req);
+    bool parseData(struct Request *req, bool respondOnError);
+    bool acceptRequest(struct Request *req, bool respondOnError);
+    bool rejectRequest(bool respondOnError);
     bool tokenizeRequestLine(String headers, String params[3]);
     bool validateRequestData(struct Request *request);
 };
@@ -0,0 +1,298 @@
+#include <Arduino.h>
+#include <HTTP/JsonStream.h>
+#include <ArduinoJson.h>
+
+void JsonStream::addSection(const char* key, JsonSection* section)
+{
+    if (numSections < JSON_STREAM_MAX_SECTIONS)
+    {
+        sections[numSections++] = {key, section};
+    }
+}
+
+void JsonStream::begin(JsonDocument* _scalars)
+{
+    scalars = _scalars;
+    active = nullptr;
+    activeDepth = 0;
+    depth = 0;
+    state = Value;
+    emptyAllowed = false;
+    unicodeDigits = 0;
+    tokenLength = 0;
+    status = Parsing;
+}
+
+void JsonStream::reset()
+{
+    for (uint8_t i = 0; i < numSections; i++)
+    {
+        sections[i].section->reset();
+    }
+}
+
+JsonStream::Status JsonStream::feed(const uint8_t* data, size_t length)
+{
+    for (size_t i = 0; (i < length) && (status == Parsing); i++)
+    {
+        if (!feed(char(data[i]))) break;
+    }
+    return status;
+}
+
+bool JsonStream::feed(char c)
+{
+    switch (state)
+    {
+        case Quoted:
+            if (unicodeDigits > 0)
+            {
+                unicodeDigits--;
+            }
+            else if (c == '\\')
+            {
+                state = Escape;
+            }
+            else if (c != '"')
+            {
+                append(c);
+            }
+            else if (stringIsKey)
+            {
+                token[tokenLength] = '\0';
+                strlcpy(stack[depth - 1].key, token, JSON_STREAM_MAX_KEY);
+                state = Colon;
+            }
+            else
+            {
+                return scalar(true);
+            }
+            return true;
+        case Escape:
+            switch (c)
+            {
+                case 'n': append('\n'); break;
+                case 't': append('\t'); break;
+                case 'r': append('\r'); break;
+                case 'b': append('\b'); break;
+                case 'f': append('\f'); break;
+                case 'u':  // Nothing in a request needs more than ASCII
+                    append('?');
+                    unicodeDigits = 4;
+                    break;
+                default: append(c); break;
+            }
+            state = Quoted;
+            return true;
+        case Literal:
+            if (isalnum(c) || (c == '.') || (c == '-') || (c == '+'))
+            {
+                append(c);
+                return true;
+            }
+            if (!scalar(false)) return false;
+            break;  // The character after a literal still has to be handled
+        default:
+            break;
+    }
+    if (isspace(c)) return true;
+    switch (state)
+    {
+        case Value:
+            if ((c == ']') && emptyAllowed) return pop(false);
+            if (depth == 0 && c != '{') return fail("Request data is not a JSON object.");
+            if (c == '{') return push(true);
+            if (c == '[') return push(false);
+            if (c == '"')
+            {
+                startValue();
+                startString(false);
+                return true;
+            }
+            if ((c == '-') || isalnum(c))
+            {
+                startValue();
+                tokenLength = 0;
+                append(c);
+                state = Literal;
+                return true;
+            }
+            break;
+        case Key:
+            if (c == '"')
+            {
+                startString(true);
+                return true;
+            }
+            if ((c == '}') && emptyAllowed) return pop(true);
+            break;
+        case Colon:
+            if (c == ':')
+            {
+                state = Value;
+                emptyAllowed = false;
+                return true;
+            }
+            break;
+        case Next:
+            if (c == ',')
+            {
+                state = stack[depth - 1].object ? Key : Value;
+                emptyAllowed = false;
+                return true;
+            }
+            if (c == '}') return pop(true);
+            if (c == ']') return pop(false);
+            break;
+        default:
+            break;
+    }
+    return fail("Request data is not valid JSON.");
+}
+
+bool JsonStream::push(bool object)
+{
+    if (depth >= JSON_STREAM_MAX_DEPTH) return fail("Request data is nested too deeply.");
+    startValue();
+    struct Level &level = stack[depth];
+    level.object = object;
+    // Arrays keep the key they were found under so their elements can be named
+    if (depth > 0)
+    {
+        strlcpy(level.key, stack[depth - 1].key, JSON_STREAM_MAX_KEY);
+    }
+    else
+    {
+        level.key[0] = '\0';
+    }
+    depth++;
+    state = object ? Key : Value;
+    emptyAllowed = true;
+    if (active && object) active->beginObject(depth - activeDepth);
+    return true;
+}
+
+bool JsonStream::pop(bool object)
+{
+    if ((depth == 0) || (stack[depth - 1].object != object))
+    {
+        return fail("Request data has mismatched brackets.");
+    }
+    if (active && object) active->endObject(depth - activeDepth);
+    depth--;
+    afterValue();
+    return status != Failed;
+}
+
+bool JsonStream::scalar(bool isString)
+{
+    token[tokenLength] = '\0';
+    if (!isString && strcmp(token, "true") && strcmp(token, "false") && strcmp(token, "null"))
+    {
+        char* end;
+        strtod(token, &end);
+        if (*end != '\0') return fail("Request data contains an invalid literal.");
+    }
+    const char* key = stack[depth - 1].key;
+    if (active)
+    {
+        active->value(depth - activeDepth, key, token, isString);
+    }
+    else if (depth == 1)
+    {
+        storeScalar(key, isString);
+    }
+    afterValue();
+    return status != Failed;
+}
+
+void JsonStream::startValue()
+{// Values directly under a registered top level key go to its section
+    if ((depth == 1) && (active == nullptr))
+    {
+        active = find(stack[0].key);
+        if (active)
+        {
+            activeDepth = depth;
+            active->begin();
+        }
+    }
+}
+
+void JsonStream::startString(bool isKey)
+{
+    stringIsKey = isKey;
+    tokenLength = 0;
+    unicodeDigits = 0;
+    state = Quoted;
+}
+
+void JsonStream::append(char c)
+{
+    if (tokenLength < JSON_STREAM_MAX_TOKEN - 1) token[tokenLength++] = c;
+}
+
+void JsonStream::afterValue()
+{
+    if (active && (depth == activeDepth))
+    {
+        bool accepted = active->end();
+        active = nullptr;
+        if (!accepted)
+        {
+            fail("A section of the request data was rejected.");
+            return;
+        }
+    }
+    if (depth == 0)
+    {
+        status = Done;
+    }
+    else
+    {
+        state = Next;
+    }
+}
+
+bool JsonStream::fail(const char* reason)
+{
+    Log.errorln(reason);
+    status = Failed;
+    return false;
+}
+
+void JsonStream::storeScalar(const char* key, bool isString)
+{
+    if (scalars == nullptr) return;
+    // Passing char* rather than const char* makes ArduinoJson copy the strings
+    char* name = const_cast<char*>(key);
+    if (isString)
+    {
+        (*scalars)[name] = token;
+    }
+    else if (!strcmp(token, "true") || !strcmp(token, "false"))
+    {
+        (*scalars)[name] = (token[0] == 't');
+    }
+    else if (strpbrk(token, ".eE"))
+    {
+        (*scalars)[name] = strtod(token, nullptr);
+    }
+    else if (token[0] == '-')
+    {
+        (*scalars)[name] = strtol(token, nullptr, 10);
+    }
+    else if (strcmp(token, "null"))
+    {
+        (*scalars)[name] = strtoul(token, nullptr, 10);
+    }
+}
+
+JsonSection* JsonStream::find(const char* key)
+{
+    for (uint8_t i = 0; i < numSections; i++)
+    {
+        if (!strcmp(sections[i].key, key)) return sections[i].section;
+    }
+    return nullptr;
+}
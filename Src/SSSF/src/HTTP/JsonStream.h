@@ -0,0 +1,111 @@
+#ifndef json_stream_h_
+#define json_stream_h_
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ArduinoLog.h>
+
+#define JSON_STREAM_MAX_DEPTH 8
+#define JSON_STREAM_MAX_KEY 32
+#define JSON_STREAM_MAX_TOKEN 64
+#define JSON_STREAM_MAX_SECTIONS 12
+
+/*
+A section is a top level key of the request whose value is compiled straight
+into a runtime table as it is parsed instead of being kept in a JsonDocument.
+Depths are relative to the section, the section's own array or object is at
+depth 1 and the objects in it are at depth 2.
+*/
+class JsonSection
+{
+public:
+    virtual ~JsonSection() {}
+    virtual void reset() {}  // Before every request, the section may not be in it
+    virtual void begin() {}
+    virtual void beginObject(uint8_t depth) {}
+    virtual void value(uint8_t depth, const char* key, const char* text, bool isString) {}
+    virtual void endObject(uint8_t depth) {}
+    virtual bool end() { return true; }  // False rejects the request
+};
+
+/*
+Incremental JSON parser for request bodies. Bytes are fed in as they arrive
+from the socket and are never buffered beyond the current token, so the size
+of a request is not limited by RAM. Top level keys that have a section
+registered are handed to it, other top level scalars are copied into a small
+JsonDocument and anything else is skipped. Strings longer than
+JSON_STREAM_MAX_TOKEN are truncated.
+*/
+class JsonStream
+{
+public:
+    enum Status
+    {
+        Parsing,
+        Done,
+        Failed
+    };
+
+private:
+    enum State
+    {
+        Value,  // Expecting a value
+        Key,  // Expecting a key or the end of an object
+        Colon,
+        Next,  // Expecting a comma or the end of a container
+        Quoted,  // In a string, key or value
+        Escape,
+        Literal
+    };
+
+    struct Level
+    {
+        bool object;
+        char key[JSON_STREAM_MAX_KEY];
+    };
+
+    struct Registered
+    {
+        const char* key;
+        JsonSection* section;
+    };
+
+    Registered sections[JSON_STREAM_MAX_SECTIONS];
+    uint8_t numSections = 0;
+
+    JsonDocument* scalars = nullptr;
+    JsonSection* active = nullptr;
+    uint8_t activeDepth = 0;  // Depth of the key the active section is under
+
+    Level stack[JSON_STREAM_MAX_DEPTH];
+    uint8_t depth = 0;
+    State state = Value;
+    bool stringIsKey = false;
+    bool emptyAllowed = false;  // A container was just opened
+    uint8_t unicodeDigits = 0;  // Hex digits of a \u escape left to skip
+    char token[JSON_STREAM_MAX_TOKEN];
+    uint8_t tokenLength = 0;
+    Status status = Parsing;
+
+public:
+    void addSection(const char* key, JsonSection* section);
+    void reset();  // Tells every section a new request has started
+    void begin(JsonDocument* _scalars);
+    Status feed(const uint8_t* data, size_t length);
+    Status getStatus() { return status; }
+
+private:
+    bool feed(char c);
+    bool push(bool object);
+    bool pop(bool object);
+    bool scalar(bool isString);
+    void startValue();
+    void startString(bool isKey);
+    void append(char c);
+    void afterValue();
+    bool fail(const char* reason);
+    void storeScalar(const char* key, bool isString);
+    JsonSection* find(const char* key);
+};
+
+#endif /* json_stream_h_ */
@@ -0,0 +1,85 @@
+#include <Arduino.h>
+#include <IdIndex/IdIndex.h>
+#include <Metrics/Metrics.h>
+#include <Benchmark/CycleCounter.h>
+
+void IdIndex::clear()
+{
+    for (int i = 0; i < ID_INDEX_ENTRIES; i++)
+    {
+        keys[i] = ID_INDEX_EMPTY;
+    }
+    used = 0;
+    Metrics.idIndexSize = 0;
+}
+
+FASTRUN int16_t IdIndex::slot(uint32_t key)
+{
+    uint32_t i = hash(key);
+    while (true)
+    {// Ends on the key or an empty entry, there is always one
+        if (keys[i] == key) return slots[i];
+        if (keys[i] == ID_INDEX_EMPTY) break;
+        i = (i + 1) & (ID_INDEX_ENTRIES - 1);
+    }
+    if (used >= ID_INDEX_CAPACITY)
+    {
+        Metrics.idIndexOverflows++;
+        return ID_INDEX_NONE;
+    }
+    keys[i] = key;
+    slots[i] = used++;
+    Metrics.idIndexSize = used;
+    return slots[i];
+}
+
+FASTRUN int16_t IdIndex::find(uint32_t key)
+{
+    uint32_t i = hash(key);
+    while (keys[i] != ID_INDEX_EMPTY)
+    {
+        if (keys[i] == key) return slots[i];
+        i = (i + 1) & (ID_INDEX_ENTRIES - 1);
+    }
+    return ID_INDEX_NONE;
+}
+
+#if defined(SSSF_CYCLE_BENCHMARK)
+void IdIndex::benchmark()
+{// J1939 style IDs, PGNs from many sources, in an index filled to capacity
+    IdIndex *index = new IdIndex();
+    CycleCounter inserts{"ID index insert"};
+    CycleCounter hits{"ID index lookup, full index"};
+    CycleCounter misses{"ID index lookup of an unseen ID, full index"};
+    uint32_t keys[ID_INDEX_CAPACITY];
+    for (uint16_t i = 0; i < ID_INDEX_CAPACITY; i++)
+    {
+        uint32_t pgn = 0xF000 + (i * 37) % 0x0F00;
+        uint8_t source = (i * 13) & 0xFF;
+        keys[i] = (0x18000000 | (pgn << 8) | source | RULES_EXTENDED) | (uint32_t(i & 1) << ID_INDEX_CHANNEL_SHIFT);
+        inserts.start();
+        index->slot(keys[i]);
+        inserts.stop();
+    }
+    for (uint16_t i = 0; i < ID_INDEX_CAPACITY; i++)
+    {// In a different order than they went in
+        uint32_t key = keys[(i * 7) % ID_INDEX_CAPACITY];
+        hits.start();
+        index->slot(key);
+        hits.stop();
+    }
+    for (uint16_t i = 0; i < ID_INDEX_BENCHMARK_MISSES; i++)
+    {
+        uint32_t key = 0x100 + i;
+        misses.start();
+        index->find(key);
+        misses.stop();
+    }
+    Log.noticeln("ID index of %d entries with %d IDs:", ID_INDEX_ENTRIES, index->size());
+    inserts.report();
+    hits.report();
+    misses.report();
+    delete index;
+    Metrics.idIndexSize = 0;  // Counted the benchmark's IDs
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef id_index_h_
+#define id_index_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <Rules/Rules.h>
+
+#define ID_INDEX_BITS 10  // 768 IDs across both channels, see RAM_BUDGET_ID_INDEX
+#define ID_INDEX_ENTRIES (1 << ID_INDEX_BITS)
+#define ID_INDEX_CAPACITY ((ID_INDEX_ENTRIES * 3) / 4)  // Distinct IDs, the rest stays empty to keep probes short
+#define ID_INDEX_NONE -1  // Slot of an ID that didn't fit
+#define ID_INDEX_EMPTY 0xFFFFFFFF  // Never a key, bit 30 is always clear
+#define ID_INDEX_CHANNEL_SHIFT 29  // Above the 29 bits of an extended ID
+#define ID_INDEX_BENCHMARK_MISSES 1000
+
+/*
+Numbers the channel and CAN ID pairs seen on the buses with dense slots, 0
+up to ID_INDEX_CAPACITY - 1 in the order they first show up. Everything that
+keeps state per ID (BusStats, the Decimator) keeps it in a plain array of
+ID_INDEX_CAPACITY indexed by the slot, and the uplink looks each frame up
+once and hands the slot to all of them. The index is cleared when a session
+starts, so the slots are rebuilt from what is on the buses then.
+
+Open addressing with linear probing, keys and slots in separate arrays so
+the probes walk consecutive words of keys alone. With the keys spread by a
+Fibonacci hash and the table at most three quarters full a lookup averages
+under three probes however many IDs there are. Frames whose ID arrives once
+the index is full get ID_INDEX_NONE and are counted in the metrics, the
+features treat them as untracked.
+
+Keys are RuleMatch::keyOf(), RULES_EXTENDED set for 29 bit IDs, with the
+channel at ID_INDEX_CHANNEL_SHIFT.
+*/
+class IdIndex
+{
+private:
+    uint32_t keys[ID_INDEX_ENTRIES];
+    uint16_t slots[ID_INDEX_ENTRIES];
+    uint16_t used = 0;
+
+public:
+    IdIndex() { clear(); }
+
+    void clear();
+    uint16_t size() { return used; }
+
+    static uint32_t key(uint8_t channel, const CAN_message_t &canFrame)
+    {
+        return RuleMatch::keyOf(canFrame) | (uint32_t(channel) << ID_INDEX_CHANNEL_SHIFT);
+    }
+
+    /**
+     * Looks key up, giving it the next free slot the first time it is seen.
+     *
+     * @return slot, ID_INDEX_NONE if the index is full
+     */
+    int16_t slot(uint32_t key);
+
+    // Like slot() without taking one, ID_INDEX_NONE for an ID not seen yet
+    int16_t find(uint32_t key);
+
+    /**
+     * Walks the table, position 0 up to ID_INDEX_ENTRIES - 1, in no
+     * particular order of slots.
+     *
+     * @return false if nothing is stored at position
+     */
+    bool at(uint16_t position, uint32_t &key, int16_t &slot)
+    {
+        if ((position >= ID_INDEX_ENTRIES) || (keys[position] == ID_INDEX_EMPTY)) return false;
+        key = keys[position];
+        slot = slots[position];
+        return true;
+    }
+
+#if defined(SSSF_CYCLE_BENCHMARK)
+    // Logs the cycles a lookup takes in a full index, run once at setup
+    static void benchmark();
+#else
+    static void benchmark() {}
+#endif
+
+private:
+    static uint32_t hash(uint32_t key) { return (key * 2654435761U) >> (32 - ID_INDEX_BITS); }
+};
+
+#endif /* id_index_h_ */
@@ -0,0 +1,432 @@
+#include <Arduino.h>
+#include <IsoTp/IsoTp.h>
+#include <Metrics/Metrics.h>
+#include <ArduinoLog.h>
+#include <FlexCAN_T4.h>
+
+namespace
+{
+    enum FrameType
+    {
+        SingleFrame = 0,
+        FirstFrame = 1,
+        ConsecutiveFrame = 2,
+        FlowControlFrame = 3
+    };
+
+    enum FlowStatus
+    {
+        ContinueToSend = 0,
+        Wait = 1,
+        Overflow = 2
+    };
+}
+
+void IsoTpTable::begin()
+{
+    numLinks = 0;
+    valid = true;
+}
+
+void IsoTpTable::beginObject(uint8_t depth)
+{
+    if (depth != 2) return;
+    pending = IsoTpConfig();
+    hasTester = false;
+    hasECU = false;
+}
+
+void IsoTpTable::value(uint8_t depth, const char* key, const char* text, bool isString)
+{
+    if (depth != 2) return;
+    uint32_t number = strtoul(text, nullptr, 0);
+    if (!strcmp(key, "Tester"))
+    {
+        pending.tester = number;
+        hasTester = true;
+    }
+    else if (!strcmp(key, "ECU"))
+    {
+        pending.ecu = number;
+        hasECU = true;
+    }
+    else if (!strcmp(key, "Channel")) pending.channel = number;
+    else if (!strcmp(key, "Extended")) pending.extended = !strcmp(text, "true");
+    else if (!strcmp(key, "BlockSize")) pending.blockSize = number;
+    else if (!strcmp(key, "STmin")) pending.stMin = number;
+}
+
+void IsoTpTable::endObject(uint8_t depth)
+{
+    if ((depth != 2) || !valid) return;
+    if (!hasTester || !hasECU)
+    {
+        Log.errorln("An ISO-TP link needs a Tester and an ECU ID.");
+        valid = false;
+    }
+    else if (numLinks >= ISOTP_MAX_LINKS)
+    {
+        Log.errorln("Too many ISO-TP links, the limit is %d.", ISOTP_MAX_LINKS);
+        valid = false;
+    }
+    else
+    {
+        if (pending.extended < 0) pending.extended = (pending.tester > 0x7FF) || (pending.ecu > 0x7FF);
+        links[numLinks++] = pending;
+    }
+}
+
+IsoTp::~IsoTp()
+{
+    release();
+}
+
+void IsoTp::begin(StagedTable<IsoTpTable>* _table)
+{
+    table = _table;
+    reset();
+}
+
+void IsoTp::reset()
+{
+    release();
+    uint8_t configured = (*table)->size();
+    for (uint8_t i = 0; i < configured; i++)
+    {
+        struct Link &link = links[i];
+        link.rx = new uint8_t[ISOTP_MAX_PDU];
+        link.tx = new uint8_t[ISOTP_MAX_PDU];
+        if ((link.rx == nullptr) || (link.tx == nullptr))
+        {
+            Log.errorln("Not enough memory for ISO-TP link %d.", i);
+            delete[] link.rx;
+            delete[] link.tx;
+            link.rx = link.tx = nullptr;
+            break;
+        }
+        link.config = (*table)->link(i);
+        uint32_t extended = link.config.extended ? RULES_EXTENDED : 0;
+        link.testerKey = link.config.tester | extended;
+        link.ecuKey = link.config.ecu | extended;
+        link.rxActive = false;
+        link.rxDone = false;
+        link.fcDue = false;
+        link.txState = TxIdle;
+        numLinks = i + 1;  // Only once it is complete, the interrupt reads it
+    }
+    if (numLinks > 0) Log.noticeln("\tTerminating ISO-TP for %d tester and ECU pairs.", numLinks);
+}
+
+FASTRUN bool IsoTp::received(uint8_t channel, const CAN_message_t &canFrame, uint32_t now)
+{
+    if (numLinks == 0) return false;
+    uint32_t key = RuleMatch::keyOf(canFrame);
+    struct Link* found = nullptr;
+    for (uint8_t i = 0; i < numLinks; i++)
+    {
+        if ((links[i].ecuKey == key) && (links[i].config.channel == channel))
+        {
+            found = &links[i];
+            break;
+        }
+    }
+    if ((found == nullptr) || (canFrame.len == 0)) return found != nullptr;
+    struct Link &link = *found;
+    const uint8_t *buf = canFrame.buf;
+    switch (buf[0] >> 4)
+    {
+        case SingleFrame:
+        {
+            uint8_t length = buf[0] & 0x0F;
+            if ((length == 0) || (length >= canFrame.len)) break;
+            if (link.rxDone)
+            {
+                Log.errorln("ISO-TP PDU from 0x%x dropped, the last one hasn't gone upstream.", link.config.ecu);
+                Metrics.isoTpAborts++;
+                break;
+            }
+            memcpy(link.rx, buf + 1, length);
+            link.rxLength = length;
+            link.rxActive = false;
+            link.rxDone = true;
+            break;
+        }
+        case FirstFrame:
+        {
+            uint16_t length = ((buf[0] & 0x0F) << 8) | buf[1];
+            if ((length < 8) || (canFrame.len < 8)) break;
+            if (link.rxDone)
+            {// Its buffer still holds the last PDU
+                Log.errorln("ISO-TP PDU from 0x%x refused, the last one hasn't gone upstream.", link.config.ecu);
+                Metrics.isoTpAborts++;
+                link.fcStatus = Overflow;
+                link.fcDue = true;
+                break;
+            }
+            memcpy(link.rx, buf + 2, 6);
+            link.rxLength = length;
+            link.rxReceived = 6;
+            link.rxSequence = 1;
+            link.rxBlock = 0;
+            link.rxDeadline = now + ISOTP_TIMEOUT_US;
+            link.rxActive = true;
+            link.fcStatus = ContinueToSend;
+            link.fcDue = true;
+            break;
+        }
+        case ConsecutiveFrame:
+        {
+            if (!link.rxActive) break;
+            if ((buf[0] & 0x0F) != link.rxSequence)
+            {
+                Log.errorln("ISO-TP consecutive frame from 0x%x out of sequence.", link.config.ecu);
+                abortRx(link);
+                break;
+            }
+            uint16_t length = min(uint16_t(7), uint16_t(link.rxLength - link.rxReceived));
+            if (canFrame.len < length + 1) break;
+            memcpy(link.rx + link.rxReceived, buf + 1, length);
+            link.rxReceived += length;
+            link.rxSequence = (link.rxSequence + 1) & 0x0F;
+            link.rxDeadline = now + ISOTP_TIMEOUT_US;
+            if (link.rxReceived >= link.rxLength)
+            {
+                link.rxActive = false;
+                link.rxDone = true;
+            }
+            else if ((link.config.blockSize > 0) && (++link.rxBlock >= link.config.blockSize))
+            {
+                link.rxBlock = 0;
+                link.fcStatus = ContinueToSend;
+                link.fcDue = true;
+            }
+            break;
+        }
+        case FlowControlFrame:
+            flowControl(link, canFrame, now);
+            break;
+    }
+    return true;
+}
+
+void IsoTp::flowControl(struct Link &link, const CAN_message_t &canFrame, uint32_t now)
+{// From the ECU, for a PDU the tester is sending
+    if (link.txState != TxWaitFC) return;
+    uint8_t status = canFrame.buf[0] & 0x0F;
+    if (status == ContinueToSend)
+    {
+        link.txBlockSize = canFrame.buf[1];
+        link.txBlockLeft = link.txBlockSize;
+        link.txSeparationUS = separation(canFrame.buf[2]);
+        link.txLast = now - link.txSeparationUS;  // The first one can go straight away
+        link.txState = TxSending;
+    }
+    else if (status == Wait)
+    {
+        link.txDeadline = now + ISOTP_TIMEOUT_US;
+    }
+    else
+    {
+        Log.errorln("ISO-TP PDU for 0x%x refused by the ECU.", link.config.ecu);
+        abortTx(link);
+    }
+}
+
+bool IsoTp::request(const struct PduHeader &header, const uint8_t *data)
+{
+    if (header.direction != Downlink) return false;
+    struct Link* found = find(header.tester, header.ecu, header.channel);
+    if (found == nullptr) return false;
+    struct Link &link = *found;
+    if ((header.total == 0) || (header.total > ISOTP_MAX_PDU) || (header.offset + header.length > header.total))
+    {
+        Log.errorln("ISO-TP PDU for 0x%x has an invalid length.", header.ecu);
+        return false;
+    }
+    if (header.offset == 0)
+    {
+        if ((link.txState != TxIdle) && (link.txState != TxAssembling))
+        {
+            Log.errorln("ISO-TP link to 0x%x is still sending, PDU dropped.", header.ecu);
+            Metrics.isoTpAborts++;
+            return false;
+        }
+        link.txSent = 0;
+        link.txState = TxAssembling;
+    }
+    else if ((link.txState != TxAssembling) || (header.offset != link.txSent))
+    {// A piece went missing, the whole PDU is lost
+        abortTx(link);
+        return false;
+    }
+    memcpy(link.tx + header.offset, data, header.length);
+    link.txSent += header.length;
+    link.txLength = header.total;
+    if (link.txSent >= link.txLength)
+    {
+        link.txSent = 0;
+        link.txState = (link.txLength <= 7) ? TxSingle : TxFirst;
+    }
+    return true;
+}
+
+FASTRUN bool IsoTp::next(uint8_t &channel, CAN_message_t &canFrame, uint32_t now)
+{
+    for (uint8_t i = 0; i < numLinks; i++)
+    {
+        struct Link &link = links[i];
+        if (link.rxActive && (int32_t(now - link.rxDeadline) > 0))
+        {
+            Log.errorln("ISO-TP PDU from 0x%x timed out.", link.config.ecu);
+            abortRx(link);
+        }
+        if ((link.txState == TxWaitFC) && (int32_t(now - link.txDeadline) > 0))
+        {
+            Log.errorln("ISO-TP flow control from 0x%x timed out.", link.config.ecu);
+            abortTx(link);
+        }
+        channel = link.config.channel;
+        nextLink = i;
+        nextIsFC = link.fcDue;
+        if (link.fcDue)
+        {
+            frame(canFrame, link.testerKey);
+            canFrame.buf[0] = (FlowControlFrame << 4) | link.fcStatus;
+            canFrame.buf[1] = link.config.blockSize;
+            canFrame.buf[2] = link.config.stMin;
+            return true;
+        }
+        if (link.txState == TxSingle)
+        {
+            frame(canFrame, link.testerKey);
+            canFrame.buf[0] = (SingleFrame << 4) | link.txLength;
+            memcpy(canFrame.buf + 1, link.tx, link.txLength);
+            return true;
+        }
+        if (link.txState == TxFirst)
+        {
+            frame(canFrame, link.testerKey);
+            canFrame.buf[0] = (FirstFrame << 4) | (link.txLength >> 8);
+            canFrame.buf[1] = link.txLength & 0xFF;
+            memcpy(canFrame.buf + 2, link.tx, 6);
+            return true;
+        }
+        if ((link.txState == TxSending) && (now - link.txLast >= link.txSeparationUS))
+        {
+            frame(canFrame, link.testerKey);
+            canFrame.buf[0] = (ConsecutiveFrame << 4) | link.txSequence;
+            memcpy(canFrame.buf + 1, link.tx + link.txSent, min(uint16_t(7), uint16_t(link.txLength - link.txSent)));
+            return true;
+        }
+    }
+    return false;
+}
+
+FASTRUN void IsoTp::written(uint32_t now)
+{
+    struct Link &link = links[nextLink];
+    if (nextIsFC)
+    {
+        link.fcDue = false;
+        return;
+    }
+    if (link.txState == TxSingle)
+    {
+        link.txState = TxIdle;
+        Metrics.isoTpPdus[1]++;
+    }
+    else if (link.txState == TxFirst)
+    {
+        link.txSent = 6;
+        link.txSequence = 1;
+        link.txDeadline = now + ISOTP_TIMEOUT_US;
+        link.txState = TxWaitFC;
+    }
+    else if (link.txState == TxSending)
+    {
+        link.txSent += min(uint16_t(7), uint16_t(link.txLength - link.txSent));
+        link.txSequence = (link.txSequence + 1) & 0x0F;
+        link.txLast = now;
+        if (link.txSent >= link.txLength)
+        {
+            link.txState = TxIdle;
+            Metrics.isoTpPdus[1]++;
+        }
+        else if ((link.txBlockSize > 0) && (--link.txBlockLeft == 0))
+        {
+            link.txDeadline = now + ISOTP_TIMEOUT_US;
+            link.txState = TxWaitFC;
+        }
+    }
+}
+
+const uint8_t* IsoTp::completed(struct PduHeader &header)
+{
+    for (uint8_t i = 0; i < numLinks; i++)
+    {
+        struct Link &link = links[i];
+        if (!link.rxDone) continue;
+        link.rxDone = false;
+        Metrics.isoTpPdus[0]++;
+        header = PduHeader();
+        header.tester = link.config.tester;
+        header.ecu = link.config.ecu;
+        header.total = link.rxLength;
+        header.channel = link.config.channel;
+        header.direction = Uplink;
+        return link.rx;
+    }
+    return nullptr;
+}
+
+struct IsoTp::Link* IsoTp::find(uint32_t tester, uint32_t ecu, uint8_t channel)
+{
+    for (uint8_t i = 0; i < numLinks; i++)
+    {
+        const struct IsoTpConfig &config = links[i].config;
+        if ((config.tester == tester) && (config.ecu == ecu) && (config.channel == channel)) return &links[i];
+    }
+    return nullptr;
+}
+
+void IsoTp::abortRx(struct Link &link)
+{
+    if (link.rxActive) Metrics.isoTpAborts++;
+    link.rxActive = false;
+    link.rxReceived = 0;
+}
+
+void IsoTp::release()
+{
+    numLinks = 0;
+    for (uint8_t i = 0; i < ISOTP_MAX_LINKS; i++)
+    {
+        delete[] links[i].rx;
+        delete[] links[i].tx;
+        links[i].rx = nullptr;
+        links[i].tx = nullptr;
+    }
+}
+
+void IsoTp::abortTx(struct Link &link)
+{
+    if ((link.txState != TxIdle) && (link.txState != TxAssembling)) Metrics.isoTpAborts++;
+    link.txState = TxIdle;
+    link.txSent = 0;
+}
+
+uint32_t IsoTp::separation(uint8_t stMin)
+{// STmin of a flow control frame in us, reserved values count as the longest
+    if (stMin <= 0x7F) return stMin * 1000;
+    if ((stMin >= 0xF1) && (stMin <= 0xF9)) return (stMin - 0xF0) * 100;
+    return 127000;
+}
+
+void IsoTp::frame(CAN_message_t &canFrame, uint32_t key)
+{
+    canFrame = CAN_message_t();
+    canFrame.id = key & ~RULES_EXTENDED;
+    canFrame.flags.extended = (key & RULES_EXTENDED) != 0;
+    canFrame.len = 8;
+    memset(canFrame.buf, ISOTP_PADDING, 8);
+}
@@ -0,0 +1,193 @@
+#ifndef iso_tp_h_
+#define iso_tp_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <HTTP/JsonStream.h>
+#include <Rules/Rules.h>
+
+#define ISOTP_MAX_LINKS 2  // Each takes two PDU buffers off the heap while it is configured
+#define ISOTP_MAX_PDU 4095  // Largest length a first frame can give
+#define ISOTP_FRAGMENT 1024  // PDU bytes per datagram
+#define ISOTP_TIMEOUT_US 1000000  // N_Bs and N_Cr
+#define ISOTP_PADDING 0xCC
+
+/*
+Tester and ECU CAN IDs whose ISO 15765-2 traffic is terminated on the node,
+from the "ISOTP" section of the session request, e.g.
+
+    {"Tester": "0x7E0", "ECU": "0x7E2", "Channel": 0,
+     "BlockSize": 8, "STmin": 0}
+
+"BlockSize" and "STmin" go in the flow control frames the node sends the
+ECU, both 0 by default for the whole PDU at bus speed. IDs over 0x7FF are
+taken to be extended unless "Extended" says otherwise.
+*/
+struct IsoTpConfig
+{
+    uint32_t tester = 0;
+    uint32_t ecu = 0;
+    uint8_t channel = 0;
+    int8_t extended = -1;  // -1 until the element says
+    uint8_t blockSize = 0;
+    uint8_t stMin = 0;
+};
+
+class IsoTpTable: public JsonSection
+{
+private:
+    struct IsoTpConfig links[ISOTP_MAX_LINKS];
+    struct IsoTpConfig pending;
+    uint8_t numLinks = 0;
+    bool hasTester = false;
+    bool hasECU = false;
+    bool valid = true;
+
+public:
+    void clear() { numLinks = 0; }
+    size_t size() { return numLinks; }
+    const struct IsoTpConfig &link(uint8_t i) { return links[i]; }
+
+    virtual void begin();
+    virtual void beginObject(uint8_t depth);
+    virtual void value(uint8_t depth, const char* key, const char* text, bool isString);
+    virtual void endObject(uint8_t depth);
+    virtual bool end() { return valid; }
+};
+
+/*
+Local ISO-TP termination for UDS sessions whose tester sits behind the
+controller. Over the multicast network every flow control and consecutive
+frame would cost a round trip and miss the N_Bs and N_Cr timeouts, so for
+each configured tester and ECU pair the node speaks ISO-TP on the bus itself
+and the session only carries whole PDUs (type 9 datagrams, a PduHeader and
+up to ISOTP_FRAGMENT bytes of the PDU each). Only PDUs marked Downlink are
+sent to an ECU, other members' uplink is ignored.
+
+From the ECU: single frames complete a PDU straight away, a first frame is
+answered with a flow control frame and the consecutive frames are collected
+(with another flow control every BlockSize frames) until the PDU is whole
+and can be sent upstream. Every frame from the ECU's ID is used up here.
+The ECU's frames take the fast lane (see terminates()), so flow control goes
+out on the next pass of the loop whether or not the uplink slot is open.
+Only one PDU per link waits to go upstream: a PDU that arrives before the
+last one has been sent is refused, a first frame with an overflow flow
+control, a single frame by dropping it.
+
+From the tester: the pieces of a PDU are put back together in order, then
+sent as a single frame, or as a first frame followed by consecutive frames
+paced by the block size and STmin of the ECU's flow control.
+
+Normal addressing, classic frames padded to 8 bytes and PDUs up to 4095
+bytes. A transfer that times out or goes out of sequence is dropped.
+*/
+class IsoTp
+{
+public:
+    struct PduHeader  // Follows the COMMBlock header of a type 9 datagram
+    {
+        uint32_t tester;
+        uint32_t ecu;
+        uint16_t total;  // Length of the whole PDU
+        uint16_t offset;  // Where this piece goes in it
+        uint16_t length;  // Bytes of the PDU in this datagram
+        uint8_t channel;
+        uint8_t direction;  // Uplink from an ECU or Downlink to it, see Rules.h
+    };
+
+private:
+    enum TxState
+    {
+        TxIdle,
+        TxAssembling,  // Pieces of the PDU still coming from the session
+        TxSingle,  // Single frame to write
+        TxFirst,  // First frame to write
+        TxWaitFC,
+        TxSending
+    };
+
+    struct Link
+    {
+        struct IsoTpConfig config;
+        uint32_t testerKey;  // Keys as in RuleMatch, with RULES_EXTENDED for 29 bit IDs
+        uint32_t ecuKey;
+
+        uint8_t *rx;  // ISOTP_MAX_PDU bytes
+        uint16_t rxLength;
+        uint16_t rxReceived;
+        uint8_t rxSequence;
+        uint8_t rxBlock;  // Consecutive frames since the last flow control
+        uint32_t rxDeadline;  // micros()
+        bool rxActive;
+        bool rxDone;  // Whole and waiting to be sent upstream
+        bool fcDue;
+        uint8_t fcStatus;  // FlowStatus of the flow control that is due
+
+        uint8_t *tx;  // ISOTP_MAX_PDU bytes
+        uint16_t txLength;
+        uint16_t txSent;  // Or assembled, while assembling
+        uint8_t txSequence;
+        uint8_t txBlockSize;
+        uint8_t txBlockLeft;
+        uint32_t txSeparationUS;
+        uint32_t txLast;  // micros() of the last consecutive frame
+        uint32_t txDeadline;
+        TxState txState;
+    };
+
+    StagedTable<IsoTpTable>* table = nullptr;
+    struct Link links[ISOTP_MAX_LINKS] = {};
+    volatile uint8_t numLinks = 0;  // Also read from the CAN receive interrupt
+    uint8_t nextLink = 0;  // Link of the frame next() built
+    bool nextIsFC = false;
+
+public:
+    ~IsoTp();
+
+    void begin(StagedTable<IsoTpTable>* _table);
+
+    // Takes the links from the live table, dropping any transfer in progress
+    void reset();
+
+    // True for frames from a link's ECU, called from the receive interrupt
+    bool terminates(uint8_t channel, const CAN_message_t &canFrame)
+    {
+        uint32_t key = RuleMatch::keyOf(canFrame);
+        for (uint8_t i = 0; i < numLinks; i++)
+        {
+            if ((links[i].ecuKey == key) && (links[i].config.channel == channel)) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @return true if the frame belongs to a link and was used up
+     */
+    bool received(uint8_t channel, const CAN_message_t &canFrame, uint32_t now);
+
+    // A piece of a PDU from the session, false if no link takes it
+    bool request(const struct PduHeader &header, const uint8_t *data);
+
+    /**
+     * Builds the next frame due on the bus. It is only taken once written()
+     * is called, so a frame no mailbox was free for comes again.
+     */
+    bool next(uint8_t &channel, CAN_message_t &canFrame, uint32_t now);
+    void written(uint32_t now);
+
+    /**
+     * @return a PDU from an ECU that is ready to go upstream, nullptr if none
+     */
+    const uint8_t* completed(struct PduHeader &header);
+
+private:
+    struct Link* find(uint32_t tester, uint32_t ecu, uint8_t channel);
+    void flowControl(struct Link &link, const CAN_message_t &canFrame, uint32_t now);
+    void abortRx(struct Link &link);
+    void abortTx(struct Link &link);
+    void release();
+    static uint32_t separation(uint8_t stMin);
+    static void frame(CAN_message_t &canFrame, uint32_t id);
+};
+
+#endif /* iso_tp_h_ */
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <J1939/AddressTable.h>
+#include <FlexCAN_T4.h>
+
+AddressTable::AddressTable()
+{
+    reset();
+}
+
+void AddressTable::reset()
+{
+    memset(handles, 0, sizeof(handles));
+    for (int i = 0; i < J1939_MAX_NAMES; i++)
+    {
+        Names[i] = NameEntry();
+    }
+    size = 0;
+    changed = false;
+}
+
+void AddressTable::update(uint8_t channel, const CAN_message_t &canFrame)
+{
+    if (!canFrame.flags.extended || (canFrame.len < 8)) return;
+    if (((canFrame.id >> 16) & 0xFF) != (J1939_PGN_ADDRESS_CLAIMED >> 8)) return;
+    uint64_t name = 0;
+    for (int i = 7; i >= 0; i--)
+    {// NAME is sent least significant byte first
+        name = (name << 8) | canFrame.buf[i];
+    }
+    uint8_t address = canFrame.id & 0xFF;
+    if (address == J1939_NULL_ADDRESS)
+    {// Cannot claim address
+        release(channel, name);
+    }
+    else if (address != J1939_GLOBAL_ADDRESS)
+    {
+        claim(channel, address, name);
+    }
+}
+
+uint8_t AddressTable::handle(uint8_t channel, const CAN_message_t &canFrame)
+{
+    return canFrame.flags.extended ? handles[channel][canFrame.id & 0xFF] : 0;
+}
+
+int16_t AddressTable::address(uint8_t channel, uint64_t name)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        if ((Names[i].name == name) && (Names[i].channel == channel) && Names[i].claimed)
+        {
+            return Names[i].address;
+        }
+    }
+    return -1;
+}
+
+uint32_t AddressTable::pgn(uint32_t id)
+{
+    uint32_t dp = (id >> 24) & 0x03;
+    uint32_t pf = (id >> 16) & 0xFF;
+    uint32_t ps = (id >> 8) & 0xFF;
+    // PDU1 format frames have a destination address instead of a group extension
+    return (dp << 16) | (pf << 8) | ((pf < 240) ? 0 : ps);
+}
+
+void AddressTable::makeClaimRequest(CAN_message_t &canFrame)
+{
+    // Request (PGN 59904) for Address Claimed sent globally from the null
+    // address, every ECU on the bus answers with its claim.
+    canFrame.id = (6UL << 26) | (uint32_t(J1939_PGN_REQUEST >> 8) << 16) |
+        (J1939_GLOBAL_ADDRESS << 8) | J1939_NULL_ADDRESS;
+    canFrame.flags.extended = true;
+    canFrame.len = 3;
+    canFrame.buf[0] = J1939_PGN_ADDRESS_CLAIMED & 0xFF;
+    canFrame.buf[1] = (J1939_PGN_ADDRESS_CLAIMED >> 8) & 0xFF;
+    canFrame.buf[2] = (J1939_PGN_ADDRESS_CLAIMED >> 16) & 0xFF;
+}
+
+void AddressTable::claim(uint8_t channel, uint8_t address, uint64_t name)
+{
+    uint8_t holder = handles[channel][address];
+    if (holder != 0)
+    {
+        struct NameEntry &current = Names[holder - 1];
+        if (current.name == name) return;  // Repeated claim
+        if (current.name < name) return;  // Will lose the contention
+    }
+    struct NameEntry *e = entry(name, true);
+    if (holder != 0)
+    {// Lost the address, even if the table has no room for the winner
+        struct NameEntry &current = Names[holder - 1];
+        current.claimed = false;
+        current.address = J1939_NULL_ADDRESS;
+        handles[channel][address] = 0;
+        changed = true;
+    }
+    if (e == nullptr) return;  // Frames from the address go untagged
+    if (e->claimed)
+    {// The ECU moved to a new address
+        handles[e->channel][e->address] = 0;
+    }
+    e->channel = channel;
+    e->address = address;
+    e->claimed = true;
+    handles[channel][address] = e->handle;
+    changed = true;
+}
+
+void AddressTable::release(uint8_t channel, uint64_t name)
+{
+    struct NameEntry *e = entry(name, false);
+    if ((e == nullptr) || !e->claimed || (e->channel != channel)) return;
+    handles[channel][e->address] = 0;
+    e->claimed = false;
+    e->address = J1939_NULL_ADDRESS;
+    changed = true;
+}
+
+struct AddressTable::NameEntry* AddressTable::entry(uint64_t name, bool create)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        if (Names[i].name == name) return &Names[i];
+    }
+    if (!create || (size >= J1939_MAX_NAMES)) return nullptr;
+    Names[size].name = name;
+    Names[size].handle = size + 1;
+    return &Names[size++];
+}
@@ -0,0 +1,63 @@
+#ifndef address_table_h_
+#define address_table_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+
+#define J1939_CHANNELS 2
+#define J1939_MAX_NAMES 64
+#define J1939_NULL_ADDRESS 254
+#define J1939_GLOBAL_ADDRESS 255
+#define J1939_PGN_ADDRESS_CLAIMED 60928  // 0xEE00
+#define J1939_PGN_REQUEST 59904  // 0xEA00
+
+/*
+Tracks J1939 address claiming (J1939-81) on each channel so frames can be tied
+to the ECU that sent them instead of to a source address that may change.
+
+Every NAME seen claiming an address gets a handle, a small number that stays
+the same for the rest of the session even when the ECU moves to another
+address. Handle 0 means the sender is unknown. When two ECUs contend for an
+address the NAME with the lower value wins, so a claim from a higher NAME
+for an address that is already held is ignored; the loser will either claim
+another address or announce that it cannot claim one.
+*/
+
+class AddressTable
+{
+public:
+    struct NameEntry
+    {
+        uint64_t name = 0;
+        uint8_t handle = 0;
+        uint8_t channel = 0;
+        uint8_t address = J1939_NULL_ADDRESS;
+        bool claimed = false;
+    };
+
+    struct NameEntry Names[J1939_MAX_NAMES];
+    uint8_t size = 0;
+    bool changed = false;
+
+private:
+    uint8_t handles[J1939_CHANNELS][256];
+
+public:
+    AddressTable();
+
+    void reset();
+    void update(uint8_t channel, const CAN_message_t &canFrame);
+    uint8_t handle(uint8_t channel, uint8_t address) { return handles[channel][address]; }
+    uint8_t handle(uint8_t channel, const CAN_message_t &canFrame);
+    int16_t address(uint8_t channel, uint64_t name);
+
+    static uint32_t pgn(uint32_t id);
+    static void makeClaimRequest(CAN_message_t &canFrame);
+
+private:
+    void claim(uint8_t channel, uint8_t address, uint64_t name);
+    void release(uint8_t channel, uint64_t name);
+    struct NameEntry* entry(uint64_t name, bool create);
+};
+
+#endif /* address_table_h_ */
@@ -0,0 +1,293 @@
+#include <Arduino.h>
+#include <Metrics/Metrics.h>
+#include <BusStats/BusStats.h>
+#include <IdIndex/IdIndex.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+struct MetricCounters Metrics = {};
+
+// The binary format is one chunk, counters added to MetricCounters have to fit it
+static_assert(sizeof(MetricsWriter::BinaryHeader) + sizeof(MetricCounters) <= METRICS_CHUNK_SIZE, "The binary metrics no longer fit a chunk");
+
+namespace
+{
+    const char* dropReasons[NumDropReasons] = {"can_tx_full", "udp_send_failed", "malformed_datagram", "can_rx_full", "auth_failed"};
+    const char* trafficClasses[METRICS_TRAFFIC_CLASSES] = {"can", "sensor", "health", "bulk"};
+}
+
+void MetricsWriter::attach(BusStats *_busStats, IdIndex *_idIndex)
+{
+    busStats = _busStats;
+    idIndex = _idIndex;
+}
+
+void MetricsWriter::begin(Format _format)
+{
+    // Copy the counters so the whole response describes the same moment.
+    noInterrupts();
+    snapshot = Metrics;
+    interrupts();
+    format = _format;
+    section = 0;
+    position = 0;
+    writing = true;
+}
+
+const char* MetricsWriter::contentType()
+{
+    return (format == Text) ? "text/plain; version=0.0.4" : "application/octet-stream";
+}
+
+size_t MetricsWriter::next(const char* &chunk)
+{
+    chunk = buffer;
+    size_t used = 0;
+    if (format == Binary)
+    {
+        if (section++ > 0)
+        {
+            writing = false;
+            return 0;
+        }
+        struct BinaryHeader header = {METRICS_BINARY_VERSION, sizeof(MetricCounters)};
+        memcpy(buffer, &header, sizeof(header));
+        memcpy(buffer + sizeof(header), &snapshot, sizeof(snapshot));
+        return sizeof(header) + sizeof(snapshot);
+    }
+    switch (section++)
+    {
+        case 0:
+            used = family(used, "sssf_can_frames_total", "counter", "CAN frames read from or written to a bus.");
+            for (int c = 0; c < METRICS_CHANNELS; c++)
+            {
+                used = append(used, "sssf_can_frames_total{channel=\"%d\",direction=\"in\"} %" PRIu32 "\n", c, snapshot.canRx[c]);
+                used = append(used, "sssf_can_frames_total{channel=\"%d\",direction=\"out\"} %" PRIu32 "\n", c, snapshot.canTx[c]);
+            }
+            break;
+        case 1:
+            used = family(used, "sssf_datagrams_total", "counter", "Session datagrams received or sent.");
+            used = append(used, "sssf_datagrams_total{direction=\"in\"} %" PRIu32 "\n", snapshot.datagramsRx);
+            used = append(used, "sssf_datagrams_total{direction=\"out\"} %" PRIu32 "\n", snapshot.datagramsTx);
+            break;
+        case 2:
+            used = family(used, "sssf_drops_total", "counter", "Frames or datagrams dropped, by reason.");
+            for (int r = 0; r < NumDropReasons; r++)
+            {
+                used = append(used, "sssf_drops_total{reason=\"%s\"} %" PRIu32 "\n", dropReasons[r], snapshot.drops[r]);
+            }
+            break;
+        case 3:
+            used = family(used, "sssf_can_tx_queue_high_water", "gauge", "Most frames waiting for a transmit mailbox.");
+            for (int c = 0; c < METRICS_CHANNELS; c++)
+            {
+                used = append(used, "sssf_can_tx_queue_high_water{channel=\"%d\"} %" PRIu32 "\n", c, snapshot.canTxQueueHighWater[c]);
+            }
+            break;
+        case 4:
+            used = family(used, "sssf_loops_total", "counter", "Passes of the forwarding loop.");
+            used = append(used, "sssf_loops_total %" PRIu32 "\n", snapshot.loops);
+            used = family(used, "sssf_loop_seconds", "gauge", "Forwarding loop duration.");
+            used = append(used, "sssf_loop_seconds{stat=\"last\"} %.6f\n", snapshot.loopLastUS / 1000000.0);
+            used = append(used, "sssf_loop_seconds{stat=\"max\"} %.6f\n", snapshot.loopMaxUS / 1000000.0);
+            used = append(used, "sssf_loop_seconds{stat=\"mean\"} %.6f\n",
+                (snapshot.loops > 0) ? (snapshot.loopTotalUS / double(snapshot.loops)) / 1000000.0 : 0.0);
+            break;
+        case 5:
+            used = family(used, "sssf_clock_offset_seconds", "gauge", "Last clock correction from NTP.");
+            used = append(used, "sssf_clock_offset_seconds %.6f\n", snapshot.clockOffsetUS / 1000000.0);
+            break;
+        case 6:
+            used = family(used, "sssf_session_rejoins_total", "counter", "Session group re-joins after silence.");
+            used = append(used, "sssf_session_rejoins_total %" PRIu32 "\n", snapshot.rejoins);
+            used = family(used, "sssf_session_socket_resets_total", "counter", "Session sockets found closed and recreated.");
+            used = append(used, "sssf_session_socket_resets_total %" PRIu32 "\n", snapshot.socketResets);
+            break;
+        case 7:
+            used = family(used, "sssf_bus_load_ratio", "gauge", "Bus load over the last health report window.");
+            for (int c = 0; c < METRICS_CHANNELS; c++)
+            {
+                used = append(used, "sssf_bus_load_ratio{channel=\"%d\"} %.4f\n", c, snapshot.busLoad[c] / 100.0);
+            }
+            break;
+        case 8:
+            used = family(used, "sssf_nacks_total", "counter", "NACKs for missing reliable datagrams.");
+            used = append(used, "sssf_nacks_total{direction=\"out\"} %" PRIu32 "\n", snapshot.nacksSent);
+            used = append(used, "sssf_nacks_total{direction=\"in\"} %" PRIu32 "\n", snapshot.nacksReceived);
+            used = family(used, "sssf_retransmits_total", "counter", "Datagrams sent again in answer to a NACK.");
+            used = append(used, "sssf_retransmits_total %" PRIu32 "\n", snapshot.retransmits);
+            used = family(used, "sssf_recovered_total", "counter", "Missing datagrams recovered from a retransmission.");
+            used = append(used, "sssf_recovered_total %" PRIu32 "\n", snapshot.recovered);
+            break;
+        case 9:
+            used = family(used, "sssf_class_latency_seconds", "gauge", "One way latency of received datagrams by traffic class.");
+            for (int c = 0; c < METRICS_TRAFFIC_CLASSES; c++)
+            {
+                used = append(used, "sssf_class_latency_seconds{class=\"%s\",stat=\"max\"} %.6f\n",
+                    trafficClasses[c], snapshot.latency[c].maxUS / 1000000.0);
+            }
+            break;
+        case 10:  // Same family, split to fit the buffer
+            for (int c = 0; c < METRICS_TRAFFIC_CLASSES; c++)
+            {
+                const struct ClassLatency &l = snapshot.latency[c];
+                used = append(used, "sssf_class_latency_seconds{class=\"%s\",stat=\"mean\"} %.6f\n",
+                    trafficClasses[c], (l.count > 0) ? (l.totalUS / double(l.count)) / 1000000.0 : 0.0);
+            }
+            break;
+        case 11:
+            used = family(used, "sssf_fast_lane_frames_total", "counter", "Critical CAN frames that took the fast lane.");
+            used = append(used, "sssf_fast_lane_frames_total{direction=\"up\"} %" PRIu32 "\n", snapshot.fastLaneUp);
+            used = append(used, "sssf_fast_lane_frames_total{direction=\"down\"} %" PRIu32 "\n", snapshot.fastLaneDown);
+            break;
+        case 12:
+            used = family(used, "sssf_uplink_slots_total", "counter", "Uplink slots sent in or missed.");
+            used = append(used, "sssf_uplink_slots_total{result=\"served\"} %" PRIu32 "\n", snapshot.slotsServed);
+            used = append(used, "sssf_uplink_slots_total{result=\"missed\"} %" PRIu32 "\n", snapshot.slotsMissed);
+            used = family(used, "sssf_uplink_slot_utilization", "gauge", "Fraction of the served uplink slots spent sending.");
+            used = append(used, "sssf_uplink_slot_utilization %.4f\n",
+                ((snapshot.slotsServed > 0) && (snapshot.slotWidthUS > 0)) ?
+                snapshot.slotBusyUS / (double(snapshot.slotsServed) * snapshot.slotWidthUS) : 0.0);
+            break;
+        case 13:
+            used = family(used, "sssf_decimated_frames_total", "counter", "CAN frames held back by a rate cap.");
+            used = append(used, "sssf_decimated_frames_total %" PRIu32 "\n", snapshot.decimated);
+            break;
+        case 14:
+            used = family(used, "sssf_isotp_pdus_total", "counter", "ISO-TP PDUs terminated on the node.");
+            used = append(used, "sssf_isotp_pdus_total{direction=\"up\"} %" PRIu32 "\n", snapshot.isoTpPdus[0]);
+            used = append(used, "sssf_isotp_pdus_total{direction=\"down\"} %" PRIu32 "\n", snapshot.isoTpPdus[1]);
+            used = family(used, "sssf_isotp_aborts_total", "counter", "ISO-TP transfers dropped on a timeout or error.");
+            used = append(used, "sssf_isotp_aborts_total %" PRIu32 "\n", snapshot.isoTpAborts);
+            break;
+        case 15:
+            used = family(used, "sssf_ethernet_packet_failures_total", "counter", "Datagrams beginPacket or endPacket failed for.");
+            used = append(used, "sssf_ethernet_packet_failures_total{call=\"begin\"} %" PRIu32 "\n", snapshot.beginPacketFailures);
+            used = append(used, "sssf_ethernet_packet_failures_total{call=\"end\"} %" PRIu32 "\n", snapshot.endPacketFailures);
+            used = family(used, "sssf_ethernet_spi_seconds_total", "counter", "Time spent in calls to the Ethernet chip.");
+            used = append(used, "sssf_ethernet_spi_seconds_total %.6f\n", snapshot.spiBusyCycles / double(F_CPU));
+            break;
+        case 16:
+            used = family(used, "sssf_ethernet_spi_busy_ratio", "gauge", "Fraction of the last second spent in calls to the Ethernet chip.");
+            used = append(used, "sssf_ethernet_spi_busy_ratio %.4f\n", snapshot.spiBusyLastSecondUS / 1000000.0);
+            used = family(used, "sssf_ethernet_socket_buffer_bytes", "gauge", "Size of each socket's receive and transmit buffer.");
+            used = append(used, "sssf_ethernet_socket_buffer_bytes %" PRIu16 "\n", snapshot.socketBufferSize);
+            break;
+        case 17:  // Only sockets that have been open, to fit the buffer
+            used = family(used, "sssf_ethernet_rx_bytes", "gauge", "Bytes waiting in a socket's receive buffer.");
+            used = sockets(used, "sssf_ethernet_rx_bytes", snapshot.socketRx);
+            break;
+        case 18:
+            used = family(used, "sssf_ethernet_rx_high_water", "gauge", "Most bytes seen waiting in a socket's receive buffer.");
+            used = sockets(used, "sssf_ethernet_rx_high_water", snapshot.socketRxHighWater);
+            break;
+        case 19:
+            used = family(used, "sssf_ethernet_tx_bytes", "gauge", "Bytes not sent yet from a socket's transmit buffer.");
+            used = sockets(used, "sssf_ethernet_tx_bytes", snapshot.socketTx);
+            break;
+        case 20:
+            used = family(used, "sssf_ethernet_tx_high_water", "gauge", "Most bytes seen not sent from a socket's transmit buffer.");
+            used = sockets(used, "sssf_ethernet_tx_high_water", snapshot.socketTxHighWater);
+            break;
+        case 21:
+            used = family(used, "sssf_capture_frames_total", "counter", "CAN frames recorded to the SD card or dropped.");
+            used = append(used, "sssf_capture_frames_total{result=\"recorded\"} %" PRIu32 "\n", snapshot.captureFrames);
+            used = append(used, "sssf_capture_frames_total{result=\"dropped\"} %" PRIu32 "\n", snapshot.captureDrops);
+            used = family(used, "sssf_capture_bytes_total", "counter", "Capture records before compression and bytes written to the card.");
+            used = append(used, "sssf_capture_bytes_total{stage=\"raw\"} %" PRIu64 "\n", snapshot.captureRawBytes);
+            used = append(used, "sssf_capture_bytes_total{stage=\"stored\"} %" PRIu64 "\n", snapshot.captureStoredBytes);
+            break;
+        case 22:
+            used = family(used, "sssf_capture_write_seconds", "gauge", "Time the loop spent in one SD card write or flush.");
+            used = append(used, "sssf_capture_write_seconds{stat=\"last\"} %.6f\n", snapshot.captureWriteLastUS / 1000000.0);
+            used = append(used, "sssf_capture_write_seconds{stat=\"max\"} %.6f\n", snapshot.captureWriteMaxUS / 1000000.0);
+            used = family(used, "sssf_capture_write_seconds_total", "counter", "Time the loop spent in SD card writes and flushes.");
+            used = append(used, "sssf_capture_write_seconds_total %.6f\n", snapshot.captureWriteUS / 1000000.0);
+            break;
+        case 23:
+            used = family(used, "sssf_capture_stalls_total", "counter", "SD card writes and flushes that held the loop too long.");
+            used = append(used, "sssf_capture_stalls_total %" PRIu32 "\n", snapshot.captureStalls);
+            break;
+        case 24:
+            used = family(used, "sssf_id_index_ids", "gauge", "CAN IDs on both channels given a slot for per ID state.");
+            used = append(used, "sssf_id_index_ids %" PRIu32 "\n", snapshot.idIndexSize);
+            used = family(used, "sssf_id_index_overflows_total", "counter", "CAN frames whose ID didn't fit in the full ID index.");
+            used = append(used, "sssf_id_index_overflows_total %" PRIu32 "\n", snapshot.idIndexOverflows);
+            break;
+        case 25:
+            if (idIndex != nullptr) used = ids(used, IdFrames);
+            break;
+        case 26:
+            if (idIndex != nullptr) used = ids(used, IdPeriod);
+            break;
+        case 27:
+            if (idIndex != nullptr) used = ids(used, IdJitter);
+            break;
+        case 28:
+            if (idIndex != nullptr) used = ids(used, IdDlc);
+            break;
+        default:
+            writing = false;
+            break;
+    }
+    // An empty chunk would end the response, so go on to the next section
+    if ((used == 0) && writing) return next(chunk);
+    return used;
+}
+
+size_t MetricsWriter::family(size_t used, const char* name, const char* type, const char* help)
+{
+    used = append(used, "# HELP %s %s\n", name, help);
+    return append(used, "# TYPE %s %s\n", name, type);
+}
+
+size_t MetricsWriter::sockets(size_t used, const char* name, const uint16_t *values)
+{
+    for (int s = 0; s < METRICS_SOCKETS; s++)
+    {
+        if (!(snapshot.socketsOpen & (1 << s))) continue;
+        used = append(used, "%s{socket=\"%d\"} %" PRIu16 "\n", name, s, values[s]);
+    }
+    return used;
+}
+
+size_t MetricsWriter::ids(size_t used, IdFamily idFamily)
+{// Picks up at position, leaving section on this family until the index is done
+    static const char* names[] = {"sssf_can_id_frames_total", "sssf_can_id_period_seconds", "sssf_can_id_jitter_seconds", "sssf_can_id_dlc"};
+    const char* name = names[idFamily];
+    if (position == 0)
+    {
+        if (idFamily == IdFrames) used = family(used, name, "counter", "CAN frames read per channel and ID this session.");
+        else if (idFamily == IdPeriod) used = family(used, name, "gauge", "Mean time between frames per channel and ID.");
+        else if (idFamily == IdJitter) used = family(used, name, "gauge", "Standard deviation of the time between frames per channel and ID.");
+        else used = family(used, name, "gauge", "Data length code of the last frame read per channel and ID.");
+    }
+    uint32_t key;
+    int16_t slot;
+    while ((position < ID_INDEX_ENTRIES) && (used < METRICS_CHUNK_SIZE - METRICS_ID_LINE))
+    {
+        if (!idIndex->at(position++, key, slot)) continue;
+        const struct BusStats::IDStats *stats = busStats->find(slot);
+        uint8_t channel = (key >> ID_INDEX_CHANNEL_SHIFT) & 0x3;
+        uint32_t id = key & ((1UL << ID_INDEX_CHANNEL_SHIFT) - 1);
+        const char* label = (key & RULES_EXTENDED) ? "%s{channel=\"%u\",id=\"%08" PRIX32 "\"} " : "%s{channel=\"%u\",id=\"%03" PRIX32 "\"} ";
+        used = append(used, label, name, channel, id);
+        if (idFamily == IdFrames) used = append(used, "%" PRIu32 "\n", stats->count);
+        else if (idFamily == IdPeriod) used = append(used, "%.6f\n", stats->meanPeriod / 1000000.0);
+        else if (idFamily == IdJitter) used = append(used, "%.6f\n", busStats->jitter(*stats) / 1000000.0);
+        else used = append(used, "%" PRIu8 "\n", stats->dlc);
+    }
+    if (position < ID_INDEX_ENTRIES) section--;
+    else position = 0;
+    return used;
+}
+
+size_t MetricsWriter::append(size_t used, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + used, METRICS_CHUNK_SIZE - used, format, args);
+    va_end(args);
+    if (written < 0) return used;
+    return min(used + written, (size_t) METRICS_CHUNK_SIZE - 1);
+}
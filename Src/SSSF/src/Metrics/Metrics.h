@@ -0,0 +1,157 @@
+#ifndef metrics_h_
+#define metrics_h_
+
+#include <Arduino.h>
+
+#define METRICS_CHANNELS 2
+#define METRICS_CHUNK_SIZE 512
+#define METRICS_TRAFFIC_CLASSES 4  // See TrafficClass in CANNode.h
+#define METRICS_SOCKETS 8  // WIZnet sockets, see EthernetStats.h
+#define METRICS_BINARY_VERSION 12
+#define METRICS_ID_LINE 96  // Room left in a chunk for one more per ID line
+
+class BusStats;
+class IdIndex;
+
+enum DropReason
+{
+    CANTxFull,  // Transmit backlog was full, see CANNode::send()
+    UDPSendFailed,  // beginPacket or endPacket failed
+    MalformedDatagram,  // Session datagram was short or of an unknown type
+    CANRxFull,  // Receive ring of a channel was full
+    AuthFailed,  // Session datagram had no valid tag or was replayed
+    NumDropReasons
+};
+
+struct ClassLatency  // One way, from the sender's timestamp to our clock
+{
+    uint32_t count;
+    uint32_t maxUS;
+    uint64_t totalUS;
+};
+
+/*
+Counters for the live metrics endpoint. They are plain integers in static
+memory that the forwarding path bumps as it goes, nothing here allocates or
+formats until somebody scrapes.
+*/
+struct MetricCounters
+{
+    uint32_t canRx[METRICS_CHANNELS];  // Frames read from each bus
+    uint32_t canTx[METRICS_CHANNELS];  // Frames written to each bus
+    uint32_t datagramsRx;
+    uint32_t datagramsTx;
+    uint32_t drops[NumDropReasons];
+    uint32_t canTxQueueHighWater[METRICS_CHANNELS];
+    uint32_t loops;
+    uint32_t loopLastUS;
+    uint32_t loopMaxUS;
+    uint64_t loopTotalUS;
+    int64_t clockOffsetUS;  // Last correction applied from NTP
+    uint32_t rejoins;
+    uint32_t socketResets;
+    float busLoad[METRICS_CHANNELS];
+    uint32_t nacksSent;
+    uint32_t nacksReceived;  // Addressed to this node
+    uint32_t retransmits;
+    uint32_t recovered;  // Missing datagrams received from a retransmission
+    struct ClassLatency latency[METRICS_TRAFFIC_CLASSES];
+    uint32_t fastLaneUp;  // Critical frames sent to the session
+    uint32_t fastLaneDown;  // Critical frames written to a bus
+    uint32_t slotsServed;  // Uplink slots the loop sent in, see UplinkSchedule.h
+    uint32_t slotsMissed;  // Uplink slots that passed while the loop was busy
+    uint32_t slotWidthUS;  // 0 when the uplink isn't slotted
+    uint64_t slotBusyUS;  // Time spent sending in open slots
+    uint32_t decimated;  // Frames held back by a rate cap
+    uint32_t isoTpPdus[2];  // Whole PDUs terminated locally, from the ECUs and to them
+    uint32_t isoTpAborts;  // ISO-TP transfers dropped
+    uint32_t beginPacketFailures;  // Session and NTP datagrams the chip had no room for
+    uint32_t endPacketFailures;  // Session and NTP datagrams the chip failed to send
+    uint64_t spiBusyCycles;  // Spent in calls to the Ethernet chip, see SPITimer
+    uint32_t spiBusyLastSecondUS;
+    uint16_t socketBufferSize;  // Of each socket's receive and transmit buffer
+    uint16_t socketsOpen;  // Bit n set once socket n has been sampled open
+    uint16_t socketRx[METRICS_SOCKETS];  // Bytes waiting in the receive buffer at the last sample
+    uint16_t socketRxHighWater[METRICS_SOCKETS];
+    uint16_t socketTx[METRICS_SOCKETS];  // Bytes not sent yet from the transmit buffer
+    uint16_t socketTxHighWater[METRICS_SOCKETS];
+    uint32_t captureFrames;  // Frames recorded to the SD card, see CaptureLog.h
+    uint32_t captureDrops;  // Frames the card couldn't keep up with
+    uint64_t captureRawBytes;  // Records before compression
+    uint64_t captureStoredBytes;  // Written to the card, headers included
+    uint64_t captureWriteUS;  // The loop spent in card writes and flushes
+    uint32_t captureWriteLastUS;
+    uint32_t captureWriteMaxUS;
+    uint32_t captureStalls;  // Writes and flushes over CAPTURE_STALL_US
+    uint32_t idIndexSize;  // Channel and ID pairs with a slot, see IdIndex.h
+    uint32_t idIndexOverflows;  // Frames whose ID came after the index filled
+};
+
+extern struct MetricCounters Metrics;
+
+/*
+Formats a snapshot of the counters for GET /metrics (Prometheus text format)
+or GET /metrics.bin (the MetricCounters struct after a small header). The text
+is produced one metric family at a time into a fixed buffer so a scrape is
+spread over several passes of the forwarding loop instead of stalling it.
+
+The text ends with BusStats' per CAN ID frame count, mean period and jitter,
+a family per pass over the IdIndex and as many chunks as the IDs take. Those
+are read live as the scrape gets to them rather than from the snapshot, the
+table is too big to copy.
+*/
+class MetricsWriter
+{
+public:
+    enum Format
+    {
+        Text,
+        Binary
+    };
+
+    struct BinaryHeader
+    {
+        uint16_t version;
+        uint16_t size;
+    };
+
+private:
+    enum IdFamily
+    {
+        IdFrames,
+        IdPeriod,
+        IdJitter,
+        IdDlc
+    };
+
+    Format format = Text;
+    bool writing = false;
+    uint8_t section = 0;
+    uint16_t position = 0;  // In the IdIndex, of the per ID family being written
+    BusStats *busStats = nullptr;
+    IdIndex *idIndex = nullptr;
+    struct MetricCounters snapshot;
+    char buffer[METRICS_CHUNK_SIZE];
+
+public:
+    // Where the per ID families come from, left out until this is called
+    void attach(BusStats *_busStats, IdIndex *_idIndex);
+    void begin(Format _format);
+    bool active() { return writing; }
+    const char* contentType();
+
+    /**
+     * Formats the next piece of the response.
+     *
+     * @return number of bytes in chunk, 0 once the response is complete
+     */
+    size_t next(const char* &chunk);
+
+private:
+    size_t family(size_t used, const char* name, const char* type, const char* help);
+    size_t sockets(size_t used, const char* name, const uint16_t *values);
+    size_t ids(size_t used, IdFamily idFamily);
+    size_t append(size_t used, const char* format, ...);
+};
+
+#endif /* metrics_h_ */
@@ -0,0 +1,115 @@
+#include <Arduino.h>
+#include <NetworkStats/HealthAggregator.h>
+#include <math.h>
+
+void HealthAggregator::start(size_t _members, uint32_t index, bool _enabled, int32_t _designated)
+{
+    enabled = _enabled;
+    // Index 0 is the controller, it doesn't aggregate and isn't elected
+    designated = ((_designated > 0) && (size_t(_designated) < _members)) ? _designated : -1;
+    self = index;
+    members = _members;
+    aggregator = (designated >= 0) ? designated : self;
+    collecting = false;
+}
+
+void HealthAggregator::stop()
+{
+    enabled = false;
+    collecting = false;
+}
+
+bool HealthAggregator::digest(const NetworkStats &stats, struct Digest &out)
+{
+    out = Digest();
+    out.reporters = 1;
+    uint32_t lowest = self;
+    for (size_t i = 0; i < stats.size; i++)
+    {
+        const struct NetworkStats::NodeReport &r = stats.HealthReport[i];
+        if ((i == self) || ((r.latency.count == 0) && (r.packetLoss == 0))) continue;
+        if (i > 0) lowest = min(lowest, (uint32_t) i);
+        out.pairs++;
+        out.packetLoss += r.packetLoss;
+        out.maxPacketLoss = max(out.maxPacketLoss, r.packetLoss);
+        merge(out.latency, r.latency);
+        merge(out.jitter, r.jitter);
+        merge(out.goodput, r.goodput);
+    }
+    // The pairs are only compared with the rest once the means are known
+    float spread = HEALTH_OUTLIER_SIGMAS * sqrtf(out.latency.variance);
+    for (size_t i = 0; i < stats.size; i++)
+    {
+        const struct NetworkStats::NodeReport &r = stats.HealthReport[i];
+        if ((i == self) || ((r.latency.count == 0) && (r.packetLoss == 0))) continue;
+        float score = r.packetLoss / HEALTH_OUTLIER_LOSS;
+        if ((r.latency.count > 0) && (spread > 0)) score = max(score, (r.latency.mean - out.latency.mean) / spread);
+        if (score >= 1.0) insert(out, {uint16_t(self), uint16_t(i), score, r});
+    }
+    aggregator = (designated >= 0) ? designated : lowest;
+    return aggregator == self;
+}
+
+void HealthAggregator::offer(const struct Digest &digest)
+{
+    if (!enabled || (aggregator != self)) return;
+    if (!collecting)
+    {
+        summary = Digest();
+        collecting = true;
+        windowStarted = millis();
+    }
+    summary.reporters += digest.reporters;
+    summary.pairs += digest.pairs;
+    summary.packetLoss += digest.packetLoss;
+    summary.maxPacketLoss = max(summary.maxPacketLoss, digest.maxPacketLoss);
+    merge(summary.latency, digest.latency);
+    merge(summary.jitter, digest.jitter);
+    merge(summary.goodput, digest.goodput);
+    for (uint16_t i = 0; (i < digest.numOutliers) && (i < HEALTH_MAX_OUTLIERS); i++)
+    {
+        insert(summary, digest.outliers[i]);
+    }
+}
+
+const struct HealthAggregator::Digest* HealthAggregator::completed()
+{
+    if (!collecting) return nullptr;
+    // Every member but the controller sends a digest
+    if ((summary.reporters + 1 < members) && (millis() - windowStarted < HEALTH_AGGREGATION_WINDOW)) return nullptr;
+    collecting = false;
+    return &summary;
+}
+
+void HealthAggregator::merge(struct NetworkStats::HealthCore &into, const struct NetworkStats::HealthCore &from)
+{// Chan et al.'s pairwise update, the counterpart of NetworkStats::calculate
+    if (from.count == 0) return;
+    if (into.count == 0)
+    {
+        into = from;
+        return;
+    }
+    uint32_t count = into.count + from.count;
+    float delta = from.mean - into.mean;
+    into.mean += delta * from.count / count;
+    into.sumOfSquaredDifferences += from.sumOfSquaredDifferences +
+        delta * delta * (float(into.count) * from.count / count);
+    into.count = count;
+    into.variance = into.sumOfSquaredDifferences / count;
+    into.min = min(into.min, from.min);
+    into.max = max(into.max, from.max);
+}
+
+void HealthAggregator::insert(struct Digest &digest, const struct Outlier &outlier)
+{// Keeps the worst HEALTH_MAX_OUTLIERS, sorted
+    uint16_t n = digest.numOutliers;
+    if ((n == HEALTH_MAX_OUTLIERS) && (outlier.score <= digest.outliers[n - 1].score)) return;
+    if (n < HEALTH_MAX_OUTLIERS) digest.numOutliers++;
+    else n--;
+    while ((n > 0) && (digest.outliers[n - 1].score < outlier.score))
+    {
+        digest.outliers[n] = digest.outliers[n - 1];
+        n--;
+    }
+    digest.outliers[n] = outlier;
+}
@@ -0,0 +1,105 @@
+#ifndef health_aggregator_h_
+#define health_aggregator_h_
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <NetworkStats/NetworkStats.h>
+
+#define HEALTH_MAX_OUTLIERS 8  // Pairs a digest or summary reports in full
+#define HEALTH_AGGREGATION_WINDOW 500  // ms the aggregator collects digests for
+#define HEALTH_OUTLIER_LOSS 1.0  // Lost datagrams that make a pair an outlier
+#define HEALTH_OUTLIER_SIGMAS 3.0  // Mean latency above the session's that does
+
+/*
+Cuts the health traffic of large sessions down from every node reporting on
+every other (a NodeReport per member, O(N^2) for the session) to one compact
+digest per node and a single session summary.
+
+With "HealthAggregation" in the session request each node answers a health
+request with a Digest (type 10) instead of its full report: the latency,
+jitter and goodput of all its peers merged into one HealthCore each, the
+total and worst packet loss, and only the pairs that stand out in full. A
+pair is an outlier when it lost datagrams or its mean latency is more than
+HEALTH_OUTLIER_SIGMAS standard deviations above the node's overall mean.
+
+One node aggregates: the one given as "HealthAggregator", or if there is
+none the lowest index heard from in the last window, which every node works
+out the same way from its own report. The controller, index 0, is never
+one; a "HealthAggregator" of 0 or past the last member is elected too. It
+merges the digests it gets within HEALTH_AGGREGATION_WINDOW ms of the first
+(or all the SSSFs' if they come sooner) and sends the result as a Digest of
+the whole session (type 11), the worst HEALTH_MAX_OUTLIERS pairs kept. The
+controller only needs to read that. While membership changes two nodes can
+briefly both aggregate, which only means two summaries for a window.
+
+Bus and Ethernet summaries stay out of the digests, they are on each node's
+metrics endpoint.
+*/
+class HealthAggregator
+{
+public:
+    struct Outlier
+    {
+        uint16_t reporter;  // Node that measured
+        uint16_t peer;  // Node it heard from
+        float score;  // 1 at the outlier threshold, higher is worse
+        struct NetworkStats::NodeReport report;
+    };
+
+    struct Digest
+    {
+        uint16_t reporters = 0;  // Nodes merged in
+        uint16_t pairs = 0;  // Reporter and peer pairs that had traffic
+        uint16_t numOutliers = 0;
+        uint16_t reserved = 0;
+        float packetLoss = 0.0;  // Summed over the pairs
+        float maxPacketLoss = 0.0;
+        struct NetworkStats::HealthCore latency;
+        struct NetworkStats::HealthCore jitter;
+        struct NetworkStats::HealthCore goodput;
+        struct Outlier outliers[HEALTH_MAX_OUTLIERS];  // Worst first, only numOutliers sent
+    };
+
+    static const size_t digestHeadSize = offsetof(Digest, outliers);
+
+private:
+    bool enabled = false;
+    int32_t designated = -1;  // -1 to elect
+    uint32_t self = 0;
+    size_t members = 0;
+    uint32_t aggregator = 0;  // Of the current window
+    bool collecting = false;
+    uint32_t windowStarted = 0;
+    struct Digest summary;
+
+public:
+    void start(size_t _members, uint32_t index, bool _enabled, int32_t _designated);
+    void stop();
+    bool active() { return enabled; }
+
+    /**
+     * Digests this node's report of the window and works out who aggregates.
+     *
+     * @return true if this node does, the digest then goes to offer() instead of the session
+     */
+    bool digest(const NetworkStats &stats, struct Digest &out);
+
+    // Merges a digest into the session summary, if this node aggregates
+    void offer(const struct Digest &digest);
+
+    /**
+     * @return the session summary once its window has closed, nullptr until then
+     */
+    const struct Digest* completed();
+
+    static size_t length(const struct Digest &digest)
+    {
+        return digestHeadSize + digest.numOutliers * sizeof(Outlier);
+    }
+
+private:
+    static void merge(struct NetworkStats::HealthCore &into, const struct NetworkStats::HealthCore &from);
+    static void insert(struct Digest &digest, const struct Outlier &outlier);
+};
+
+#endif /* health_aggregator_h_ */
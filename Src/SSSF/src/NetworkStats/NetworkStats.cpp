@@ -8,17 +8,20 @@ NetworkStats::NetworkStats(size_t _size, TimeClient* _timeClient):
     timeClient(_timeClient),
     size(_size),
     Basics(new HealthBasics [_size]),
-    HealthReport(new NodeReport [_size])
+    HealthReport(new NodeReport [_size]),
+    Recoveries(new Recovery [_size])
 {}
 
 NetworkStats::~NetworkStats()
 {
+    delete[] Recoveries;
     delete[] HealthReport;
     delete[] Basics;
 }
 
-void NetworkStats::update(uint16_t i, int packetSize, uint64_t timestamp, uint32_t sequenceNumber)
+FASTRUN void NetworkStats::update(uint16_t i, int packetSize, uint64_t timestamp, uint32_t sequenceNumber)
 {
+    if (i >= size) return;  // Not in the request's Devices, which may be empty
     int64_t _now = timeClient->getEpochTimeMS();
     int delay = _now - int64_t(timestamp);
     // if these numbers are 0 this is the first message we've received
@@ -47,13 +50,27 @@ void NetworkStats::update(uint16_t i, int packetSize, uint64_t timestamp, uint32
     Basics[i].lastSequenceNumber = int64_t(sequenceNumber);
 }
 
+void NetworkStats::recovered(uint16_t i)
+{
+    if (i < size) Recoveries[i].recovered++;
+}
+
+void NetworkStats::unrecoverable(uint16_t i, uint32_t count)
+{
+    if (i < size) Recoveries[i].unrecoverable += count;
+}
+
 void NetworkStats::reset()
 {
     delete[] HealthReport;
     HealthReport = new NodeReport[size];
+    for (size_t i = 0; i < size; i++)
+    {
+        Recoveries[i] = Recovery();
+    }
 }
 
-void NetworkStats::calculate(struct HealthCore &edge, float n)
+FASTRUN void NetworkStats::calculate(struct HealthCore &edge, float n)
 {// From: https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Welford's_online_algorithm
     edge.min = min(edge.min, n);
     edge.max = max(edge.max, n);
@@ -39,13 +39,24 @@ public:
         struct HealthCore goodput;
     };
 
+    // Kept apart from NodeReport so the health report layout older
+    // controllers parse doesn't change.
+    struct Recovery
+    {
+        uint32_t recovered = 0;  // Lost datagrams rebuilt from parity
+        uint32_t unrecoverable = 0;  // Lost in a block parity couldn't repair
+    };
+
     size_t size = 0;
     struct HealthBasics *Basics;
     struct NodeReport *HealthReport;
+    struct Recovery *Recoveries;
 
     NetworkStats(size_t _size, TimeClient* _timeClient);
     ~NetworkStats();
     void update(uint16_t _index, int packetSize, uint64_t timestamp, uint32_t sequenceNumber);
+    void recovered(uint16_t _index);
+    void unrecoverable(uint16_t _index, uint32_t count);
     void reset();
     // TODO: Reset every health report keep last seen sequence number
 
@@ -0,0 +1,117 @@
+#include <Arduino.h>
+#include <Reliability/ParityFEC.h>
+
+ParityFEC::~ParityFEC()
+{
+    stop();
+}
+
+void ParityFEC::start(size_t members, size_t datagramLength)
+{
+    stop();
+    length = min(datagramLength, (size_t) FEC_MAX_DATAGRAM);
+    blocks = new Block[members];
+    numBlocks = members;
+    encoded = 0;
+}
+
+void ParityFEC::stop()
+{
+    delete[] blocks;
+    blocks = nullptr;
+    numBlocks = 0;
+}
+
+void ParityFEC::setBlockSize(uint8_t k)
+{
+    blockSize = (k < 2) ? 0 : min(k, (uint8_t) FEC_MAX_BLOCK);
+    encoded = 0;
+}
+
+bool ParityFEC::encode(uint32_t sequenceNumber, const uint8_t *datagram)
+{
+    if (blockSize == 0) return false;
+    uint32_t position = (sequenceNumber - 1) % blockSize;
+    if (position == 0)
+    {
+        outbound.firstSequence = sequenceNumber;
+        outbound.count = blockSize;
+        memset(outbound.data, 0, length);
+        encoded = 0;
+    }
+    else if ((encoded == 0) || (outbound.firstSequence + encoded != sequenceNumber))
+    {// Joined mid block, wait for the next one
+        encoded = 0;
+        return false;
+    }
+    accumulate(outbound.data, datagram, length);
+    encoded++;
+    return encoded == blockSize;
+}
+
+void ParityFEC::received(uint32_t sender, uint32_t sequenceNumber, const uint8_t *datagram, uint32_t &unrecoverable)
+{
+    unrecoverable = 0;
+    if ((sender >= numBlocks) || (blocks[sender].size == 0)) return;
+    struct Block &block = blocks[sender];
+    uint32_t first = sequenceNumber - ((sequenceNumber - 1) % block.size);
+    if (first != block.first)
+    {
+        if (int32_t(first - block.first) < 0) return;  // Late, its block is gone
+        unrecoverable = close(block);
+        block.first = first;
+        block.received = 0;
+        block.resolved = false;
+        memset(block.data, 0, length);
+    }
+    uint16_t bit = 1 << (sequenceNumber - first);
+    if (block.resolved || (block.received & bit)) return;
+    block.received |= bit;
+    accumulate(block.data, datagram, length);
+}
+
+bool ParityFEC::repair(uint32_t sender, const struct Parity &parity, uint8_t *datagram, uint32_t &unrecoverable)
+{
+    unrecoverable = 0;
+    if ((sender >= numBlocks) || (parity.count < 2) || (parity.count > FEC_MAX_BLOCK)) return false;
+    struct Block &block = blocks[sender];
+    if ((block.size != parity.count) || (block.first != parity.firstSequence))
+    {// First parity from this sender, or it changed its block size
+        unrecoverable = close(block);
+        block.size = parity.count;
+        block.first = parity.firstSequence + parity.count;
+        block.received = 0;
+        block.resolved = false;
+        memset(block.data, 0, length);
+        return false;
+    }
+    if (block.resolved) return false;
+    block.resolved = true;
+    uint16_t all = (1 << block.size) - 1;
+    uint16_t missing = all & ~block.received;
+    if (missing == 0) return false;
+    if (missing & (missing - 1))
+    {// More than one datagram missing
+        unrecoverable = __builtin_popcount(missing);
+        return false;
+    }
+    memcpy(datagram, parity.data, length);
+    accumulate(datagram, block.data, length);
+    block.received = all;
+    return true;
+}
+
+uint32_t ParityFEC::close(struct Block &block)
+{// Losses in a block whose parity never came
+    if ((block.size == 0) || block.resolved || (block.received == 0)) return 0;
+    uint16_t all = (1 << block.size) - 1;
+    return __builtin_popcount(all & ~block.received);
+}
+
+void ParityFEC::accumulate(uint8_t *into, const uint8_t *from, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        into[i] ^= from[i];
+    }
+}
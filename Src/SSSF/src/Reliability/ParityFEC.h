@@ -0,0 +1,84 @@
+#ifndef parity_fec_h_
+#define parity_fec_h_
+
+#include <Arduino.h>
+#include <stddef.h>
+
+#define RECOVERED_FLAG 0x08  // Set locally on a COMMBlock rebuilt from parity, never sent
+#define FEC_MAX_BLOCK 16
+#define FEC_MAX_DATAGRAM 128
+
+/*
+XOR parity over blocks of CAN datagrams, so a receiver can rebuild one lost
+datagram per block without asking for it.
+
+With a block size of K the sender XORs every K consecutive CAN datagrams it
+sends together and follows them with a parity datagram, costing 1/K extra
+bandwidth. Blocks start at sequence numbers where (sequenceNumber - 1) is a
+multiple of K, so receivers learn K from the first parity datagram and can
+place every later datagram in its block without any other signalling. A
+receiver that is missing exactly one datagram of a block when the parity
+arrives XORs the parity with what it has and gets the missing datagram back.
+Two or more losses in a block can't be repaired and are counted as such.
+
+Datagrams are XORed as the fixed size COMMBlock they travel in, so the
+rebuilt copy is byte for byte what was sent, apart from anything that was
+appended after the COMMBlock such as a trace.
+*/
+class ParityFEC
+{
+public:
+    struct Parity  // Follows the COMMBlock header of a parity datagram
+    {
+        uint32_t firstSequence;
+        uint8_t count;  // Datagrams in the block
+        uint8_t reserved[3];
+        uint8_t data[FEC_MAX_DATAGRAM];
+    };
+
+private:
+    struct Block
+    {
+        uint8_t size = 0;  // Block size learned from the sender's parity, 0 until then
+        uint32_t first = 0;
+        uint16_t received = 0;  // Bit i set if first + i has been received
+        bool resolved = false;  // Parity arrived and was used
+        uint8_t data[FEC_MAX_DATAGRAM];
+    };
+
+    size_t length = 0;  // Bytes of each datagram that are protected
+    uint8_t blockSize = 0;
+    struct Parity outbound;
+    uint8_t encoded = 0;
+
+    struct Block *blocks = nullptr;
+    size_t numBlocks = 0;
+
+public:
+    ~ParityFEC();
+
+    void start(size_t members, size_t datagramLength);
+    void stop();
+    void setBlockSize(uint8_t k);
+    uint8_t getBlockSize() { return blockSize; }
+
+    /**
+     * Adds a datagram that is being sent to the current block.
+     *
+     * @return true once the block is complete and parity() is ready to send
+     */
+    bool encode(uint32_t sequenceNumber, const uint8_t *datagram);
+    struct Parity& parity() { return outbound; }
+    size_t parityLength() { return offsetof(Parity, data) + length; }
+
+    // Receiving side. unrecoverable is set to the datagrams of the sender's
+    // blocks that were lost beyond repair since the last call.
+    void received(uint32_t sender, uint32_t sequenceNumber, const uint8_t *datagram, uint32_t &unrecoverable);
+    bool repair(uint32_t sender, const struct Parity &parity, uint8_t *datagram, uint32_t &unrecoverable);
+
+private:
+    uint32_t close(struct Block &block);
+    static void accumulate(uint8_t *into, const uint8_t *from, size_t length);
+};
+
+#endif /* parity_fec_h_ */
@@ -0,0 +1,120 @@
+#include <Arduino.h>
+#include <Reliability/ReliableLink.h>
+
+ReliableLink::~ReliableLink()
+{
+    stop();
+}
+
+void ReliableLink::start(size_t members)
+{
+    stop();
+    peers = new Peer[members];
+    numPeers = members;
+    nextPeer = 0;
+    for (int i = 0; i < RELIABLE_RING_SIZE; i++)
+    {
+        ring[i].length = 0;
+    }
+}
+
+void ReliableLink::stop()
+{
+    delete[] peers;
+    peers = nullptr;
+    numPeers = 0;
+}
+
+void ReliableLink::store(uint32_t sequenceNumber, const uint8_t *datagram, size_t length)
+{
+    if (length > RELIABLE_MAX_DATAGRAM) return;
+    struct Stored &slot = ring[sequenceNumber % RELIABLE_RING_SIZE];
+    slot.sequenceNumber = sequenceNumber;
+    slot.lastSent = 0;
+    slot.length = length;
+    memcpy(slot.data, datagram, length);
+}
+
+uint8_t* ReliableLink::retransmission(uint32_t sequenceNumber, size_t &length)
+{
+    struct Stored &slot = ring[sequenceNumber % RELIABLE_RING_SIZE];
+    if ((slot.length == 0) || (slot.sequenceNumber != sequenceNumber)) return nullptr;
+    // Several receivers usually miss the same datagram, one copy serves them all.
+    uint32_t now = millis();
+    if ((slot.lastSent != 0) && (now - slot.lastSent < NACK_INTERVAL)) return nullptr;
+    slot.lastSent = now;
+    length = slot.length;
+    return slot.data;
+}
+
+bool ReliableLink::received(uint32_t sender, uint32_t sequenceNumber, bool reliable)
+{
+    if (sender >= numPeers) return true;
+    struct Peer &peer = peers[sender];
+    if (reliable) peer.reliable = true;
+    if (!peer.seen)
+    {
+        peer.seen = true;
+        peer.highest = sequenceNumber;
+        return true;
+    }
+    if (int32_t(sequenceNumber - peer.highest) > 0)
+    {
+        uint32_t shift = sequenceNumber - peer.highest;
+        if (shift >= RELIABLE_WINDOW)
+        {// Too big a gap to be loss, the sender restarted or the link was down
+            peer.missing = 0;
+        }
+        else
+        {
+            // Everything skipped over is missing and hasn't been asked for
+            uint64_t gap = ((1ULL << shift) - 1) & ~1ULL;
+            peer.missing = (peer.missing << shift) | gap;
+            for (uint32_t skipped = peer.highest + 1; skipped != sequenceNumber; skipped++)
+            {
+                peer.tries[skipped % RELIABLE_NACK_WINDOW] = 0;
+            }
+        }
+        peer.highest = sequenceNumber;
+        return true;
+    }
+    uint32_t age = peer.highest - sequenceNumber;
+    if (age >= RELIABLE_WINDOW)
+    {// Too old to be a retransmission, the sender must have restarted
+        peer.highest = sequenceNumber;
+        peer.missing = 0;
+        return true;
+    }
+    uint64_t bit = 1ULL << age;
+    if (!(peer.missing & bit)) return false;  // Duplicate
+    peer.missing &= ~bit;
+    return true;
+}
+
+bool ReliableLink::nackDue(struct Nack &nack)
+{// Finds at most one sender to NACK per call
+    uint32_t now = millis();
+    for (size_t n = 0; n < numPeers; n++)
+    {
+        size_t i = (nextPeer + n) % numPeers;
+        struct Peer &peer = peers[i];
+        if (!peer.reliable || (peer.missing == 0) || (now - peer.lastNack < NACK_INTERVAL)) continue;
+        // Bit 0 is the newest datagram, which is never missing
+        uint64_t due = 0;
+        for (uint32_t age = 1; age < RELIABLE_NACK_WINDOW; age++)
+        {
+            uint8_t &tries = peer.tries[(peer.highest - age) % RELIABLE_NACK_WINDOW];
+            if (!(peer.missing & (1ULL << age)) || (tries >= RELIABLE_NACK_TRIES)) continue;
+            tries++;
+            due |= 1ULL << age;
+        }
+        if (due == 0) continue;
+        nack.target = i;
+        nack.highest = peer.highest;
+        nack.missing = due;
+        peer.lastNack = now;
+        nextPeer = (i + 1) % numPeers;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,93 @@
+#ifndef reliable_link_h_
+#define reliable_link_h_
+
+#include <Arduino.h>
+#include <Rules/Rules.h>
+
+#define RELIABLE_FLAG 0x02  // COMMBlock carries a frame from a reliable ID
+#define RETRANSMIT_FLAG 0x04  // COMMBlock is a copy sent in answer to a NACK
+#define RELIABLE_RING_SIZE 32  // Reliable datagrams kept for retransmission
+#define RELIABLE_MAX_DATAGRAM 128
+#define RELIABLE_WINDOW 64  // Sequence numbers a receiver tracks per sender
+#define RELIABLE_NACK_WINDOW RELIABLE_RING_SIZE  // Ages a NACK asks for, what the sender can still have
+#define RELIABLE_NACK_TRIES 3  // NACKs per missing sequence number before giving up on it
+#define RELIABLE_MAX_IDS 64  // Exact IDs in the "Reliable" section, see RamBudget.h
+#define RELIABLE_MAX_MASKED_IDS 8
+#define NACK_INTERVAL 20  // ms between NACKs to the same sender
+
+/*
+Selective retransmission for CAN IDs in the reliable class.
+
+The sending side copies every datagram carrying a reliable ID into a small ring
+indexed by its sequence number. Best effort datagrams are sent exactly as
+before and never copied.
+
+The receiving side remembers which of the last RELIABLE_WINDOW sequence
+numbers from each sender it is missing. It can't tell a lost best effort
+datagram from a lost reliable one, so once a sender has shown it has reliable
+IDs it asks that sender for the gaps, no more often than every NACK_INTERVAL.
+Only the last RELIABLE_NACK_WINDOW sequence numbers are asked for, older ones
+have left the sender's ring, and each is asked for up to RELIABLE_NACK_TRIES
+times in case the NACK or the retransmission was lost too. A jump of
+RELIABLE_WINDOW or more is an outage or a restarted sender, not something
+retransmission can repair, so nothing before it is asked for. The sender
+re-multicasts the ones still in its ring and ignores the rest. Because a
+retransmission reaches every member of the group, receivers only accept a
+datagram they are missing and drop duplicates.
+
+Which IDs are reliable comes from the "Reliable" section of the session
+request, a filter table of RELIABLE_MAX_IDS exact IDs.
+*/
+class ReliableLink
+{
+public:
+    struct Nack
+    {
+        uint32_t target;  // Index of the sender being asked
+        uint32_t highest;  // Highest sequence number received from it
+        uint64_t missing;  // Bit k set if highest - k is missing
+    };
+
+private:
+    struct Stored
+    {
+        uint32_t sequenceNumber = 0;
+        uint32_t lastSent = 0;  // millis() of the last retransmission
+        uint16_t length = 0;
+        uint8_t data[RELIABLE_MAX_DATAGRAM];
+    };
+
+    struct Peer
+    {
+        bool seen = false;
+        bool reliable = false;  // Has sent reliable datagrams, so NACKs help
+        uint32_t highest = 0;
+        uint64_t missing = 0;
+        uint8_t tries[RELIABLE_NACK_WINDOW] = {};  // NACKs sent, by sequence number % RELIABLE_NACK_WINDOW
+        uint32_t lastNack = 0;  // millis()
+    };
+
+    struct Stored ring[RELIABLE_RING_SIZE];
+    struct Peer *peers = nullptr;
+    size_t numPeers = 0;
+    size_t nextPeer = 0;  // Where the NACK scan resumes
+
+public:
+    ~ReliableLink();
+
+    void start(size_t members);
+    void stop();
+
+    // Sending side
+    void store(uint32_t sequenceNumber, const uint8_t *datagram, size_t length);
+    uint8_t* retransmission(uint32_t sequenceNumber, size_t &length);
+
+    // Receiving side
+    bool received(uint32_t sender, uint32_t sequenceNumber, bool reliable);
+    bool nackDue(struct Nack &nack);
+};
+
+// The session's "Reliable" IDs
+typedef SizedFilterTable<RELIABLE_MAX_IDS, RELIABLE_MAX_MASKED_IDS> ReliableIdTable;
+
+#endif /* reliable_link_h_ */
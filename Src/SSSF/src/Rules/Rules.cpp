@@ -0,0 +1,295 @@
+#include <Arduino.h>
+#include <Rules/Rules.h>
+#include <ArduinoLog.h>
+#include <FlexCAN_T4.h>
+
+void RuleSection::begin()
+{
+    valid = true;
+}
+
+void RuleSection::beginObject(uint8_t depth)
+{
+    if (depth != 2) return;  // Only the objects in the section's array are rules
+    pending = RuleMatch();
+    extended = -1;
+    hasID = false;
+    clearPending();
+}
+
+void RuleSection::value(uint8_t depth, const char* key, const char* text, bool isString)
+{
+    if (depth != 2) return;
+    if (!matchField(key, text)) field(key, text);
+}
+
+void RuleSection::endObject(uint8_t depth)
+{
+    if ((depth != 2) || !valid) return;
+    if (!hasID)
+    {
+        Log.errorln("A rule is missing its ID.");
+        valid = false;
+        return;
+    }
+    if (extended < 0) extended = (pending.key > 0x7FF);
+    pending.key = (pending.key & pending.mask) | (extended ? RULES_EXTENDED : 0);
+    pending.mask |= RULES_EXTENDED;
+    valid = add();
+}
+
+bool RuleSection::matchField(const char* key, const char* text)
+{
+    if (!strcmp(key, "ID"))
+    {
+        pending.key = number(text) & ~RULES_EXTENDED;
+        hasID = true;
+    }
+    else if (!strcmp(key, "Mask"))
+    {
+        pending.mask = number(text) & ~RULES_EXTENDED;
+    }
+    else if (!strcmp(key, "Extended"))
+    {
+        extended = !strcmp(text, "true");
+    }
+    else if (!strcmp(key, "Channel"))
+    {
+        pending.channel = number(text);
+    }
+    else if (!strcmp(key, "Direction"))
+    {
+        if (!strcmp(text, "Uplink")) pending.direction = Uplink;
+        else if (!strcmp(text, "Downlink")) pending.direction = Downlink;
+        else pending.direction = AnyDirection;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void FilterTable::clear()
+{
+    numExact = 0;
+    numMasked = 0;
+    defaultAccept = true;
+}
+
+bool FilterTable::accept(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame)
+{
+    if ((numExact == 0) && (numMasked == 0)) return true;
+    int8_t decision = lookup(channel, direction, canFrame);
+    return (decision < 0) ? defaultAccept : decision;
+}
+
+bool FilterTable::selects(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame)
+{
+    if ((numExact == 0) && (numMasked == 0)) return false;
+    return lookup(channel, direction, canFrame) == 1;
+}
+
+FASTRUN int8_t FilterTable::lookup(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame)
+{// 1 to accept, 0 to reject and -1 if no rule matches
+    uint32_t key = RuleMatch::keyOf(canFrame);
+    uint16_t low = 0;
+    uint16_t high = numExact;
+    while (low < high)
+    {// First exact filter with this key
+        uint16_t middle = (low + high) / 2;
+        if (exact[middle].key < key) low = middle + 1;
+        else high = middle;
+    }
+    for (uint16_t i = low; (i < numExact) && (exact[i].key == key); i++)
+    {
+        if (((exact[i].channel == RULES_ANY_CHANNEL) || (exact[i].channel == channel)) &&
+            (exact[i].direction & direction))
+        {
+            return exact[i].accept;
+        }
+    }
+    for (uint16_t i = 0; i < numMasked; i++)
+    {
+        if (masked[i].match.matches(key, channel, direction)) return masked[i].accept;
+    }
+    return -1;
+}
+
+void FilterTable::begin()
+{
+    RuleSection::begin();
+    clear();
+}
+
+bool FilterTable::end()
+{
+    if (!valid) return false;
+    // Equal keys are left in the order they were given, so of two
+    // contradicting filters for the same ID the first one wins as it would
+    // among the masked ones.
+    qsort(exact, numExact, sizeof(Filter), compare);
+    defaultAccept = true;
+    for (uint16_t i = 0; i < numExact; i++)
+    {
+        if (exact[i].accept) defaultAccept = false;
+    }
+    for (uint16_t i = 0; i < numMasked; i++)
+    {
+        if (masked[i].accept) defaultAccept = false;
+    }
+    Log.noticeln("\tCompiled %d exact and %d masked CAN ID rules.", numExact, numMasked);
+    return true;
+}
+
+void FilterTable::field(const char* key, const char* text)
+{
+    if (!strcmp(key, "Action")) pendingAccept = strcmp(text, "Reject");
+}
+
+bool FilterTable::add()
+{
+    if (pending.mask == 0xFFFFFFFF)
+    {
+        if (numExact >= maxExact)
+        {
+            Log.errorln("Too many exact CAN filters, the limit is %d.", maxExact);
+            return false;
+        }
+        exact[numExact] = {pending.key, numExact, pending.channel, pending.direction, pendingAccept};
+        numExact++;
+    }
+    else
+    {
+        if (numMasked >= maxMasked)
+        {
+            Log.errorln("Too many masked CAN filters, the limit is %d.", maxMasked);
+            return false;
+        }
+        masked[numMasked++] = {pending, pendingAccept};
+    }
+    return true;
+}
+
+int FilterTable::compare(const void* a, const void* b)
+{// By key, then by position in the request since qsort isn't stable
+    const struct Filter* x = static_cast<const struct Filter*>(a);
+    const struct Filter* y = static_cast<const struct Filter*>(b);
+    if (x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+    return x->order - y->order;
+}
+
+FASTRUN bool RewriteTable::apply(uint8_t channel, uint8_t direction, CAN_message_t &canFrame)
+{
+    if (numRewrites == 0) return false;
+    uint32_t key = RuleMatch::keyOf(canFrame);
+    for (uint16_t i = 0; i < numRewrites; i++)
+    {
+        const struct Rewrite &r = rewrites[i];
+        if (!r.match.matches(key, channel, direction)) continue;
+        canFrame.id = (canFrame.id & ~r.idMask) | (r.id & r.idMask);
+        for (uint8_t b = 0; b < 8; b++)
+        {
+            canFrame.buf[b] = (canFrame.buf[b] & ~r.dataMask[b]) | (r.data[b] & r.dataMask[b]);
+        }
+        return true;
+    }
+    return false;
+}
+
+void RewriteTable::begin()
+{
+    RuleSection::begin();
+    clear();
+}
+
+void RewriteTable::field(const char* key, const char* text)
+{
+    if (!strcmp(key, "SetID"))
+    {
+        pendingRewrite.id = number(text);
+        if (pendingRewrite.idMask == 0) pendingRewrite.idMask = 0x1FFFFFFF;
+    }
+    else if (!strcmp(key, "SetIDMask"))
+    {
+        pendingRewrite.idMask = number(text) & 0x1FFFFFFF;
+    }
+    else if (!strcmp(key, "Data"))
+    {
+        for (uint8_t n = 0; (n < 16) && text[n]; n++)
+        {
+            int8_t value = nibble(text[n]);
+            if (value < 0) continue;  // '?' keeps what was there
+            uint8_t shift = (n % 2) ? 0 : 4;
+            pendingRewrite.data[n / 2] |= value << shift;
+            pendingRewrite.dataMask[n / 2] |= 0x0F << shift;
+        }
+    }
+}
+
+bool RewriteTable::add()
+{
+    if (numRewrites >= RULES_MAX_REWRITES)
+    {
+        Log.errorln("Too many CAN rewrites, the limit is %d.", RULES_MAX_REWRITES);
+        return false;
+    }
+    pendingRewrite.match = pending;
+    rewrites[numRewrites++] = pendingRewrite;
+    return true;
+}
+
+void CriticalTable::clear()
+{
+    memset(standard, 0, sizeof(standard));
+    numExtended = 0;
+    numRules = 0;
+}
+
+void CriticalTable::begin()
+{
+    RuleSection::begin();
+    clear();
+}
+
+bool CriticalTable::end()
+{
+    if (!valid) return false;
+    Log.noticeln("\tCompiled %d critical CAN ID rules.", numRules);
+    return true;
+}
+
+bool CriticalTable::add()
+{
+    if (pending.key & RULES_EXTENDED)
+    {
+        if (numExtended >= RULES_MAX_CRITICAL_EXTENDED)
+        {
+            Log.errorln("Too many critical extended CAN IDs, the limit is %d.", RULES_MAX_CRITICAL_EXTENDED);
+            return false;
+        }
+        extendedRules[numExtended++] = pending;
+        numRules++;
+        return true;
+    }
+    for (uint32_t id = 0; id < 2048; id++)
+    {
+        if ((id ^ pending.key) & pending.mask & 0x7FF) continue;
+        for (uint8_t channel = 0; channel < RULES_CHANNELS; channel++)
+        {
+            if ((pending.channel != RULES_ANY_CHANNEL) && (pending.channel != channel)) continue;
+            if (pending.direction & Uplink) standard[channel][0][id >> 5] |= 1UL << (id & 31);
+            if (pending.direction & Downlink) standard[channel][1][id >> 5] |= 1UL << (id & 31);
+        }
+    }
+    numRules++;
+    return true;
+}
+
+int8_t RewriteTable::nibble(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
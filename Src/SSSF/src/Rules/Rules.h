@@ -0,0 +1,299 @@
+#ifndef rules_h_
+#define rules_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <HTTP/JsonStream.h>
+
+#define RULES_MAX_EXACT_FILTERS 512  // Of the session's "Filters", see RamBudget.h
+#define RULES_MAX_MASKED_FILTERS 32
+#define RULES_MAX_REWRITES 64
+#define RULES_MAX_CRITICAL_EXTENDED 16
+#define RULES_CHANNELS 2
+#define RULES_ANY_CHANNEL 0xFF
+#define RULES_EXTENDED 0x80000000  // Set in a key for 29 bit IDs
+
+enum Direction
+{
+    Uplink = 1,  // CAN bus to session
+    Downlink = 2,  // Session to CAN bus
+    AnyDirection = 3
+};
+
+/*
+Which frames a rule applies to. Keys are CAN IDs with RULES_EXTENDED set for
+29 bit IDs so a standard and an extended frame with the same number never
+match each other. In the request a match is written as
+
+    {"ID": "0x18FEF100", "Mask": "0x00FFFF00", "Extended": true,
+     "Channel": 0, "Direction": "Uplink"}
+
+where everything but "ID" is optional. Numbers can be given as JSON numbers
+or as strings in any base strtoul understands. Without "Extended" IDs over
+0x7FF are taken to be extended.
+*/
+struct RuleMatch
+{
+    uint32_t key = 0;
+    uint32_t mask = 0xFFFFFFFF;
+    uint8_t channel = RULES_ANY_CHANNEL;
+    uint8_t direction = AnyDirection;
+
+    bool matches(uint32_t frameKey, uint8_t frameChannel, uint8_t frameDirection) const
+    {
+        return (((frameKey ^ key) & mask) == 0) &&
+            ((channel == RULES_ANY_CHANNEL) || (channel == frameChannel)) &&
+            (direction & frameDirection);
+    }
+
+    static uint32_t keyOf(const CAN_message_t &canFrame)
+    {
+        return canFrame.flags.extended ? (canFrame.id | RULES_EXTENDED) : canFrame.id;
+    }
+};
+
+/*
+Base for the rule tables that are compiled from the session request. Each
+element of the section's array is collected field by field and handed to
+add() when its object closes, so a table of any length is built without the
+request ever being held in memory.
+*/
+class RuleSection: public JsonSection
+{
+protected:
+    struct RuleMatch pending;
+    int8_t extended = -1;  // -1 until the element says
+    bool hasID = false;
+    bool valid = true;
+
+public:
+    virtual void begin();
+    virtual void beginObject(uint8_t depth);
+    virtual void value(uint8_t depth, const char* key, const char* text, bool isString);
+    virtual void endObject(uint8_t depth);
+    virtual bool end() { return valid; }
+
+protected:
+    virtual void clearPending() = 0;
+    virtual void field(const char* key, const char* text) = 0;
+    virtual bool add() = 0;
+    bool matchField(const char* key, const char* text);
+    static uint32_t number(const char* text) { return strtoul(text, nullptr, 0); }
+};
+
+/*
+Accept and reject rules for the "Filters" section of the session request,
+e.g. {"ID": 1234, "Action": "Reject"}. Rules that match one ID exactly are
+kept sorted and binary searched, so large allow lists cost a few compares per
+frame. Rules with a mask are checked in the order given after that. The first
+rule that matches decides; a frame no rule matches is forwarded unless the
+table holds accept rules, in which case only what they accept gets through.
+
+The rules are kept in arrays the SizedFilterTable below declares, so each
+use of a filter table is given only as many rules as it needs.
+*/
+class FilterTable: public RuleSection
+{
+protected:
+    struct Filter
+    {
+        uint32_t key;
+        uint16_t order;  // Position in the request, which of equal keys comes first
+        uint8_t channel;
+        uint8_t direction : 2;
+        bool accept : 1;
+    };
+    static_assert(sizeof(Filter) == 8, "Exact filters grew, the tables are sized for 8 bytes");
+
+    struct MaskedFilter
+    {
+        struct RuleMatch match;
+        bool accept;
+    };
+
+private:
+    struct Filter *exact;
+    struct MaskedFilter *masked;
+    const uint16_t maxExact;
+    const uint8_t maxMasked;
+    uint16_t numExact = 0;
+    uint16_t numMasked = 0;
+    bool defaultAccept = true;
+    bool pendingAccept = true;
+
+public:
+    void clear();
+    size_t size() { return numExact + numMasked; }
+    bool accept(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame);
+    // True only if an accept rule matches, for tables that select a class of IDs
+    bool selects(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame);
+
+    virtual void begin();
+    virtual bool end();
+
+protected:
+    FilterTable(struct Filter *_exact, uint16_t _maxExact, struct MaskedFilter *_masked, uint8_t _maxMasked):
+        exact(_exact), masked(_masked), maxExact(_maxExact), maxMasked(_maxMasked)
+    {}
+    FilterTable(const FilterTable&) = delete;
+
+    virtual void clearPending() { pendingAccept = true; }
+    virtual void field(const char* key, const char* text);
+    virtual bool add();
+
+private:
+    int8_t lookup(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame);
+    static int compare(const void* a, const void* b);
+};
+
+template<uint16_t MaxExact, uint8_t MaxMasked>
+class SizedFilterTable: public FilterTable
+{
+private:
+    struct Filter exactRules[MaxExact];
+    struct MaskedFilter maskedRules[MaxMasked];
+
+public:
+    SizedFilterTable(): FilterTable(exactRules, MaxExact, maskedRules, MaxMasked) {}
+};
+
+// The session's "Filters"
+typedef SizedFilterTable<RULES_MAX_EXACT_FILTERS, RULES_MAX_MASKED_FILTERS> SessionFilterTable;
+
+/*
+Rules for the "Rewrites" section of the session request. The first rule that
+matches a frame replaces the bits of its ID selected by "SetIDMask" (all of
+them by default) with "SetID" and overwrites data bytes given in "Data", a
+hex string where '?' keeps the nibble that was there, e.g.
+
+    {"ID": "0x18F00400", "Mask": "0x00FFFF00", "SetID": "0x18F00427",
+     "SetIDMask": "0xFF", "Data": "????FF"}
+*/
+class RewriteTable: public RuleSection
+{
+private:
+    struct Rewrite
+    {
+        struct RuleMatch match;
+        uint32_t id = 0;
+        uint32_t idMask = 0;
+        uint8_t data[8] = {0};
+        uint8_t dataMask[8] = {0};
+    };
+
+    struct Rewrite rewrites[RULES_MAX_REWRITES];
+    struct Rewrite pendingRewrite;
+    uint16_t numRewrites = 0;
+
+public:
+    void clear() { numRewrites = 0; }
+    size_t size() { return numRewrites; }
+    bool apply(uint8_t channel, uint8_t direction, CAN_message_t &canFrame);
+
+    virtual void begin();
+
+protected:
+    virtual void clearPending() { pendingRewrite = Rewrite(); }
+    virtual void field(const char* key, const char* text);
+    virtual bool add();
+
+private:
+    static int8_t nibble(char c);
+};
+
+/*
+CAN IDs for the "Critical" section of the session request, the frames that
+take the fast lane (see FastLane.h), e.g. {"ID": "0x0C000003", "Channel": 0}.
+Matches use the usual fields, "Direction" says whether frames from the bus,
+to the bus or both are critical. Standard IDs are compiled into a bitmap per
+channel and direction so the receive interrupt decides with one load, a mask
+expands to every ID it covers. Extended IDs are checked against a short list.
+*/
+class CriticalTable: public RuleSection
+{
+private:
+    uint32_t standard[RULES_CHANNELS][2][2048 / 32];  // [channel][direction - 1]
+    struct RuleMatch extendedRules[RULES_MAX_CRITICAL_EXTENDED];
+    uint8_t numExtended = 0;
+    uint16_t numRules = 0;
+
+public:
+    CriticalTable() { clear(); }
+    void clear();
+    size_t size() { return numRules; }
+
+    bool critical(uint8_t channel, uint8_t direction, const CAN_message_t &canFrame) const
+    {
+        if ((numRules == 0) || (channel >= RULES_CHANNELS)) return false;
+        if (!canFrame.flags.extended)
+        {
+            uint32_t id = canFrame.id & 0x7FF;
+            return standard[channel][direction - 1][id >> 5] & (1UL << (id & 31));
+        }
+        uint32_t key = RuleMatch::keyOf(canFrame);
+        for (uint8_t i = 0; i < numExtended; i++)
+        {
+            if (extendedRules[i].matches(key, channel, direction)) return true;
+        }
+        return false;
+    }
+
+    virtual void begin();
+    virtual bool end();
+
+protected:
+    virtual void clearPending() {}
+    virtual void field(const char* key, const char* text) {}
+    virtual bool add();
+};
+
+/*
+Keeps two copies of a rule table so a running session can be given new rules
+without stopping. Requests are compiled into the standby copy while frames go
+through the live one; commit() swaps them once a request has been accepted,
+which the forwarding loop does between frames, so every frame sees either the
+old rules or the new ones and never a half built table.
+*/
+template<class Table>
+class StagedTable: public JsonSection
+{
+private:
+    Table tables[2];
+    Table* volatile live = &tables[0];  // Also read from the CAN receive interrupt
+    Table* standby = &tables[1];
+    bool staged = false;
+
+public:
+    Table* operator->() { return live; }
+    Table& operator*() { return *live; }
+
+    /**
+     * Makes the table compiled by the last request live.
+     *
+     * @return false if the last request didn't contain this table
+     */
+    bool commit()
+    {
+        if (!staged) return false;
+        Table* old = live;
+        asm volatile("" ::: "memory");  // The standby table is complete before it goes live
+        live = standby;
+        standby = old;
+        staged = false;
+        return true;
+    }
+
+    void clear() { live->clear(); }
+
+    virtual void reset() { staged = false; }
+    virtual void begin() { standby->begin(); }
+    virtual void beginObject(uint8_t depth) { standby->beginObject(depth); }
+    virtual void value(uint8_t depth, const char* key, const char* text, bool isString)
+    {
+        standby->value(depth, key, text, isString);
+    }
+    virtual void endObject(uint8_t depth) { standby->endObject(depth); }
+    virtual bool end() { return staged = standby->end(); }
+};
+
+#endif /* rules_h_ */
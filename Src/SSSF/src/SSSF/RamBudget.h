@@ -0,0 +1,25 @@
+#ifndef ram_budget_h_
+#define ram_budget_h_
+
+/*
+Static RAM the parts of the SSSF object may take, in bytes. The node is made
+once at start up and lives as long as the firmware runs, so whatever it holds
+is RAM nothing else gets; the Teensy 3.6's 256 KB are shared with the
+Ethernet, FlexCAN and SD libraries and the stack. The limits in each module's
+header are chosen to fit its line here and SSSF.cpp checks them at compile
+time, so growing a table means taking the RAM from somewhere on purpose.
+RAM_BUDGET_TOTAL caps the whole object, leaving the rest for the heap (the
+JSON documents, NetworkStats, and the capture and ISO-TP buffers of sessions
+that use them), FASTRUN code and the stack.
+*/
+#define RAM_BUDGET_TOTAL 98304  // The SSSF object, everything below included
+#define RAM_BUDGET_FILTERS 10240  // Both copies of the session's "Filters"
+#define RAM_BUDGET_REWRITES 5120  // Both copies of "Rewrites"
+#define RAM_BUDGET_DECIMATOR 9216  // A slot per IdIndex entry and the streams
+#define RAM_BUDGET_FAST_LANE 8192  // The interrupt's receive rings
+#define RAM_BUDGET_RELIABLE 6656  // Both copies of "Reliable" and the retransmit ring
+#define RAM_BUDGET_ID_INDEX 6400  // Keys and slots of the IdIndex
+#define RAM_BUDGET_BUS_STATS 15872  // An IDStats per IdIndex slot
+#define RAM_BUDGET_ISOTP 512  // The links, their PDU buffers are on the heap while a session has any
+
+#endif /* ram_budget_h_ */
@@ -4,17 +4,52 @@
 #include <CANNode/CANNode.h>
 #include <HTTP/HTTPClient.h>
 #include <NetworkStats/NetworkStats.h>
+#include <NetworkStats/HealthAggregator.h>
 #include <TimeClient/TimeClient.h>
+#include <Trace/FrameTrace.h>
+#include <BusStats/BusStats.h>
+#include <EthernetStats/EthernetStats.h>
+#include <J1939/AddressTable.h>
+#include <Metrics/Metrics.h>
+#include <Rules/Rules.h>
+#include <Control/ControlSocket.h>
+#include <Reliability/ReliableLink.h>
+#include <Reliability/ParityFEC.h>
+#include <Benchmark/CycleCounter.h>
+#include <Schedule/UplinkSchedule.h>
+#include <Signals/SignalTable.h>
+#include <Decimation/Decimator.h>
+#include <IsoTp/IsoTp.h>
 #include <EthernetUdp.h>
 #include <ArduinoJson.h>
 #include <Dns.h>
 #include <FlexCAN_T4.h>
 
+static_assert(sizeof(SSSF::COMMBlock) <= RELIABLE_MAX_DATAGRAM, "COMMBlocks no longer fit the retransmit ring");
+static_assert(sizeof(SSSF::COMMBlock) <= FEC_MAX_DATAGRAM, "COMMBlocks no longer fit a parity datagram");
+static_assert(sizeof(StagedTable<SessionFilterTable>) <= RAM_BUDGET_FILTERS, "The filter tables are over their RAM budget");
+static_assert(sizeof(StagedTable<RewriteTable>) <= RAM_BUDGET_REWRITES, "The rewrite tables are over their RAM budget");
+static_assert((FAST_LANE_TX_MB > CAN_LAST_QUEUED_TX_MB) && (FAST_LANE_TX_MB <= CAN_LAST_TX_MB), "The fast lane's mailbox is shared with send()");
+static_assert(sizeof(FastLane) <= RAM_BUDGET_FAST_LANE, "The fast lane's rings are over their RAM budget");
+static_assert(sizeof(Decimator) <= RAM_BUDGET_DECIMATOR, "The decimator's streams are over their RAM budget");
+static_assert(sizeof(StagedTable<ReliableIdTable>) + sizeof(ReliableLink) <= RAM_BUDGET_RELIABLE, "Reliable delivery is over its RAM budget");
+static_assert(sizeof(IsoTp) <= RAM_BUDGET_ISOTP, "The ISO-TP links are over their RAM budget");
+static_assert(sizeof(IdIndex) <= RAM_BUDGET_ID_INDEX, "The ID index is over its RAM budget");
+static_assert(sizeof(BusStats) <= RAM_BUDGET_BUS_STATS, "The per ID bus statistics are over their RAM budget");
+static_assert(sizeof(SSSF) <= RAM_BUDGET_TOTAL, "The SSSF object is over its RAM budget");
+
+namespace
+{
+    // Session request keys for the DSCP of each TrafficClass
+    const char* dscpKeys[NumTrafficClasses] = {"DSCPCAN", "DSCPSensor", "DSCPHealth", "DSCPBulk"};
+}
+
 SSSF::SSSF(const char* serverAddress, DynamicJsonDocument& _config, uint32_t _can0Baudrate):
-    CANNode(_can0Baudrate, _config["SSSFDevice"].as<String>()),
+    CANNode(_can0Baudrate),
     SensorNode(),
     HTTPClient(_config, serverAddress),
-    timeClient(&Log)
+    timeClient(&Log),
+    frameTrace(&timeClient)
     {}
 
 SSSF::SSSF(String& serverAddress, DynamicJsonDocument& _config, uint32_t _can0Baudrate):
@@ -22,17 +57,19 @@ SSSF::SSSF(String& serverAddress, DynamicJsonDocument& _config, uint32_t _can0Ba
     {}
 
 SSSF::SSSF(IPAddress& serverAddress, DynamicJsonDocument& _config, uint32_t _can0Baudrate):
-    CANNode(_can0Baudrate, _config["SSSFDevice"].as<String>()),
+    CANNode(_can0Baudrate),
     SensorNode(),
     HTTPClient(_config, serverAddress),
-    timeClient(&Log)
+    timeClient(&Log),
+    frameTrace(&timeClient)
     {}
 
 SSSF::SSSF(const char* serverAddress, DynamicJsonDocument& _config, uint32_t _can0Baudrate, uint32_t _can1Baudrate):
-    CANNode(_can0Baudrate, _can1Baudrate, _config["SSSFDevice"].as<String>()),
+    CANNode(_can0Baudrate, _can1Baudrate),
     SensorNode(),
     HTTPClient(_config, serverAddress),
-    timeClient(&Log)
+    timeClient(&Log),
+    frameTrace(&timeClient)
     {}
 
 SSSF::SSSF(String& serverAddress, DynamicJsonDocument& _config, uint32_t _can0Baudrate, uint32_t _can1Baudrate):
@@ -40,10 +77,11 @@ SSSF::SSSF(String& serverAddress, DynamicJsonDocument& _config, uint32_t _can0Ba
     {}
 
 SSSF::SSSF(IPAddress& serverAddress, DynamicJsonDocument& _config, uint32_t _can0Baudrate, uint32_t _can1Baudrate):
-    CANNode(_can0Baudrate, _can1Baudrate, _config["SSSFDevice"].as<String>()),
+    CANNode(_can0Baudrate, _can1Baudrate),
     SensorNode(),
     HTTPClient(_config, serverAddress),
-    timeClient(&Log)
+    timeClient(&Log),
+    frameTrace(&timeClient)
     {}
 
 bool SSSF::setup()
@@ -55,16 +93,44 @@ bool SSSF::setup()
         Log.noticeln("Setting up message sizes.");
         comBlockSize = sizeof(COMMBlock);
         comHeadSize = comBlockSize - sizeof(WCANBlock);
+        HTTPClient::addSection("Filters", &filters);
+        HTTPClient::addSection("Rewrites", &rewrites);
+        HTTPClient::addSection("Reliable", &reliable);
+        HTTPClient::addSection("Critical", &critical);
+        HTTPClient::addSection("Signals", &signalTable);
+        HTTPClient::addSection("Decimation", &decimation);
+        decimator.begin(&decimation);
+        HTTPClient::addSection("ISOTP", &isoTpLinks);
+        isoTp.begin(&isoTpLinks);
+        fastLane.begin(&critical, &isoTp);
+        metricsWriter.attach(&busStats, &idIndex);
+        CANNode::onReceive(0, FastLane::received0);
+        if (can1BaudRate >= 0) CANNode::onReceive(1, FastLane::received1);
+        control.begin();
+        control.setTOS(getDSCP(HealthTraffic) << 2);
+        CycleCounter::begin();
+        IdIndex::benchmark();
+        EthernetStats::begin();
         Log.noticeln("Ready.");
         return true;
     }
     return false;
 }
 
-void SSSF::forwardingLoop(bool print)
+FASTRUN void SSSF::forwardingLoop(bool print)
 {
+    uint32_t loopStart = micros();
+    // Critical frames are sent between each of the slow steps.
+    forwardCritical();
     timeClient.update();
+    forwardCritical();
+    pollControl();
+    forwardCritical();
     pollServer();
+    forwardCritical();
+    pollMetrics();
+    ethernetStats.poll(CANNode::sessionSocket());
+    forwardCritical();
     // struct CAN_message_t canFrame;
     // if (can0.read(canFrame))
     // {
@@ -89,20 +155,34 @@ void SSSF::forwardingLoop(bool print)
         // -----------
         struct COMMBlock msg = {0};
         struct CAN_message_t canFrame;
-        pollCANNetwork(canFrame);
+        uint32_t slotStart = micros();
+        uint32_t slotLeft = UINT32_MAX;
+        uint32_t uplinkUS = 0;  // Time spent sending uplink, for the slot utilization
+        if (uplinkSlots.enabled())
+        {// Everything read since our last slot goes out together
+            slotLeft = uplinkSlots.open(timeClient.getEpochTimeUS());
+            while ((micros() - slotStart < slotLeft) && pollCANNetwork(canFrame)) {}
+            uplinkUS = micros() - slotStart;
+        }
+        else
+        {
+            pollCANNetwork(canFrame);
+        }
+        forwardCritical();
+        downlinkCycles.start();
         int packetSize = readCOMMBlock(&msg);
         if (packetSize > 0)
         {
             if (print) Serial.println(dumpCOMMBlock(msg));
             if (msg.type == 1)
             {
-                networkHealth->update(msg.index, packetSize, msg.timestamp, msg.canFrame.sequenceNumber);
-                can0.write(msg.canFrame.can);
-                if (can1BaudRate > 0) can1.write(msg.canFrame.can);
+                receive(msg, packetSize);
+                downlinkCycles.stop();
             }
-            else if (msg.type == 2)
-            {
+            else if ((msg.type == 2) && (msg.index == 0))
+            {// Only the controller sends sensor frames, it paces the session's frame numbers
                 networkHealth->update(msg.index, packetSize, msg.timestamp, msg.frameNumber);
+                measure(SensorTraffic, msg.timestamp);
                 frameNumber = msg.frameNumber;
                 // // Apply transformation
                 // canFrame.mb = 0;
@@ -120,31 +200,165 @@ void SSSF::forwardingLoop(bool print)
             }
             else if (msg.type == 3)
             {
-                write(networkHealth->HealthReport);
-                networkHealth->reset();
+                measure(HealthTraffic, msg.timestamp);
+                uint32_t now = millis();
+                if (lastHealthRequest != 0) healthInterval = now - lastHealthRequest;
+                lastHealthRequest = now;
+                healthDue = true;
+            }
+            else if (msg.type == 10)
+            {
+                measure(HealthTraffic, msg.timestamp);
+                healthAggregator.offer(inboundDigest);
+            }
+            else if ((msg.type == 7) && (inboundNack.target == index))
+            {
+                Metrics.nacksReceived++;
+                retransmit(inboundNack);
+            }
+            else if (msg.type == 8)
+            {
+                struct COMMBlock rebuilt = {0};
+                uint32_t lost;
+                if (fec.repair(msg.index, inboundParity, reinterpret_cast<uint8_t*>(&rebuilt), lost))
+                {
+                    networkHealth->recovered(msg.index);
+                    // Anything that followed the COMMBlock wasn't protected
+                    rebuilt.flags = (rebuilt.flags & ~TRACE_FLAG) | RECOVERED_FLAG;
+                    receive(rebuilt, comBlockSize);
+                }
+                if (lost > 0) networkHealth->unrecoverable(msg.index, lost);
+            }
+            else if (msg.type == 9)
+            {
+                isoTp.request(inboundPdu, inboundPduData);
             }
         }
-        if (numSignals > 0)
+        pollTransmit();
+        pollIsoTp();
+        ReliableLink::Nack nack;
+        if (reliableLink.nackDue(nack))
         {
-            delete[] signals;
-            numSignals = 0;
+            write(nack);
         }
+        uint32_t uplinkStart = micros();
+        if (uplinkStart - slotStart < slotLeft)
+        {
+            uint8_t heldChannel;
+            struct CAN_message_t held;
+            while (decimator.expired(heldChannel, held, millis()))
+            {// Held back by a rate cap whose interval has ended, no later frame came to close it
+                rewrites->apply(heldChannel, Uplink, held);
+                write(held, heldChannel);
+            }
+            if (healthDue) reportHealth();
+            const HealthAggregator::Digest *summary = healthAggregator.completed();
+            if (summary != nullptr) write(*summary, 11);
+            IsoTp::PduHeader pduHeader;
+            const uint8_t *pdu;
+            while ((pdu = isoTp.completed(pduHeader)) != nullptr)
+            {
+                write(pduHeader, pdu);
+            }
+            if ((signalTable->size() > 0) && (millis() - lastSignals >= signalInterval) && signalTable->changed())
+            {
+                lastSignals = millis();
+                write(*signalTable);
+            }
+            FrameTrace::TraceBlock trace;
+            if (frameTrace.enabled() && frameTrace.completed(trace))
+            {
+                write(trace);
+            }
+            if (addressTable.changed)
+            {
+                write(addressTable);
+                addressTable.changed = false;
+            }
+        }
+        CANNode::flush();
+        uplinkUS += micros() - uplinkStart;
+        if (uplinkSlots.enabled() && (slotLeft > 0)) uplinkSlots.used(uplinkUS);
+        capture.poll();  // After the slot, a card write can take a while
+#if defined(SSSF_CYCLE_BENCHMARK)
+        if (millis() - lastCycleReport >= CYCLE_REPORT_INTERVAL)
+        {
+            lastCycleReport = millis();
+            uplinkCycles.report();
+            downlinkCycles.report();
+        }
+#endif
+        // Allow for a few missed health requests before assuming we were cut off.
+        if (watchdogTimeout > 0) checkSession(max(watchdogTimeout, 3 * healthInterval));
     }
+    uint32_t loopTime = micros() - loopStart;
+    Metrics.loops++;
+    Metrics.loopLastUS = loopTime;
+    Metrics.loopMaxUS = max(Metrics.loopMaxUS, loopTime);
+    Metrics.loopTotalUS += loopTime;
 }
 
-void SSSF::write(struct CAN_message_t &canFrame)
+FASTRUN void SSSF::receive(struct COMMBlock &msg, int packetSize)
+{// A CAN datagram from the session, as sent or rebuilt
+    if (!reliableLink.received(msg.index, msg.canFrame.sequenceNumber, msg.flags & RELIABLE_FLAG)) return;
+    if (msg.flags & (RETRANSMIT_FLAG | RECOVERED_FLAG))
+    {// Its timestamp is from the first attempt, keep it out of the latency
+        if (msg.flags & RETRANSMIT_FLAG) Metrics.recovered++;
+    }
+    else
+    {
+        networkHealth->update(msg.index, packetSize, msg.timestamp, msg.canFrame.sequenceNumber);
+        measure(CANTraffic, msg.timestamp);
+    }
+    struct CAN_message_t written[RULES_CHANNELS];
+    uint8_t queued = 0;
+    if (transmit(0, msg.canFrame.can, written[queued])) queued++;
+    if ((can1BaudRate > 0) && transmit(1, msg.canFrame.can, written[queued])) queued++;
+    if (msg.flags & TRACE_FLAG) frameTrace.received(inboundTrace, index, inboundTraceAt, written, queued);
+}
+
+void SSSF::measure(TrafficClass trafficClass, uint64_t timestamp)
+{// Sender timestamps are in ms, so is the resolution of this
+    int64_t age = int64_t(timeClient.getEpochTimeUS()) - int64_t(timestamp) * 1000;
+    if (age < 0) age = 0;  // Clocks a little apart
+    if (age > UINT32_MAX) age = UINT32_MAX;
+    struct ClassLatency &latency = Metrics.latency[trafficClass];
+    latency.count++;
+    latency.maxUS = max(latency.maxUS, uint32_t(age));
+    latency.totalUS += age;
+}
+
+FASTRUN void SSSF::write(struct CAN_message_t &canFrame, uint8_t channel)
 {
+    uplinkCycles.start();
     struct COMMBlock msg = {0};
     msg.index = index;
     msg.frameNumber = frameNumber;
     msg.timestamp = timeClient.getEpochTimeMS();
     msg.type = 1;
+    if (tagSources) msg.source = addressTable.handle(channel, canFrame);
     CANNode::beginPacket(msg.canFrame);
     msg.canFrame.fd = false;
     msg.canFrame.needResponse = false;
     memcpy(&msg.canFrame.can, &canFrame, canSize);
+    if (reliable->selects(channel, Uplink, canFrame))
+    {
+        msg.flags |= RELIABLE_FLAG;
+        reliableLink.store(msg.canFrame.sequenceNumber, reinterpret_cast<uint8_t*>(&msg), comBlockSize);
+    }
+    bool traced = frameTrace.armed(msg.canFrame.sequenceNumber);
+    if (traced) msg.flags |= TRACE_FLAG;
     CANNode::write(reinterpret_cast<uint8_t*>(&msg), comBlockSize);
+    if (traced)
+    {
+        CANNode::write(reinterpret_cast<uint8_t*>(frameTrace.send()), sizeof(FrameTrace::TraceBlock));
+    }
     CANNode::endPacket();
+    if (fec.encode(msg.canFrame.sequenceNumber, reinterpret_cast<uint8_t*>(&msg)))
+    {
+        write(fec.parity());
+    }
+    uplinkCycles.stop();
 }
 
 void SSSF::write(struct CANFD_message_t &canFrame)
@@ -169,54 +383,288 @@ void SSSF::write(NetworkStats::NodeReport *healthReport)
     msg.frameNumber = frameNumber;
     msg.timestamp = timeClient.getEpochTimeMS();
     msg.type = 4;
-    CANNode::beginPacket();
+    CANNode::beginPacket(HealthTraffic);
     int reportSize = networkHealth->size * sizeof(NetworkStats::NodeReport);
-    uint8_t report[comHeadSize + reportSize];
-    memcpy(report, &msg, comHeadSize);
-    memcpy(report + comHeadSize, healthReport, reportSize);
-    CANNode::write(report, comHeadSize + reportSize);
+    // The bus summary goes after the node reports so older controllers that
+    // only read the node reports keep working.
+    int summarySize = sizeof(busStats.Summary);
+    int linkSize = sizeof(linkStats);
+    int recoverySize = networkHealth->size * sizeof(NetworkStats::Recovery);
+    int ethernetSize = sizeof(ethernetStats.summary);
+    uint8_t report[comHeadSize + reportSize + summarySize + linkSize + recoverySize + ethernetSize];
+    uint8_t *end = report;
+    memcpy(end, &msg, comHeadSize);
+    end += comHeadSize;
+    memcpy(end, healthReport, reportSize);
+    end += reportSize;
+    memcpy(end, busStats.Summary, summarySize);
+    end += summarySize;
+    memcpy(end, &linkStats, linkSize);
+    end += linkSize;
+    memcpy(end, networkHealth->Recoveries, recoverySize);
+    end += recoverySize;
+    memcpy(end, &ethernetStats.summary, ethernetSize);
+    end += ethernetSize;
+    CANNode::write(report, end - report);
     CANNode::endPacket(false);
 }
 
-int SSSF::readCOMMBlock(struct COMMBlock *buffer)
+void SSSF::reportHealth()
+{
+    healthDue = false;
+    busStats.summarize();
+    ethernetStats.summarize();
+    if (healthAggregator.active())
+    {
+        HealthAggregator::Digest digest;
+        if (healthAggregator.digest(*networkHealth, digest)) healthAggregator.offer(digest);
+        else write(digest, 10);
+    }
+    else
+    {
+        write(networkHealth->HealthReport);
+    }
+    if (addressTable.size > 0) addressTable.changed = true;
+    networkHealth->reset();
+    busStats.reset();
+    ethernetStats.reset();
+}
+
+void SSSF::write(const HealthAggregator::Digest &digest, uint8_t type)
+{// A node's digest (10) or the session summary (11)
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = type;
+    CANNode::beginPacket(HealthTraffic);
+    CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+    CANNode::write(reinterpret_cast<const uint8_t*>(&digest), HealthAggregator::length(digest));
+    CANNode::endPacket(false);
+}
+
+void SSSF::write(SignalTable &table)
+{// Laid out like a type 2 frame, but a type of its own so peers don't take it for the controller's
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = 12;
+    CANNode::beginPacket(SensorTraffic);
+    CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+    uint8_t count[4] = {uint8_t(table.size()), 0, 0, 0};  // numSignals, padded as in WSensorBlock
+    CANNode::write(count, sizeof(count));
+    CANNode::write(reinterpret_cast<const uint8_t*>(table.latest()), table.size() * sizeof(float));
+    CANNode::endPacket(false);
+}
+
+void SSSF::write(IsoTp::PduHeader &header, const uint8_t *pdu)
+{// In as many datagrams as it takes
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = 9;
+    for (header.offset = 0; header.offset < header.total; header.offset += header.length)
+    {
+        header.length = min(uint16_t(ISOTP_FRAGMENT), uint16_t(header.total - header.offset));
+        CANNode::beginPacket(CANTraffic);
+        CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+        CANNode::write(reinterpret_cast<uint8_t*>(&header), sizeof(IsoTp::PduHeader));
+        CANNode::write(pdu + header.offset, header.length);
+        CANNode::endPacket(false);
+    }
+}
+
+void SSSF::write(struct FrameTrace::TraceBlock &trace)
+{
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = 5;
+    CANNode::beginPacket(BulkTraffic);
+    CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+    CANNode::write(reinterpret_cast<uint8_t*>(&trace), sizeof(FrameTrace::TraceBlock));
+    CANNode::endPacket(false);
+}
+
+void SSSF::write(AddressTable &table)
+{
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = 6;
+    CANNode::beginPacket(BulkTraffic);
+    CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+    CANNode::write(reinterpret_cast<uint8_t*>(table.Names), table.size * sizeof(AddressTable::NameEntry));
+    CANNode::endPacket(false);
+}
+
+void SSSF::write(ReliableLink::Nack &nack)
+{
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = 7;
+    CANNode::beginPacket(CANTraffic);
+    CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+    CANNode::write(reinterpret_cast<uint8_t*>(&nack), sizeof(ReliableLink::Nack));
+    if (CANNode::endPacket(false)) Metrics.nacksSent++;
+}
+
+void SSSF::retransmit(ReliableLink::Nack &nack)
+{
+    for (uint32_t age = 1; age < RELIABLE_WINDOW; age++)
+    {
+        if (!(nack.missing & (1ULL << age))) continue;
+        size_t length;
+        uint8_t *datagram = reliableLink.retransmission(nack.highest - age, length);
+        if (datagram == nullptr) continue;  // Best effort or already gone
+        reinterpret_cast<COMMBlock*>(datagram)->flags |= RETRANSMIT_FLAG;
+        CANNode::beginPacket(CANTraffic);
+        CANNode::write(datagram, length);
+        if (CANNode::endPacket(false)) Metrics.retransmits++;
+    }
+}
+
+void SSSF::write(ParityFEC::Parity &parity)
+{
+    struct COMMBlock msg = {0};
+    msg.index = index;
+    msg.frameNumber = frameNumber;
+    msg.timestamp = timeClient.getEpochTimeMS();
+    msg.type = 8;
+    CANNode::beginPacket(CANTraffic);
+    CANNode::write(reinterpret_cast<uint8_t*>(&msg), comHeadSize);
+    CANNode::write(reinterpret_cast<uint8_t*>(&parity), fec.parityLength());
+    CANNode::endPacket(false);
+}
+
+FASTRUN int SSSF::readCOMMBlock(struct COMMBlock *buffer)
 {
     if (CANNode::parsePacket())
     {
         uint8_t *buf = reinterpret_cast<uint8_t*>(buffer);
         int recvdHeaders = CANNode::read(buf, comHeadSize);
+        int recvd = -1;
+        bool traceLost = false;
         if (recvdHeaders > 0)
         {
             int recvdData = 0;
             if (buffer->type == 1)
             {
                 recvdData = CANNode::read(&buffer->canFrame);
+                if (recvdData > 0)
+                {// Parity covers the COMMBlock as sent, with the part of the union a
+                    // classic frame doesn't fill zeroed as it was on the sender, not
+                    // left over from an earlier datagram.
+                    int used = recvdHeaders + recvdData;
+                    memset(buf + used, 0, comBlockSize - used);
+                }
+                if ((buffer->flags & TRACE_FLAG) && (recvdData > 0))
+                {
+                    inboundTraceAt = timeClient.getEpochTimeUS();
+                    // The trace follows the full sized COMMBlock the sender wrote.
+                    int skip = comBlockSize - (recvdHeaders + recvdData);
+                    uint8_t unused[skip];
+                    CANNode::read(unused, skip);
+                    traceLost = (CANNode::read(reinterpret_cast<uint8_t*>(&inboundTrace), sizeof(FrameTrace::TraceBlock)) <= 0);
+                }
             }
             else if (buffer->type == 2)
             {
                 recvdData = SensorNode::read(&buffer->sensorFrame);
             }
-            else if (buffer->type == 3)
+            else if (((buffer->type >= 3) && (buffer->type <= 6)) || (buffer->type == 11) || (buffer->type == 12))
+            {// Health requests have no data, the rest aren't meant for SSSFs
+                recvd = recvdHeaders;
+            }
+            else if (buffer->type == 10)
+            {
+                uint8_t *digest = reinterpret_cast<uint8_t*>(&inboundDigest);
+                recvdData = CANNode::read(digest, HealthAggregator::digestHeadSize);
+                if ((recvdData > 0) && (inboundDigest.numOutliers <= HEALTH_MAX_OUTLIERS))
+                {
+                    size_t outliers = inboundDigest.numOutliers * sizeof(HealthAggregator::Outlier);
+                    if ((outliers > 0) && (CANNode::read(digest + HealthAggregator::digestHeadSize, outliers) != int(outliers)))
+                    {
+                        recvdData = 0;
+                    }
+                    else
+                    {
+                        recvdData += outliers;
+                    }
+                }
+                else
+                {
+                    recvdData = 0;
+                }
+            }
+            else if (buffer->type == 7)
+            {
+                recvdData = CANNode::read(reinterpret_cast<uint8_t*>(&inboundNack), sizeof(ReliableLink::Nack));
+            }
+            else if (buffer->type == 8)
             {
-                return recvdHeaders;
+                recvdData = CANNode::read(reinterpret_cast<uint8_t*>(&inboundParity), fec.parityLength());
+            }
+            else if (buffer->type == 9)
+            {
+                recvdData = CANNode::read(reinterpret_cast<uint8_t*>(&inboundPdu), sizeof(IsoTp::PduHeader));
+                if ((recvdData > 0) && (inboundPdu.length <= ISOTP_FRAGMENT) &&
+                    (CANNode::read(inboundPduData, inboundPdu.length) == inboundPdu.length))
+                {
+                    recvdData += inboundPdu.length;
+                }
+                else
+                {
+                    recvdData = 0;
+                }
             }
             if (recvdData > 0)
             {
-                return recvdHeaders + recvdData;
+                recvd = recvdHeaders + recvdData;
             }
         }
+        if (recvd < 0)
+        {
+            Metrics.drops[MalformedDatagram]++;
+            return -1;
+        }
+        // Nothing a forged or replayed datagram says may reach the FEC state either
+        if (!CANNode::authenticate(buffer->index))
+        {
+            Metrics.drops[AuthFailed]++;
+            return -1;
+        }
+        if ((buffer->type == 1) && !(buffer->flags & RETRANSMIT_FLAG))
+        {// Before any flag is cleared below
+            uint32_t lost;
+            fec.received(buffer->index, buffer->canFrame.sequenceNumber, buf, lost);
+            if (lost > 0) networkHealth->unrecoverable(buffer->index, lost);
+        }
+        if (traceLost) buffer->flags &= ~TRACE_FLAG;
+        return recvd;
     }
     return -1;
 }
 
 void SSSF::pollServer()
 {
-    struct Request request;
+    struct Request &request = httpRequest;
     if(HTTPClient::read(&request))
     {
         if (request.method.equalsIgnoreCase("POST"))
         {
             start(&request);
         }
+        else if (request.method.equalsIgnoreCase("PUT"))
+        {
+            reconfigure(&request);
+        }
         else if (request.method.equalsIgnoreCase("DELETE"))
         {
             id = 0;
@@ -224,6 +672,14 @@ void SSSF::pollServer()
             frameNumber = 0;
             stop();
         }
+        else if (request.method.equalsIgnoreCase("GET") && (request.uri == "/metrics"))
+        {
+            serveMetrics(MetricsWriter::Text);
+        }
+        else if (request.method.equalsIgnoreCase("GET") && (request.uri == "/metrics.bin"))
+        {
+            serveMetrics(MetricsWriter::Binary);
+        }
         else
         {
             struct Response notImplemented = {501, "NOT IMPLEMENTED"};
@@ -232,42 +688,459 @@ void SSSF::pollServer()
     }
 }
 
-void SSSF::pollCANNetwork(struct CAN_message_t &canFrame)
-{ // If messages build up in the queue this should be a while loop
-    if ((can0BaudRate > 0) && can0.read(canFrame))
+void SSSF::pollControl()
+{
+    if (!control.poll()) return;
+    const struct ControlHeader &command = control.header;
+    if (command.command == CommandStart)
+    {
+        if (command.length < sizeof(struct ControlStart))
+        {
+            control.reply(ControlBadRequest);
+            return;
+        }
+        struct ControlStart request;
+        memcpy(&request, control.payload, sizeof(request));
+        if ((request.ip[0] != 239) || (request.ip[1] != 255) || (request.port < 1025))
+        {
+            Log.errorln("Control start has an invalid multicast group or port.");
+            control.reply(ControlBadRequest);
+            return;
+        }
+        struct SessionConfig config;
+        config.id = request.id;
+        config.index = request.index;
+        config.ip = IPAddress(request.ip[0], request.ip[1], request.ip[2], request.ip[3]);
+        config.port = request.port;
+        config.members = request.members;
+        config.traceRate = request.options.traceRate;
+        config.tagSources = request.options.options & CONTROL_OPTION_J1939_TAGGING;
+        config.watchdogTimeout = request.options.watchdogTimeout;
+        config.fecBlock = request.options.fecBlock;
+        config.slotPeriod = request.options.slotPeriod;
+        config.transport = (request.options.options & CONTROL_OPTION_RAW_TRANSPORT) ? RawTransport : UDPTransport;
+        control.reply(start(config) ? ControlOK : ControlFailed);
+    }
+    else if (command.command == CommandStop)
+    {
+        if (sessionStatus != Active)
+        {
+            control.reply(ControlNotActive);
+            return;
+        }
+        frameNumber = 0;
+        stop();
+        control.reply(ControlOK);
+    }
+    else if (command.command == CommandReconfigure)
+    {
+        if (command.length < sizeof(struct ControlOptions))
+        {
+            control.reply(ControlBadRequest);
+        }
+        else if (sessionStatus != Active)
+        {
+            control.reply(ControlNotActive);
+        }
+        else
+        {
+            struct ControlOptions options;
+            memcpy(&options, control.payload, sizeof(options));
+            struct SessionConfig config;
+            config.traceRate = options.traceRate;
+            config.tagSources = options.options & CONTROL_OPTION_J1939_TAGGING;
+            config.watchdogTimeout = options.watchdogTimeout;
+            config.fecBlock = options.fecBlock;
+            config.slotPeriod = options.slotPeriod;
+            config.slotCount = uplinkSlots.getSlots();
+            config.signalInterval = signalInterval;
+            for (int c = 0; c < NumTrafficClasses; c++)
+            {// Not carried by the control protocol
+                config.dscp[c] = getDSCP(TrafficClass(c));
+            }
+            control.reply(configure(config) ? ControlOK : ControlBadRequest);
+        }
+    }
+    else if (command.command == CommandPing)
+    {
+        struct ControlStatusReport report = {0};
+        report.id = id;
+        report.index = index;
+        report.epochUS = timeClient.getEpochTimeUS();
+        report.uptimeMS = millis();
+        report.sessionActive = (sessionStatus == Active);
+        control.reply(ControlOK, &report, sizeof(report));
+    }
+    else
+    {
+        control.reply(ControlBadRequest);
+    }
+}
+
+void SSSF::pollMetrics()
+{ // Sends one piece of an in progress scrape per pass of the loop
+    if (metricsWriter.active())
+    {
+        const char* chunk;
+        size_t length = metricsWriter.next(chunk);
+        HTTPClient::writeChunk(chunk, length);
+    }
+}
+
+void SSSF::serveMetrics(MetricsWriter::Format format)
+{
+    Metrics.clockOffsetUS = timeClient.getOffset();
+    Metrics.rejoins = linkStats.rejoins;
+    Metrics.socketResets = linkStats.socketResets;
+    for (int c = 0; c < METRICS_CHANNELS; c++)
+    {
+        Metrics.busLoad[c] = busStats.Summary[c].load;
+    }
+    metricsWriter.begin(format);
+    if (!HTTPClient::beginResponse(200, "OK", metricsWriter.contentType()))
+    {
+        while (metricsWriter.active())
+        {
+            const char* chunk;
+            metricsWriter.next(chunk);
+        }
+    }
+}
+
+FASTRUN bool SSSF::pollCANNetwork(struct CAN_message_t &canFrame)
+{// Forwards up to one frame from each channel, false if there were none
+    bool read = false;
+    if ((can0BaudRate > 0) && fastLane.read(0, canFrame))
+    {
+        uplink(0, canFrame);
+        read = true;
+    }
+    if ((can1BaudRate > 0) && fastLane.read(1, canFrame))
+    {
+        uplink(1, canFrame);
+        read = true;
+    }
+    return read;
+}
+
+FASTRUN void SSSF::forwardCritical()
+{
+    uint8_t channel;
+    struct CAN_message_t canFrame;
+    bool sent = false;
+    while (fastLane.nextCritical(channel, canFrame))
+    {// Outside a session they are stale by the time one starts
+        if (sessionStatus != Active) continue;
+        if (!isoTp.terminates(channel, canFrame)) Metrics.fastLaneUp++;
+        uplink(channel, canFrame);
+        sent = true;
+    }
+    if (sent) CANNode::flush();  // Not batched with what the pass sends later
+}
+
+FASTRUN void SSSF::uplink(uint8_t channel, struct CAN_message_t &canFrame)
+{
+    if (channel == 0)
     {
         digitalWrite(rxCANLED, rxCANLEDStatus);
         rxCANLEDStatus = !rxCANLEDStatus;
-        write(canFrame);
     }
-    if ((can1BaudRate > 0) && can1.read(canFrame))
+    Metrics.canRx[channel]++;
+    int16_t slot = idIndex.slot(IdIndex::key(channel, canFrame));
+    capture.record(channel, canFrame, timeClient.getEpochTimeUS(), false);
+    busStats.received(channel, slot, canFrame);
+    addressTable.update(channel, canFrame);
+    if (isoTp.received(channel, canFrame, micros())) return;
+    signalTable->decode(channel, canFrame);
+    if (filters->accept(channel, Uplink, canFrame) && decimator.offer(channel, slot, canFrame, millis()))
     {
-        write(canFrame);
+        rewrites->apply(channel, Uplink, canFrame);
+        if (frameTrace.sample(sequenceNumber))
+        {
+            frameTrace.begin(index, sequenceNumber, canFrame, busAge(channel, canFrame));
+        }
+        write(canFrame, channel);
+    }
+}
+
+FASTRUN bool SSSF::transmit(uint8_t channel, const struct CAN_message_t &received, struct CAN_message_t &canFrame)
+{ // Rewrites a copy so a rewrite for one channel doesn't leak onto the other
+    canFrame = received;
+    if (!filters->accept(channel, Downlink, canFrame)) return false;
+    rewrites->apply(channel, Downlink, canFrame);
+    bool written = false;
+    if (fastLane.critical(channel, Downlink, canFrame))
+    {// Straight into its mailbox, the backlog is the fallback if it's still busy
+        written = (channel == 0) ? can0.write(FAST_LANE_TX_MB, canFrame) : can1.write(FAST_LANE_TX_MB, canFrame);
+        if (written) Metrics.fastLaneDown++;
+    }
+    if (!written) written = send(channel, canFrame);
+    if (written)
+    {
+        busStats.transmitted(channel, canFrame);
+        capture.record(channel, canFrame, timeClient.getEpochTimeUS(), true);
+        Metrics.canTx[channel]++;
+    }
+    else
+    {
+        Metrics.drops[CANTxFull]++;
+    }
+    Metrics.canTxQueueHighWater[channel] = max(Metrics.canTxQueueHighWater[channel], (uint32_t) transmitBacklog(channel));
+    return written;
+}
+
+void SSSF::pollIsoTp()
+{// Frames made here don't go through the filters or rewrites
+    uint8_t channel;
+    struct CAN_message_t canFrame;
+    while (isoTp.next(channel, canFrame, micros()))
+    {
+        // Not backlogged, the separation time counts from when it went to a mailbox
+        if (!send(channel, canFrame, false)) break;  // Tried again on the next pass
+        isoTp.written(micros());
+        busStats.transmitted(channel, canFrame);
+        capture.record(channel, canFrame, timeClient.getEpochTimeUS(), true);
+        Metrics.canTx[channel]++;
     }
 }
 
 void SSSF::start(struct Request *request)
 {
+    struct SessionConfig config;
+    config.id = request->json["ID"];
+    config.index = request->json["Index"];
+    String ip = request->json["IP"];
+    if (!config.ip.fromString(ip))
+    {
+        Log.errorln("Failed to parse multicast IP address.");
+        return;
+    }
+    // Only installed once the running session has stopped
+    const char* authKey = request->json["AuthKey"] | "";
+    uint8_t key[AUTH_KEY_SIZE];
+    config.newAuthKey = true;
+    if (authKey[0] != '\0')
+    {
+        if (!SessionAuth::parseKey(authKey, key))
+        {
+            Log.errorln("AuthKey must be 32 hex digits.");
+            return;
+        }
+        config.authKey = key;
+    }
+    config.port = request->json["Port"];
+    config.members = request->devices;
+    config.traceRate = request->json["TraceRate"] | 0;
+    config.tagSources = request->json["J1939Tagging"] | false;
+    config.watchdogTimeout = request->json["WatchdogTimeout"] | 5000;
+    config.fecBlock = request->json["FECBlock"] | 0;
+    if (!readSlotPeriod(request->json, config)) return;
+    config.slotCount = request->json["SlotCount"] | 0;
+    config.signalInterval = request->json["SignalInterval"] | SIGNALS_DEFAULT_INTERVAL;
+    config.healthAggregation = request->json["HealthAggregation"] | false;
+    config.healthAggregator = request->json["HealthAggregator"] | -1;
+    config.capture = request->json["Capture"] | "";
+    if (!readDSCP(request->json, config)) return;
+    const char* transport = request->json["Transport"] | "UDP";
+    config.transport = (strcmp(transport, "Raw") == 0) ? RawTransport : UDPTransport;
+    // A new session doesn't inherit rules the request left out
+    commitRules(true);
+    start(config);
+}
+
+bool SSSF::start(struct SessionConfig &config)
+{
+    if (sessionStatus == Active) stop();
+    if (config.newAuthKey && !auth.setKey(config.authKey)) return false;
     timeClient.session = true;
-    id = request->json["ID"];
-    index = request->json["Index"];
-    size_t membersSize = request->json["Devices"].size();
+    id = config.id;
+    index = config.index;
     frameNumber = 0;
-    networkHealth = new NetworkStats(membersSize, &timeClient);
-    String ip = request->json["IP"];
-    if (CANNode::startSession(ip, request->json["Port"]))
+    networkHealth = new NetworkStats(config.members, &timeClient);
+    idIndex.clear();
+    decimator.reset();
+    busStats.start(can0BaudRate, can1BaudRate);
+    ethernetStats.reset();
+    reliableLink.start(config.members);
+    fec.start(config.members, comBlockSize);
+    auth.start(config.members);
+    healthAggregator.start(config.members, config.index, config.healthAggregation, config.healthAggregator);
+    addressTable.reset();
+    tagSources = false;
+    lastHealthRequest = 0;
+    healthInterval = 0;
+    healthDue = false;
+    if (config.slotCount == 0) config.slotCount = config.members;
+    fastLane.start();
+    if (!configure(config) || !CANNode::startSession(config.ip, config.port, config.transport))
+    {
+        release();
+        return false;
+    }
+    Log.noticeln("\tID: %d\tIndex: %d", id, index);
+    if (auth.enabled()) Log.noticeln("\tAuthenticating datagrams.");
+    if ((config.capture[0] != '\0') && capture.start(config.capture))
+    {
+        Log.noticeln("\tRecording the buses to %s.", config.capture);
+    }
+    return true;
+}
+
+void SSSF::reconfigure(struct Request *request)
+{// Changes a running session in place, anything the request leaves out stays
+    if (sessionStatus != Active)
+    {// A session takes its rules from the POST that starts it
+        Log.errorln("There is no session to change.");
+        struct Response conflict = {409, "CONFLICT"};
+        HTTPClient::write(&conflict);
+        return;
+    }
+    if (commitRules(false)) Log.noticeln("Switched to the new rule tables.");
+    JsonDocument &json = request->json;
+    bool options = json.containsKey("TraceRate") || json.containsKey("J1939Tagging") ||
+        json.containsKey("WatchdogTimeout") || json.containsKey("FECBlock") ||
+        json.containsKey("SlotPeriod") || json.containsKey("SlotCount") || json.containsKey("SignalInterval");
+    for (int c = 0; c < NumTrafficClasses; c++)
+    {
+        options = options || json.containsKey(dscpKeys[c]);
+    }
+    if (options)
+    {
+        struct SessionConfig config;
+        config.traceRate = json["TraceRate"] | (int) frameTrace.rate();
+        config.tagSources = json["J1939Tagging"] | tagSources;
+        config.watchdogTimeout = json["WatchdogTimeout"] | watchdogTimeout;
+        config.fecBlock = json["FECBlock"] | fec.getBlockSize();
+        config.slotPeriod = uplinkSlots.getPeriod();
+        config.slotCount = json["SlotCount"] | uplinkSlots.getSlots();
+        config.signalInterval = json["SignalInterval"] | signalInterval;
+        for (int c = 0; c < NumTrafficClasses; c++)
+        {
+            config.dscp[c] = getDSCP(TrafficClass(c));
+        }
+        if (!readDSCP(json, config) || !readSlotPeriod(json, config) || !configure(config))
+        {
+            struct Response badRequest = {400, "BAD REQUEST"};
+            HTTPClient::write(&badRequest);
+            return;
+        }
+    }
+    struct Response ok = {200, "OK"};
+    HTTPClient::write(&ok);
+}
+
+bool SSSF::readDSCP(JsonDocument &json, struct SessionConfig &config)
+{// Takes the DSCPs the request sets over the ones in config, false if one is out of range
+    for (int c = 0; c < NumTrafficClasses; c++)
+    {
+        int32_t value = json[dscpKeys[c]] | int32_t(config.dscp[c]);
+        if ((value < 0) || (value > DSCP_MAX))
+        {
+            Log.errorln("%s must be 0 to %d.", dscpKeys[c], DSCP_MAX);
+            return false;
+        }
+        config.dscp[c] = value;
+    }
+    return true;
+}
+
+bool SSSF::readSlotPeriod(JsonDocument &json, struct SessionConfig &config)
+{// Takes a "SlotPeriod" the request sets over the one in config, false if it is out of range
+    uint32_t period = json["SlotPeriod"] | uint32_t(config.slotPeriod);
+    if (period > UPLINK_SLOT_MAX_PERIOD_US)
+    {
+        Log.errorln("SlotPeriod must be at most %d us.", UPLINK_SLOT_MAX_PERIOD_US);
+        return false;
+    }
+    config.slotPeriod = period;
+    return true;
+}
+
+bool SSSF::commitRules(bool replace)
+{// Makes the tables compiled from the last request live, replace clears the rest
+    bool committed = false;
+    if (filters.commit()) committed = true;
+    else if (replace) filters.clear();
+    if (rewrites.commit()) committed = true;
+    else if (replace) rewrites.clear();
+    if (reliable.commit()) committed = true;
+    else if (replace) reliable.clear();
+    if (critical.commit()) committed = true;
+    else if (replace) critical.clear();
+    if (signalTable.commit()) committed = true;
+    else if (replace) signalTable.clear();
+    if (decimation.commit()) committed = true;
+    else if (replace) decimation.clear();
+    if (committed || replace) decimator.reset();
+    bool links = isoTpLinks.commit();
+    if (links) committed = true;
+    else if (replace) isoTpLinks.clear();
+    if (links || replace) isoTp.reset();
+    return committed;
+}
+
+bool SSSF::configure(struct SessionConfig &config)
+{// The options that can change while a session is running, false if the slots don't fit
+    // First, so a bad slot config leaves everything as it was
+    if (!uplinkSlots.start(config.slotPeriod, config.slotCount, index)) return false;
+    watchdogTimeout = config.watchdogTimeout;
+    for (int c = 0; c < NumTrafficClasses; c++)
+    {
+        setDSCP(TrafficClass(c), config.dscp[c]);
+    }
+    control.setTOS(getDSCP(HealthTraffic) << 2);
+    fec.setBlockSize(config.fecBlock);
+    if (fec.getBlockSize() > 0)
+    {
+        Log.noticeln("\tSending a parity datagram every %d CAN datagrams.", fec.getBlockSize());
+    }
+    signalInterval = config.signalInterval;
+    if (uplinkSlots.enabled())
     {
-        Log.noticeln("\tID: %d\tIndex: %d", id, index);
+        Log.noticeln("\tSending uplink in slot %d of %d every %d us.",
+            index % config.slotCount, config.slotCount, config.slotPeriod);
     }
+    frameTrace.start(config.traceRate);
+    if (frameTrace.enabled())
+    {
+        CANNode::onTransmit(FrameTrace::transmitted);
+        Log.noticeln("\tTracing 1 in every %d CAN frames.", config.traceRate);
+    }
+    if (config.tagSources && !tagSources)
+    {
+        Log.noticeln("\tTagging frames with J1939 NAME handles.");
+        // Have every ECU announce its address so the table fills quickly.
+        struct CAN_message_t claimRequest;
+        AddressTable::makeClaimRequest(claimRequest);
+        if (can0BaudRate > 0) send(0, claimRequest);
+        if (can1BaudRate > 0) send(1, claimRequest);
+    }
+    tagSources = config.tagSources;
+    return true;
 }
 
 void SSSF::stop()
 {
+    release();
+    CANNode::stopSession();
+}
+
+void SSSF::release()
+{// Everything start() sets up besides the session socket
     timeClient.session = false;
     id = 0;
     index = 0;
+    frameTrace.stop();
+    reliableLink.stop();
+    fec.stop();
+    auth.stop();
+    healthAggregator.stop();
+    capture.stop();
+    uplinkSlots.stop();
+    fastLane.stop();
+    healthDue = false;
     delete networkHealth;
-    CANNode::stopSession();
+    networkHealth = nullptr;
 }
 
 String SSSF::dumpCOMMBlock(struct COMMBlock &commBlock)
@@ -2,10 +2,29 @@
 #define SSSF_H_
 
 #include <Arduino.h>
+#include <SSSF/RamBudget.h>
 #include <SensorNode/SensorNode.h>
 #include <HTTP/HTTPClient.h>
 #include <NetworkStats/NetworkStats.h>
+#include <NetworkStats/HealthAggregator.h>
 #include <TimeClient/TimeClient.h>
+#include <Trace/FrameTrace.h>
+#include <BusStats/BusStats.h>
+#include <EthernetStats/EthernetStats.h>
+#include <J1939/AddressTable.h>
+#include <Metrics/Metrics.h>
+#include <Rules/Rules.h>
+#include <Control/ControlSocket.h>
+#include <Reliability/ReliableLink.h>
+#include <Reliability/ParityFEC.h>
+#include <Benchmark/CycleCounter.h>
+#include <FastLane/FastLane.h>
+#include <Schedule/UplinkSchedule.h>
+#include <Signals/SignalTable.h>
+#include <IdIndex/IdIndex.h>
+#include <Decimation/Decimator.h>
+#include <IsoTp/IsoTp.h>
+#include <Capture/CaptureLog.h>
 #include <EthernetUdp.h>
 #include <ArduinoJson.h>
 #include <IPAddress.h>
@@ -18,8 +37,51 @@ private:
     uint32_t index;
     uint32_t frameNumber;
     TimeClient timeClient;
+    FrameTrace frameTrace;
 
-    NetworkStats *networkHealth;
+    IdIndex idIndex;  // Slots for the per ID state of BusStats and the Decimator
+    NetworkStats *networkHealth = nullptr;
+    HealthAggregator healthAggregator;
+    HealthAggregator::Digest inboundDigest;
+    BusStats busStats;
+    EthernetStats ethernetStats;
+    AddressTable addressTable;
+    bool tagSources = false;
+
+    StagedTable<SessionFilterTable> filters;
+    StagedTable<RewriteTable> rewrites;
+    StagedTable<ReliableIdTable> reliable;  // IDs whose datagrams can be NACKed
+    StagedTable<CriticalTable> critical;  // IDs that take the fast lane
+    StagedTable<SignalTable> signalTable;
+    uint32_t signalInterval = SIGNALS_DEFAULT_INTERVAL;  // ms
+    uint32_t lastSignals = 0;  // millis()
+    StagedTable<DecimationTable> decimation;
+    Decimator decimator;
+    StagedTable<IsoTpTable> isoTpLinks;
+    IsoTp isoTp;
+    IsoTp::PduHeader inboundPdu;
+    uint8_t inboundPduData[ISOTP_FRAGMENT];
+    CaptureLog capture;
+    FastLane fastLane;
+    UplinkSchedule uplinkSlots;
+    ReliableLink reliableLink;
+    ReliableLink::Nack inboundNack;
+    ParityFEC fec;
+    ParityFEC::Parity inboundParity;
+    CycleCounter uplinkCycles{"Uplink CAN frame"};
+    CycleCounter downlinkCycles{"Downlink CAN frame"};
+    uint32_t lastCycleReport = 0;
+    struct Request httpRequest;  // Filled over several loops for big bodies
+
+    uint32_t watchdogTimeout = 0;  // ms, 0 disables the session watchdog
+    uint32_t lastHealthRequest = 0;  // millis()
+    uint32_t healthInterval = 0;  // ms between the last two health requests
+    bool healthDue = false;  // Requested, waiting for the uplink slot
+
+    MetricsWriter metricsWriter;
+    ControlSocket control;
+    FrameTrace::TraceBlock inboundTrace;
+    uint64_t inboundTraceAt = 0;
 
     int comBlockSize = 0;
     int comHeadSize = 0;
@@ -36,6 +98,8 @@ public:
         uint32_t frameNumber;
         uint64_t timestamp;
         uint8_t type;
+        uint8_t flags;
+        uint8_t source;  // NAME handle of the sending ECU, 0 if unknown
         union
         {
             struct WSensorBlock sensorFrame;
@@ -44,6 +108,30 @@ public:
         };
     };
 
+    // What a session is started with, from either HTTP or the control socket
+    struct SessionConfig
+    {
+        uint32_t id = 0;
+        uint32_t index = 0;
+        IPAddress ip;
+        uint16_t port = 0;
+        size_t members = 0;
+        int traceRate = 0;
+        bool tagSources = false;
+        uint32_t watchdogTimeout = 5000;
+        uint8_t fecBlock = 0;
+        uint16_t slotPeriod = 0;  // us, 0 sends whenever
+        uint32_t slotCount = 0;  // 0 for one slot per member
+        uint32_t signalInterval = SIGNALS_DEFAULT_INTERVAL;  // ms between decoded signal frames
+        bool healthAggregation = false;  // Digests instead of full health reports
+        int32_t healthAggregator = -1;  // Index of the node that merges them, -1 to elect one
+        const char* capture = "";  // File on the SD card to record the buses to, empty for none
+        bool newAuthKey = false;  // Set by HTTP requests, a control start keeps the last key
+        const uint8_t *authKey = nullptr;  // AUTH_KEY_SIZE bytes, nullptr for none
+        Transport transport = UDPTransport;  // Fixed for the life of the session
+        uint8_t dscp[NumTrafficClasses] = DSCP_DEFAULTS;
+    };
+
     SSSF(const char* serverAddress, DynamicJsonDocument& _attachedDevice, uint32_t _can0Baudrate);
     SSSF(String& serverAddress, DynamicJsonDocument& _attachedDevice, uint32_t _can0Baudrate);
     SSSF(IPAddress& serverAddress, DynamicJsonDocument& _attachedDevice, uint32_t _can0Baudrate);
@@ -55,18 +143,44 @@ public:
     virtual bool setup();
     virtual void forwardingLoop(bool print = false);
 
-    void write(struct CAN_message_t &canFrame);
+    void write(struct CAN_message_t &canFrame, uint8_t channel = 0);
 private:
     void write(struct CANFD_message_t &canFrame);
     void write(NetworkStats::NodeReport *healthReport);
+    void reportHealth();
+    void write(SignalTable &table);
+    void write(IsoTp::PduHeader &header, const uint8_t *pdu);
+    void write(struct FrameTrace::TraceBlock &trace);
+    void write(AddressTable &table);
+    void write(ReliableLink::Nack &nack);
+    void write(ParityFEC::Parity &parity);
+    void write(const HealthAggregator::Digest &digest, uint8_t type);
+    void retransmit(ReliableLink::Nack &nack);
 
     int readCOMMBlock(struct COMMBlock *buffer);
+    void receive(struct COMMBlock &msg, int packetSize);
+    void measure(TrafficClass trafficClass, uint64_t timestamp);
 
     void pollServer();
-    void pollCANNetwork(struct CAN_message_t &canFrame);
+    void pollControl();
+    void pollMetrics();
+    void serveMetrics(MetricsWriter::Format format);
+    bool pollCANNetwork(struct CAN_message_t &canFrame);
+    void forwardCritical();
+    void uplink(uint8_t channel, struct CAN_message_t &canFrame);
+    // canFrame is set to the frame as written to the channel, after its rewrites
+    bool transmit(uint8_t channel, const struct CAN_message_t &received, struct CAN_message_t &canFrame);
+    void pollIsoTp();
 
     void start(struct Request *request);
+    bool start(struct SessionConfig &config);
+    bool configure(struct SessionConfig &config);
+    void reconfigure(struct Request *request);
+    bool commitRules(bool replace);
+    bool readDSCP(JsonDocument &json, struct SessionConfig &config);
+    bool readSlotPeriod(JsonDocument &json, struct SessionConfig &config);
     void stop();
+    void release();
 
     String dumpCOMMBlock(struct COMMBlock &commBlock);
 };
@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include <Schedule/UplinkSchedule.h>
+#include <Metrics/Metrics.h>
+#include <ArduinoLog.h>
+
+bool UplinkSchedule::start(uint16_t _periodUS, uint32_t _slots, uint32_t index)
+{
+    if ((_periodUS > 0) && (_slots > 0) && (_periodUS / _slots < UPLINK_SLOT_MIN_US))
+    {
+        Log.errorln("Uplink slots of %d us are too short, the minimum is %d us.", _periodUS / _slots, UPLINK_SLOT_MIN_US);
+        return false;
+    }
+    slots = _slots;
+    periodUS = 0;
+    lastCycle = 0;
+    Metrics.slotWidthUS = 0;
+    if ((_periodUS == 0) || (slots == 0)) return true;
+    widthUS = _periodUS / slots;
+    offsetUS = (index % slots) * widthUS;
+    guardUS = min(uint32_t(UPLINK_SLOT_GUARD_US), widthUS / 4);
+    periodUS = _periodUS;
+    Metrics.slotWidthUS = widthUS;
+    return true;
+}
+
+FASTRUN uint32_t UplinkSchedule::open(uint64_t epochUS)
+{
+    uint64_t cycle = epochUS / periodUS;
+    uint32_t into = epochUS % periodUS;
+    uint32_t end = offsetUS + widthUS - guardUS;
+    if ((into < offsetUS) || (into >= end)) return 0;
+    if (cycle != lastCycle)
+    {// First time the loop sees the slot open this period
+        if ((lastCycle != 0) && (cycle > lastCycle + 1)) Metrics.slotsMissed += cycle - lastCycle - 1;
+        lastCycle = cycle;
+        Metrics.slotsServed++;
+    }
+    return end - into;
+}
+
+void UplinkSchedule::used(uint32_t busyUS)
+{
+    Metrics.slotBusyUS += busyUS;
+}
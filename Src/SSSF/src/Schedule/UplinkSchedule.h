@@ -0,0 +1,62 @@
+#ifndef uplink_schedule_h_
+#define uplink_schedule_h_
+
+#include <Arduino.h>
+
+#define UPLINK_SLOT_GUARD_US 100  // Kept clear at the end of a slot for the last datagram to leave
+#define UPLINK_SLOT_MIN_US 250
+#define UPLINK_SLOT_MAX_PERIOD_US UINT16_MAX  // Periods are 16 bits in JSON and on the control socket alike
+
+/*
+Optional slotted uplink for large sessions. With dozens of nodes in one group
+their uplink datagrams and health reports reach the switch and the controller
+in bursts and queue behind each other. Given a period the session's time is
+cut into that many equal slots, one per node, and each node only sends its
+uplink while the NTP synchronized clock is inside its own slot:
+
+    slot = index % slots
+    open while (epochUS % period) is in [slot * width, (slot + 1) * width - guard)
+
+CAN frames read outside the slot wait in the receive rings (see FastLane.h)
+and go out together when it opens, so the queueing delay at the fan-in point
+is bounded by one node's slot however big the session gets. Critical frames,
+NACKs and retransmissions aren't held back. A period in which the loop never
+ran while our slot was open is counted as missed, and the time the loop spent
+sending uplink in open slots over the time they offered is the slot
+utilization, both are in the metrics. Downlink handling that happens to run
+while the slot is open isn't counted.
+*/
+class UplinkSchedule
+{
+private:
+    uint16_t periodUS = 0;  // 0 when slotting is off
+    uint32_t slots = 0;
+    uint32_t widthUS = 0;
+    uint32_t offsetUS = 0;  // Where our slot starts in each period
+    uint32_t guardUS = 0;
+    uint64_t lastCycle = 0;  // Period our slot was last open in, 0 before the first
+
+public:
+    /**
+     * @param _periodUS length of one round of slots, 0 turns slotting off
+     * @param _slots number of slots in a period, normally the session's members
+     * @param index session index of this node
+     * @return false, leaving the slots as they were, if they would be too
+     *         short to use
+     */
+    bool start(uint16_t _periodUS, uint32_t _slots, uint32_t index);
+    void stop() { periodUS = 0; }
+    bool enabled() { return periodUS > 0; }
+    uint16_t getPeriod() { return periodUS; }
+    uint32_t getSlots() { return slots; }
+
+    /**
+     * @return microseconds left in our slot, 0 if it isn't open
+     */
+    uint32_t open(uint64_t epochUS);
+
+    // Time the loop spent sending uplink in the slot
+    void used(uint32_t busyUS);
+};
+
+#endif /* uplink_schedule_h_ */
@@ -8,20 +8,15 @@ int SensorNode::read(struct WSensorBlock *buffer)
     int recvdHeaders = CANNode::read(buf, 4);
     if (recvdHeaders > 0)
     {
-        numSignals = buffer->numSignals;
-        int readSize = numSignals * sizeof(float);
-        signals = new float[numSignals];
-        int recvdData = CANNode::read(reinterpret_cast<unsigned char*>(signals), readSize);
+        numSignals = min(buffer->numSignals, uint8_t(SENSOR_MAX_SIGNALS));
+        int recvdData = CANNode::read(reinterpret_cast<unsigned char*>(signals), numSignals * sizeof(float));
         if (recvdData > 0)
         {
+            buffer->numSignals = numSignals;
             buffer->signals = signals;
             return recvdHeaders + recvdData;
         }
-        else
-        {
-            numSignals = 0;
-            delete[] signals;
-        }
+        numSignals = 0;
     }
     return -1;
 }
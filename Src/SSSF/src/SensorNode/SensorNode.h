@@ -4,11 +4,13 @@
 #include <Arduino.h>
 #include <CANNode/CANNode.h>
 
+#define SENSOR_MAX_SIGNALS 64  // Signals kept from a type 2 frame, the rest are dropped
+
 class SensorNode: public virtual CANNode
 {
 public:
     uint8_t numSignals = 0;
-    float *signals;
+    float signals[SENSOR_MAX_SIGNALS];  // Of the last type 2 frame read
 
     struct WSensorBlock
     {
@@ -0,0 +1,74 @@
+#include <Arduino.h>
+#include <Signals/BitField.h>
+#include <FlexCAN_T4.h>
+
+// Numbers too big for a uint8_t, negative ones included, become UINT8_MAX
+// rather than wrapping into range, so prepare() refuses them.
+static uint8_t parseBits(const char* text)
+{
+    unsigned long value = strtoul(text, nullptr, 0);
+    return (value > UINT8_MAX) || (text[0] == '-') ? UINT8_MAX : value;
+}
+
+bool BitField::field(const char* key, const char* text)
+{
+    if (!strcmp(key, "Start")) start = parseBits(text);
+    else if (!strcmp(key, "Length")) length = parseBits(text);
+    else if (!strcmp(key, "ByteOrder")) motorola = !strcmp(text, "Motorola");
+    else if (!strcmp(key, "Signed")) isSigned = !strcmp(text, "true");
+    else return false;
+    return true;
+}
+
+bool BitField::prepare()
+{
+    // Bits from the start of the frame to the first bit of the field
+    uint8_t first = motorola ? (start / 8) * 8 + (7 - (start % 8)) : start;
+    if ((start > 63) || (length == 0) || (length > 64) || (first + length > 64)) return false;
+    bytes = (first + length + 7) / 8;
+    return true;
+}
+
+FASTRUN bool BitField::read(const CAN_message_t &canFrame, double &value) const
+{
+    if (canFrame.len < bytes) return false;
+    uint64_t raw = (pack(canFrame) >> shift()) & mask();
+    if (isSigned && (length < 64) && (raw & (1ULL << (length - 1)))) value = int64_t(raw | ~mask());
+    else if (isSigned) value = int64_t(raw);
+    else value = raw;
+    return true;
+}
+
+void BitField::write(CAN_message_t &canFrame, double value) const
+{
+    uint64_t raw = uint64_t(llround(value));  // Two's complement for negative values
+    uint64_t data = pack(canFrame) & ~(mask() << shift());
+    unpack(canFrame, data | ((raw & mask()) << shift()));
+}
+
+uint8_t BitField::shift() const
+{
+    if (!motorola) return start;
+    // Most significant bit counting from the first bit on the wire
+    uint8_t msb = (start / 8) * 8 + (7 - (start % 8));
+    return 64 - msb - length;
+}
+
+uint64_t BitField::pack(const CAN_message_t &canFrame) const
+{// Intel fields are little endian, Motorola big endian
+    uint64_t data = 0;
+    for (uint8_t b = 0; b < 8; b++)
+    {
+        if (motorola) data = (data << 8) | canFrame.buf[b];
+        else data |= uint64_t(canFrame.buf[b]) << (8 * b);
+    }
+    return data;
+}
+
+void BitField::unpack(CAN_message_t &canFrame, uint64_t data) const
+{
+    for (uint8_t b = 0; b < 8; b++)
+    {
+        canFrame.buf[b] = motorola ? (data >> (8 * (7 - b))) : (data >> (8 * b));
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef bit_field_h_
+#define bit_field_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+
+/*
+Where a value sits in the data of a classic CAN frame, described the way a
+DBC file does: "Start" is the least significant bit for "Intel" byte order
+and the most significant bit in the DBC's sawtooth numbering for "Motorola".
+*/
+struct BitField
+{
+    uint8_t start = 0;
+    uint8_t length = 8;
+    uint8_t bytes = 1;  // Frame length the field needs
+    bool motorola = false;
+    bool isSigned = false;
+
+    // Takes "Start", "Length", "ByteOrder" and "Signed", false for other keys
+    bool field(const char* key, const char* text);
+
+    // Checks the field fits in a frame, false if it doesn't
+    bool prepare();
+
+    // False if the frame is too short to hold the field
+    bool read(const CAN_message_t &canFrame, double &value) const;
+    void write(CAN_message_t &canFrame, double value) const;
+
+private:
+    uint8_t shift() const;  // Of the field in the frame data taken as one integer
+    uint64_t mask() const { return (length < 64) ? (1ULL << length) - 1 : ~0ULL; }
+    uint64_t pack(const CAN_message_t &canFrame) const;
+    void unpack(CAN_message_t &canFrame, uint64_t data) const;
+};
+
+#endif /* bit_field_h_ */
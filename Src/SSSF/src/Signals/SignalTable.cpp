@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include <Signals/SignalTable.h>
+#include <ArduinoLog.h>
+#include <FlexCAN_T4.h>
+
+void SignalTable::clear()
+{
+    numSignals = 0;
+    numExact = 0;
+    updated = false;
+}
+
+FASTRUN void SignalTable::decode(uint8_t channel, const CAN_message_t &canFrame)
+{
+    if (numSignals == 0) return;
+    uint32_t key = RuleMatch::keyOf(canFrame);
+    uint8_t low = 0;
+    uint8_t high = numExact;
+    while (low < high)
+    {// First exact signal with this key
+        uint8_t middle = (low + high) / 2;
+        if (signals[middle].match.key < key) low = middle + 1;
+        else high = middle;
+    }
+    for (uint8_t i = low; (i < numExact) && (signals[i].match.key == key); i++)
+    {
+        if (signals[i].match.matches(key, channel, Uplink)) update(signals[i], canFrame);
+    }
+    for (uint8_t i = numExact; i < numSignals; i++)
+    {
+        if (signals[i].match.matches(key, channel, Uplink)) update(signals[i], canFrame);
+    }
+}
+
+FASTRUN void SignalTable::update(const struct Signal &signal, const CAN_message_t &canFrame)
+{
+    double value;
+    if (!signal.bits.read(canFrame, value)) return;
+    values[signal.position] = value * signal.scale + signal.offset;
+    updated = true;
+}
+
+bool SignalTable::changed()
+{
+    bool was = updated;
+    updated = false;
+    return was;
+}
+
+void SignalTable::begin()
+{
+    RuleSection::begin();
+    clear();
+}
+
+bool SignalTable::end()
+{
+    if (!valid) return false;
+    qsort(signals, numSignals, sizeof(Signal), compare);
+    numExact = 0;
+    while ((numExact < numSignals) && (signals[numExact].match.mask == 0xFFFFFFFF)) numExact++;
+    for (uint8_t i = 0; i < numSignals; i++)
+    {
+        values[i] = NAN;
+    }
+    Log.noticeln("\tCompiled %d CAN signals.", numSignals);
+    return true;
+}
+
+void SignalTable::field(const char* key, const char* text)
+{
+    if (pendingSignal.bits.field(key, text)) return;
+    if (!strcmp(key, "Scale")) pendingSignal.scale = strtod(text, nullptr);
+    else if (!strcmp(key, "Offset")) pendingSignal.offset = strtod(text, nullptr);
+}
+
+bool SignalTable::add()
+{
+    if (numSignals >= SIGNALS_MAX)
+    {
+        Log.errorln("Too many CAN signals, the limit is %d.", SIGNALS_MAX);
+        return false;
+    }
+    if (!pendingSignal.bits.prepare())
+    {
+        Log.errorln("CAN signal %d doesn't fit in a frame.", numSignals);
+        return false;
+    }
+    pendingSignal.match = pending;
+    pendingSignal.position = numSignals;
+    signals[numSignals++] = pendingSignal;
+    return true;
+}
+
+int SignalTable::compare(const void* a, const void* b)
+{// Exact IDs first and by key, the rest in the order they were given
+    const struct Signal* x = static_cast<const struct Signal*>(a);
+    const struct Signal* y = static_cast<const struct Signal*>(b);
+    bool xExact = (x->match.mask == 0xFFFFFFFF);
+    bool yExact = (y->match.mask == 0xFFFFFFFF);
+    if (xExact != yExact) return xExact ? -1 : 1;
+    if (xExact && (x->match.key != y->match.key)) return (x->match.key > y->match.key) - (x->match.key < y->match.key);
+    return x->position - y->position;
+}
@@ -0,0 +1,75 @@
+#ifndef signal_table_h_
+#define signal_table_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <Rules/Rules.h>
+#include <Signals/BitField.h>
+
+#define SIGNALS_MAX 64
+#define SIGNALS_DEFAULT_INTERVAL 100  // ms between signal frames
+
+/*
+DBC style signal decoding for the "Signals" section of the session request,
+so a controller that only needs a few dozen values doesn't have to receive
+and decode every raw frame. Each element names a signal in a CAN ID with the
+usual match fields and says where its bits are and how to scale them, e.g.
+
+    {"ID": "0x0CF00400", "Mask": "0xFFFFFF00", "Start": 24, "Length": 16,
+     "ByteOrder": "Intel", "Signed": false, "Scale": 0.125, "Offset": 0}
+
+"Start" and "ByteOrder" ("Intel" or "Motorola") follow the DBC convention:
+the least significant bit for Intel, the most significant bit in the DBC's
+sawtooth numbering for Motorola. Every frame read from a bus is decoded
+before the filters see it, so the raw frames can be rejected with a filter
+and only the decoded values go upstream. Where the bits are is described by
+a BitField.
+
+The latest value of every signal is sent every "SignalInterval" ms as a
+type 12 datagram laid out like a type 2 sensor frame, a count padded to four
+bytes then one float per signal in the order of the request, NaN for a
+signal not seen yet. Nothing is sent until a frame carrying one of the
+signals has arrived since the last signal frame.
+*/
+class SignalTable: public RuleSection
+{
+private:
+    struct Signal
+    {
+        struct RuleMatch match;
+        uint8_t position = 0;  // Index of its value, the order of the request
+        struct BitField bits;
+        float scale = 1.0;
+        float offset = 0.0;
+    };
+
+    struct Signal signals[SIGNALS_MAX];  // Exact IDs sorted by key, then masked ones
+    struct Signal pendingSignal;
+    uint8_t numSignals = 0;
+    uint8_t numExact = 0;
+    float values[SIGNALS_MAX];
+    bool updated = false;
+
+public:
+    void clear();
+    size_t size() { return numSignals; }
+    void decode(uint8_t channel, const CAN_message_t &canFrame);
+
+    // True once a signal has been decoded since the last call
+    bool changed();
+    const float* latest() { return values; }
+
+    virtual void begin();
+    virtual bool end();
+
+protected:
+    virtual void clearPending() { pendingSignal = Signal(); }
+    virtual void field(const char* key, const char* text);
+    virtual bool add();
+
+private:
+    void update(const struct Signal &signal, const CAN_message_t &canFrame);
+    static int compare(const void* a, const void* b);
+};
+
+#endif /* signal_table_h_ */
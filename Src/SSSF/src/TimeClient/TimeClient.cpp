@@ -5,6 +5,7 @@
 
 #include <Arduino.h>
 #include <TimeClient/TimeClient.h>
+#include <EthernetStats/EthernetStats.h>
 #include <EthernetUdp.h>
 #include <ArduinoLog.h>
 #include <inttypes.h>
@@ -25,11 +26,7 @@ void TimeClient::setup()
     ntpSock.begin(NTP_DEFAULT_LOCAL_PORT);
     for (int i = 0; i < 3; i++)
     {
-        if (tryNTPServer(i))
-        {
-            getAddrInfo();
-            break;
-        }
+        if (tryNTPServer(i)) break;
     }
     if (logging)
     {
@@ -116,9 +113,10 @@ uint64_t TimeClient::getEpochTimeUS()
     {
         currentEpoc = getTeensyTime();
         lastSync = millis();
+        lastSyncMicros = micros();
     }
     // Epoc returned by the NTP server or Teensy RTC + Time since last sync - 70 years
-    uint64_t timePassed = (millis() - lastSync) * MICROSPERMILLIS;
+    uint64_t timePassed = micros() - lastSyncMicros;
     // return currentEpoc + timePassed - SEVENTYYEARSMICROS + adjustment;
     return currentEpoc + timePassed - SEVENTYYEARSMICROS;
 }
@@ -197,16 +195,17 @@ void TimeClient::makeNTPPacket(bool firstTime)
 
 void TimeClient::sendNTPPacket(bool firstTime)
 {
-    int resolved = 0;
-    if (ipTranslated)
-    {
-        resolved = ntpSock.beginPacket(ntpIP, 123);
-    }
-    else
+    // The lookup is DNS traffic rather than a send, it isn't SPI time of the
+    // NTP socket and a failed one isn't a beginPacket failure.
+    if (!ipTranslated) getAddrInfo();
+    if (!ipTranslated)
     {
-        resolved = ntpSock.beginPacket(ntpServer, 123);
+        status = Timedout;
+        return;
     }
-    if (resolved)
+    SPITimer timer;
+    int started = ntpSock.beginPacket(ntpIP, 123);
+    if (started)
     {
         makeNTPPacket(firstTime);
         ntpSock.write(packetBuffer, NTP_PACKET_SIZE);
@@ -218,10 +217,12 @@ void TimeClient::sendNTPPacket(bool firstTime)
         else
         {
             logger->errorln("Failed to send NTP packet.");
+            Metrics.endPacketFailures++;
         }
     }
     else
     { // Server is not available.
+        Metrics.beginPacketFailures++;
         status = Timedout;
     }
 }
@@ -303,6 +304,7 @@ uint64_t TimeClient::readTimestamp(int start)
 
 void TimeClient::recvNTPPacket(bool firstTime)
 {
+    SPITimer timer;
     if (status == Sent && ntpSock.parsePacket())
     {
         ntpSock.read(packetBuffer, NTP_PACKET_SIZE);
@@ -310,6 +312,7 @@ void TimeClient::recvNTPPacket(bool firstTime)
         transmit = timeFromNTPTimestamp(readTimestamp(40));
 
         int64_t offset = calculateOffset(firstTime);
+        lastOffset = offset;
         currentEpoc = transmit + offset;
         setTeensyTime(currentEpoc);
 
@@ -347,6 +350,7 @@ bool TimeClient::tryNTPServer(int index)
         logger->noticeln("Trying the NTP server \"%s\".", ntpServers[index]);
     }
     ntpServer = ntpServers[index];
+    ipTranslated = false;  // The address is looked up for the new server
     if (firstUpdate())
     {
         if (logging)
@@ -365,6 +369,7 @@ bool TimeClient::tryNTPServer(int index)
         }
     }
     ntpServer = ntpServers[0];
+    ipTranslated = false;
     return false;
 }
 
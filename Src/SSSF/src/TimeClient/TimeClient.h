@@ -83,9 +83,11 @@ private:
     long lastUpdate = 0;  // In ms
     unsigned int syncInterval = 1000; // In ms
     long lastSync = 0; // In ms
+    uint32_t lastSyncMicros = 0; // In us
     long sentNTPPacket = 0; // In ms
 
     uint64_t currentEpoc = 0; // In us
+    int64_t lastOffset = 0; // In us
 
     /*
     time.nist.gov and pool.ntp.org are "pools" of ntp servers. time.nist.gov
@@ -150,6 +152,11 @@ public:
      */
     uint64_t getEpochTimeUS();
 
+    /**
+     * @return the last clock correction calculated from NTP in microseconds
+     */
+    int64_t getOffset() { return lastOffset; }
+
 private:
 
     void setPollingInterval();
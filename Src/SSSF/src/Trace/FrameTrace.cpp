@@ -0,0 +1,139 @@
+#include <Arduino.h>
+#include <Trace/FrameTrace.h>
+#include <FlexCAN_T4.h>
+#include <TimeClient/TimeClient.h>
+
+FrameTrace* FrameTrace::active = nullptr;
+
+FrameTrace::FrameTrace(TimeClient* _timeClient):
+    timeClient(_timeClient)
+{
+    reset(outbound);
+}
+
+void FrameTrace::start(uint32_t _sampleRate)
+{
+    sampleRate = _sampleRate;
+    reset(outbound);
+    for (int i = 0; i < MAX_PENDING_TRACES; i++)
+    {
+        pending[i].used = false;
+    }
+    active = this;
+}
+
+void FrameTrace::stop()
+{
+    sampleRate = 0;
+    active = nullptr;
+}
+
+bool FrameTrace::sample(uint32_t sequenceNumber)
+{
+    return (sampleRate > 0) && ((sequenceNumber % sampleRate) == 0);
+}
+
+void FrameTrace::begin(uint32_t origin, uint32_t sequenceNumber, const CAN_message_t &canFrame, uint32_t busAgeUS)
+{
+    uint64_t now = timeClient->getEpochTimeUS();
+    reset(outbound);
+    outbound.origin = origin;
+    outbound.sequenceNumber = sequenceNumber;
+    outbound.canID = canFrame.id;
+    outbound.epoch = now - busAgeUS;
+    outbound.stages[CANReceive] = 0;
+    outbound.stages[LoopPickup] = busAgeUS;
+}
+
+struct FrameTrace::TraceBlock* FrameTrace::send()
+{
+    outbound.stages[UDPSend] = since(outbound.epoch, timeClient->getEpochTimeUS());
+    return &outbound;
+}
+
+void FrameTrace::received(struct TraceBlock &block, uint32_t reporter, uint64_t receivedAt,
+    const CAN_message_t *written, uint8_t queued)
+{
+    for (int i = 0; i < MAX_PENDING_TRACES; i++)
+    {
+        if (!pending[i].used)
+        {
+            pending[i].block = block;
+            pending[i].block.reporter = reporter;
+            pending[i].block.stages[NetworkReceive] = since(block.epoch, receivedAt);
+            pending[i].block.stages[CANQueued] = since(block.epoch, timeClient->getEpochTimeUS());
+            pending[i].queuedAt = micros();
+            pending[i].transmittedAt = 0;
+            pending[i].queued = min(queued, (uint8_t) RULES_CHANNELS);
+            for (uint8_t q = 0; q < pending[i].queued; q++)
+            {
+                pending[i].keys[q] = RuleMatch::keyOf(written[q]);
+            }
+            pending[i].used = true;
+            return;
+        }
+    }
+    // Every slot is waiting on the bus, drop this sample rather than block.
+}
+
+bool FrameTrace::completed(struct TraceBlock &block)
+{
+    for (int i = 0; i < MAX_PENDING_TRACES; i++)
+    {
+        if (!pending[i].used) continue;
+        uint32_t transmittedAt = pending[i].transmittedAt;
+        if (transmittedAt != 0)
+        {
+            pending[i].block.stages[CANTransmitted] =
+                pending[i].block.stages[CANQueued] + int32_t(transmittedAt - pending[i].queuedAt);
+        }
+        else if ((micros() - pending[i].queuedAt) < TRACE_TIMEOUT_US)
+        {
+            continue;
+        }
+        block = pending[i].block;
+        pending[i].used = false;
+        return true;
+    }
+    return false;
+}
+
+int32_t FrameTrace::since(uint64_t epoch, uint64_t now)
+{
+    int64_t elapsed = int64_t(now) - int64_t(epoch);
+    if (elapsed > INT32_MAX) return INT32_MAX;
+    if (elapsed < INT32_MIN) return INT32_MIN;
+    return int32_t(elapsed);
+}
+
+void FrameTrace::reset(struct TraceBlock &block)
+{
+    block.origin = 0;
+    block.reporter = 0;
+    block.sequenceNumber = 0;
+    block.canID = 0;
+    block.epoch = 0;
+    for (int i = 0; i < NumTraceStages; i++)
+    {
+        block.stages[i] = -1;
+    }
+}
+
+void FrameTrace::transmitted(const CAN_message_t &canFrame)
+{ // Called by FlexCAN from the transmit interrupt
+    if (active == nullptr) return;
+    uint32_t key = RuleMatch::keyOf(canFrame);
+    for (int i = 0; i < MAX_PENDING_TRACES; i++)
+    {
+        PendingTrace &p = active->pending[i];
+        if (!p.used || (p.transmittedAt != 0)) continue;
+        for (uint8_t q = 0; q < p.queued; q++)
+        {
+            if (p.keys[q] == key)
+            {
+                p.transmittedAt = micros();
+                return;
+            }
+        }
+    }
+}
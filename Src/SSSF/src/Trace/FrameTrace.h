@@ -0,0 +1,99 @@
+#ifndef frame_trace_h_
+#define frame_trace_h_
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+#include <TimeClient/TimeClient.h>
+#include <Rules/Rules.h>
+
+#define TRACE_FLAG 0x01
+#define MAX_PENDING_TRACES 4
+#define TRACE_TIMEOUT_US 100000
+
+/*
+Frame path tracing:
+One in every N CAN frames forwarded by a node is sampled. The COMMBlock for a
+sampled frame has TRACE_FLAG set in its flags and a TraceBlock appended after
+the CAN block. The sender stamps when the frame hit the bus, when the loop
+picked it up and when it was handed to the WIZnet chip. The receiver stamps
+when it read the datagram, when the frame was queued on its CAN bus and when
+FlexCAN reported the transmit as complete. The completed trace is then sent to
+the session as a type 5 COMMBlock so the controller gets a per-hop breakdown.
+The transmit is recognized by the ID and format of the frame as each channel
+queued it, after that channel's rewrites.
+
+Stages are stored in microseconds relative to the sender's CANReceive epoch
+time, so hops that cross nodes depend on how well both nodes are synced with
+NTP. A stage that was never reached is left at -1.
+*/
+
+enum TraceStage
+{
+    CANReceive,
+    LoopPickup,
+    UDPSend,
+    NetworkReceive,
+    CANQueued,
+    CANTransmitted,
+    NumTraceStages
+};
+
+class FrameTrace
+{
+public:
+    struct TraceBlock
+    {
+        uint32_t origin = 0;  // Session index of the sending node
+        uint32_t reporter = 0;  // Session index of the receiving node
+        uint32_t sequenceNumber = 0;
+        uint32_t canID = 0;
+        uint64_t epoch = 0;  // Sender's epoch time (us) at CANReceive
+        int32_t stages[NumTraceStages];
+    };
+
+private:
+    struct PendingTrace
+    {
+        bool used = false;
+        uint32_t queuedAt = 0;  // micros() when the frame was queued on the bus
+        volatile uint32_t transmittedAt = 0;  // micros() from the TX callback
+        uint32_t keys[RULES_CHANNELS];  // RuleMatch::keyOf() the frames queued
+        uint8_t queued = 0;
+        struct TraceBlock block;
+    };
+
+    TimeClient* timeClient;
+    uint32_t sampleRate = 0;
+
+    struct TraceBlock outbound;
+    PendingTrace pending[MAX_PENDING_TRACES];
+
+    static FrameTrace* active;
+
+public:
+    FrameTrace(TimeClient* _timeClient);
+
+    void start(uint32_t _sampleRate);
+    void stop();
+    bool enabled() { return sampleRate > 0; }
+    uint32_t rate() { return sampleRate; }
+
+    // Sender side
+    bool sample(uint32_t sequenceNumber);
+    bool armed(uint32_t sequenceNumber) { return enabled() && (outbound.sequenceNumber == sequenceNumber); }
+    void begin(uint32_t origin, uint32_t sequenceNumber, const CAN_message_t &canFrame, uint32_t busAgeUS);
+    struct TraceBlock* send();
+
+    // Receiver side
+    // written are the frames queued on the buses, as rewritten for each
+    void received(struct TraceBlock &block, uint32_t reporter, uint64_t receivedAt,
+        const CAN_message_t *written, uint8_t queued);
+    bool completed(struct TraceBlock &block);
+    static void transmitted(const CAN_message_t &canFrame);
+
+private:
+    int32_t since(uint64_t epoch, uint64_t now);
+    void reset(struct TraceBlock &block);
+};
+
+#endif /* frame_trace_h_ */
@@ -1,3 +1,5 @@
+#ifndef PIO_UNIT_TESTING  // The tests in test/ bring their own setup() and loop()
+
 #include <Arduino.h>
 #include <SSSF/SSSF.h>
 #include <Configuration/Load.h>
@@ -33,6 +35,8 @@ void loop() {
     sssf->forwardingLoop(false);
 }
 
+#endif /* PIO_UNIT_TESTING */
+
 // TimeClient* timeClient;
 // uint8_t mac[6];
 
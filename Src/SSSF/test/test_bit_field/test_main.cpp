@@ -0,0 +1,139 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <Signals/BitField.h>
+
+/*
+BitField against values worked out by hand from the DBC conventions, Intel
+fields by their least significant bit and Motorola fields by their most
+significant bit in sawtooth numbering. Runs on the board, "pio test -e sss3".
+*/
+
+static BitField makeField(uint8_t start, uint8_t length, bool motorola, bool isSigned = false)
+{
+    BitField bits;
+    bits.start = start;
+    bits.length = length;
+    bits.motorola = motorola;
+    bits.isSigned = isSigned;
+    return bits;
+}
+
+static CAN_message_t makeFrame(std::initializer_list<uint8_t> data)
+{
+    CAN_message_t canFrame;
+    canFrame.len = data.size();
+    uint8_t b = 0;
+    for (uint8_t byte : data) canFrame.buf[b++] = byte;
+    return canFrame;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_intel_reads_little_endian()
+{
+    BitField bits = makeField(8, 16, false);
+    TEST_ASSERT_TRUE(bits.prepare());
+    TEST_ASSERT_EQUAL_UINT8(3, bits.bytes);
+    double value;
+    TEST_ASSERT_TRUE(bits.read(makeFrame({0xFF, 0x34, 0x12, 0xFF}), value));
+    TEST_ASSERT_TRUE(value == 0x1234);
+}
+
+void test_intel_reads_across_bytes()
+{
+    BitField bits = makeField(4, 8, false);
+    TEST_ASSERT_TRUE(bits.prepare());
+    double value;
+    TEST_ASSERT_TRUE(bits.read(makeFrame({0xA5, 0xBC}), value));
+    TEST_ASSERT_TRUE(value == 0xCA);
+}
+
+void test_motorola_reads_big_endian()
+{
+    BitField bits = makeField(7, 16, true);
+    TEST_ASSERT_TRUE(bits.prepare());
+    TEST_ASSERT_EQUAL_UINT8(2, bits.bytes);
+    double value;
+    TEST_ASSERT_TRUE(bits.read(makeFrame({0x12, 0x34}), value));
+    TEST_ASSERT_TRUE(value == 0x1234);
+}
+
+void test_motorola_starts_mid_byte()
+{
+    // Bit 3 of byte 0 down through byte 1
+    BitField bits = makeField(3, 12, true);
+    TEST_ASSERT_TRUE(bits.prepare());
+    double value;
+    TEST_ASSERT_TRUE(bits.read(makeFrame({0xA5, 0xBC}), value));
+    TEST_ASSERT_TRUE(value == 0x5BC);
+}
+
+void test_signed_values()
+{
+    BitField intel = makeField(0, 8, false, true);
+    TEST_ASSERT_TRUE(intel.prepare());
+    double value;
+    TEST_ASSERT_TRUE(intel.read(makeFrame({0xFE}), value));
+    TEST_ASSERT_TRUE(value == -2);
+    BitField motorola = makeField(7, 12, true, true);
+    TEST_ASSERT_TRUE(motorola.prepare());
+    TEST_ASSERT_TRUE(motorola.read(makeFrame({0x80, 0x0F}), value));
+    TEST_ASSERT_TRUE(value == -2048);
+}
+
+void test_write_keeps_other_bits()
+{
+    BitField bits = makeField(3, 12, true);
+    TEST_ASSERT_TRUE(bits.prepare());
+    CAN_message_t canFrame = makeFrame({0xFF, 0xFF, 0xFF});
+    bits.write(canFrame, 0x123);
+    TEST_ASSERT_EQUAL_HEX32(0xF1, canFrame.buf[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x23, canFrame.buf[1]);
+    TEST_ASSERT_EQUAL_HEX32(0xFF, canFrame.buf[2]);
+    double value;
+    TEST_ASSERT_TRUE(bits.read(canFrame, value));
+    TEST_ASSERT_TRUE(value == 0x123);
+}
+
+void test_short_frame_is_not_read()
+{
+    BitField bits = makeField(8, 16, false);
+    TEST_ASSERT_TRUE(bits.prepare());
+    double value;
+    TEST_ASSERT_FALSE(bits.read(makeFrame({0x00, 0x34}), value));
+}
+
+void test_fields_past_the_frame_are_refused()
+{
+    BitField intel = makeField(60, 8, false);
+    TEST_ASSERT_FALSE(intel.prepare());
+    BitField motorola = makeField(56, 2, true);  // Bit 0 of byte 7 is the last
+    TEST_ASSERT_FALSE(motorola.prepare());
+    BitField empty = makeField(0, 0, false);
+    TEST_ASSERT_FALSE(empty.prepare());
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_intel_reads_little_endian);
+    RUN_TEST(test_intel_reads_across_bytes);
+    RUN_TEST(test_motorola_reads_big_endian);
+    RUN_TEST(test_motorola_starts_mid_byte);
+    RUN_TEST(test_signed_values);
+    RUN_TEST(test_write_keeps_other_bits);
+    RUN_TEST(test_short_frame_is_not_read);
+    RUN_TEST(test_fields_past_the_frame_are_refused);
+    UNITY_END();
+}
+
+void loop()
+{
+}
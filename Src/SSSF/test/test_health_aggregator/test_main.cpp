@@ -0,0 +1,138 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <NetworkStats/HealthAggregator.h>
+
+/*
+Which node aggregates the health digests of a session, with and without a
+"HealthAggregator", and when the session summary is ready. Index 0 is the
+controller, which never aggregates. Runs on the board, "pio test -e sss3".
+*/
+
+#define MEMBERS 4
+
+HealthAggregator aggregator;
+NetworkStats *stats;
+HealthAggregator::Digest digest;
+
+// Marks the peer as heard from in this node's report
+static void heard(size_t peer, float latency = 1000.0, float packetLoss = 0.0)
+{
+    struct NetworkStats::NodeReport &r = stats->HealthReport[peer];
+    r.packetLoss = packetLoss;
+    r.latency.count = 10;
+    r.latency.min = r.latency.max = r.latency.mean = latency;
+}
+
+void setUp()
+{
+    stats = new NetworkStats(MEMBERS, nullptr);
+}
+
+void tearDown()
+{
+    aggregator.stop();
+    delete stats;
+}
+
+void test_lowest_node_heard_from_aggregates()
+{
+    aggregator.start(MEMBERS, 3, true, -1);
+    heard(0);
+    heard(1);
+    heard(2);
+    TEST_ASSERT_FALSE(aggregator.digest(*stats, digest));
+    TEST_ASSERT_EQUAL_UINT16(3, digest.pairs);
+}
+
+void test_controller_is_never_elected()
+{
+    aggregator.start(MEMBERS, 2, true, -1);
+    heard(0);
+    heard(3);
+    TEST_ASSERT_TRUE(aggregator.digest(*stats, digest));
+}
+
+void test_node_alone_with_controller_aggregates()
+{
+    aggregator.start(MEMBERS, 1, true, -1);
+    heard(0);
+    TEST_ASSERT_TRUE(aggregator.digest(*stats, digest));
+}
+
+void test_designated_node_aggregates()
+{
+    aggregator.start(MEMBERS, 2, true, 2);
+    heard(1);
+    TEST_ASSERT_TRUE(aggregator.digest(*stats, digest));
+    aggregator.start(MEMBERS, 1, true, 2);
+    TEST_ASSERT_FALSE(aggregator.digest(*stats, digest));
+}
+
+void test_controller_or_unknown_designated_is_elected_instead()
+{
+    aggregator.start(MEMBERS, 1, true, 0);
+    heard(0);
+    heard(2);
+    TEST_ASSERT_TRUE(aggregator.digest(*stats, digest));
+    aggregator.start(MEMBERS, 1, true, MEMBERS);
+    TEST_ASSERT_TRUE(aggregator.digest(*stats, digest));
+}
+
+void test_lossy_pair_is_an_outlier()
+{
+    aggregator.start(MEMBERS, 1, true, -1);
+    heard(2);
+    heard(3, 1000.0, 5.0);
+    aggregator.digest(*stats, digest);
+    TEST_ASSERT_EQUAL_UINT16(1, digest.numOutliers);
+    TEST_ASSERT_EQUAL_UINT16(3, digest.outliers[0].peer);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 5.0, digest.maxPacketLoss);
+}
+
+void test_summary_ready_once_every_node_reported()
+{
+    aggregator.start(MEMBERS, 1, true, -1);
+    heard(2);
+    heard(3);
+    TEST_ASSERT_TRUE(aggregator.digest(*stats, digest));
+    aggregator.offer(digest);
+    TEST_ASSERT_NULL(aggregator.completed());
+    aggregator.offer(digest);  // Node 2's
+    TEST_ASSERT_NULL(aggregator.completed());
+    aggregator.offer(digest);  // Node 3's, the controller sends none
+    const HealthAggregator::Digest *summary = aggregator.completed();
+    TEST_ASSERT_NOT_NULL(summary);
+    TEST_ASSERT_EQUAL_UINT16(3, summary->reporters);
+    TEST_ASSERT_EQUAL_UINT16(6, summary->pairs);
+    TEST_ASSERT_NULL(aggregator.completed());
+}
+
+void test_summary_sent_after_window()
+{
+    aggregator.start(MEMBERS, 1, true, -1);
+    heard(2);
+    aggregator.digest(*stats, digest);
+    aggregator.offer(digest);
+    TEST_ASSERT_NULL(aggregator.completed());
+    delay(HEALTH_AGGREGATION_WINDOW);
+    TEST_ASSERT_NOT_NULL(aggregator.completed());
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_lowest_node_heard_from_aggregates);
+    RUN_TEST(test_controller_is_never_elected);
+    RUN_TEST(test_node_alone_with_controller_aggregates);
+    RUN_TEST(test_designated_node_aggregates);
+    RUN_TEST(test_controller_or_unknown_designated_is_elected_instead);
+    RUN_TEST(test_lossy_pair_is_an_outlier);
+    RUN_TEST(test_summary_ready_once_every_node_reported);
+    RUN_TEST(test_summary_sent_after_window);
+    UNITY_END();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,161 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <IdIndex/IdIndex.h>
+#include <Metrics/Metrics.h>
+
+/*
+The IdIndex against a plain list of what went in: dense slots in the order
+IDs first show up, channels and 11/29 bit IDs kept apart, find() never
+taking a slot, and a full index refusing new IDs while still finding the
+ones it has. Also times a lookup in a full index. Runs on the board, "pio
+test -e sss3".
+*/
+
+IdIndex *idIndex;
+uint32_t inserted[ID_INDEX_CAPACITY];
+
+static CAN_message_t makeFrame(uint32_t id, bool extended)
+{
+    CAN_message_t canFrame;
+    canFrame.id = id;
+    canFrame.flags.extended = extended;
+    return canFrame;
+}
+
+// J1939 style keys, PGNs from many sources on both channels
+static uint32_t j1939Key(uint16_t i)
+{
+    uint32_t pgn = 0xF000 + (i * 37) % 0x0F00;
+    uint8_t source = (i * 13) & 0xFF;
+    return IdIndex::key(i & 1, makeFrame(0x18000000 | (pgn << 8) | source, true));
+}
+
+static void fill()
+{
+    for (uint16_t i = 0; i < ID_INDEX_CAPACITY; i++)
+    {
+        inserted[i] = j1939Key(i);
+        TEST_ASSERT_EQUAL_INT16(i, idIndex->slot(inserted[i]));
+    }
+}
+
+void setUp()
+{
+    idIndex = new IdIndex();
+    Metrics.idIndexOverflows = 0;
+}
+
+void tearDown()
+{
+    delete idIndex;
+}
+
+void test_slots_are_dense_in_order_seen()
+{
+    TEST_ASSERT_EQUAL_INT16(0, idIndex->slot(IdIndex::key(0, makeFrame(0x100, false))));
+    TEST_ASSERT_EQUAL_INT16(1, idIndex->slot(IdIndex::key(0, makeFrame(0x7FF, false))));
+    TEST_ASSERT_EQUAL_INT16(0, idIndex->slot(IdIndex::key(0, makeFrame(0x100, false))));
+    TEST_ASSERT_EQUAL_INT16(2, idIndex->slot(IdIndex::key(0, makeFrame(0x000, false))));
+    TEST_ASSERT_EQUAL_UINT16(3, idIndex->size());
+    TEST_ASSERT_EQUAL_UINT32(3, Metrics.idIndexSize);
+}
+
+void test_channels_and_formats_are_kept_apart()
+{
+    int16_t standard = idIndex->slot(IdIndex::key(0, makeFrame(0x123, false)));
+    int16_t extended = idIndex->slot(IdIndex::key(0, makeFrame(0x123, true)));
+    int16_t otherChannel = idIndex->slot(IdIndex::key(1, makeFrame(0x123, false)));
+    TEST_ASSERT_TRUE(standard != extended);
+    TEST_ASSERT_TRUE(standard != otherChannel);
+    TEST_ASSERT_TRUE(extended != otherChannel);
+    TEST_ASSERT_EQUAL_INT16(extended, idIndex->find(IdIndex::key(0, makeFrame(0x123, true))));
+}
+
+void test_find_does_not_take_a_slot()
+{
+    uint32_t key = IdIndex::key(1, makeFrame(0x18FEF100, true));
+    TEST_ASSERT_EQUAL_INT16(ID_INDEX_NONE, idIndex->find(key));
+    TEST_ASSERT_EQUAL_UINT16(0, idIndex->size());
+    int16_t slot = idIndex->slot(key);
+    TEST_ASSERT_EQUAL_INT16(slot, idIndex->find(key));
+}
+
+void test_full_index_refuses_new_ids()
+{
+    fill();
+    TEST_ASSERT_EQUAL_UINT16(ID_INDEX_CAPACITY, idIndex->size());
+    uint32_t unseen = IdIndex::key(0, makeFrame(0x0CF00400, true));
+    TEST_ASSERT_EQUAL_INT16(ID_INDEX_NONE, idIndex->slot(unseen));
+    TEST_ASSERT_EQUAL_INT16(ID_INDEX_NONE, idIndex->slot(unseen));
+    TEST_ASSERT_EQUAL_UINT32(2, Metrics.idIndexOverflows);
+    for (uint16_t i = 0; i < ID_INDEX_CAPACITY; i++)
+    {// In a different order than they went in
+        uint16_t n = (i * 7) % ID_INDEX_CAPACITY;
+        TEST_ASSERT_EQUAL_INT16(n, idIndex->slot(inserted[n]));
+        TEST_ASSERT_EQUAL_INT16(n, idIndex->find(inserted[n]));
+    }
+    TEST_ASSERT_EQUAL_UINT32(2, Metrics.idIndexOverflows);
+}
+
+void test_walk_finds_every_id_once()
+{
+    fill();
+    bool seen[ID_INDEX_CAPACITY] = {false};
+    uint16_t found = 0;
+    for (uint16_t position = 0; position < ID_INDEX_ENTRIES; position++)
+    {
+        uint32_t key;
+        int16_t slot;
+        if (!idIndex->at(position, key, slot)) continue;
+        TEST_ASSERT_TRUE((slot >= 0) && (slot < ID_INDEX_CAPACITY));
+        TEST_ASSERT_FALSE(seen[slot]);
+        TEST_ASSERT_EQUAL_HEX32(inserted[slot], key);
+        seen[slot] = true;
+        found++;
+    }
+    TEST_ASSERT_EQUAL_UINT16(ID_INDEX_CAPACITY, found);
+}
+
+void test_clear_forgets_everything()
+{
+    fill();
+    idIndex->clear();
+    TEST_ASSERT_EQUAL_UINT16(0, idIndex->size());
+    TEST_ASSERT_EQUAL_UINT32(0, Metrics.idIndexSize);
+    TEST_ASSERT_EQUAL_INT16(ID_INDEX_NONE, idIndex->find(inserted[0]));
+    TEST_ASSERT_EQUAL_INT16(0, idIndex->slot(inserted[5]));
+}
+
+void test_lookup_cost()
+{// A full index is the worst case for the probes, compare with the cycle counts of a benchmark build
+    fill();
+    uint32_t started = micros();
+    for (int round = 0; round < 10; round++)
+    {
+        for (uint16_t i = 0; i < ID_INDEX_CAPACITY; i++) idIndex->slot(inserted[i]);
+    }
+    uint32_t elapsed = micros() - started;
+    char message[64];
+    snprintf(message, sizeof(message), "%lu us for %d lookups in a full index",
+        (unsigned long)elapsed, 10 * ID_INDEX_CAPACITY);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN_UINT32(10 * ID_INDEX_CAPACITY, elapsed);  // Under 1 us each
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_slots_are_dense_in_order_seen);
+    RUN_TEST(test_channels_and_formats_are_kept_apart);
+    RUN_TEST(test_find_does_not_take_a_slot);
+    RUN_TEST(test_full_index_refuses_new_ids);
+    RUN_TEST(test_walk_finds_every_id_once);
+    RUN_TEST(test_clear_forgets_everything);
+    RUN_TEST(test_lookup_cost);
+    UNITY_END();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,181 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <IsoTp/IsoTp.h>
+#include <Metrics/Metrics.h>
+
+/*
+ISO-TP termination on a link from tester 0x7E0 to ECU 0x7E8 with a block
+size of 2: reassembly of what the ECU sends, segmentation of what the tester
+sends and the flow control frames in between. Runs on the board, "pio test
+-e sss3".
+*/
+
+StagedTable<IsoTpTable> table;
+IsoTp isoTp;
+
+static CAN_message_t makeFrame(uint32_t id, std::initializer_list<uint8_t> data)
+{
+    CAN_message_t canFrame;
+    canFrame.id = id;
+    canFrame.len = 8;
+    memset(canFrame.buf, ISOTP_PADDING, 8);
+    uint8_t b = 0;
+    for (uint8_t byte : data) canFrame.buf[b++] = byte;
+    return canFrame;
+}
+
+// The next frame due on the bus, taken as written
+static bool nextFrame(CAN_message_t &canFrame, uint32_t now)
+{
+    uint8_t channel;
+    if (!isoTp.next(channel, canFrame, now)) return false;
+    isoTp.written(now);
+    return true;
+}
+
+// Sends the ECU's first frame of a 20 byte PDU and checks the flow control
+static void firstFrame(uint32_t now)
+{
+    TEST_ASSERT_TRUE(isoTp.received(0, makeFrame(0x7E8, {0x10, 20, 1, 2, 3, 4, 5, 6}), now));
+    CAN_message_t canFrame;
+    TEST_ASSERT_TRUE(nextFrame(canFrame, now));
+    TEST_ASSERT_EQUAL_HEX32(0x7E0, canFrame.id);
+    TEST_ASSERT_EQUAL_HEX32(0x30, canFrame.buf[0]);  // Continue to send
+    TEST_ASSERT_EQUAL_UINT8(2, canFrame.buf[1]);
+}
+
+static void consecutiveFrames(uint32_t now)
+{
+    isoTp.received(0, makeFrame(0x7E8, {0x21, 7, 8, 9, 10, 11, 12, 13}), now);
+    isoTp.received(0, makeFrame(0x7E8, {0x22, 14, 15, 16, 17, 18, 19, 20}), now);
+}
+
+void setUp()
+{
+    table.begin();
+    table.beginObject(2);
+    table.value(2, "Tester", "0x7E0", false);
+    table.value(2, "ECU", "0x7E8", false);
+    table.value(2, "BlockSize", "2", false);
+    table.endObject(2);
+    TEST_ASSERT_TRUE(table.end());
+    table.commit();
+    isoTp.begin(&table);
+}
+
+void tearDown()
+{
+}
+
+void test_single_frame_completes()
+{
+    TEST_ASSERT_TRUE(isoTp.received(0, makeFrame(0x7E8, {0x03, 0x7F, 0x22, 0x31}), 0));
+    IsoTp::PduHeader header;
+    const uint8_t *pdu = isoTp.completed(header);
+    TEST_ASSERT_NOT_NULL(pdu);
+    TEST_ASSERT_EQUAL_UINT16(3, header.total);
+    TEST_ASSERT_EQUAL_UINT8(Uplink, header.direction);
+    TEST_ASSERT_EQUAL_HEX32(0x31, pdu[2]);
+    TEST_ASSERT_NULL(isoTp.completed(header));
+}
+
+void test_multi_frame_reassembles()
+{
+    firstFrame(0);
+    consecutiveFrames(10);
+    IsoTp::PduHeader header;
+    const uint8_t *pdu = isoTp.completed(header);
+    TEST_ASSERT_NOT_NULL(pdu);
+    TEST_ASSERT_EQUAL_UINT16(20, header.total);
+    for (uint8_t i = 0; i < 20; i++) TEST_ASSERT_EQUAL_UINT8(i + 1, pdu[i]);
+}
+
+void test_flow_control_every_block()
+{
+    TEST_ASSERT_TRUE(isoTp.received(0, makeFrame(0x7E8, {0x10, 30, 1, 2, 3, 4, 5, 6}), 0));
+    CAN_message_t canFrame;
+    TEST_ASSERT_TRUE(nextFrame(canFrame, 0));
+    consecutiveFrames(10);
+    TEST_ASSERT_TRUE(nextFrame(canFrame, 10));
+    TEST_ASSERT_EQUAL_HEX32(0x30, canFrame.buf[0]);
+}
+
+void test_out_of_sequence_aborts()
+{
+    firstFrame(0);
+    uint32_t aborts = Metrics.isoTpAborts;
+    isoTp.received(0, makeFrame(0x7E8, {0x22, 7, 8, 9, 10, 11, 12, 13}), 10);
+    TEST_ASSERT_EQUAL_UINT32(aborts + 1, Metrics.isoTpAborts);
+    IsoTp::PduHeader header;
+    TEST_ASSERT_NULL(isoTp.completed(header));
+}
+
+void test_first_frame_refused_while_pdu_pending()
+{
+    firstFrame(0);
+    consecutiveFrames(10);
+    // The finished PDU hasn't gone upstream when the ECU starts another
+    TEST_ASSERT_TRUE(isoTp.received(0, makeFrame(0x7E8, {0x10, 9, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6}), 20));
+    CAN_message_t canFrame;
+    TEST_ASSERT_TRUE(nextFrame(canFrame, 20));
+    TEST_ASSERT_EQUAL_HEX32(0x32, canFrame.buf[0]);  // Overflow
+    TEST_ASSERT_TRUE(isoTp.received(0, makeFrame(0x7E8, {0x02, 0xB1, 0xB2}), 30));
+    IsoTp::PduHeader header;
+    const uint8_t *pdu = isoTp.completed(header);
+    TEST_ASSERT_NOT_NULL(pdu);
+    TEST_ASSERT_EQUAL_UINT16(20, header.total);
+    TEST_ASSERT_EQUAL_UINT8(1, pdu[0]);
+    TEST_ASSERT_EQUAL_UINT8(20, pdu[19]);
+}
+
+void test_tester_pdu_is_segmented()
+{
+    uint8_t data[10] = {0x36, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    IsoTp::PduHeader header = {0x7E0, 0x7E8, 10, 0, 10, 0, Downlink};
+    TEST_ASSERT_TRUE(isoTp.request(header, data));
+    CAN_message_t canFrame;
+    TEST_ASSERT_TRUE(nextFrame(canFrame, 0));
+    TEST_ASSERT_EQUAL_HEX32(0x10, canFrame.buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(10, canFrame.buf[1]);
+    TEST_ASSERT_FALSE(nextFrame(canFrame, 1));  // Waiting for the ECU's flow control
+    isoTp.received(0, makeFrame(0x7E8, {0x30, 0, 0}), 2);
+    TEST_ASSERT_TRUE(nextFrame(canFrame, 3));
+    TEST_ASSERT_EQUAL_HEX32(0x21, canFrame.buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(6, canFrame.buf[1]);
+    TEST_ASSERT_EQUAL_UINT8(9, canFrame.buf[4]);
+    TEST_ASSERT_FALSE(nextFrame(canFrame, 4));
+}
+
+void test_uplink_pieces_are_ignored()
+{
+    uint8_t data[3] = {0x22, 0xF1, 0x90};
+    IsoTp::PduHeader header = {0x7E0, 0x7E8, 3, 0, 3, 0, Uplink};
+    TEST_ASSERT_FALSE(isoTp.request(header, data));
+}
+
+void test_other_ids_pass_through()
+{
+    TEST_ASSERT_FALSE(isoTp.received(0, makeFrame(0x123, {0x01}), 0));
+    TEST_ASSERT_FALSE(isoTp.received(1, makeFrame(0x7E8, {0x01, 0x01}), 0));
+    TEST_ASSERT_TRUE(isoTp.terminates(0, makeFrame(0x7E8, {})));
+    TEST_ASSERT_FALSE(isoTp.terminates(0, makeFrame(0x7E0, {})));
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_single_frame_completes);
+    RUN_TEST(test_multi_frame_reassembles);
+    RUN_TEST(test_flow_control_every_block);
+    RUN_TEST(test_out_of_sequence_aborts);
+    RUN_TEST(test_first_frame_refused_while_pdu_pending);
+    RUN_TEST(test_tester_pdu_is_segmented);
+    RUN_TEST(test_uplink_pieces_are_ignored);
+    RUN_TEST(test_other_ids_pass_through);
+    UNITY_END();
+}
+
+void loop()
+{
+}
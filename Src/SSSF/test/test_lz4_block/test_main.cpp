@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <Capture/CaptureFormat.h>
+#include <Capture/Lz4Block.h>
+
+/*
+LZ4 blocks as the capture writes them: round trips of data that does and
+doesn't compress, decompression refusing what is corrupt or too big, and
+the ratio and time to pack a block of synthetic J1939 traffic, with and
+without the shuffle. Runs on the board, "pio test -e sss3".
+*/
+
+#define RAW_SIZE (sizeof(CaptureRecord) * CAPTURE_RECORDS_PER_BLOCK)
+#define PGNS 20
+
+Lz4Block codec;
+struct CaptureRecord records[CAPTURE_RECORDS_PER_BLOCK];
+struct CaptureRecord unpacked[CAPTURE_RECORDS_PER_BLOCK];
+uint8_t raw[RAW_SIZE];
+uint8_t packed[Lz4Block::bound(RAW_SIZE)];
+uint8_t restored[RAW_SIZE];
+
+// A bus of PGNS messages every 10 to 200 ms, each with a counter byte and a
+// slowly moving value, the rest of the data fixed
+static void j1939Block(uint64_t start)
+{
+    const uint16_t periods[] = {10, 20, 50, 100, 200};
+    uint64_t due[PGNS];
+    uint8_t counters[PGNS] = {0};
+    for (int p = 0; p < PGNS; p++) due[p] = start + p * 397;
+    for (int i = 0; i < CAPTURE_RECORDS_PER_BLOCK; i++)
+    {
+        int next = 0;
+        for (int p = 1; p < PGNS; p++)
+        {
+            if (due[p] < due[next]) next = p;
+        }
+        struct CaptureRecord &r = records[i];
+        r.timestamp = due[next] + (i * 7) % 40;  // Some arbitration jitter
+        r.id = ((next < 4) ? 0x0C000000 : 0x18000000) | ((0xF000 + next * 0x11) << 8) | (next % 3);
+        r.channel = next & 1;
+        r.length = 8;
+        r.flags = CaptureExtended;
+        r.reserved = 0;
+        for (int b = 0; b < 8; b++) r.data[b] = 0xFF - next - b;
+        r.data[0] = counters[next]++;
+        r.data[2] = counters[next] / 16;
+        due[next] += periods[next % 5] * 1000;
+    }
+}
+
+static void roundTrip(size_t size)
+{
+    size_t stored = codec.compress(raw, size, packed, sizeof(packed));
+    TEST_ASSERT_TRUE(stored > 0);
+    TEST_ASSERT_TRUE(stored <= Lz4Block::bound(size));
+    TEST_ASSERT_EQUAL_INT(size, Lz4Block::decompress(packed, stored, restored, sizeof(restored)));
+    TEST_ASSERT_EQUAL_MEMORY(raw, restored, size);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_repeating_data_round_trips()
+{
+    for (size_t i = 0; i < RAW_SIZE; i++) raw[i] = "J1939 "[i % 6];
+    roundTrip(RAW_SIZE);
+    TEST_ASSERT_TRUE(codec.compress(raw, RAW_SIZE, packed, sizeof(packed)) < RAW_SIZE / 20);
+}
+
+void test_random_data_round_trips()
+{
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < RAW_SIZE; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        raw[i] = x;
+    }
+    roundTrip(RAW_SIZE);
+}
+
+void test_short_data_round_trips()
+{
+    for (size_t size = 0; size <= 20; size++)
+    {
+        memset(raw, 0xAA, size);
+        roundTrip(size);
+    }
+}
+
+void test_small_capacity_is_refused()
+{
+    uint32_t x = 1;
+    for (size_t i = 0; i < RAW_SIZE; i++)
+    {
+        x = x * 1103515245 + 12345;
+        raw[i] = x >> 16;
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, codec.compress(raw, RAW_SIZE, packed, RAW_SIZE / 2));
+    size_t stored = codec.compress(raw, RAW_SIZE, packed, sizeof(packed));
+    TEST_ASSERT_EQUAL_INT(-1, Lz4Block::decompress(packed, stored, restored, RAW_SIZE - 1));
+}
+
+void test_corrupt_data_is_refused()
+{
+    for (size_t i = 0; i < RAW_SIZE; i++) raw[i] = i / 64;
+    size_t stored = codec.compress(raw, RAW_SIZE, packed, sizeof(packed));
+    TEST_ASSERT_EQUAL_INT(-1, Lz4Block::decompress(packed, stored - 3, restored, sizeof(restored)));
+    // A match reaching back before the start of the output
+    const uint8_t backwards[] = {0x14, 'a', 0x10, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e'};
+    TEST_ASSERT_EQUAL_INT(-1, Lz4Block::decompress(backwards, sizeof(backwards), restored, sizeof(restored)));
+}
+
+void test_capture_block_round_trips()
+{
+    j1939Block(1760000000000000ULL);
+    memcpy(unpacked, records, sizeof(records));
+    captureShuffle(records, CAPTURE_RECORDS_PER_BLOCK, raw);
+    size_t stored = codec.compress(raw, RAW_SIZE, packed, sizeof(packed));
+    TEST_ASSERT_TRUE(stored > 0);
+    TEST_ASSERT_EQUAL_INT(RAW_SIZE, Lz4Block::decompress(packed, stored, restored, sizeof(restored)));
+    captureUnshuffle(restored, CAPTURE_RECORDS_PER_BLOCK, records);
+    TEST_ASSERT_EQUAL_MEMORY(unpacked, records, sizeof(records));
+}
+
+void test_capture_block_ratio()
+{// What a block of J1939 costs the loop and saves on the card, the shuffle should pay for itself
+    j1939Block(1760000000000000ULL);
+    memcpy(raw, records, RAW_SIZE);
+    size_t plain = codec.compress(raw, RAW_SIZE, packed, sizeof(packed));
+    uint32_t started = micros();
+    for (int i = 0; i < 10; i++)
+    {
+        j1939Block(1760000000000000ULL);
+        captureShuffle(records, CAPTURE_RECORDS_PER_BLOCK, raw);
+        codec.compress(raw, RAW_SIZE, packed, sizeof(packed));
+    }
+    uint32_t elapsed = micros() - started;
+    size_t shuffled = codec.compress(raw, RAW_SIZE, packed, sizeof(packed));
+    char message[96];
+    snprintf(message, sizeof(message), "%.2f to 1 shuffled, %.2f to 1 not, %lu us a block",
+        double(RAW_SIZE) / shuffled, double(RAW_SIZE) / plain, (unsigned long)(elapsed / 10));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(shuffled < plain);
+    TEST_ASSERT_LESS_THAN_UINT32(RAW_SIZE / 3, shuffled);  // At least 3 to 1
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_repeating_data_round_trips);
+    RUN_TEST(test_random_data_round_trips);
+    RUN_TEST(test_short_data_round_trips);
+    RUN_TEST(test_small_capacity_is_refused);
+    RUN_TEST(test_corrupt_data_is_refused);
+    RUN_TEST(test_capture_block_round_trips);
+    RUN_TEST(test_capture_block_ratio);
+    UNITY_END();
+}
+
+void loop()
+{
+}
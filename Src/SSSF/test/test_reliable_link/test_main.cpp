@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <Reliability/ReliableLink.h>
+
+/*
+The receiving side of ReliableLink, which sequence numbers from a sender get
+NACKed and how often. Runs on the board, "pio test -e sss3".
+*/
+
+ReliableLink link;
+ReliableLink::Nack nack;
+
+void setUp()
+{
+    link.start(2);
+    delay(NACK_INTERVAL);  // millis() may still be below the interval
+}
+
+void tearDown()
+{
+    link.stop();
+}
+
+static bool nackAfterInterval()
+{
+    delay(NACK_INTERVAL);
+    return link.nackDue(nack);
+}
+
+void test_gap_is_nacked()
+{
+    link.received(1, 100, true);
+    link.received(1, 103, true);
+    TEST_ASSERT_TRUE(nackAfterInterval());
+    TEST_ASSERT_EQUAL_UINT32(1, nack.target);
+    TEST_ASSERT_EQUAL_UINT32(103, nack.highest);
+    TEST_ASSERT_TRUE(nack.missing == 0x6ULL);  // 102 and 101
+}
+
+void test_nack_waits_for_interval()
+{
+    link.received(1, 100, true);
+    link.received(1, 102, true);
+    TEST_ASSERT_TRUE(nackAfterInterval());
+    TEST_ASSERT_FALSE(link.nackDue(nack));
+}
+
+void test_best_effort_sender_is_not_nacked()
+{
+    link.received(1, 100, false);
+    link.received(1, 105, false);
+    TEST_ASSERT_FALSE(nackAfterInterval());
+}
+
+void test_nack_is_retried_then_given_up()
+{
+    link.received(1, 100, true);
+    link.received(1, 102, true);
+    for (int i = 0; i < RELIABLE_NACK_TRIES; i++)
+    {
+        TEST_ASSERT_TRUE(nackAfterInterval());
+        TEST_ASSERT_TRUE(nack.missing == 0x2ULL);
+    }
+    TEST_ASSERT_FALSE(nackAfterInterval());
+}
+
+void test_new_gap_is_asked_for_after_old_one_gave_up()
+{
+    link.received(1, 100, true);
+    link.received(1, 102, true);
+    for (int i = 0; i < RELIABLE_NACK_TRIES; i++) nackAfterInterval();
+    link.received(1, 104, true);
+    TEST_ASSERT_TRUE(nackAfterInterval());
+    TEST_ASSERT_TRUE(nack.missing == 0x2ULL);  // 103 alone, 101 gave up
+}
+
+void test_retransmission_is_accepted_once()
+{
+    link.received(1, 100, true);
+    link.received(1, 103, true);
+    TEST_ASSERT_TRUE(link.received(1, 101, true));
+    TEST_ASSERT_FALSE(link.received(1, 101, true));
+    TEST_ASSERT_FALSE(link.received(1, 103, true));
+    TEST_ASSERT_TRUE(nackAfterInterval());
+    TEST_ASSERT_TRUE(nack.missing == 0x2ULL);  // 102 alone
+}
+
+void test_nack_is_capped_to_ring()
+{
+    link.received(1, 100, true);
+    link.received(1, 100 + RELIABLE_WINDOW - 1, true);
+    TEST_ASSERT_TRUE(nackAfterInterval());
+    // Only what the sender can still have in its ring
+    uint64_t window = ((1ULL << RELIABLE_NACK_WINDOW) - 1) & ~1ULL;
+    TEST_ASSERT_TRUE(nack.missing == window);
+}
+
+void test_jump_past_window_is_not_nacked()
+{
+    link.received(1, 100, true);
+    link.received(1, 100 + RELIABLE_WINDOW, true);
+    TEST_ASSERT_FALSE(nackAfterInterval());
+    link.received(1, 100 + RELIABLE_WINDOW + 1000, true);
+    TEST_ASSERT_FALSE(nackAfterInterval());
+}
+
+void test_sequence_wraps()
+{
+    link.received(1, 0xFFFFFFFE, true);
+    link.received(1, 1, true);
+    TEST_ASSERT_TRUE(nackAfterInterval());
+    TEST_ASSERT_EQUAL_UINT32(1, nack.highest);
+    TEST_ASSERT_TRUE(nack.missing == 0x6ULL);  // 0 and 0xFFFFFFFF
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_gap_is_nacked);
+    RUN_TEST(test_nack_waits_for_interval);
+    RUN_TEST(test_best_effort_sender_is_not_nacked);
+    RUN_TEST(test_nack_is_retried_then_given_up);
+    RUN_TEST(test_new_gap_is_asked_for_after_old_one_gave_up);
+    RUN_TEST(test_retransmission_is_accepted_once);
+    RUN_TEST(test_nack_is_capped_to_ring);
+    RUN_TEST(test_jump_past_window_is_not_nacked);
+    RUN_TEST(test_sequence_wraps);
+    UNITY_END();
+}
+
+void loop()
+{
+}
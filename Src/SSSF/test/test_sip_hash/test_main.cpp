@@ -0,0 +1,153 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <Auth/SessionAuth.h>
+
+/*
+SipHash-2-4 against the reference vectors and the datagram trailers
+SessionAuth builds from it: a tag the other side accepts once, and nothing
+with a wrong key, byte or counter. The Python controller's SessionAuth.py
+uses the same vectors. Runs on the board, "pio test -e sss3".
+*/
+
+#define KEY "000102030405060708090a0b0c0d0e0f"
+#define DATAGRAM_SIZE 56  // A COMMBlock with a classic CAN frame
+
+SessionAuth sender;
+SessionAuth receiver;
+uint8_t datagram[DATAGRAM_SIZE];
+
+static void signDatagram(SessionAuth::Trailer &trailer)
+{
+    sender.beginSend();
+    sender.sent(datagram, 20);  // In pieces like the header and frame
+    sender.sent(datagram + 20, DATAGRAM_SIZE - 20);
+    sender.sign(trailer);
+}
+
+static bool checkDatagram(uint32_t index, const SessionAuth::Trailer &trailer)
+{
+    receiver.beginReceive();
+    receiver.received(datagram, DATAGRAM_SIZE);
+    return receiver.check(index, trailer);
+}
+
+void setUp()
+{
+    for (uint8_t i = 0; i < DATAGRAM_SIZE; i++) datagram[i] = i * 7;
+    TEST_ASSERT_TRUE(sender.setKey(KEY));
+    TEST_ASSERT_TRUE(receiver.setKey(KEY));
+    sender.start(3);
+    receiver.start(3);
+}
+
+void tearDown()
+{
+    sender.stop();
+    receiver.stop();
+}
+
+void test_reference_vectors()
+{
+    TEST_ASSERT_TRUE(SipHash::selfTest());
+}
+
+void test_pieces_hash_like_one_block()
+{
+    uint8_t key[16];
+    for (uint8_t i = 0; i < sizeof(key); i++) key[i] = i;
+    SipHash whole;
+    whole.begin(key);
+    whole.update(datagram, DATAGRAM_SIZE);
+    SipHash pieces;
+    pieces.begin(key);
+    for (uint8_t i = 0; i < DATAGRAM_SIZE; i++) pieces.update(datagram + i, 1);
+    TEST_ASSERT_TRUE(whole.end() == pieces.end());
+}
+
+void test_key_must_be_32_hex_digits()
+{
+    TEST_ASSERT_FALSE(sender.setKey("000102"));
+    TEST_ASSERT_FALSE(sender.setKey("000102030405060708090a0b0c0d0e0g"));
+    TEST_ASSERT_FALSE(sender.enabled());
+    TEST_ASSERT_TRUE(sender.setKey(""));
+    TEST_ASSERT_FALSE(sender.enabled());
+}
+
+void test_signed_datagram_is_accepted_once()
+{
+    SessionAuth::Trailer trailer;
+    signDatagram(trailer);
+    TEST_ASSERT_EQUAL_UINT32(1, trailer.counter);
+    TEST_ASSERT_TRUE(checkDatagram(1, trailer));
+    TEST_ASSERT_FALSE(checkDatagram(1, trailer));
+    // The same counter from another member is its own
+    TEST_ASSERT_TRUE(checkDatagram(2, trailer));
+}
+
+void test_late_datagram_is_accepted_within_window()
+{
+    SessionAuth::Trailer first, second;
+    signDatagram(first);
+    signDatagram(second);
+    TEST_ASSERT_TRUE(checkDatagram(1, second));
+    TEST_ASSERT_TRUE(checkDatagram(1, first));
+    TEST_ASSERT_FALSE(checkDatagram(1, first));
+}
+
+void test_tampering_is_rejected()
+{
+    SessionAuth::Trailer trailer;
+    signDatagram(trailer);
+    datagram[30] ^= 1;
+    TEST_ASSERT_FALSE(checkDatagram(1, trailer));
+    datagram[30] ^= 1;
+    trailer.counter++;
+    TEST_ASSERT_FALSE(checkDatagram(1, trailer));
+}
+
+void test_wrong_key_is_rejected()
+{
+    SessionAuth::Trailer trailer;
+    signDatagram(trailer);
+    receiver.setKey("0f0e0d0c0b0a09080706050403020100");
+    TEST_ASSERT_FALSE(checkDatagram(1, trailer));
+}
+
+void test_unknown_member_is_rejected()
+{
+    SessionAuth::Trailer trailer;
+    signDatagram(trailer);
+    TEST_ASSERT_FALSE(checkDatagram(3, trailer));
+}
+
+void test_tag_cost()
+{// What a key adds to each datagram sent, compare with the cycle counts of a benchmark build
+    SessionAuth::Trailer trailer;
+    uint32_t started = micros();
+    for (int i = 0; i < 1000; i++) signDatagram(trailer);
+    uint32_t elapsed = micros() - started;
+    char message[64];
+    snprintf(message, sizeof(message), "%lu ns to tag a %d byte datagram", (unsigned long)elapsed, DATAGRAM_SIZE);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN_UINT32(20000, elapsed);  // 20 us each
+}
+
+void setup()
+{
+    delay(2000);  // Lets the serial monitor attach
+    UNITY_BEGIN();
+    RUN_TEST(test_reference_vectors);
+    RUN_TEST(test_pieces_hash_like_one_block);
+    RUN_TEST(test_key_must_be_32_hex_digits);
+    RUN_TEST(test_signed_datagram_is_accepted_once);
+    RUN_TEST(test_late_datagram_is_accepted_within_window);
+    RUN_TEST(test_tampering_is_rejected);
+    RUN_TEST(test_wrong_key_is_rejected);
+    RUN_TEST(test_unknown_member_is_rejected);
+    RUN_TEST(test_tag_cost);
+    UNITY_END();
+}
+
+void loop()
+{
+}
@@ -9,7 +9,7 @@ from io import BytesIO
 from ipaddress import IPv4Address
 from json.decoder import JSONDecodeError
 from types import FunctionType
-from typing import List, Tuple
+from typing import Dict, List, Tuple
 
 import jsonschema
 from jsonschema import ValidationError
@@ -190,25 +190,28 @@ class DeviceCollection:
         self.info("Submitted a change in registration.")
         return self.register(key, rfile, wfile)
 
-    def create_session_information(self, index: int, ip: IPv4Address, members: List) -> bytes:
-        session_information = json.dumps({
+    def create_session_information(self, index: int, ip: IPv4Address, members: List,
+                                   options: Dict = None) -> bytes:
+        session_information = {
             "ID": members[index]["ID"],
             "Index": members[index]["Index"],
             "IP": str(ip),
             "Port": self.can_port,
             "Devices": members
-        })
-        session_information = bytes(session_information, "UTF-8")
+        }
+        # The same for every member, e.g. the AuthKey
+        session_information.update(options or {})
+        session_information = bytes(json.dumps(session_information), "UTF-8")
         return session_information
 
-    def notify_session_members(self, members: List, message: bytes, IP=None):
+    def notify_session_members(self, members: List, message: bytes, IP=None, options=None):
         self.key.data.in_use = not self.key.data.in_use
         self.info(f'Notifying devices.')
         mapping = self.sel.get_map()
         for i in range(1, len(members)):
             msg = message
             if IP:
-                msg += self.create_session_information(i, IP, members)
+                msg += self.create_session_information(i, IP, members, options)
             key = mapping[members[i]["ID"]]
             key.data.callback = key.data.write
             key.data.outgoing_messages.put(msg)
@@ -227,6 +230,10 @@ class DeviceCollection:
             if members and self.key.fd == ip["sockets"][0]["ID"]:
                 ip["available"] = True
                 self.notify_session_members(ip["sockets"], message)
+            elif ip.get("relay_of") == self.key.fd:
+                # The controller's group of a relayed session
+                ip["available"] = True
+                ip["relay_of"] = None
 
     @set_key
     @registration_required
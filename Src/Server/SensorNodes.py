@@ -1,4 +1,5 @@
 import json
+import secrets
 import selectors as sel
 from http import HTTPStatus
 from io import BytesIO
@@ -15,6 +16,7 @@ from DeviceCollection import DeviceCollection
 
 SELECTOR = sel.DefaultSelector
 KEY = sel.SelectorKey
+AUTH_KEY_SIZE = 16  # Bytes, as the SSSFs' SessionAuth takes them
 
 
 class SensorNodes(DeviceCollection):
@@ -79,6 +81,17 @@ class SensorNodes(DeviceCollection):
                 ip["sockets"] = members
                 return ip["ip"]
 
+    def __find_relay_IP(self) -> IPv4Address:
+        # The controller's side of a session relayed by the impairment proxy.
+        # The members stay on the first group, this one is freed with it.
+        for ip in self.multicast_ips:
+            if ip["available"]:
+                self.info(f'Found available multicast IP address for the relay: {ip["ip"]}.')
+                ip["available"] = False
+                ip["sockets"] = []
+                ip["relay_of"] = self.key.fd
+                return ip["ip"]
+
     def __gather_requested_devices(self, requested: List) -> List:
         self.info("Gathering requested devices.")
         available = Device.get_available_devices(self.sel, Device.is_SSSF)
@@ -99,6 +112,17 @@ class SensorNodes(DeviceCollection):
                 return []
         return members
 
+    def __session_options(self, requested: Dict) -> Dict:
+        # What every member is started with besides its group
+        options = dict(requested.get("Node", {}))
+        if requested.get("Authenticate", False):
+            options["AuthKey"] = secrets.token_hex(AUTH_KEY_SIZE)
+        if requested.get("HealthAggregation", False):
+            options["HealthAggregation"] = True
+        if requested.get("Capture"):
+            options["Capture"] = requested["Capture"]
+        return options
+
     def __initiate_session_request(self, requested: Dict, wfile: BytesIO):
         if requested["MAC"] != self.key.data.MAC:
             self.error(
@@ -111,9 +135,19 @@ class SensorNodes(DeviceCollection):
             if len(members) > 1:
                 self.info("Successfully allocated requested devices.")
                 ip = self.__find_mcast_IP(members)
-                wfile.write(self.create_session_information(0, ip, members))
+                options = self.__session_options(requested.get("Options", {}))
+                if "AuthKey" in options:
+                    self.info("Session datagrams will be authenticated.")
+                controller_ip = ip
+                if requested.get("Options", {}).get("ImpairmentProxy", False):
+                    controller_ip = self.__find_relay_IP()
+                    options["ImpairmentGroups"] = [str(ip), str(controller_ip)]
+                    self.info(
+                        f'Relay the session with impairment_proxy '
+                        f'-a {ip}:{self.can_port} -b {controller_ip}:{self.can_port}.')
+                wfile.write(self.create_session_information(0, controller_ip, members, options))
                 message = self.__create_start_message()
-                self.notify_session_members(members, message, ip)
+                self.notify_session_members(members, message, ip, options)
                 return HTTPStatus.CREATED
             self.error("Requested devices are no longer available.")
             return HTTPStatus.CONFLICT
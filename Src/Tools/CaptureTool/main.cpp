@@ -0,0 +1,236 @@
+/*
+Reads the CAN captures an SSSF records to its SD card (see
+Src/SSSF/src/Capture/CaptureFormat.h).
+
+    capture_tool index CAPTURE.BIN
+    capture_tool dump CAPTURE.BIN [--from SECONDS] [--to SECONDS] [--direction]
+    capture_tool raw CAPTURE.BIN OUT.BIN
+
+index lists the blocks from their headers alone. dump prints the frames in
+candump's log format, decompressing only the blocks that overlap the time
+range, which is given in seconds since the epoch like the timestamps. With
+--direction every line ends in " R" for a frame read from the bus or " T"
+for one the SSSF wrote, as candump -x logs them. raw
+writes the records decompressed, for anything that would rather read them
+as they are.
+
+A block that is cut short or fails its checksum is reported on stderr and
+skipped by searching on for the next block's magic.
+*/
+#include <Capture/CaptureFormat.h>
+#include <Capture/Lz4Block.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Block
+    {
+        long offset;
+        CaptureBlockHeader header;
+    };
+
+    bool valid(const CaptureBlockHeader &header)
+    {
+        return (header.magic == CAPTURE_MAGIC) &&
+            (header.records > 0) && (header.records <= CAPTURE_RECORDS_PER_BLOCK) &&
+            (header.rawSize == header.records * sizeof(CaptureRecord)) &&
+            (header.storedSize <= Lz4Block::bound(header.rawSize));
+    }
+
+    /**
+     * Finds the next block at or after offset, resynchronising on the magic.
+     *
+     * @return false at the end of the file
+     */
+    bool next(FILE *file, long &offset, Block &block, std::vector<uint8_t> &stored)
+    {
+        const uint8_t magic[4] = {CAPTURE_MAGIC & 0xFF, (CAPTURE_MAGIC >> 8) & 0xFF,
+            (CAPTURE_MAGIC >> 16) & 0xFF, CAPTURE_MAGIC >> 24};
+        bool reported = false;
+        while (true)
+        {
+            fseek(file, offset, SEEK_SET);
+            if (fread(&block.header, sizeof(block.header), 1, file) != 1) return false;
+            stored.resize(block.header.storedSize);
+            if (valid(block.header) && (fread(stored.data(), 1, stored.size(), file) == stored.size()) &&
+                (captureChecksum(stored.data(), stored.size()) == block.header.checksum))
+            {
+                block.offset = offset;
+                offset += sizeof(block.header) + block.header.storedSize;
+                return true;
+            }
+            if (!reported)
+            {
+                fprintf(stderr, "Corrupt or truncated block at offset %ld, skipping to the next one.\n", offset);
+                reported = true;
+            }
+            // Search on from the byte after where the bad block started
+            offset++;
+            fseek(file, offset, SEEK_SET);
+            int matched = 0;
+            int c;
+            while ((matched < 4) && ((c = fgetc(file)) != EOF))
+            {
+                matched = (c == magic[matched]) ? matched + 1 : ((c == magic[0]) ? 1 : 0);
+                offset++;
+            }
+            if (matched < 4) return false;
+            offset -= 4;
+        }
+    }
+
+    bool unpack(const Block &block, const std::vector<uint8_t> &stored, std::vector<CaptureRecord> &records)
+    {
+        std::vector<uint8_t> raw(block.header.rawSize);
+        if (!(block.header.flags & CAPTURE_COMPRESSED))
+        {
+            if (stored.size() != raw.size()) return false;
+            memcpy(raw.data(), stored.data(), stored.size());
+        }
+        else if (Lz4Block::decompress(stored.data(), stored.size(), raw.data(), raw.size()) != int(raw.size()))
+        {
+            return false;
+        }
+        records.resize(block.header.records);
+        if (block.header.flags & CAPTURE_SHUFFLED) captureUnshuffle(raw.data(), records.size(), records.data());
+        else memcpy(records.data(), raw.data(), raw.size());
+        return true;
+    }
+
+    int index(FILE *file)
+    {
+        Block block;
+        std::vector<uint8_t> stored;
+        long offset = 0;
+        uint64_t blocks = 0, records = 0, raw = 0, written = 0;
+        printf("%10s %8s %7s %17s %17s %6s\n", "offset", "sequence", "records", "first", "last", "ratio");
+        while (next(file, offset, block, stored))
+        {
+            const CaptureBlockHeader &h = block.header;
+            printf("%10ld %8" PRIu32 " %7u %17.6f %17.6f %6.2f\n", block.offset, h.sequence, h.records,
+                h.firstTimestamp / 1e6, h.lastTimestamp / 1e6, double(h.rawSize) / (sizeof(h) + h.storedSize));
+            blocks++;
+            records += h.records;
+            raw += h.rawSize;
+            written += sizeof(h) + h.storedSize;
+        }
+        printf("%" PRIu64 " blocks, %" PRIu64 " frames, %" PRIu64 " bytes of records in %" PRIu64 " bytes, %.2f to 1\n",
+            blocks, records, raw, written, (written > 0) ? double(raw) / written : 0.0);
+        return 0;
+    }
+
+    int dump(FILE *file, double from, double to, bool direction)
+    {
+        Block block;
+        std::vector<uint8_t> stored;
+        std::vector<CaptureRecord> records;
+        long offset = 0;
+        uint64_t fromUS = (from > 0) ? uint64_t(from * 1e6) : 0;
+        uint64_t toUS = (to > 0) ? uint64_t(to * 1e6) : UINT64_MAX;
+        while (next(file, offset, block, stored))
+        {
+            if ((block.header.lastTimestamp < fromUS) || (block.header.firstTimestamp > toUS)) continue;
+            if (!unpack(block, stored, records))
+            {
+                fprintf(stderr, "Block %" PRIu32 " at offset %ld doesn't decompress.\n", block.header.sequence, block.offset);
+                continue;
+            }
+            for (const CaptureRecord &r : records)
+            {
+                if ((r.timestamp < fromUS) || (r.timestamp > toUS)) continue;
+                printf("(%" PRIu64 ".%06" PRIu64 ") can%u ", r.timestamp / 1000000, r.timestamp % 1000000, r.channel);
+                printf((r.flags & CaptureExtended) ? "%08" PRIX32 "#" : "%03" PRIX32 "#", r.id);
+                if (r.flags & CaptureRemote)
+                {
+                    printf("R");
+                }
+                else
+                {
+                    for (int i = 0; (i < r.length) && (i < 8); i++)
+                    {
+                        printf("%02X", r.data[i]);
+                    }
+                }
+                if (direction) printf((r.flags & CaptureTransmitted) ? " T" : " R");
+                printf("\n");
+            }
+        }
+        return 0;
+    }
+
+    int raw(FILE *file, const char* path)
+    {
+        FILE *out = fopen(path, "wb");
+        if (out == nullptr)
+        {
+            perror(path);
+            return 1;
+        }
+        Block block;
+        std::vector<uint8_t> stored;
+        std::vector<CaptureRecord> records;
+        long offset = 0;
+        while (next(file, offset, block, stored))
+        {
+            if (!unpack(block, stored, records))
+            {
+                fprintf(stderr, "Block %" PRIu32 " at offset %ld doesn't decompress.\n", block.header.sequence, block.offset);
+                continue;
+            }
+            fwrite(records.data(), sizeof(CaptureRecord), records.size(), out);
+        }
+        return (fclose(out) == 0) ? 0 : 1;
+    }
+
+    void usage()
+    {
+        fprintf(stderr,
+            "Usage: capture_tool index CAPTURE\n"
+            "       capture_tool dump CAPTURE [--from SECONDS] [--to SECONDS] [--direction]\n"
+            "       capture_tool raw CAPTURE OUT\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+    std::string command = argv[1];
+    FILE *file = fopen(argv[2], "rb");
+    if (file == nullptr)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    if (command == "index") return index(file);
+    if (command == "raw" && (argc == 4)) return raw(file, argv[3]);
+    if (command == "dump")
+    {
+        double from = 0.0;
+        double to = 0.0;
+        bool direction = false;
+        for (int i = 3; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if ((arg == "--from") && (i + 1 < argc)) from = atof(argv[++i]);
+            else if ((arg == "--to") && (i + 1 < argc)) to = atof(argv[++i]);
+            else if (arg == "--direction") direction = true;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        return dump(file, from, to, direction);
+    }
+    usage();
+    return 1;
+}
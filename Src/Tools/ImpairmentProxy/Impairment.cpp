@@ -0,0 +1,210 @@
+#include "Impairment.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+    bool numbers(const std::string &text, double *values, size_t count)
+    {// Comma separated, exactly count of them
+        const char* p = text.c_str();
+        for (size_t i = 0; i < count; i++)
+        {
+            char *end;
+            values[i] = strtod(p, &end);
+            if (end == p) return false;
+            p = end;
+            if (i + 1 < count)
+            {
+                if (*p != ',') return false;
+                p++;
+            }
+        }
+        return *p == '\0';
+    }
+
+    bool probabilities(const double *values, size_t count)
+    {// Between 0 and 1, which also keeps out NaN
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!((values[i] >= 0.0) && (values[i] <= 1.0))) return false;
+        }
+        return true;
+    }
+
+    bool bitRate(const std::string &text, double &rate)
+    {
+        char *end;
+        rate = strtod(text.c_str(), &end);
+        if (end == text.c_str()) return false;
+        if (*end != '\0')
+        {
+            if (end[1] != '\0') return false;
+            if ((*end == 'k') || (*end == 'K')) rate *= 1e3;
+            else if (*end == 'M') rate *= 1e6;
+            else if (*end == 'G') rate *= 1e9;
+            else return false;
+        }
+        return rate >= 0;
+    }
+}
+
+bool Impairment::set(const std::string &setting)
+{// Parsed into a copy so a bad setting changes nothing
+    Impairment next = *this;
+    size_t equals = setting.find('=');
+    std::string key = setting.substr(0, equals);
+    std::string value = (equals == std::string::npos) ? "" : setting.substr(equals + 1);
+    bool valid = false;
+    double v[4] = {0.0};
+    if (setting == "reset")
+    {
+        next = Impairment();
+        valid = true;
+    }
+    else if (key == "delay")
+    {
+        v[1] = 0.0;
+        if (value.compare(0, 8, "uniform:") == 0)
+        {
+            valid = numbers(value.substr(8), v, 2) && (v[0] <= v[1]);
+            next.delayShape = UniformDelay;
+        }
+        else if (value.compare(0, 7, "normal:") == 0)
+        {
+            valid = numbers(value.substr(7), v, 2) && (v[1] >= 0);
+            next.delayShape = NormalDelay;
+        }
+        else if (value.compare(0, 4, "exp:") == 0)
+        {
+            valid = numbers(value.substr(4), v, 2) && (v[1] > 0);
+            next.delayShape = ExponentialDelay;
+        }
+        else
+        {
+            valid = numbers(value, v, 1);
+            next.delayShape = FixedDelay;
+        }
+        next.delayA = v[0];
+        next.delayB = v[1];
+    }
+    else if (key == "loss")
+    {
+        if (value.compare(0, 3, "ge:") == 0)
+        {
+            valid = numbers(value.substr(3), v, 4) && probabilities(v, 4);
+            next.gilbertElliott = true;
+            next.toBad = v[0];
+            next.toGood = v[1];
+            next.loss = v[2];
+            next.lossBad = v[3];
+        }
+        else
+        {
+            valid = numbers(value, v, 1) && probabilities(v, 1);
+            next.gilbertElliott = false;
+            next.loss = v[0];
+        }
+    }
+    else if (key == "reorder")
+    {// The extra delay is optional
+        v[1] = reorderExtra;
+        valid = (numbers(value, v, 2) || numbers(value, v, 1)) && probabilities(v, 1) && (v[1] >= 0.0);
+        next.reorder = v[0];
+        next.reorderExtra = v[1];
+    }
+    else if (key == "duplicate")
+    {
+        valid = numbers(value, v, 1) && probabilities(v, 1);
+        next.duplicate = v[0];
+    }
+    else if (key == "rate")
+    {
+        valid = bitRate(value, next.rate);
+    }
+    else if (key == "queue")
+    {
+        valid = numbers(value, v, 1) && (v[0] >= 1);
+        next.queueLimit = v[0];
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "Can't use the setting \"%s\".\n", setting.c_str());
+        return false;
+    }
+    *this = next;
+    return true;
+}
+
+std::string Impairment::describe() const
+{
+    std::ostringstream text;
+    const char* shapes[] = {"fixed", "uniform", "normal", "exp"};
+    text << "delay=" << shapes[delayShape] << ":" << delayA << "," << delayB;
+    if (gilbertElliott) text << " loss=ge:" << toBad << "," << toGood << "," << loss << "," << lossBad;
+    else text << " loss=" << loss;
+    text << " reorder=" << reorder << "," << reorderExtra << " duplicate=" << duplicate;
+    text << " rate=" << rate << " queue=" << queueLimit;
+    return text.str();
+}
+
+int Channel::schedule(double now, size_t bytes, double departures[2])
+{
+    counters.received++;
+    if (lose())
+    {
+        counters.lost++;
+        return 0;
+    }
+    double leaves = now;
+    if (settings.rate > 0)
+    {
+        while (!onLink.empty() && (onLink.front() <= now)) onLink.pop_front();
+        if (onLink.size() >= settings.queueLimit)
+        {
+            counters.queueDrops++;
+            return 0;
+        }
+        leaves = std::max(now, linkFree) + (bytes * 8.0) / settings.rate;
+        linkFree = leaves;
+        onLink.push_back(leaves);
+    }
+    int copies = (chance() < settings.duplicate) ? 2 : 1;
+    if (copies == 2) counters.duplicated++;
+    for (int c = 0; c < copies; c++)
+    {
+        double held = delay();
+        if (chance() < settings.reorder)
+        {
+            held += settings.reorderExtra;
+            counters.reordered++;
+        }
+        departures[c] = leaves + std::max(held, 0.0) / 1000.0;
+    }
+    return copies;
+}
+
+bool Channel::lose()
+{
+    if (!settings.gilbertElliott) return chance() < settings.loss;
+    // The state moves on before each datagram so a burst starts with the datagram that found the link bad
+    if (bad) bad = !(chance() < settings.toGood);
+    else bad = chance() < settings.toBad;
+    return chance() < (bad ? settings.lossBad : settings.loss);
+}
+
+double Channel::delay()
+{// ms
+    switch (settings.delayShape)
+    {
+        case UniformDelay:
+            return std::uniform_real_distribution<double>(settings.delayA, settings.delayB)(random);
+        case NormalDelay:
+            return std::normal_distribution<double>(settings.delayA, settings.delayB)(random);
+        case ExponentialDelay:
+            return settings.delayA + std::exponential_distribution<double>(1.0 / settings.delayB)(random);
+        default:
+            return settings.delayA;
+    }
+}
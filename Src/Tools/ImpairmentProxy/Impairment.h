@@ -0,0 +1,100 @@
+#ifndef impairment_h_
+#define impairment_h_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+
+enum DelayShape
+{
+    FixedDelay,  // delay=5
+    UniformDelay,  // delay=uniform:2,8
+    NormalDelay,  // delay=normal:5,1 (mean, standard deviation)
+    ExponentialDelay  // delay=exp:2,3 (floor, mean added on top)
+};
+
+/*
+What happens to datagrams going one way through the proxy. Every setting is
+written key=value, times in ms and probabilities between 0 and 1:
+
+    delay=SHAPE       see DelayShape, negative draws are sent right away
+    loss=P            independent loss
+    loss=ge:p,r,g,b   Gilbert-Elliott bursty loss, p and r the chances of
+                      going from the good state to the bad one and back per
+                      datagram, g and b the loss in each state
+    reorder=P,MS      P of the datagrams are held MS longer than the rest
+    duplicate=P       P of the datagrams are sent twice, delayed apart
+    rate=BITS         link speed in bit/s (k, M and G suffixes), 0 for none
+    queue=N           datagrams that can wait for the link before more drop
+    reset             everything back to a clean link
+*/
+struct Impairment
+{
+    DelayShape delayShape = FixedDelay;
+    double delayA = 0.0;
+    double delayB = 0.0;
+    bool gilbertElliott = false;
+    double loss = 0.0;  // Independent, or in the good state
+    double lossBad = 0.0;
+    double toBad = 0.0;
+    double toGood = 0.0;
+    double reorder = 0.0;
+    double reorderExtra = 10.0;
+    double duplicate = 0.0;
+    double rate = 0.0;
+    size_t queueLimit = 1000;
+
+    /**
+     * @return false with a message on stderr if the setting isn't understood
+     */
+    bool set(const std::string &setting);
+    std::string describe() const;
+};
+
+/*
+State of one direction: the random draws, the Gilbert-Elliott state and the
+link queue. schedule() decides what happens to a datagram when it arrives,
+the link is modelled before the delay so a rate cap builds a queue the way a
+slow uplink does and the delay then stands for the rest of the path.
+*/
+class Channel
+{
+public:
+    struct Counters
+    {
+        uint64_t received = 0;
+        uint64_t lost = 0;
+        uint64_t queueDrops = 0;
+        uint64_t duplicated = 0;
+        uint64_t reordered = 0;
+        uint64_t sent = 0;
+    };
+
+    Impairment settings;
+    struct Counters counters;
+
+private:
+    std::mt19937_64 random;
+    bool bad = false;
+    double linkFree = 0.0;  // s, when the link finishes the last datagram queued
+    std::deque<double> onLink;  // When each queued datagram leaves the link
+
+public:
+    explicit Channel(uint64_t seed): random(seed) {}
+
+    /**
+     * @param now s since the proxy started
+     * @param departures when to send each copy, s since the proxy started
+     * @return number of copies to send, 0 if the datagram is dropped
+     */
+    int schedule(double now, size_t bytes, double departures[2]);
+
+private:
+    bool lose();
+    double delay();
+    double chance() { return std::uniform_real_distribution<double>(0.0, 1.0)(random); }
+};
+
+#endif /* impairment_h_ */
@@ -0,0 +1,79 @@
+#include "Script.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+bool Script::load(const char* path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "Can't open the script %s.\n", path);
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line))
+    {
+        number++;
+        if (!add(line, std::string(path) + ":" + std::to_string(number))) return false;
+    }
+    return true;
+}
+
+bool Script::add(const std::string &line, const std::string &origin)
+{
+    std::istringstream words(line.substr(0, line.find('#')));
+    std::string direction;
+    struct Step step;
+    if (!(words >> step.at))
+    {
+        if (words.eof()) return true;  // Blank or a comment
+        fprintf(stderr, "%s: a step starts with its time in seconds.\n", origin.c_str());
+        return false;
+    }
+    words >> direction;
+    step.aToB = (direction == "a2b") || (direction == "both");
+    step.bToA = (direction == "b2a") || (direction == "both");
+    if (!step.aToB && !step.bToA)
+    {
+        fprintf(stderr, "%s: direction must be a2b, b2a or both.\n", origin.c_str());
+        return false;
+    }
+    std::string setting;
+    Impairment check;
+    while (words >> setting)
+    {
+        if (!check.set(setting))
+        {
+            fprintf(stderr, "%s: in this step.\n", origin.c_str());
+            return false;
+        }
+        step.settings.push_back(setting);
+    }
+    steps.push_back(step);
+    return true;
+}
+
+void Script::sort()
+{// Stable, so steps at the same time keep the order they were given in
+    std::stable_sort(steps.begin(), steps.end(),
+        [](const Step &a, const Step &b) { return a.at < b.at; });
+    next = 0;
+}
+
+void Script::apply(double now, Channel &aToB, Channel &bToA)
+{
+    for (; (next < steps.size()) && (steps[next].at <= now); next++)
+    {
+        const struct Step &step = steps[next];
+        for (const std::string &setting : step.settings)
+        {
+            if (step.aToB) aToB.settings.set(setting);
+            if (step.bToA) bToA.settings.set(setting);
+        }
+        printf("%8.3f s  a2b %s\n", now, aToB.settings.describe().c_str());
+        printf("%8.3f s  b2a %s\n", now, bToA.settings.describe().c_str());
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef script_h_
+#define script_h_
+
+#include "Impairment.h"
+#include <string>
+#include <vector>
+
+/*
+Changes to the impairments over the course of a run, one per line:
+
+    # seconds  direction  settings (see Impairment.h)
+    0     both  delay=normal:5,1
+    10    a2b   loss=ge:0.01,0.3,0,0.5
+    20.5  b2a   rate=2M queue=50 reorder=0.05,15
+    40    both  reset
+
+Direction is a2b, b2a or both. Steps take effect in order of their time,
+those given on the command line with -e and in files are merged.
+*/
+class Script
+{
+private:
+    struct Step
+    {
+        double at;  // s
+        bool aToB;
+        bool bToA;
+        std::vector<std::string> settings;
+    };
+
+    std::vector<Step> steps;
+    size_t next = 0;
+
+public:
+    /**
+     * @return false with a message on stderr if a line is invalid
+     */
+    bool load(const char* path);
+    bool add(const std::string &line, const std::string &origin);
+    void sort();
+
+    // Applies the steps due by now, in order
+    void apply(double now, Channel &aToB, Channel &bToA);
+    // s, when the next step is due, negative once there are none
+    double due() { return (next < steps.size()) ? steps[next].at : -1.0; }
+};
+
+#endif /* script_h_ */
@@ -0,0 +1,244 @@
+/*
+Impairment proxy for session traffic, so loss recovery, jitter handling and
+the rest can be tested on one Linux box against the same bad network every
+run.
+
+The proxy relays datagrams between two multicast groups, side A and side B,
+and impairs each direction on its own (see Impairment.h) as a script tells
+it to (see Script.h). A controller started with --impairment-proxy gets a
+session where the broker gives the SSSFs group A and the controller group
+B, and shows both, e.g.
+
+    impairment_proxy -a 239.255.0.1:41665 -b 239.255.0.2:41665 \
+        -i 192.168.1.20 -s lossy.txt --seed 7
+
+Only the UDP transport can be proxied, raw Ethernet sessions don't leave
+their segment. Datagrams the proxy sent itself are recognised by their
+source port and never relayed back.
+*/
+#include "Impairment.h"
+#include "Script.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <vector>
+
+#define PROXY_MAX_DATAGRAM 65536
+
+namespace
+{
+    volatile sig_atomic_t running = 1;
+
+    struct Side
+    {
+        sockaddr_in group = {};
+        int receiver = -1;  // Bound to the group
+        int sender = -1;  // Bound to a port of its own so our datagrams can be told apart
+        uint16_t senderPort = 0;
+    };
+
+    struct Pending
+    {
+        double at;  // s since start
+        uint64_t order;  // Ties go out in the order they arrived
+        int to;  // Side index
+        std::vector<uint8_t> data;
+
+        bool operator>(const Pending &other) const
+        {
+            return (at > other.at) || ((at == other.at) && (order > other.order));
+        }
+    };
+
+    void stop(int)
+    {
+        running = 0;
+    }
+
+    bool parseGroup(const char* text, sockaddr_in &address)
+    {// ADDRESS:PORT
+        std::string s(text);
+        size_t colon = s.rfind(':');
+        if (colon == std::string::npos) return false;
+        address.sin_family = AF_INET;
+        address.sin_port = htons(atoi(s.c_str() + colon + 1));
+        return (inet_pton(AF_INET, s.substr(0, colon).c_str(), &address.sin_addr) == 1) &&
+            IN_MULTICAST(ntohl(address.sin_addr.s_addr)) && (address.sin_port != 0);
+    }
+
+    bool open(Side &side, in_addr interface)
+    {
+        int yes = 1;
+        side.receiver = socket(AF_INET, SOCK_DGRAM, 0);
+        side.sender = socket(AF_INET, SOCK_DGRAM, 0);
+        if ((side.receiver < 0) || (side.sender < 0)) return false;
+        setsockopt(side.receiver, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        // Bound to the group, not INADDR_ANY, or Linux hands the socket every
+        // group joined on the port, the other side's included.
+        if (bind(side.receiver, reinterpret_cast<sockaddr*>(&side.group), sizeof(side.group)) < 0) return false;
+        ip_mreq membership = {side.group.sin_addr, interface};
+        if (setsockopt(side.receiver, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) return false;
+
+        sockaddr_in any = {};
+        any.sin_family = AF_INET;
+        socklen_t length = sizeof(any);
+        if (bind(side.sender, reinterpret_cast<sockaddr*>(&any), sizeof(any)) < 0) return false;
+        if (getsockname(side.sender, reinterpret_cast<sockaddr*>(&any), &length) < 0) return false;
+        side.senderPort = ntohs(any.sin_port);
+        // Loopback stays on so SSSFs built for the host on this machine hear us
+        setsockopt(side.sender, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface));
+        return true;
+    }
+
+    double elapsed(std::chrono::steady_clock::time_point started)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    void report(double now, const char* name, const Channel::Counters &c)
+    {
+        printf("%8.3f s  %s received %llu lost %llu queue drops %llu duplicated %llu reordered %llu sent %llu\n",
+            now, name, (unsigned long long) c.received, (unsigned long long) c.lost,
+            (unsigned long long) c.queueDrops, (unsigned long long) c.duplicated,
+            (unsigned long long) c.reordered, (unsigned long long) c.sent);
+    }
+
+    void usage()
+    {
+        fprintf(stderr,
+            "Usage: impairment_proxy -a GROUP:PORT -b GROUP:PORT [-i INTERFACE_IP]\n"
+            "                        [-s SCRIPT]... [-e STEP]... [--seed N] [--stats SECONDS]\n"
+            "                        [--duration SECONDS]\n"
+            "A step is \"SECONDS a2b|b2a|both SETTING...\", see Impairment.h for the settings.\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Side sides[2];
+    in_addr interface = {htonl(INADDR_ANY)};
+    Script script;
+    uint64_t seed = 1;
+    double statsInterval = 5.0;
+    double duration = 0.0;
+    bool hasA = false;
+    bool hasB = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        bool valid = (value != nullptr);
+        if (arg == "-a") valid = valid && (hasA = parseGroup(value, sides[0].group));
+        else if (arg == "-b") valid = valid && (hasB = parseGroup(value, sides[1].group));
+        else if (arg == "-i") valid = valid && (inet_pton(AF_INET, value, &interface) == 1);
+        else if (arg == "-s") valid = valid && script.load(value);
+        else if (arg == "-e") valid = valid && script.add(value, "-e");
+        else if (arg == "--seed") seed = valid ? strtoull(value, nullptr, 0) : 0;
+        else if (arg == "--stats") statsInterval = valid ? atof(value) : 0;
+        else if (arg == "--duration") duration = valid ? atof(value) : 0;
+        else valid = false;
+        if (!valid)
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+    if (!hasA || !hasB)
+    {
+        usage();
+        return 1;
+    }
+    for (int s = 0; s < 2; s++)
+    {
+        if (!open(sides[s], interface))
+        {
+            fprintf(stderr, "Can't open the sockets for side %c: %s\n", 'A' + s, strerror(errno));
+            return 1;
+        }
+    }
+    script.sort();
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    // Each direction draws from its own generator so changing one doesn't change the other's run.
+    Channel channels[2] = {Channel(seed), Channel(seed ^ 0x9E3779B97F4A7C15ULL)};  // A to B, B to A
+    const char* names[2] = {"a2b", "b2a"};
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+    uint64_t order = 0;
+    std::vector<uint8_t> buffer(PROXY_MAX_DATAGRAM);
+    auto started = std::chrono::steady_clock::now();
+    double lastStats = 0.0;
+    script.apply(0.0, channels[0], channels[1]);
+
+    while (running)
+    {
+        double now = elapsed(started);
+        if ((duration > 0) && (now >= duration)) break;
+        script.apply(now, channels[0], channels[1]);
+        while (!pending.empty() && (pending.top().at <= now))
+        {
+            const Pending &p = pending.top();
+            Side &to = sides[p.to];
+            if (sendto(to.sender, p.data.data(), p.data.size(), 0,
+                reinterpret_cast<sockaddr*>(&to.group), sizeof(to.group)) >= 0)
+            {
+                channels[1 - p.to].counters.sent++;
+            }
+            pending.pop();
+        }
+        if ((statsInterval > 0) && (now - lastStats >= statsInterval))
+        {
+            lastStats = now;
+            report(now, names[0], channels[0].counters);
+            report(now, names[1], channels[1].counters);
+            fflush(stdout);
+        }
+
+        // Sleep until a datagram arrives or the next one is due, at most until the next report
+        double wait = (statsInterval > 0) ? lastStats + statsInterval - now : 1.0;
+        if (!pending.empty()) wait = std::min(wait, pending.top().at - now);
+        if (duration > 0) wait = std::min(wait, duration - now);
+        if (script.due() >= 0) wait = std::min(wait, script.due() - now);
+        wait = std::max(wait, 0.0);
+        timespec timeout = {time_t(wait), long((wait - time_t(wait)) * 1e9)};
+        pollfd fds[2] = {{sides[0].receiver, POLLIN, 0}, {sides[1].receiver, POLLIN, 0}};
+        if (ppoll(fds, 2, &timeout, nullptr) <= 0) continue;
+
+        for (int s = 0; s < 2; s++)
+        {
+            if (!(fds[s].revents & POLLIN)) continue;
+            sockaddr_in source;
+            socklen_t length = sizeof(source);
+            ssize_t size = recvfrom(sides[s].receiver, buffer.data(), buffer.size(), 0,
+                reinterpret_cast<sockaddr*>(&source), &length);
+            if (size < 0) continue;
+            uint16_t port = ntohs(source.sin_port);
+            if ((port == sides[0].senderPort) || (port == sides[1].senderPort))
+            {
+                if ((interface.s_addr == htonl(INADDR_ANY)) || (source.sin_addr.s_addr == interface.s_addr)) continue;
+            }
+            double departures[2];
+            int copies = channels[s].schedule(elapsed(started), size, departures);
+            for (int c = 0; c < copies; c++)
+            {
+                pending.push({departures[c], order++, 1 - s, std::vector<uint8_t>(buffer.begin(), buffer.begin() + size)});
+            }
+        }
+    }
+    double now = elapsed(started);
+    report(now, names[0], channels[0].counters);
+    report(now, names[1], channels[1].counters);
+    return 0;
+}